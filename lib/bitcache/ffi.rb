@@ -104,7 +104,7 @@ module Bitcache
     attach_function :bitcache_id_to_mpi, [:bitcache_id, :pointer], :pointer
 
     # Filter API
-    attach_function :bitcache_filter_init, [:bitcache_filter, :size_t], :int
+    attach_function :bitcache_filter_init, [:bitcache_filter, :size_t, :int, :uint], :int
     attach_function :bitcache_filter_reset, [:bitcache_filter], :int
     attach_function :bitcache_filter_clear, [:bitcache_filter], :int
     attach_function :bitcache_filter_size, [:bitcache_filter], :ssize_t
@@ -113,8 +113,8 @@ module Bitcache
     attach_function :bitcache_filter_insert, [:bitcache_filter, :bitcache_id], :int
     attach_function :bitcache_filter_compare, [:bitcache_filter, :bitcache_filter], :int
     attach_function :bitcache_filter_merge, [:bitcache_filter, :bitcache_op, :bitcache_filter, :bitcache_filter], :int
-    attach_function :bitcache_filter_load, [:bitcache_filter, :int], :int
-    attach_function :bitcache_filter_dump, [:bitcache_filter, :int], :int
+    attach_function :bitcache_filter_load, [:bitcache_filter, :int], :long
+    attach_function :bitcache_filter_dump, [:bitcache_filter, :int], :long
 
     # List API: Constants
     BITCACHE_LIST_SENTINEL = nil
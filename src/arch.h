@@ -13,6 +13,10 @@ extern "C" {
 # define NONNULL __attribute__((__nonnull__)) /* the function requires non-NULL arguments */
 # define FLATTEN __attribute__((__flatten__)  /* inline every call inside the function, if possible */
 # define PURE    __attribute__((__pure__))    /* declare that the function has no side effects */
+# define CONSTRUCTOR __attribute__((__constructor__)) /* run the function when the library is loaded */
+# define TARGET(isa) __attribute__((__target__(isa))) /* compile the function for a given instruction set */
+# define prefetch(addr)  __builtin_prefetch((addr), 0, 3) /* prefetch for reading */
+# define prefetchw(addr) __builtin_prefetch((addr), 1, 3) /* prefetch for writing */
 # if __GNUC_VERSION__ >= 40300
 #  define HOT    __attribute__((__hot__))     /* the function is a hot spot (GCC 4.3+ only) */
 #  define COLD   __attribute__((__cold__))    /* the function is unlikely to be executed (GCC 4.3+ only) */
@@ -24,6 +28,10 @@ extern "C" {
 # define NONNULL
 # define FLATTEN
 # define PURE
+# define CONSTRUCTOR
+# define TARGET(isa)
+# define prefetch(addr)
+# define prefetchw(addr)
 # define HOT
 # define COLD
 #endif /* __GNUC__ */
@@ -25,11 +25,14 @@ const unsigned int bitcache_feature_count =
   (sizeof(bitcache_feature_names) / sizeof(bitcache_feature_names[0])) - 1;
 
 const char* const bitcache_module_names[] = {
+  "counting_filter",
+  "cuckoo_filter",
   "filter",
   "id",
   "map",
   "set",
   "tree",
+  "xor_filter",
   NULL
 };
 
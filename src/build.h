@@ -18,6 +18,7 @@ extern "C" {
 
 /* private headers for the build process only */
 #include "arch.h"
+#include "cpu.h"
 
 /* public headers included from <bitcache.h> */
 #ifndef DISABLE_MD5
@@ -28,6 +29,9 @@ extern "C" {
 #endif
 #include "id.h"
 #include "filter.h"
+#include "counting_filter.h"
+#include "cuckoo_filter.h"
+#include "xor_filter.h"
 #include "map.h"
 #include "set.h"
 #include "tree.h"
@@ -0,0 +1,335 @@
+/* This is free and unencumbered software released into the public domain. */
+
+#include "build.h"
+#include "crc32c.h"
+#include "filter_hash.h"
+#include "io.h"
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h> /* for mmap() */
+#include <sys/stat.h> /* for fstat() */
+#include <unistd.h>   /* for getpagesize(), lseek(), pread() */
+
+//////////////////////////////////////////////////////////////////////////////
+// Counting filter helpers
+
+// The number of counter bytes that project onto one byte of a bitmap.
+#define BITCACHE_COUNTING_FILTER_RATIO 4
+
+static inline uint64_t
+bitcache_counting_filter_counters(const bitcache_counting_filter_t* filter) {
+  return (uint64_t)filter->size * 2; // two 4-bit counters per byte
+}
+
+static inline uint8_t
+bitcache_counting_filter_get(const uint8_t* counters, const uint64_t i) {
+  return (counters[i >> 1] >> ((i & 1) << 2)) & 0x0f;
+}
+
+static inline void
+bitcache_counting_filter_set(uint8_t* counters, const uint64_t i, const uint8_t value) {
+  const unsigned int shift = (i & 1) << 2;
+  counters[i >> 1] = (counters[i >> 1] & ~(0x0f << shift)) | (value << shift);
+}
+
+// Returns `TRUE` if counters of the given size can back a filter of the
+// given layout, projecting onto whole bitmap bytes or blocks.
+static inline bool
+bitcache_counting_filter_size_valid(const bitcache_filter_layout_t layout, const uint64_t size) {
+  if (layout == BITCACHE_FILTER_BLOCKED)
+    return size > 0 && size % (BITCACHE_FILTER_BLOCK_SIZE * BITCACHE_COUNTING_FILTER_RATIO) == 0 &&
+      size / (BITCACHE_FILTER_BLOCK_SIZE * BITCACHE_COUNTING_FILTER_RATIO) < UINT32_MAX;
+  return size > 0 && size % BITCACHE_COUNTING_FILTER_RATIO == 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Counting filter API
+
+int
+bitcache_counting_filter_init(bitcache_counting_filter_t* filter, const size_t size, const bitcache_filter_layout_t layout, const unsigned int k) {
+  validate_with_errno_return(filter != NULL);
+  validate_with_errno_return(layout == BITCACHE_FILTER_CLASSIC || layout == BITCACHE_FILTER_BLOCKED);
+  validate_with_errno_return(k <= (layout == BITCACHE_FILTER_BLOCKED ? BITCACHE_FILTER_BLOCKED_K_MAX : BITCACHE_FILTER_K_MAX));
+  validate_with_errno_return(layout != BITCACHE_FILTER_BLOCKED ||
+    size / (BITCACHE_FILTER_BLOCK_SIZE * BITCACHE_COUNTING_FILTER_RATIO) < UINT32_MAX);
+
+  bzero(filter, sizeof(bitcache_counting_filter_t));
+  filter->layout = layout;
+  filter->k = (k > 0) ? k : BITCACHE_FILTER_K_DEFAULT;
+
+  if (likely(size > 0)) {
+    // round up so that the counters project onto whole bitmap bytes
+    // (classic) or whole bitmap blocks (blocked):
+    const size_t unit = (layout == BITCACHE_FILTER_BLOCKED) ?
+      BITCACHE_FILTER_BLOCK_SIZE * BITCACHE_COUNTING_FILTER_RATIO : BITCACHE_COUNTING_FILTER_RATIO;
+    filter->size = ((size + unit - 1) / unit) * unit;
+    filter->counters = calloc(1, filter->size);
+    if (unlikely(filter->counters == NULL))
+      return -errno; // cannot allocate memory
+  }
+
+  return 0;
+}
+
+int
+bitcache_counting_filter_reset(bitcache_counting_filter_t* filter) {
+  validate_with_errno_return(filter != NULL);
+
+  if (unlikely(filter->mapping != NULL)) {
+    munmap(filter->mapping, filter->mapping_size);
+    filter->mapping = NULL, filter->mapping_size = 0;
+    filter->counters = NULL;
+    filter->size = 0;
+  }
+
+  if (likely(filter->counters != NULL)) {
+    free(filter->counters), filter->counters = NULL;
+    filter->size = 0;
+  }
+
+  filter->checksum = 0;
+
+  return 0;
+}
+
+int
+bitcache_counting_filter_clear(bitcache_counting_filter_t* filter) {
+  validate_with_errno_return(filter != NULL && filter->counters != NULL);
+
+  bzero(filter->counters, filter->size);
+
+  return 0;
+}
+
+long PURE
+bitcache_counting_filter_size(const bitcache_counting_filter_t* filter) {
+  validate_with_errno_return(filter != NULL);
+
+  return sizeof(bitcache_counting_filter_t) + filter->size;
+}
+
+long HOT
+bitcache_counting_filter_count(const bitcache_counting_filter_t* filter, const bitcache_id_t* id) {
+  validate_with_errno_return(filter != NULL && filter->counters != NULL && id != NULL);
+
+  // the smallest counter bounds the number of insertions from above:
+  uint8_t count = BITCACHE_COUNTING_FILTER_MAX;
+
+  const uint64_t m = bitcache_counting_filter_counters(filter);
+  for (size_t k = 0; k < filter->k && count > 0; k++) {
+    const uint8_t c = bitcache_counting_filter_get(filter->counters,
+      bitcache_filter_probe(id, m, filter->k, filter->layout, k));
+    if (c < count)
+      count = c;
+  }
+
+  return count;
+}
+
+bool HOT
+bitcache_counting_filter_lookup(const bitcache_counting_filter_t* filter, const bitcache_id_t* id) {
+  validate_with_false_return(filter != NULL && filter->counters != NULL && id != NULL);
+
+  const uint64_t m = bitcache_counting_filter_counters(filter);
+  for (size_t k = 0; k < filter->k; k++) {
+    const uint64_t i = bitcache_filter_probe(id, m, filter->k, filter->layout, k);
+    if (bitcache_counting_filter_get(filter->counters, i) == 0)
+      return FALSE; // false negatives are NOT possible
+  }
+
+  return TRUE; // false positives are possible
+}
+
+int HOT
+bitcache_counting_filter_insert(bitcache_counting_filter_t* filter, const bitcache_id_t* id) {
+  validate_with_errno_return(filter != NULL && filter->counters != NULL && id != NULL);
+
+  const uint64_t m = bitcache_counting_filter_counters(filter);
+  for (size_t k = 0; k < filter->k; k++) {
+    const uint64_t i = bitcache_filter_probe(id, m, filter->k, filter->layout, k);
+    const uint8_t c = bitcache_counting_filter_get(filter->counters, i);
+    if (likely(c < BITCACHE_COUNTING_FILTER_MAX))
+      bitcache_counting_filter_set(filter->counters, i, c + 1);
+  }
+
+  return 0;
+}
+
+int HOT
+bitcache_counting_filter_remove(bitcache_counting_filter_t* filter, const bitcache_id_t* id) {
+  validate_with_errno_return(filter != NULL && filter->counters != NULL && id != NULL);
+
+  // decrementing the counters of an identifier that was never inserted
+  // would introduce false negatives for other identifiers:
+  if (unlikely(!bitcache_counting_filter_lookup(filter, id)))
+    return -(errno = ENOENT); // no such identifier
+
+  const uint64_t m = bitcache_counting_filter_counters(filter);
+  for (size_t k = 0; k < filter->k; k++) {
+    const uint64_t i = bitcache_filter_probe(id, m, filter->k, filter->layout, k);
+    const uint8_t c = bitcache_counting_filter_get(filter->counters, i);
+    // a saturated counter no longer knows its true value, so it sticks:
+    if (likely(c > 0 && c < BITCACHE_COUNTING_FILTER_MAX))
+      bitcache_counting_filter_set(filter->counters, i, c - 1);
+  }
+
+  return 0;
+}
+
+int
+bitcache_counting_filter_compare(const bitcache_counting_filter_t* filter1, const bitcache_counting_filter_t* filter2) {
+  validate_with_errno_return(filter1 != NULL && filter1->counters != NULL);
+  validate_with_errno_return(filter2 != NULL && filter2->counters != NULL);
+  validate_with_errno_return(filter1->size == filter2->size);
+  validate_with_errno_return(filter1->layout == filter2->layout && filter1->k == filter2->k);
+
+  return bcmp(filter1->counters, filter2->counters, filter1->size);
+}
+
+int
+bitcache_counting_filter_merge(bitcache_counting_filter_t* filter0, const bitcache_filter_op_t op, const bitcache_counting_filter_t* filter1, const bitcache_counting_filter_t* filter2) {
+  validate_with_errno_return(filter0 != NULL && filter0->counters != NULL);
+  validate_with_errno_return(filter1 != NULL && filter1->counters != NULL);
+  validate_with_errno_return(filter2 != NULL && filter2->counters != NULL);
+  validate_with_errno_return(filter0->size == filter1->size && filter1->size == filter2->size);
+  validate_with_errno_return(filter0->layout == filter1->layout && filter1->layout == filter2->layout);
+  validate_with_errno_return(filter0->k == filter1->k && filter1->k == filter2->k);
+
+  switch (op) {
+    case BITCACHE_FILTER_NOP:
+      // do nothing
+      break;
+    case BITCACHE_FILTER_OR:
+      for (size_t i = 0; i < filter0->size; i++) {
+        const uint8_t a = filter1->counters[i], b = filter2->counters[i];
+        const uint8_t lo = (a & 0x0f) + (b & 0x0f), hi = (a >> 4) + (b >> 4);
+        filter0->counters[i] =
+          (lo > BITCACHE_COUNTING_FILTER_MAX ? BITCACHE_COUNTING_FILTER_MAX : lo) |
+          (hi > BITCACHE_COUNTING_FILTER_MAX ? BITCACHE_COUNTING_FILTER_MAX : hi) << 4;
+      }
+      break;
+    case BITCACHE_FILTER_AND:
+      for (size_t i = 0; i < filter0->size; i++) {
+        const uint8_t a = filter1->counters[i], b = filter2->counters[i];
+        filter0->counters[i] =
+          ((a & 0x0f) < (b & 0x0f) ? (a & 0x0f) : (b & 0x0f)) |
+          ((a & 0xf0) < (b & 0xf0) ? (a & 0xf0) : (b & 0xf0));
+      }
+      break;
+    case BITCACHE_FILTER_XOR:
+      return -(errno = ENOTSUP); // operation not supported
+    default:
+      return -(errno = EINVAL); // invalid argument
+  }
+
+  return 0;
+}
+
+int
+bitcache_counting_filter_project(const bitcache_counting_filter_t* filter, bitcache_filter_t* bitmap) {
+  validate_with_errno_return(filter != NULL && filter->counters != NULL && bitmap != NULL);
+
+  const int rc = bitcache_filter_init(bitmap, filter->size / BITCACHE_COUNTING_FILTER_RATIO, filter->layout, filter->k);
+  if (unlikely(rc < 0))
+    return rc;
+  assert(bitmap->size * BITCACHE_COUNTING_FILTER_RATIO == filter->size);
+
+  // every 4 bytes of counters project onto 1 byte of the bitmap:
+  const uint8_t* c = filter->counters;
+  for (size_t i = 0; i < bitmap->size; i++, c += BITCACHE_COUNTING_FILTER_RATIO) {
+    uint8_t b = 0;
+    for (unsigned int j = 0; j < BITCACHE_COUNTING_FILTER_RATIO; j++) {
+      b |= ((c[j] & 0x0f) != 0) << (j * 2);
+      b |= ((c[j] & 0xf0) != 0) << (j * 2 + 1);
+    }
+    bitmap->bitmap[i] = b;
+  }
+
+  return 0;
+}
+
+long COLD
+bitcache_counting_filter_load(bitcache_counting_filter_t* filter, const int fd) {
+  validate_with_errno_return(filter != NULL && fd >= 0);
+
+  off_t off = lseek(fd, 0, SEEK_CUR);
+  if (unlikely(off == -1)) {
+    return -errno; // pipes, sockets and FIFOs are not supported
+  }
+
+  struct stat sb;
+  if (unlikely(fstat(fd, &sb) == -1)) {
+    return -errno;
+  }
+
+  bitcache_filter_header_t header;
+  if (unlikely(sb.st_size - off < (off_t)sizeof(header) ||
+      pread(fd, &header, sizeof(header), off) != sizeof(header) ||
+      memcmp(header.magic, BITCACHE_COUNTING_FILTER_MAGIC, sizeof(header.magic)) != 0 ||
+      header.version < 1 || header.version > BITCACHE_FILTER_VERSION ||
+      (header.layout != BITCACHE_FILTER_CLASSIC && header.layout != BITCACHE_FILTER_BLOCKED) ||
+      header.k == 0 ||
+      header.k > (header.layout == BITCACHE_FILTER_BLOCKED ? BITCACHE_FILTER_BLOCKED_K_MAX : BITCACHE_FILTER_K_MAX) ||
+      !bitcache_counting_filter_size_valid(header.layout, header.size) ||
+      header.size > (uint64_t)(sb.st_size - off) - sizeof(header))) {
+    return -(errno = EINVAL); // not a counting filter
+  }
+
+  // mmap() requires a page-aligned file offset:
+  const off_t page_off = off & ~((off_t)getpagesize() - 1);
+  const size_t mapping_size = (off - page_off) + sizeof(header) + header.size;
+
+  void* base = mmap(NULL, mapping_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, page_off);
+  if (unlikely(base == MAP_FAILED)) {
+    return -errno;
+  }
+
+  filter->layout = header.layout;
+  filter->k = header.k;
+  filter->size = header.size;
+  filter->checksum = header.checksum;
+  filter->mapping = base;
+  filter->mapping_size = mapping_size;
+  filter->counters = (uint8_t*)base + (off - page_off) + sizeof(header);
+  return filter->size;
+}
+
+int COLD
+bitcache_counting_filter_verify(const bitcache_counting_filter_t* filter) {
+  validate_with_errno_return(filter != NULL && filter->counters != NULL);
+
+  if (filter->checksum == 0)
+    return 0; // no checksum was recorded
+
+  if (unlikely(bitcache_crc32c(0, filter->counters, filter->size) != filter->checksum))
+    return -(errno = EBADMSG); // checksum mismatch
+
+  return 0;
+}
+
+long COLD
+bitcache_counting_filter_dump(const bitcache_counting_filter_t* filter, const int fd) {
+  validate_with_errno_return(filter != NULL && filter->counters != NULL && fd >= 0);
+
+  bitcache_filter_header_t header;
+  bzero(&header, sizeof(header));
+  memcpy(header.magic, BITCACHE_COUNTING_FILTER_MAGIC, sizeof(header.magic));
+  header.version  = BITCACHE_FILTER_VERSION;
+  header.layout   = filter->layout;
+  header.k        = filter->k;
+  header.size     = filter->size;
+  header.checksum = bitcache_crc32c(0, filter->counters, filter->size);
+
+  int rc = bitcache_write(fd, &header, sizeof(header));
+  if (unlikely(rc < 0))
+    return rc;
+
+  rc = bitcache_write(fd, filter->counters, filter->size);
+  if (unlikely(rc < 0))
+    return rc;
+
+  return sizeof(header) + filter->size;
+}
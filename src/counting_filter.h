@@ -0,0 +1,144 @@
+/* This is free and unencumbered software released into the public domain. */
+
+#ifndef _BITCACHE_COUNTING_FILTER_H
+#define _BITCACHE_COUNTING_FILTER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h> /* for bool */
+#include <stddef.h>  /* for size_t */
+#include <stdint.h>  /* for uint8_t, uint32_t */
+
+/**
+ * Defines the largest value a counting filter's 4-bit counters can hold.
+ */
+#define BITCACHE_COUNTING_FILTER_MAX 15
+
+/**
+ * Defines the magic bytes at the start of a dumped counting filter header.
+ */
+#define BITCACHE_COUNTING_FILTER_MAGIC "BCCOUNTF"
+
+/**
+ * Represents a Bitcache counting filter.
+ *
+ * A counting filter replaces each bit of a filter with a 4-bit saturating
+ * counter, packed two to a byte, which allows identifiers to be removed.
+ * Counter `i` corresponds to bit `i` of a filter with the same layout.
+ */
+typedef struct {
+  size_t size;
+  uint8_t* counters;
+  bitcache_filter_layout_t layout;
+  unsigned int k;      /* number of hashes */
+  uint32_t checksum;   /* CRC-32C recorded for a loaded filter, or zero */
+  void* mapping;       /* the mmap() region backing a loaded filter, if any */
+  size_t mapping_size;
+} bitcache_counting_filter_t;
+
+/**
+ * Initializes a counting filter using a given counter array size (in
+ * bytes), layout, and number of hashes (zero selecting
+ * `BITCACHE_FILTER_K_DEFAULT`). The size is rounded up so that the filter
+ * projects onto a whole bitmap.
+ */
+extern int bitcache_counting_filter_init(bitcache_counting_filter_t* filter,
+  const size_t size,
+  const bitcache_filter_layout_t layout,
+  const unsigned int k);
+
+/**
+ * Resets a counting filter back to an uninitialized state.
+ */
+extern int bitcache_counting_filter_reset(bitcache_counting_filter_t* filter);
+
+/**
+ * Clears the counters of a counting filter.
+ */
+extern int bitcache_counting_filter_clear(bitcache_counting_filter_t* filter);
+
+/**
+ * Returns the size of a counting filter (in bytes).
+ */
+extern long bitcache_counting_filter_size(const bitcache_counting_filter_t* filter);
+
+/**
+ * Returns an upper bound on the number of times a given identifier has
+ * been inserted into a counting filter.
+ */
+extern long bitcache_counting_filter_count(const bitcache_counting_filter_t* filter,
+  const bitcache_id_t* id);
+
+/**
+ * Checks whether a counting filter recognizes a given identifier.
+ */
+extern bool bitcache_counting_filter_lookup(const bitcache_counting_filter_t* filter,
+  const bitcache_id_t* id);
+
+/**
+ * Inserts a given identifier into a counting filter.
+ */
+extern int bitcache_counting_filter_insert(bitcache_counting_filter_t* filter,
+  const bitcache_id_t* id);
+
+/**
+ * Removes a given identifier from a counting filter.
+ *
+ * Fails with `ENOENT` if the filter does not recognize the identifier.
+ * Saturated counters are never decremented.
+ */
+extern int bitcache_counting_filter_remove(bitcache_counting_filter_t* filter,
+  const bitcache_id_t* id);
+
+/**
+ * Compares two counting filters for equality.
+ */
+extern int bitcache_counting_filter_compare(const bitcache_counting_filter_t* filter1,
+  const bitcache_counting_filter_t* filter2);
+
+/**
+ * Merges two counting filters into a given counting filter using a
+ * specific operation: `OR` adds counters (saturating), `AND` takes the
+ * lesser of each pair of counters; `XOR` is not supported.
+ */
+extern int bitcache_counting_filter_merge(bitcache_counting_filter_t* filter0,
+  const bitcache_filter_op_t op,
+  const bitcache_counting_filter_t* filter1,
+  const bitcache_counting_filter_t* filter2);
+
+/**
+ * Projects a counting filter onto a filter with the same layout, setting
+ * each bit whose counter is non-zero. The filter is (re)initialized.
+ */
+extern int bitcache_counting_filter_project(const bitcache_counting_filter_t* filter,
+  bitcache_filter_t* bitmap);
+
+/**
+ * Reads in a counting filter from a file descriptor.
+ *
+ * The counters are mapped copy-on-write, so that the loaded filter can
+ * be updated without modifying the file.
+ */
+extern long bitcache_counting_filter_load(bitcache_counting_filter_t* filter,
+  const int fd);
+
+/**
+ * Verifies the counters of a loaded counting filter, before any updates,
+ * against the checksum recorded in its header, failing with `EBADMSG` on
+ * a mismatch.
+ */
+extern int bitcache_counting_filter_verify(const bitcache_counting_filter_t* filter);
+
+/**
+ * Writes out a counting filter to a file descriptor.
+ */
+extern long bitcache_counting_filter_dump(const bitcache_counting_filter_t* filter,
+  const int fd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _BITCACHE_COUNTING_FILTER_H */
@@ -0,0 +1,27 @@
+/* This is free and unencumbered software released into the public domain. */
+
+#ifndef _BITCACHE_CPU_H
+#define _BITCACHE_CPU_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h> /* for bool */
+
+/* runtime CPU feature detection, for selecting vectorized kernels */
+/* @see http://gcc.gnu.org/onlinedocs/gcc/x86-Built-in-Functions.html */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define BITCACHE_CPU_X86 1
+# define bitcache_cpu_init()      __builtin_cpu_init()
+# define bitcache_cpu_has(isa)    (__builtin_cpu_supports(isa) != 0)
+#else
+# define bitcache_cpu_init()
+# define bitcache_cpu_has(isa)    (false)
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _BITCACHE_CPU_H */
@@ -0,0 +1,97 @@
+/* This is free and unencumbered software released into the public domain. */
+
+#include "build.h"
+#include "crc32c.h"
+#include <string.h>
+
+#ifdef BITCACHE_CPU_X86
+#include <immintrin.h>
+#endif
+
+//////////////////////////////////////////////////////////////////////////////
+// CRC-32C (software implementation, slicing by 8)
+
+#define BITCACHE_CRC32C_POLY 0x82f63b78 /* reversed Castagnoli polynomial */
+
+static uint32_t bitcache_crc32c_table[8][256];
+
+static uint32_t
+bitcache_crc32c_sw(uint32_t crc, const uint8_t* p, size_t size) {
+  for (; size > 0 && ((uintptr_t)p & 7) != 0; size--)
+    crc = bitcache_crc32c_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+
+  for (; size >= 8; size -= 8, p += 8) {
+    uint64_t word;
+    memcpy(&word, p, sizeof(word));
+    word ^= crc; // assumes a little-endian host, as do the filter formats
+    crc = bitcache_crc32c_table[7][word & 0xff] ^
+          bitcache_crc32c_table[6][(word >> 8) & 0xff] ^
+          bitcache_crc32c_table[5][(word >> 16) & 0xff] ^
+          bitcache_crc32c_table[4][(word >> 24) & 0xff] ^
+          bitcache_crc32c_table[3][(word >> 32) & 0xff] ^
+          bitcache_crc32c_table[2][(word >> 40) & 0xff] ^
+          bitcache_crc32c_table[1][(word >> 48) & 0xff] ^
+          bitcache_crc32c_table[0][word >> 56];
+  }
+
+  for (; size > 0; size--)
+    crc = bitcache_crc32c_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+
+  return crc;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// CRC-32C (hardware implementation, SSE 4.2)
+
+#if defined(BITCACHE_CPU_X86) && defined(__x86_64__)
+static TARGET("sse4.2") uint32_t
+bitcache_crc32c_hw(uint32_t crc, const uint8_t* p, size_t size) {
+  for (; size > 0 && ((uintptr_t)p & 7) != 0; size--)
+    crc = _mm_crc32_u8(crc, *p++);
+
+  uint64_t crc64 = crc;
+  for (; size >= 8; size -= 8, p += 8) {
+    uint64_t word;
+    memcpy(&word, p, sizeof(word));
+    crc64 = _mm_crc32_u64(crc64, word);
+  }
+  crc = (uint32_t)crc64;
+
+  for (; size > 0; size--)
+    crc = _mm_crc32_u8(crc, *p++);
+
+  return crc;
+}
+#endif
+
+//////////////////////////////////////////////////////////////////////////////
+// CRC-32C API
+
+static uint32_t (*bitcache_crc32c_impl)(uint32_t crc, const uint8_t* p, size_t size) = bitcache_crc32c_sw;
+
+static void CONSTRUCTOR COLD
+bitcache_crc32c_init(void) {
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t crc = i;
+    for (int j = 0; j < 8; j++)
+      crc = (crc & 1) ? (crc >> 1) ^ BITCACHE_CRC32C_POLY : crc >> 1;
+    bitcache_crc32c_table[0][i] = crc;
+  }
+  for (uint32_t i = 0; i < 256; i++) {
+    for (int t = 1; t < 8; t++) {
+      const uint32_t prev = bitcache_crc32c_table[t - 1][i];
+      bitcache_crc32c_table[t][i] = bitcache_crc32c_table[0][prev & 0xff] ^ (prev >> 8);
+    }
+  }
+
+  bitcache_cpu_init();
+#if defined(BITCACHE_CPU_X86) && defined(__x86_64__)
+  if (bitcache_cpu_has("sse4.2"))
+    bitcache_crc32c_impl = bitcache_crc32c_hw;
+#endif
+}
+
+uint32_t
+bitcache_crc32c(uint32_t crc, const void* buffer, size_t size) {
+  return ~bitcache_crc32c_impl(~crc, buffer, size);
+}
@@ -0,0 +1,15 @@
+/* This is free and unencumbered software released into the public domain. */
+
+#ifndef _BITCACHE_CRC32C_H
+#define _BITCACHE_CRC32C_H
+
+#include <stddef.h> /* for size_t */
+#include <stdint.h> /* for uint32_t */
+
+//////////////////////////////////////////////////////////////////////////////
+// CRC-32C (Castagnoli) checksums, for verifying dumped structures
+
+// Extends a CRC-32C checksum (initially 0) over a buffer.
+extern uint32_t bitcache_crc32c(uint32_t crc, const void* buffer, size_t size);
+
+#endif /* _BITCACHE_CRC32C_H */
@@ -0,0 +1,409 @@
+/* This is free and unencumbered software released into the public domain. */
+
+#include "build.h"
+#include "crc32c.h"
+#include "filter_hash.h"
+#include "io.h"
+#include <errno.h>
+#include <math.h>   /* for ceil() */
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h> /* for mmap() */
+#include <sys/stat.h> /* for fstat() */
+#include <unistd.h>   /* for getpagesize(), lseek(), pread() */
+
+//////////////////////////////////////////////////////////////////////////////
+// Cuckoo filter helpers
+
+// The number of evictions attempted before a fingerprint is held aside.
+#define BITCACHE_CUCKOO_FILTER_MAX_KICKS 500
+
+// The load factor that buckets of four slots reliably reach.
+#define BITCACHE_CUCKOO_FILTER_LOAD 0.95
+
+static inline size_t
+bitcache_cuckoo_filter_bucket_size(const unsigned int bits) {
+  return BITCACHE_CUCKOO_FILTER_SLOTS * (bits / 8);
+}
+
+static inline uint64_t
+bitcache_cuckoo_filter_buckets(const bitcache_cuckoo_filter_t* filter) {
+  return filter->size / bitcache_cuckoo_filter_bucket_size(filter->bits);
+}
+
+// The fingerprint comes from the last word of the digest, which neither
+// bucket index depends on; zero marks an empty slot, so it is never used.
+static inline uint32_t
+bitcache_cuckoo_filter_fingerprint(const bitcache_cuckoo_filter_t* filter, const bitcache_id_t* id) {
+  const uint32_t fp = bitcache_filter_word(id, 4) >> (32 - filter->bits);
+  return (fp != 0) ? fp : 1;
+}
+
+static inline uint64_t
+bitcache_cuckoo_filter_index(const bitcache_id_t* id, const uint64_t buckets) {
+  return bitcache_filter_range64(bitcache_filter_dword(id, 0), buckets);
+}
+
+// Returns the other bucket a fingerprint may live in. Computing it as
+// `h(fp) - i (mod n)`, rather than the usual `i ^ h(fp)`, makes it an
+// involution for any number of buckets, not only powers of two.
+static inline uint64_t
+bitcache_cuckoo_filter_alt_index(const uint64_t i, const uint32_t fp, const uint64_t buckets) {
+  const uint64_t h = bitcache_filter_range64(fp * UINT64_C(0x9e3779b97f4a7c15), buckets);
+  return (h >= i) ? h - i : h + buckets - i;
+}
+
+static inline uint32_t
+bitcache_cuckoo_filter_get(const bitcache_cuckoo_filter_t* filter, const uint64_t i, const unsigned int slot) {
+  const uint8_t* const bucket = filter->buckets + i * bitcache_cuckoo_filter_bucket_size(filter->bits);
+  if (filter->bits == 8)
+    return bucket[slot];
+  uint16_t fp;
+  memcpy(&fp, bucket + slot * sizeof(fp), sizeof(fp));
+  return fp;
+}
+
+static inline void
+bitcache_cuckoo_filter_set(bitcache_cuckoo_filter_t* filter, const uint64_t i, const unsigned int slot, const uint32_t fp) {
+  uint8_t* const bucket = filter->buckets + i * bitcache_cuckoo_filter_bucket_size(filter->bits);
+  if (filter->bits == 8) {
+    bucket[slot] = (uint8_t)fp;
+    return;
+  }
+  const uint16_t fp16 = (uint16_t)fp;
+  memcpy(bucket + slot * sizeof(fp16), &fp16, sizeof(fp16));
+}
+
+// Checks all four slots of a bucket at once, using the "has zero byte"
+// trick on the bucket XORed with the fingerprint broadcast to every slot.
+static inline bool
+bitcache_cuckoo_filter_contains(const bitcache_cuckoo_filter_t* filter, const uint64_t i, const uint32_t fp) {
+  if (filter->bits == 8) {
+    uint32_t bucket;
+    memcpy(&bucket, filter->buckets + i * sizeof(bucket), sizeof(bucket));
+    const uint32_t x = bucket ^ (fp * UINT32_C(0x01010101));
+    return ((x - UINT32_C(0x01010101)) & ~x & UINT32_C(0x80808080)) != 0;
+  }
+  uint64_t bucket;
+  memcpy(&bucket, filter->buckets + i * sizeof(bucket), sizeof(bucket));
+  const uint64_t x = bucket ^ (fp * UINT64_C(0x0001000100010001));
+  return ((x - UINT64_C(0x0001000100010001)) & ~x & UINT64_C(0x8000800080008000)) != 0;
+}
+
+static inline bool
+bitcache_cuckoo_filter_add(bitcache_cuckoo_filter_t* filter, const uint64_t i, const uint32_t fp) {
+  for (unsigned int slot = 0; slot < BITCACHE_CUCKOO_FILTER_SLOTS; slot++) {
+    if (bitcache_cuckoo_filter_get(filter, i, slot) == 0) {
+      bitcache_cuckoo_filter_set(filter, i, slot, fp);
+      return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+static inline bool
+bitcache_cuckoo_filter_delete(bitcache_cuckoo_filter_t* filter, const uint64_t i, const uint32_t fp) {
+  for (unsigned int slot = 0; slot < BITCACHE_CUCKOO_FILTER_SLOTS; slot++) {
+    if (bitcache_cuckoo_filter_get(filter, i, slot) == fp) {
+      bitcache_cuckoo_filter_set(filter, i, slot, 0);
+      return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+static inline bool
+bitcache_cuckoo_filter_is_victim(const bitcache_cuckoo_filter_t* filter, const uint64_t i1, const uint64_t i2, const uint32_t fp) {
+  return filter->victim == fp && (filter->victim_index == i1 || filter->victim_index == i2);
+}
+
+// Places a fingerprint into bucket `i` or its alternate, evicting other
+// fingerprints into their alternates as needed; the last one evicted
+// becomes the victim if no room turns up.
+static void
+bitcache_cuckoo_filter_place(bitcache_cuckoo_filter_t* filter, uint64_t i, uint32_t fp) {
+  const uint64_t buckets = bitcache_cuckoo_filter_buckets(filter);
+
+  if (bitcache_cuckoo_filter_add(filter, i, fp))
+    return;
+  i = bitcache_cuckoo_filter_alt_index(i, fp, buckets);
+  if (bitcache_cuckoo_filter_add(filter, i, fp))
+    return;
+
+  uint32_t random = (fp * UINT32_C(2654435761)) ^ (uint32_t)filter->count;
+  for (unsigned int kick = 0; kick < BITCACHE_CUCKOO_FILTER_MAX_KICKS; kick++) {
+    random = random * UINT32_C(1103515245) + 12345;
+    const unsigned int slot = random >> 30;
+    const uint32_t evicted = bitcache_cuckoo_filter_get(filter, i, slot);
+    bitcache_cuckoo_filter_set(filter, i, slot, fp);
+    fp = evicted;
+    i = bitcache_cuckoo_filter_alt_index(i, fp, buckets);
+    if (bitcache_cuckoo_filter_add(filter, i, fp))
+      return;
+  }
+
+  filter->victim = fp;
+  filter->victim_index = i;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Cuckoo filter API
+
+int
+bitcache_cuckoo_filter_sizing(const uint64_t count, const double fp_rate, size_t* size, unsigned int* bits) {
+  validate_with_errno_return(count > 0 && fp_rate > 0 && fp_rate < 1);
+  validate_with_errno_return(size != NULL && bits != NULL);
+
+  // a lookup compares against up to eight fingerprints of f bits each, for
+  // a false-positive rate of at most 8 / 2^f:
+  const double slots = 2 * BITCACHE_CUCKOO_FILTER_SLOTS;
+  if (fp_rate >= slots / 256)
+    *bits = 8;
+  else if (fp_rate >= slots / 65536)
+    *bits = 16;
+  else
+    return -(errno = ERANGE); // unattainable with 16-bit fingerprints
+
+  const double buckets = ceil((double)count / (BITCACHE_CUCKOO_FILTER_SLOTS * BITCACHE_CUCKOO_FILTER_LOAD));
+  *size = (size_t)buckets * bitcache_cuckoo_filter_bucket_size(*bits);
+  return 0;
+}
+
+int
+bitcache_cuckoo_filter_init(bitcache_cuckoo_filter_t* filter, const size_t size, const unsigned int bits) {
+  validate_with_errno_return(filter != NULL);
+  validate_with_errno_return(bits == 0 || bits == 8 || bits == 16);
+
+  bzero(filter, sizeof(bitcache_cuckoo_filter_t));
+  filter->bits = (bits > 0) ? bits : 16;
+
+  if (likely(size > 0)) {
+    const size_t unit = bitcache_cuckoo_filter_bucket_size(filter->bits);
+    filter->size = ((size + unit - 1) / unit) * unit;
+    filter->buckets = calloc(1, filter->size);
+    if (unlikely(filter->buckets == NULL))
+      return -errno; // cannot allocate memory
+  }
+
+  return 0;
+}
+
+int
+bitcache_cuckoo_filter_reset(bitcache_cuckoo_filter_t* filter) {
+  validate_with_errno_return(filter != NULL);
+
+  if (unlikely(filter->mapping != NULL)) {
+    munmap(filter->mapping, filter->mapping_size);
+    filter->mapping = NULL, filter->mapping_size = 0;
+    filter->buckets = NULL;
+    filter->size = 0;
+  }
+
+  if (likely(filter->buckets != NULL)) {
+    free(filter->buckets), filter->buckets = NULL;
+    filter->size = 0;
+  }
+
+  filter->victim = 0, filter->victim_index = 0;
+  filter->count = 0;
+  filter->checksum = 0;
+
+  return 0;
+}
+
+int
+bitcache_cuckoo_filter_clear(bitcache_cuckoo_filter_t* filter) {
+  validate_with_errno_return(filter != NULL && filter->buckets != NULL);
+
+  bzero(filter->buckets, filter->size);
+  filter->victim = 0, filter->victim_index = 0;
+  filter->count = 0;
+
+  return 0;
+}
+
+long PURE
+bitcache_cuckoo_filter_size(const bitcache_cuckoo_filter_t* filter) {
+  validate_with_errno_return(filter != NULL);
+
+  return sizeof(bitcache_cuckoo_filter_t) + filter->size;
+}
+
+long HOT
+bitcache_cuckoo_filter_count(const bitcache_cuckoo_filter_t* filter, const bitcache_id_t* id) {
+  validate_with_errno_return(filter != NULL && filter->buckets != NULL && id != NULL);
+
+  const uint64_t buckets = bitcache_cuckoo_filter_buckets(filter);
+  const uint32_t fp = bitcache_cuckoo_filter_fingerprint(filter, id);
+  const uint64_t i1 = bitcache_cuckoo_filter_index(id, buckets);
+  const uint64_t i2 = bitcache_cuckoo_filter_alt_index(i1, fp, buckets);
+
+  long count = bitcache_cuckoo_filter_is_victim(filter, i1, i2, fp) ? 1 : 0;
+  for (unsigned int slot = 0; slot < BITCACHE_CUCKOO_FILTER_SLOTS; slot++) {
+    count += (bitcache_cuckoo_filter_get(filter, i1, slot) == fp);
+    if (i2 != i1)
+      count += (bitcache_cuckoo_filter_get(filter, i2, slot) == fp);
+  }
+
+  return count;
+}
+
+bool HOT
+bitcache_cuckoo_filter_lookup(const bitcache_cuckoo_filter_t* filter, const bitcache_id_t* id) {
+  validate_with_false_return(filter != NULL && filter->buckets != NULL && id != NULL);
+
+  const uint64_t buckets = bitcache_cuckoo_filter_buckets(filter);
+  const uint32_t fp = bitcache_cuckoo_filter_fingerprint(filter, id);
+  const uint64_t i1 = bitcache_cuckoo_filter_index(id, buckets);
+  const uint64_t i2 = bitcache_cuckoo_filter_alt_index(i1, fp, buckets);
+
+  // false positives are possible, but false negatives are not:
+  return bitcache_cuckoo_filter_contains(filter, i1, fp) ||
+    bitcache_cuckoo_filter_contains(filter, i2, fp) ||
+    bitcache_cuckoo_filter_is_victim(filter, i1, i2, fp);
+}
+
+int HOT
+bitcache_cuckoo_filter_insert(bitcache_cuckoo_filter_t* filter, const bitcache_id_t* id) {
+  validate_with_errno_return(filter != NULL && filter->buckets != NULL && id != NULL);
+
+  if (unlikely(filter->victim != 0))
+    return -(errno = ENOSPC); // the filter is full
+
+  const uint64_t buckets = bitcache_cuckoo_filter_buckets(filter);
+  const uint32_t fp = bitcache_cuckoo_filter_fingerprint(filter, id);
+  bitcache_cuckoo_filter_place(filter, bitcache_cuckoo_filter_index(id, buckets), fp);
+  filter->count++;
+
+  return 0;
+}
+
+int HOT
+bitcache_cuckoo_filter_remove(bitcache_cuckoo_filter_t* filter, const bitcache_id_t* id) {
+  validate_with_errno_return(filter != NULL && filter->buckets != NULL && id != NULL);
+
+  const uint64_t buckets = bitcache_cuckoo_filter_buckets(filter);
+  const uint32_t fp = bitcache_cuckoo_filter_fingerprint(filter, id);
+  const uint64_t i1 = bitcache_cuckoo_filter_index(id, buckets);
+  const uint64_t i2 = bitcache_cuckoo_filter_alt_index(i1, fp, buckets);
+
+  if (bitcache_cuckoo_filter_is_victim(filter, i1, i2, fp)) {
+    filter->victim = 0, filter->victim_index = 0;
+    filter->count--;
+    return 0;
+  }
+
+  if (unlikely(!bitcache_cuckoo_filter_delete(filter, i1, fp) &&
+               !bitcache_cuckoo_filter_delete(filter, i2, fp)))
+    return -(errno = ENOENT); // no such identifier
+  filter->count--;
+
+  // a slot has opened up, so the victim may now find a place:
+  if (filter->victim != 0) {
+    const uint32_t victim = filter->victim;
+    filter->victim = 0;
+    bitcache_cuckoo_filter_place(filter, filter->victim_index, victim);
+  }
+
+  return 0;
+}
+
+int
+bitcache_cuckoo_filter_compare(const bitcache_cuckoo_filter_t* filter1, const bitcache_cuckoo_filter_t* filter2) {
+  validate_with_errno_return(filter1 != NULL && filter1->buckets != NULL);
+  validate_with_errno_return(filter2 != NULL && filter2->buckets != NULL);
+  validate_with_errno_return(filter1->size == filter2->size && filter1->bits == filter2->bits);
+
+  if (filter1->victim != filter2->victim ||
+      (filter1->victim != 0 && filter1->victim_index != filter2->victim_index))
+    return 1;
+
+  return bcmp(filter1->buckets, filter2->buckets, filter1->size);
+}
+
+long COLD
+bitcache_cuckoo_filter_load(bitcache_cuckoo_filter_t* filter, const int fd) {
+  validate_with_errno_return(filter != NULL && fd >= 0);
+
+  off_t off = lseek(fd, 0, SEEK_CUR);
+  if (unlikely(off == -1)) {
+    return -errno; // pipes, sockets and FIFOs are not supported
+  }
+
+  struct stat sb;
+  if (unlikely(fstat(fd, &sb) == -1)) {
+    return -errno;
+  }
+
+  bitcache_cuckoo_filter_header_t header;
+  if (unlikely(sb.st_size - off < (off_t)sizeof(header) ||
+      pread(fd, &header, sizeof(header), off) != sizeof(header) ||
+      memcmp(header.magic, BITCACHE_CUCKOO_FILTER_MAGIC, sizeof(header.magic)) != 0 ||
+      header.version < 1 || header.version > BITCACHE_CUCKOO_FILTER_VERSION ||
+      (header.bits != 8 && header.bits != 16) ||
+      header.size == 0 || header.size % bitcache_cuckoo_filter_bucket_size(header.bits) != 0 ||
+      header.size > (uint64_t)(sb.st_size - off) - sizeof(header) ||
+      (header.victim != 0 && header.victim_index >= header.size / bitcache_cuckoo_filter_bucket_size(header.bits)))) {
+    return -(errno = EINVAL); // not a cuckoo filter
+  }
+
+  // mmap() requires a page-aligned file offset:
+  const off_t page_off = off & ~((off_t)getpagesize() - 1);
+  const size_t mapping_size = (off - page_off) + sizeof(header) + header.size;
+
+  void* base = mmap(NULL, mapping_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, page_off);
+  if (unlikely(base == MAP_FAILED)) {
+    return -errno;
+  }
+
+  filter->bits = header.bits;
+  filter->size = header.size;
+  filter->count = header.count;
+  filter->victim = header.victim;
+  filter->victim_index = header.victim_index;
+  filter->checksum = header.checksum;
+  filter->mapping = base;
+  filter->mapping_size = mapping_size;
+  filter->buckets = (uint8_t*)base + (off - page_off) + sizeof(header);
+  return filter->size;
+}
+
+int COLD
+bitcache_cuckoo_filter_verify(const bitcache_cuckoo_filter_t* filter) {
+  validate_with_errno_return(filter != NULL && filter->buckets != NULL);
+
+  if (filter->checksum == 0)
+    return 0; // no checksum was recorded
+
+  if (unlikely(bitcache_crc32c(0, filter->buckets, filter->size) != filter->checksum))
+    return -(errno = EBADMSG); // checksum mismatch
+
+  return 0;
+}
+
+long COLD
+bitcache_cuckoo_filter_dump(const bitcache_cuckoo_filter_t* filter, const int fd) {
+  validate_with_errno_return(filter != NULL && filter->buckets != NULL && fd >= 0);
+
+  bitcache_cuckoo_filter_header_t header;
+  bzero(&header, sizeof(header));
+  memcpy(header.magic, BITCACHE_CUCKOO_FILTER_MAGIC, sizeof(header.magic));
+  header.version      = BITCACHE_CUCKOO_FILTER_VERSION;
+  header.bits         = filter->bits;
+  header.checksum     = bitcache_crc32c(0, filter->buckets, filter->size);
+  header.victim       = filter->victim;
+  header.size         = filter->size;
+  header.count        = filter->count;
+  header.victim_index = filter->victim_index;
+
+  int rc = bitcache_write(fd, &header, sizeof(header));
+  if (unlikely(rc < 0))
+    return rc;
+
+  rc = bitcache_write(fd, filter->buckets, filter->size);
+  if (unlikely(rc < 0))
+    return rc;
+
+  return sizeof(header) + filter->size;
+}
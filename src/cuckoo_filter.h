@@ -0,0 +1,163 @@
+/* This is free and unencumbered software released into the public domain. */
+
+#ifndef _BITCACHE_CUCKOO_FILTER_H
+#define _BITCACHE_CUCKOO_FILTER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h> /* for bool */
+#include <stddef.h>  /* for size_t */
+#include <stdint.h>  /* for uint8_t, uint32_t, uint64_t */
+
+/**
+ * Defines the number of fingerprints held in each cuckoo filter bucket.
+ */
+#define BITCACHE_CUCKOO_FILTER_SLOTS 4
+
+/**
+ * Defines the magic bytes at the start of a dumped cuckoo filter header.
+ */
+#define BITCACHE_CUCKOO_FILTER_MAGIC "BCCUCKOO"
+
+/**
+ * Defines the current version of the dumped cuckoo filter header format.
+ */
+#define BITCACHE_CUCKOO_FILTER_VERSION 1
+
+/**
+ * Represents a Bitcache cuckoo filter.
+ *
+ * A cuckoo filter stores an 8-bit or 16-bit fingerprint of each identifier
+ * in one of two candidate buckets of four slots, so that a lookup touches
+ * at most two buckets and identifiers can be removed again. A fingerprint
+ * that could not be placed is held aside as the victim, after which the
+ * filter is full.
+ */
+typedef struct {
+  size_t size;
+  uint8_t* buckets;
+  unsigned int bits;   /* fingerprint width: 8 or 16 */
+  uint32_t victim;     /* fingerprint evicted for lack of room, or zero */
+  size_t victim_index; /* the bucket the victim was evicted from */
+  uint64_t count;      /* number of fingerprints held */
+  uint32_t checksum;   /* CRC-32C recorded for a loaded filter, or zero */
+  void* mapping;       /* the mmap() region backing a loaded filter, if any */
+  size_t mapping_size;
+} bitcache_cuckoo_filter_t;
+
+/**
+ * Represents the header preceding the buckets of a dumped cuckoo filter.
+ * Fields are stored in host byte order.
+ */
+typedef struct {
+  char     magic[8];     /* BITCACHE_CUCKOO_FILTER_MAGIC */
+  uint32_t version;      /* BITCACHE_CUCKOO_FILTER_VERSION */
+  uint32_t bits;         /* fingerprint width */
+  uint32_t checksum;     /* CRC-32C of the buckets */
+  uint32_t victim;       /* fingerprint evicted for lack of room, or zero */
+  uint64_t size;         /* bucket array size (in bytes) */
+  uint64_t count;        /* number of fingerprints held */
+  uint64_t victim_index; /* the bucket the victim was evicted from */
+  uint8_t  reserved[16];
+} bitcache_cuckoo_filter_header_t;
+
+/**
+ * Computes the bucket array size (in bytes) and fingerprint width that a
+ * cuckoo filter needs to hold a given number of identifiers at a given
+ * false-positive rate.
+ */
+extern int bitcache_cuckoo_filter_sizing(const uint64_t count,
+  const double fp_rate,
+  size_t* size,
+  unsigned int* bits);
+
+/**
+ * Initializes a cuckoo filter using a given bucket array size (in bytes)
+ * and fingerprint width (zero selecting 16 bits). The size is rounded up
+ * to a whole number of buckets.
+ */
+extern int bitcache_cuckoo_filter_init(bitcache_cuckoo_filter_t* filter,
+  const size_t size,
+  const unsigned int bits);
+
+/**
+ * Resets a cuckoo filter back to an uninitialized state.
+ */
+extern int bitcache_cuckoo_filter_reset(bitcache_cuckoo_filter_t* filter);
+
+/**
+ * Clears the buckets of a cuckoo filter.
+ */
+extern int bitcache_cuckoo_filter_clear(bitcache_cuckoo_filter_t* filter);
+
+/**
+ * Returns the size of a cuckoo filter (in bytes).
+ */
+extern long bitcache_cuckoo_filter_size(const bitcache_cuckoo_filter_t* filter);
+
+/**
+ * Returns the number of times a cuckoo filter holds the fingerprint of a
+ * given identifier.
+ */
+extern long bitcache_cuckoo_filter_count(const bitcache_cuckoo_filter_t* filter,
+  const bitcache_id_t* id);
+
+/**
+ * Checks whether a cuckoo filter recognizes a given identifier.
+ */
+extern bool bitcache_cuckoo_filter_lookup(const bitcache_cuckoo_filter_t* filter,
+  const bitcache_id_t* id);
+
+/**
+ * Inserts a given identifier into a cuckoo filter.
+ *
+ * Fails with `ENOSPC` if the filter is full.
+ */
+extern int bitcache_cuckoo_filter_insert(bitcache_cuckoo_filter_t* filter,
+  const bitcache_id_t* id);
+
+/**
+ * Removes a given identifier from a cuckoo filter.
+ *
+ * Fails with `ENOENT` if the filter does not recognize the identifier.
+ * Only identifiers that were inserted may be removed, or else another
+ * identifier sharing the fingerprint may go missing.
+ */
+extern int bitcache_cuckoo_filter_remove(bitcache_cuckoo_filter_t* filter,
+  const bitcache_id_t* id);
+
+/**
+ * Compares two cuckoo filters for equality.
+ */
+extern int bitcache_cuckoo_filter_compare(const bitcache_cuckoo_filter_t* filter1,
+  const bitcache_cuckoo_filter_t* filter2);
+
+/**
+ * Reads in a cuckoo filter from a file descriptor.
+ *
+ * The buckets are mapped copy-on-write, so that the loaded filter can be
+ * updated without modifying the file.
+ */
+extern long bitcache_cuckoo_filter_load(bitcache_cuckoo_filter_t* filter,
+  const int fd);
+
+/**
+ * Verifies the buckets of a loaded cuckoo filter, before any updates,
+ * against the checksum recorded in its header, failing with `EBADMSG` on
+ * a mismatch.
+ */
+extern int bitcache_cuckoo_filter_verify(const bitcache_cuckoo_filter_t* filter);
+
+/**
+ * Writes out a cuckoo filter to a file descriptor.
+ */
+extern long bitcache_cuckoo_filter_dump(const bitcache_cuckoo_filter_t* filter,
+  const int fd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _BITCACHE_CUCKOO_FILTER_H */
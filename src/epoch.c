@@ -0,0 +1,195 @@
+/* This is free and unencumbered software released into the public domain. */
+
+#include "build.h"
+#include "epoch.h"
+
+#ifndef DISABLE_THREADS
+
+#include <pthread.h> /* for pthread_*() */
+#include <sched.h>   /* for sched_yield() */
+#include <stdint.h>  /* for uint64_t */
+#include <stdlib.h>  /* for calloc(), realloc() */
+
+//////////////////////////////////////////////////////////////////////////////
+// Epoch records
+
+// Every thread that has ever entered a section owns a record, which is
+// handed on to a new thread once its owner exits. Records are never freed.
+typedef struct bitcache_epoch_record {
+  struct bitcache_epoch_record* next;
+  uint64_t epoch;     // the epoch announced on entry, or zero when outside
+  unsigned int depth; // section nesting depth, touched only by the owner
+  bool in_use;
+} bitcache_epoch_record_t;
+
+typedef struct {
+  void* ptr;
+  free_func_t free_func;
+  uint64_t epoch;     // the epoch the pointer was retired in
+} bitcache_epoch_limbo_t;
+
+static bitcache_epoch_record_t* bitcache_epoch_records = NULL;
+static uint64_t bitcache_epoch_global = 1;
+
+static pthread_mutex_t bitcache_epoch_lock = PTHREAD_MUTEX_INITIALIZER;
+static bitcache_epoch_limbo_t* bitcache_epoch_limbo = NULL;
+static size_t bitcache_epoch_limbo_count = 0, bitcache_epoch_limbo_capacity = 0;
+
+static pthread_once_t bitcache_epoch_once = PTHREAD_ONCE_INIT;
+static pthread_key_t bitcache_epoch_key;
+static __thread bitcache_epoch_record_t* bitcache_epoch_local = NULL;
+
+static void
+bitcache_epoch_release(void* arg) {
+  bitcache_epoch_record_t* const record = arg;
+  __atomic_store_n(&record->epoch, 0, __ATOMIC_RELEASE);
+  record->depth = 0;
+  __atomic_store_n(&record->in_use, FALSE, __ATOMIC_RELEASE);
+}
+
+static void
+bitcache_epoch_init(void) {
+  pthread_key_create(&bitcache_epoch_key, bitcache_epoch_release);
+}
+
+static COLD bitcache_epoch_record_t*
+bitcache_epoch_register(void) {
+  pthread_once(&bitcache_epoch_once, bitcache_epoch_init);
+
+  // reuse the record of a thread that has since exited, if any:
+  bitcache_epoch_record_t* record = __atomic_load_n(&bitcache_epoch_records, __ATOMIC_ACQUIRE);
+  for (; record != NULL; record = record->next) {
+    bool expected = FALSE;
+    if (!__atomic_load_n(&record->in_use, __ATOMIC_RELAXED) &&
+        __atomic_compare_exchange_n(&record->in_use, &expected, TRUE, FALSE, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+      break;
+  }
+
+  if (record == NULL) {
+    record = calloc(1, sizeof(bitcache_epoch_record_t));
+    if (unlikely(record == NULL))
+      abort(); // cannot allocate memory, and readers have no way to fail
+    record->in_use = TRUE;
+    record->next = __atomic_load_n(&bitcache_epoch_records, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&bitcache_epoch_records, &record->next, record, TRUE, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+  }
+
+  pthread_setspecific(bitcache_epoch_key, record);
+  return bitcache_epoch_local = record;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Epoch API
+
+void
+bitcache_epoch_enter(void) {
+  bitcache_epoch_record_t* record = bitcache_epoch_local;
+  if (unlikely(record == NULL))
+    record = bitcache_epoch_register();
+
+  if (record->depth++ == 0) {
+    __atomic_store_n(&record->epoch, __atomic_load_n(&bitcache_epoch_global, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    // the announcement must be visible before any shared memory is read:
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  }
+}
+
+void
+bitcache_epoch_exit(void) {
+  bitcache_epoch_record_t* const record = bitcache_epoch_local;
+  if (--record->depth == 0)
+    __atomic_store_n(&record->epoch, 0, __ATOMIC_RELEASE);
+}
+
+// Advances the global epoch if every reader inside a section has seen the
+// current one, then moves whatever is now safe to free into `ready`.
+// Memory retired in epoch e is unreachable once the epoch reaches e + 2.
+// Must be called with the limbo lock held.
+static size_t
+bitcache_epoch_collect(bitcache_epoch_limbo_t* ready, const size_t capacity) {
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  const uint64_t global = __atomic_load_n(&bitcache_epoch_global, __ATOMIC_RELAXED);
+
+  bool quiescent = TRUE;
+  for (bitcache_epoch_record_t* record = __atomic_load_n(&bitcache_epoch_records, __ATOMIC_ACQUIRE); record != NULL; record = record->next) {
+    const uint64_t epoch = __atomic_load_n(&record->epoch, __ATOMIC_ACQUIRE);
+    if (epoch != 0 && epoch != global) {
+      quiescent = FALSE;
+      break;
+    }
+  }
+  if (quiescent)
+    __atomic_store_n(&bitcache_epoch_global, global + 1, __ATOMIC_RELEASE);
+
+  const uint64_t safe = quiescent ? global + 1 : global;
+  size_t count = 0, kept = 0;
+  for (size_t i = 0; i < bitcache_epoch_limbo_count; i++) {
+    if (bitcache_epoch_limbo[i].epoch + 2 <= safe && count < capacity)
+      ready[count++] = bitcache_epoch_limbo[i];
+    else
+      bitcache_epoch_limbo[kept++] = bitcache_epoch_limbo[i];
+  }
+  bitcache_epoch_limbo_count = kept;
+  return count;
+}
+
+// The number of retired pointers freed per collection, at most.
+#define BITCACHE_EPOCH_BATCH 64
+
+void
+bitcache_epoch_retire(void* ptr, const free_func_t free_func) {
+  if (ptr == NULL || free_func == NULL)
+    return;
+
+  bitcache_epoch_limbo_t ready[BITCACHE_EPOCH_BATCH];
+  size_t count;
+
+  pthread_mutex_lock(&bitcache_epoch_lock);
+  if (unlikely(bitcache_epoch_limbo_count == bitcache_epoch_limbo_capacity)) {
+    const size_t capacity = bitcache_epoch_limbo_capacity ? bitcache_epoch_limbo_capacity * 2 : BITCACHE_EPOCH_BATCH;
+    bitcache_epoch_limbo_t* const limbo = realloc(bitcache_epoch_limbo, capacity * sizeof(*limbo));
+    if (unlikely(limbo == NULL)) {
+      // with nowhere to park the pointer, wait out every current reader:
+      pthread_mutex_unlock(&bitcache_epoch_lock);
+      bitcache_epoch_barrier();
+      free_func(ptr);
+      return;
+    }
+    bitcache_epoch_limbo = limbo;
+    bitcache_epoch_limbo_capacity = capacity;
+  }
+  bitcache_epoch_limbo[bitcache_epoch_limbo_count].ptr = ptr;
+  bitcache_epoch_limbo[bitcache_epoch_limbo_count].free_func = free_func;
+  bitcache_epoch_limbo[bitcache_epoch_limbo_count].epoch = __atomic_load_n(&bitcache_epoch_global, __ATOMIC_RELAXED);
+  bitcache_epoch_limbo_count++;
+  count = bitcache_epoch_collect(ready, BITCACHE_EPOCH_BATCH);
+  pthread_mutex_unlock(&bitcache_epoch_lock);
+
+  // run the free functions outside of the lock, as they may retire more:
+  for (size_t i = 0; i < count; i++)
+    ready[i].free_func(ready[i].ptr);
+}
+
+void
+bitcache_epoch_barrier(void) {
+  bitcache_epoch_limbo_t ready[BITCACHE_EPOCH_BATCH];
+  const uint64_t target = __atomic_load_n(&bitcache_epoch_global, __ATOMIC_RELAXED) + 2;
+
+  for (;;) {
+    pthread_mutex_lock(&bitcache_epoch_lock);
+    const size_t count = bitcache_epoch_collect(ready, BITCACHE_EPOCH_BATCH);
+    const bool reached = __atomic_load_n(&bitcache_epoch_global, __ATOMIC_RELAXED) >= target;
+    pthread_mutex_unlock(&bitcache_epoch_lock);
+
+    for (size_t i = 0; i < count; i++)
+      ready[i].free_func(ready[i].ptr);
+    // once the target is reached, everything retired before the barrier
+    // is eligible, and a short batch means that it has all been freed:
+    if (reached && count < BITCACHE_EPOCH_BATCH)
+      break;
+    if (count == 0)
+      sched_yield(); // some reader has yet to leave its section
+  }
+}
+
+#endif /* !DISABLE_THREADS */
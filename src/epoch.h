@@ -0,0 +1,29 @@
+/* This is free and unencumbered software released into the public domain. */
+
+#ifndef _BITCACHE_EPOCH_H
+#define _BITCACHE_EPOCH_H
+
+#include <cprime.h> /* for free_func_t */
+
+//////////////////////////////////////////////////////////////////////////////
+// Epoch-based reclamation
+//
+// Readers that traverse shared memory without taking a lock bracket the
+// traversal with bitcache_epoch_enter() and bitcache_epoch_exit(). Writers
+// that unlink memory such readers might still be looking at pass it to
+// bitcache_epoch_retire(), which frees it only once every reader that
+// could have seen it has exited. Sections may nest, but must not block.
+
+#ifndef DISABLE_THREADS
+extern void bitcache_epoch_enter(void);
+extern void bitcache_epoch_exit(void);
+extern void bitcache_epoch_retire(void* ptr, const free_func_t free_func);
+extern void bitcache_epoch_barrier(void);
+#else
+static inline void bitcache_epoch_enter(void) {}
+static inline void bitcache_epoch_exit(void) {}
+static inline void bitcache_epoch_retire(void* ptr, const free_func_t free_func) { free_func(ptr); }
+static inline void bitcache_epoch_barrier(void) {}
+#endif /* DISABLE_THREADS */
+
+#endif /* _BITCACHE_EPOCH_H */
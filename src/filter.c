@@ -1,29 +1,340 @@
 /* This is free and unencumbered software released into the public domain. */
 
 #include "build.h"
+#include "crc32c.h"
+#include "filter_hash.h"
+#include "io.h"
+#include "thread.h"
 #include <assert.h>
 #include <errno.h>
+#include <math.h>   /* for exp(), log(), log1p(), lround(), pow() */
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
-#include <sys/mman.h> /* for mmap() */
+#include <sys/mman.h> /* for madvise(), mmap(), msync() */
 #include <sys/stat.h> /* for fstat() */
-#include <unistd.h>   /* for getpagesize(), lseek(), write() */
+#include <unistd.h>   /* for getpagesize(), lseek(), pread(), read(), write() */
+
+#ifdef BITCACHE_CPU_X86
+#include <immintrin.h>
+#endif
+
+//////////////////////////////////////////////////////////////////////////////
+// Filter hashing
+
+// Returns the block that holds every bit of an identifier in a blocked filter.
+static inline const uint64_t*
+bitcache_filter_block(const bitcache_filter_t* filter, const bitcache_id_t* id) {
+  const uint32_t j = bitcache_filter_block_index(id, filter->size / BITCACHE_FILTER_BLOCK_SIZE);
+  return (const uint64_t*)(filter->bitmap + (size_t)j * BITCACHE_FILTER_BLOCK_SIZE);
+}
+
+static inline uint64_t
+bitcache_filter_bits(const bitcache_filter_t* filter) {
+  return (uint64_t)filter->size * 8;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Filter memory
+
+// Bitmaps at least this large get a mapping of their own, advised to use
+// transparent huge pages to cut down on TLB misses.
+#define BITCACHE_FILTER_HUGEPAGE_SIZE (2 << 20)
+
+// Allocates a zeroed, block-aligned bitmap for a filter.
+static NONNULL int
+bitcache_filter_alloc(bitcache_filter_t* filter, const size_t size) {
+  if (size >= BITCACHE_FILTER_HUGEPAGE_SIZE) {
+    void* base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (unlikely(base == MAP_FAILED))
+      return -errno; // cannot allocate memory
+#ifdef MADV_HUGEPAGE
+    madvise(base, size, MADV_HUGEPAGE);
+#endif
+    filter->mapping = base;
+    filter->mapping_size = size;
+    filter->bitmap = base;
+  }
+  else {
+    void* bitmap = NULL;
+    const int rc = posix_memalign(&bitmap, BITCACHE_FILTER_BLOCK_SIZE, size > 0 ? size : 1);
+    if (unlikely(rc != 0))
+      return -(errno = rc); // cannot allocate memory
+    bzero(bitmap, size);
+    filter->bitmap = bitmap;
+  }
+  return 0;
+}
+
+// Releases the bitmap of a filter, whether allocated or mapped.
+static NONNULL void
+bitcache_filter_free(bitcache_filter_t* filter) {
+  if (filter->mapping != NULL)
+    munmap(filter->mapping, filter->mapping_size);
+  else
+    free(filter->bitmap);
+  free(filter->dirty);
+  filter->mapping = NULL, filter->mapping_size = 0;
+  filter->bitmap = NULL, filter->dirty = NULL;
+}
+
+// log2 of the page size that writable mappings track dirty pages at.
+static unsigned int bitcache_filter_page_shift = 12;
+
+// Marks the page of a writable mapping holding a given byte as dirty.
+static inline void
+bitcache_filter_touch(bitcache_filter_t* filter, const void* p) {
+  const size_t page = (size_t)((const uint8_t*)p - (const uint8_t*)filter->mapping) >> bitcache_filter_page_shift;
+  filter->dirty[page >> 3] |= 1 << (page & 7);
+}
+
+// Marks the page of a writable mapping holding a given byte as dirty, when
+// other threads may be doing the same.
+static inline void
+bitcache_filter_touch_atomic(bitcache_filter_t* filter, const void* p) {
+  const size_t page = (size_t)((const uint8_t*)p - (const uint8_t*)filter->mapping) >> bitcache_filter_page_shift;
+  const uint8_t b = 1 << (page & 7);
+  if ((__atomic_load_n(&filter->dirty[page >> 3], __ATOMIC_RELAXED) & b) == 0)
+    __atomic_fetch_or(&filter->dirty[page >> 3], b, __ATOMIC_RELAXED);
+}
+
+// Marks every page of a writable mapping as dirty.
+static inline void
+bitcache_filter_touch_all(bitcache_filter_t* filter) {
+  const size_t pages = (filter->mapping_size >> bitcache_filter_page_shift) + 1;
+  memset(filter->dirty, 0xff, (pages + 7) / 8);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Filter kernels
+
+// Computes `dst[i] = src1[i] OP src2[i]`; `dst` may alias `src1`.
+typedef void (*bitcache_filter_kernel_t)(uint8_t* dst,
+  const uint8_t* src1, const uint8_t* src2, size_t size);
+
+#define BITCACHE_FILTER_KERNEL_WORD(name, op) \
+  static void \
+  name(uint8_t* dst, const uint8_t* src1, const uint8_t* src2, size_t size) { \
+    size_t i = 0; \
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) { \
+      uint64_t a, b; \
+      memcpy(&a, src1 + i, sizeof(a)); \
+      memcpy(&b, src2 + i, sizeof(b)); \
+      a = a op b; \
+      memcpy(dst + i, &a, sizeof(a)); \
+    } \
+    for (; i < size; i++) \
+      dst[i] = src1[i] op src2[i]; \
+  }
+
+BITCACHE_FILTER_KERNEL_WORD(bitcache_filter_or_word,  |)
+BITCACHE_FILTER_KERNEL_WORD(bitcache_filter_and_word, &)
+BITCACHE_FILTER_KERNEL_WORD(bitcache_filter_xor_word, ^)
+
+#ifdef BITCACHE_CPU_X86
+#define BITCACHE_FILTER_KERNEL_SIMD(name, isa, type, width, load, store, op, word) \
+  static TARGET(isa) void \
+  name(uint8_t* dst, const uint8_t* src1, const uint8_t* src2, size_t size) { \
+    size_t i = 0; \
+    for (; i + (width) <= size; i += (width)) { \
+      const type a = load((const void*)(src1 + i)); \
+      const type b = load((const void*)(src2 + i)); \
+      store((void*)(dst + i), op(a, b)); \
+    } \
+    word(dst + i, src1 + i, src2 + i, size - i); \
+  }
+
+BITCACHE_FILTER_KERNEL_SIMD(bitcache_filter_or_avx2, "avx2", __m256i, 32,
+  _mm256_loadu_si256, _mm256_storeu_si256, _mm256_or_si256, bitcache_filter_or_word)
+BITCACHE_FILTER_KERNEL_SIMD(bitcache_filter_and_avx2, "avx2", __m256i, 32,
+  _mm256_loadu_si256, _mm256_storeu_si256, _mm256_and_si256, bitcache_filter_and_word)
+BITCACHE_FILTER_KERNEL_SIMD(bitcache_filter_xor_avx2, "avx2", __m256i, 32,
+  _mm256_loadu_si256, _mm256_storeu_si256, _mm256_xor_si256, bitcache_filter_xor_word)
+
+BITCACHE_FILTER_KERNEL_SIMD(bitcache_filter_or_avx512, "avx512f", __m512i, 64,
+  _mm512_loadu_si512, _mm512_storeu_si512, _mm512_or_si512, bitcache_filter_or_word)
+BITCACHE_FILTER_KERNEL_SIMD(bitcache_filter_and_avx512, "avx512f", __m512i, 64,
+  _mm512_loadu_si512, _mm512_storeu_si512, _mm512_and_si512, bitcache_filter_and_word)
+BITCACHE_FILTER_KERNEL_SIMD(bitcache_filter_xor_avx512, "avx512f", __m512i, 64,
+  _mm512_loadu_si512, _mm512_storeu_si512, _mm512_xor_si512, bitcache_filter_xor_word)
+#endif /* BITCACHE_CPU_X86 */
+
+// Counts the bits set in each 64-byte block of `src1`, or of `src1 | src2`
+// if `src2` is given, without materializing the union.
+typedef void (*bitcache_filter_popcount_t)(const uint8_t* src1,
+  const uint8_t* src2, size_t blocks, uint16_t* counts);
+
+#define BITCACHE_FILTER_POPCOUNT_WORD(name, attributes) \
+  static attributes void \
+  name(const uint8_t* src1, const uint8_t* src2, size_t blocks, uint16_t* counts) { \
+    for (size_t j = 0; j < blocks; j++) { \
+      unsigned int count = 0; \
+      for (size_t i = 0; i < BITCACHE_FILTER_BLOCK_SIZE; i += sizeof(uint64_t)) { \
+        uint64_t a, b = 0; \
+        memcpy(&a, src1 + i, sizeof(a)); \
+        if (src2 != NULL) \
+          memcpy(&b, src2 + i, sizeof(b)); \
+        count += __builtin_popcountll(a | b); \
+      } \
+      counts[j] = count; \
+      src1 += BITCACHE_FILTER_BLOCK_SIZE; \
+      src2 = (src2 != NULL) ? src2 + BITCACHE_FILTER_BLOCK_SIZE : NULL; \
+    } \
+  }
+
+BITCACHE_FILTER_POPCOUNT_WORD(bitcache_filter_popcount_word, )
+
+#ifdef BITCACHE_CPU_X86
+BITCACHE_FILTER_POPCOUNT_WORD(bitcache_filter_popcount_popcnt, TARGET("popcnt"))
+
+// Looks up the popcount of each nibble with a byte shuffle (Muła et al.).
+static TARGET("avx2") void
+bitcache_filter_popcount_avx2(const uint8_t* src1, const uint8_t* src2, size_t blocks, uint16_t* counts) {
+  const __m256i table = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                         0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+  const __m256i mask = _mm256_set1_epi8(0x0f);
+  for (size_t j = 0; j < blocks; j++) {
+    __m256i a0 = _mm256_loadu_si256((const void*)src1);
+    __m256i a1 = _mm256_loadu_si256((const void*)(src1 + 32));
+    if (src2 != NULL) {
+      a0 = _mm256_or_si256(a0, _mm256_loadu_si256((const void*)src2));
+      a1 = _mm256_or_si256(a1, _mm256_loadu_si256((const void*)(src2 + 32)));
+    }
+    const __m256i c0 = _mm256_add_epi8(
+      _mm256_shuffle_epi8(table, _mm256_and_si256(a0, mask)),
+      _mm256_shuffle_epi8(table, _mm256_and_si256(_mm256_srli_epi16(a0, 4), mask)));
+    const __m256i c1 = _mm256_add_epi8(
+      _mm256_shuffle_epi8(table, _mm256_and_si256(a1, mask)),
+      _mm256_shuffle_epi8(table, _mm256_and_si256(_mm256_srli_epi16(a1, 4), mask)));
+    const __m256i sums = _mm256_sad_epu8(_mm256_add_epi8(c0, c1), _mm256_setzero_si256());
+    counts[j] = _mm256_extract_epi64(sums, 0) + _mm256_extract_epi64(sums, 1) +
+                _mm256_extract_epi64(sums, 2) + _mm256_extract_epi64(sums, 3);
+    src1 += BITCACHE_FILTER_BLOCK_SIZE;
+    src2 = (src2 != NULL) ? src2 + BITCACHE_FILTER_BLOCK_SIZE : NULL;
+  }
+}
+
+static TARGET("avx512f,avx512vpopcntdq") void
+bitcache_filter_popcount_avx512(const uint8_t* src1, const uint8_t* src2, size_t blocks, uint16_t* counts) {
+  for (size_t j = 0; j < blocks; j++) {
+    __m512i a = _mm512_loadu_si512((const void*)src1);
+    if (src2 != NULL)
+      a = _mm512_or_si512(a, _mm512_loadu_si512((const void*)src2));
+    counts[j] = _mm512_reduce_add_epi64(_mm512_popcnt_epi64(a));
+    src1 += BITCACHE_FILTER_BLOCK_SIZE;
+    src2 = (src2 != NULL) ? src2 + BITCACHE_FILTER_BLOCK_SIZE : NULL;
+  }
+}
+#endif /* BITCACHE_CPU_X86 */
+
+static bitcache_filter_popcount_t bitcache_filter_popcount_kernel = bitcache_filter_popcount_word;
+
+// Indexed by bitcache_filter_op_t; selected once the library is loaded.
+static bitcache_filter_kernel_t bitcache_filter_kernels[4] = {
+  NULL,
+  bitcache_filter_or_word,
+  bitcache_filter_and_word,
+  bitcache_filter_xor_word,
+};
+
+static void CONSTRUCTOR COLD
+bitcache_filter_kernels_init(void) {
+  bitcache_cpu_init();
+#ifdef BITCACHE_CPU_X86
+  if (bitcache_cpu_has("avx512f")) {
+    bitcache_filter_kernels[BITCACHE_FILTER_OR]  = bitcache_filter_or_avx512;
+    bitcache_filter_kernels[BITCACHE_FILTER_AND] = bitcache_filter_and_avx512;
+    bitcache_filter_kernels[BITCACHE_FILTER_XOR] = bitcache_filter_xor_avx512;
+  }
+  else if (bitcache_cpu_has("avx2")) {
+    bitcache_filter_kernels[BITCACHE_FILTER_OR]  = bitcache_filter_or_avx2;
+    bitcache_filter_kernels[BITCACHE_FILTER_AND] = bitcache_filter_and_avx2;
+    bitcache_filter_kernels[BITCACHE_FILTER_XOR] = bitcache_filter_xor_avx2;
+  }
+
+  if (bitcache_cpu_has("avx512vpopcntdq"))
+    bitcache_filter_popcount_kernel = bitcache_filter_popcount_avx512;
+  else if (bitcache_cpu_has("avx2"))
+    bitcache_filter_popcount_kernel = bitcache_filter_popcount_avx2;
+  else if (bitcache_cpu_has("popcnt"))
+    bitcache_filter_popcount_kernel = bitcache_filter_popcount_popcnt;
+#endif
+}
+
+static inline bitcache_filter_kernel_t
+bitcache_filter_kernel(const bitcache_filter_op_t op) {
+  return ((unsigned int)op < 4) ? bitcache_filter_kernels[op] : NULL;
+}
 
 //////////////////////////////////////////////////////////////////////////////
 // Filter API
 
+// Returns the false-positive rate of a blocked filter, whose blocks receive
+// a Poisson-distributed number of identifiers rather than an even share.
+static double
+bitcache_filter_blocked_fp_rate(const double count, const double blocks, const unsigned int k) {
+  const double load = count / blocks;
+  const double limit = load + 10 * sqrt(load) + 10;
+  double fp_rate = 0, p = exp(-load); // P(j = 0)
+  for (double j = 0; j <= limit; j++) {
+    fp_rate += p * pow(1 - pow(1 - 1.0 / BITCACHE_FILTER_BLOCK_BITS, j * k), k);
+    p *= load / (j + 1);
+  }
+  return fp_rate;
+}
+
+int COLD
+bitcache_filter_sizing(const uint64_t count, const double fp_rate, const bitcache_filter_layout_t layout, size_t* size, unsigned int* k) {
+  validate_with_errno_return(count > 0 && fp_rate > 0 && fp_rate < 1);
+  validate_with_errno_return(size != NULL && k != NULL);
+
+  // the optimal classic filter has m = -n ln(p) / ln(2)^2 bits and k = (m / n) ln(2):
+  double m = ceil(-(double)count * log(fp_rate) / (M_LN2 * M_LN2));
+  double k_opt = round(m / count * M_LN2);
+
+  switch (layout) {
+    case BITCACHE_FILTER_CLASSIC:
+      *k = (k_opt < 1) ? 1 : (k_opt > BITCACHE_FILTER_K_MAX) ? BITCACHE_FILTER_K_MAX : (unsigned int)k_opt;
+      *size = (size_t)ceil(m / 8);
+      return 0;
+
+    case BITCACHE_FILTER_BLOCKED: {
+      // uneven block loads make blocked filters need somewhat more space;
+      // grow the classic estimate until some k meets the target:
+      for (double blocks = ceil(m / BITCACHE_FILTER_BLOCK_BITS); ; blocks = ceil(blocks * 1.02)) {
+        for (unsigned int j = 1; j <= BITCACHE_FILTER_BLOCKED_K_MAX; j++) {
+          if (bitcache_filter_blocked_fp_rate(count, blocks, j) <= fp_rate) {
+            *k = j;
+            *size = (size_t)blocks * BITCACHE_FILTER_BLOCK_SIZE;
+            return 0;
+          }
+        }
+      }
+    }
+
+    default:
+      return -(errno = EINVAL); // invalid argument
+  }
+}
+
 int
-bitcache_filter_init(bitcache_filter_t* filter, const size_t size) {
+bitcache_filter_init(bitcache_filter_t* filter, const size_t size, const bitcache_filter_layout_t layout, const unsigned int k) {
   validate_with_errno_return(filter != NULL);
+  validate_with_errno_return(layout == BITCACHE_FILTER_CLASSIC || layout == BITCACHE_FILTER_BLOCKED);
+  validate_with_errno_return(k <= (layout == BITCACHE_FILTER_BLOCKED ? BITCACHE_FILTER_BLOCKED_K_MAX : BITCACHE_FILTER_K_MAX));
+  validate_with_errno_return(layout != BITCACHE_FILTER_BLOCKED || size / BITCACHE_FILTER_BLOCK_SIZE < UINT32_MAX);
 
   bzero(filter, sizeof(bitcache_filter_t));
+  filter->layout = layout;
+  filter->k = (k > 0) ? k : BITCACHE_FILTER_K_DEFAULT;
 
   if (likely(size > 0)) {
-    filter->size = size;
-    filter->bitmap = calloc(1, size);
-    if (unlikely(filter->bitmap == NULL))
-      return -errno; // cannot allocate memory
+    // round blocked filters up to whole blocks:
+    filter->size = (layout == BITCACHE_FILTER_BLOCKED) ?
+      ((size + BITCACHE_FILTER_BLOCK_SIZE - 1) / BITCACHE_FILTER_BLOCK_SIZE) * BITCACHE_FILTER_BLOCK_SIZE : size;
+    const int rc = bitcache_filter_alloc(filter, filter->size);
+    if (unlikely(rc < 0))
+      return rc; // cannot allocate memory
   }
 
   return 0;
@@ -34,7 +345,9 @@ bitcache_filter_reset(bitcache_filter_t* filter) {
   validate_with_errno_return(filter != NULL);
 
   if (likely(filter->bitmap != NULL)) {
-    free(filter->bitmap), filter->bitmap = NULL;
+    if (filter->dirty != NULL)
+      bitcache_filter_sync(filter, FALSE);
+    bitcache_filter_free(filter);
     filter->size = 0;
   }
 
@@ -47,6 +360,9 @@ bitcache_filter_clear(bitcache_filter_t* filter) {
 
   bzero(filter->bitmap, filter->size);
 
+  if (unlikely(filter->dirty != NULL))
+    bitcache_filter_touch_all(filter);
+
   return 0;
 }
 
@@ -71,9 +387,20 @@ bitcache_filter_lookup(const bitcache_filter_t* filter, const bitcache_id_t* id)
 
   bool found = TRUE; // false positives are possible
 
-  const uint32_t m = filter->size * 8;
-  for (size_t k = 0; k < BITCACHE_FILTER_K_MAX; k++) {
-    const uint32_t i = ((uint32_t*)id)[k] % m;
+  if (filter->layout == BITCACHE_FILTER_BLOCKED) {
+    // a single cache line holds every bit that needs to be checked:
+    const uint64_t* const block = bitcache_filter_block(filter, id);
+    for (size_t k = 0; k < filter->k; k++) {
+      const uint32_t i = bitcache_filter_block_offset(id, k);
+      if ((block[i >> 6] & ((uint64_t)1 << (i & 63))) == 0)
+        return FALSE; // false negatives are NOT possible
+    }
+    return found;
+  }
+
+  const uint64_t m = bitcache_filter_bits(filter);
+  for (size_t k = 0; k < filter->k; k++) {
+    const uint64_t i = bitcache_filter_probe(id, m, filter->k, filter->layout, k);
     const uint8_t* p = filter->bitmap + (i >> 3);
     const uint8_t  b = 1 << (i & 7);
 
@@ -86,19 +413,204 @@ bitcache_filter_lookup(const bitcache_filter_t* filter, const bitcache_id_t* id)
   return found;
 }
 
+// The number of identifiers whose probes are in flight at any one time.
+#define BITCACHE_FILTER_LOOKAHEAD 16
+
+typedef struct {
+  const uint8_t* p[BITCACHE_FILTER_K_MAX];
+  uint8_t b[BITCACHE_FILTER_K_MAX];
+} bitcache_filter_probe_t;
+
+long HOT
+bitcache_filter_lookup_many(const bitcache_filter_t* filter, const bitcache_id_t* ids, const size_t count, uint8_t* results) {
+  validate_with_errno_return(filter != NULL && filter->bitmap != NULL);
+  validate_with_errno_return(count == 0 || (ids != NULL && results != NULL));
+
+  bzero(results, (count + 7) / 8);
+
+  long found = 0;
+
+  if (filter->layout == BITCACHE_FILTER_BLOCKED) {
+    // prefetch the blocks a window ahead of the identifier being resolved:
+    for (size_t i = 0; i < count && i < BITCACHE_FILTER_LOOKAHEAD; i++)
+      prefetch(bitcache_filter_block(filter, &ids[i]));
+
+    for (size_t i = 0; i < count; i++) {
+      if (likely(i + BITCACHE_FILTER_LOOKAHEAD < count))
+        prefetch(bitcache_filter_block(filter, &ids[i + BITCACHE_FILTER_LOOKAHEAD]));
+
+      if (bitcache_filter_lookup(filter, &ids[i])) {
+        results[i >> 3] |= 1 << (i & 7);
+        found++;
+      }
+    }
+    return found;
+  }
+
+  // compute every probe of an identifier up front, using a reciprocal
+  // instead of a division per probe, and prefetch them all; by the time
+  // the identifier comes up for resolution its bitmap bytes are in cache:
+  const uint64_t m = bitcache_filter_bits(filter);
+  const bool legacy = bitcache_filter_legacy(m, filter->k);
+  const uint64_t r = legacy ? UINT64_C(0xFFFFFFFFFFFFFFFF) / m + 1 : 0;
+  bitcache_filter_probe_t window[BITCACHE_FILTER_LOOKAHEAD];
+
+  for (size_t i = 0; i < count + BITCACHE_FILTER_LOOKAHEAD; i++) {
+    if (likely(i >= BITCACHE_FILTER_LOOKAHEAD)) {
+      const size_t j = i - BITCACHE_FILTER_LOOKAHEAD;
+      const bitcache_filter_probe_t* const probe = &window[j % BITCACHE_FILTER_LOOKAHEAD];
+
+      bool match = TRUE;
+      for (size_t k = 0; k < filter->k; k++)
+        match &= (*probe->p[k] & probe->b[k]) != 0;
+
+      if (match) {
+        results[j >> 3] |= 1 << (j & 7);
+        found++;
+      }
+    }
+
+    if (likely(i < count)) {
+      bitcache_filter_probe_t* const probe = &window[i % BITCACHE_FILTER_LOOKAHEAD];
+      for (size_t k = 0; k < filter->k; k++) {
+        const uint64_t bit = legacy ?
+          bitcache_filter_fastmod(bitcache_filter_word(&ids[i], k), r, m) :
+          bitcache_filter_probe(&ids[i], m, filter->k, filter->layout, k);
+        probe->p[k] = filter->bitmap + (bit >> 3);
+        probe->b[k] = 1 << (bit & 7);
+        prefetch(probe->p[k]);
+      }
+    }
+  }
+
+  return found;
+}
+
+// Sets the bits of an identifier.
+static inline void
+bitcache_filter_set(bitcache_filter_t* filter, const bitcache_id_t* id) {
+  if (filter->layout == BITCACHE_FILTER_BLOCKED) {
+    uint64_t* const block = (uint64_t*)bitcache_filter_block(filter, id);
+    for (size_t k = 0; k < filter->k; k++) {
+      const uint32_t i = bitcache_filter_block_offset(id, k);
+      block[i >> 6] |= (uint64_t)1 << (i & 63); // set the bit at block[i] to 1
+    }
+    if (unlikely(filter->dirty != NULL)) {
+      // a block can only straddle two pages if the file offset was unaligned:
+      bitcache_filter_touch(filter, (const uint8_t*)block);
+      bitcache_filter_touch(filter, (const uint8_t*)block + BITCACHE_FILTER_BLOCK_SIZE - 1);
+    }
+    return;
+  }
+
+  const uint64_t m = bitcache_filter_bits(filter);
+  for (size_t k = 0; k < filter->k; k++) {
+    const uint64_t i = bitcache_filter_probe(id, m, filter->k, filter->layout, k);
+    uint8_t* const p = filter->bitmap + (i >> 3);
+    const uint8_t  b = 1 << (i & 7);
+
+    *p |= b; // set the bit at bitmap[i] to 1
+    if (unlikely(filter->dirty != NULL))
+      bitcache_filter_touch(filter, p);
+  }
+}
+
 int HOT
 bitcache_filter_insert(bitcache_filter_t* filter, const bitcache_id_t* id) {
   validate_with_errno_return(filter != NULL && filter->bitmap != NULL && id != NULL);
 
-  const uint32_t m = filter->size * 8;
-  for (size_t k = 0; k < BITCACHE_FILTER_K_MAX; k++) {
-    const uint32_t i = ((uint32_t*)id)[k] % m;
+  bitcache_filter_set(filter, id);
+  filter->count++;
+
+  return 0;
+}
+
+// Sets the bits of an identifier with atomic read-modify-writes, skipping
+// the write (and the cache line transfer) for bits that are already set.
+static inline void
+bitcache_filter_set_atomic(bitcache_filter_t* filter, const bitcache_id_t* id) {
+  if (filter->layout == BITCACHE_FILTER_BLOCKED) {
+    uint64_t* const block = (uint64_t*)bitcache_filter_block(filter, id);
+    for (size_t k = 0; k < filter->k; k++) {
+      const uint32_t i = bitcache_filter_block_offset(id, k);
+      const uint64_t b = (uint64_t)1 << (i & 63);
+      if ((__atomic_load_n(&block[i >> 6], __ATOMIC_RELAXED) & b) == 0)
+        __atomic_fetch_or(&block[i >> 6], b, __ATOMIC_RELAXED);
+    }
+    if (unlikely(filter->dirty != NULL)) {
+      bitcache_filter_touch_atomic(filter, (const uint8_t*)block);
+      bitcache_filter_touch_atomic(filter, (const uint8_t*)block + BITCACHE_FILTER_BLOCK_SIZE - 1);
+    }
+    return;
+  }
+
+  const uint64_t m = bitcache_filter_bits(filter);
+  for (size_t k = 0; k < filter->k; k++) {
+    const uint64_t i = bitcache_filter_probe(id, m, filter->k, filter->layout, k);
     uint8_t* const p = filter->bitmap + (i >> 3);
     const uint8_t  b = 1 << (i & 7);
 
-    *p |= b; // set the bit at bitmap[i] to 1
+    if ((__atomic_load_n(p, __ATOMIC_RELAXED) & b) == 0)
+      __atomic_fetch_or(p, b, __ATOMIC_RELAXED);
+    if (unlikely(filter->dirty != NULL))
+      bitcache_filter_touch_atomic(filter, p);
+  }
+}
+
+int HOT
+bitcache_filter_insert_atomic(bitcache_filter_t* filter, const bitcache_id_t* id) {
+  validate_with_errno_return(filter != NULL && filter->bitmap != NULL && id != NULL);
+
+  bitcache_filter_set_atomic(filter, id);
+  __atomic_fetch_add(&filter->count, 1, __ATOMIC_RELAXED);
+
+  return 0;
+}
+
+// The fewest identifiers worth handing to a thread of their own.
+#define BITCACHE_FILTER_BUILD_MIN 16384
+
+typedef struct {
+  bitcache_filter_t* filter;
+  const bitcache_id_t* ids;
+  size_t count;
+  bool atomic;
+} bitcache_filter_build_t;
+
+static void*
+bitcache_filter_build_slice(void* arg) {
+  const bitcache_filter_build_t* const slice = arg;
+  for (size_t i = 0; i < slice->count; i++) {
+    if (likely(i + 1 < slice->count))
+      prefetch(&slice->ids[i + 1]);
+    if (slice->atomic)
+      bitcache_filter_set_atomic(slice->filter, &slice->ids[i]);
+    else
+      bitcache_filter_set(slice->filter, &slice->ids[i]);
+  }
+  __atomic_fetch_add(&slice->filter->count, slice->count, __ATOMIC_RELAXED);
+  return NULL;
+}
+
+int
+bitcache_filter_build(bitcache_filter_t* filter, const bitcache_id_t* ids, const size_t count, const unsigned int threads) {
+  validate_with_errno_return(filter != NULL && filter->bitmap != NULL);
+  validate_with_errno_return(ids != NULL || count == 0);
+
+  if (unlikely(count == 0))
+    return 0; // nothing to insert
+
+  const size_t n = bitcache_thread_count(threads, count, BITCACHE_FILTER_BUILD_MIN);
+  bitcache_filter_build_t slices[n];
+  for (size_t t = 0; t < n; t++) {
+    slices[t].filter = filter;
+    slices[t].ids = ids + (count * t) / n;
+    slices[t].count = (count * (t + 1)) / n - (count * t) / n;
+    slices[t].atomic = (n > 1);
   }
 
+  bitcache_thread_run(bitcache_filter_build_slice, slices, sizeof(slices[0]), n);
+
   return 0;
 }
 
@@ -107,6 +619,7 @@ bitcache_filter_compare(const bitcache_filter_t* filter1, const bitcache_filter_
   validate_with_errno_return(filter1 != NULL && filter1->bitmap != NULL);
   validate_with_errno_return(filter2 != NULL && filter2->bitmap != NULL);
   validate_with_errno_return(filter1->size == filter2->size);
+  validate_with_errno_return(filter1->layout == filter2->layout && filter1->k == filter2->k);
 
   return bcmp(filter1->bitmap, filter2->bitmap, filter1->size);
 }
@@ -117,56 +630,498 @@ bitcache_filter_merge(bitcache_filter_t* filter0, const bitcache_filter_op_t op,
   validate_with_errno_return(filter1 != NULL && filter1->bitmap != NULL);
   validate_with_errno_return(filter2 != NULL && filter2->bitmap != NULL);
   validate_with_errno_return(filter0->size == filter1->size && filter1->size == filter2->size);
+  validate_with_errno_return(filter0->layout == filter1->layout && filter1->layout == filter2->layout);
+  validate_with_errno_return(filter0->k == filter1->k && filter1->k == filter2->k);
 
-  switch (op) {
-    case BITCACHE_FILTER_NOP:
-      // do nothing
-      break;
-    case BITCACHE_FILTER_OR:
-      for (size_t i = 0; i < filter0->size; i++)
-        filter0->bitmap[i] = filter1->bitmap[i] | filter2->bitmap[i];
-      break;
-    case BITCACHE_FILTER_AND:
-      for (size_t i = 0; i < filter0->size; i++)
-        filter0->bitmap[i] = filter1->bitmap[i] & filter2->bitmap[i];
-      break;
-    case BITCACHE_FILTER_XOR:
-      for (size_t i = 0; i < filter0->size; i++)
-        filter0->bitmap[i] = filter1->bitmap[i] ^ filter2->bitmap[i];
-      break;
-    default:
-      return -(errno = EINVAL); // invalid argument
+  if (unlikely(op == BITCACHE_FILTER_NOP))
+    return 0; // do nothing
+
+  const bitcache_filter_kernel_t kernel = bitcache_filter_kernel(op);
+  if (unlikely(kernel == NULL))
+    return -(errno = EINVAL); // invalid argument
+
+  kernel(filter0->bitmap, filter1->bitmap, filter2->bitmap, filter0->size);
+
+  if (unlikely(filter0->dirty != NULL))
+    bitcache_filter_touch_all(filter0);
+
+  // the count of a union is bounded by the sum of counts, but the count of
+  // an intersection or difference is unknown:
+  filter0->count = (op == BITCACHE_FILTER_OR) ? filter1->count + filter2->count : 0;
+
+  return 0;
+}
+
+// The number of bytes merged from every source before moving on, chosen so
+// that the destination chunk stays in the L1 cache.
+#define BITCACHE_FILTER_CHUNK_SIZE 16384
+
+int
+bitcache_filter_merge_many(bitcache_filter_t* filter0, const bitcache_filter_op_t op, const bitcache_filter_t* const filters[], const size_t count) {
+  validate_with_errno_return(filter0 != NULL && filter0->bitmap != NULL);
+  validate_with_errno_return(filters != NULL && count > 0);
+  for (size_t i = 0; i < count; i++) {
+    validate_with_errno_return(filters[i] != NULL && filters[i]->bitmap != NULL);
+    validate_with_errno_return(filters[i]->size == filter0->size && filters[i]->layout == filter0->layout);
+    validate_with_errno_return(filters[i]->k == filter0->k);
+  }
+
+  if (unlikely(op == BITCACHE_FILTER_NOP))
+    return 0; // do nothing
+
+  const bitcache_filter_kernel_t kernel = bitcache_filter_kernel(op);
+  if (unlikely(kernel == NULL))
+    return -(errno = EINVAL); // invalid argument
+
+  // the destination may be among the sources, as long as its bits are all
+  // read before they're overwritten, so fold its slots in first:
+  size_t first = 0, second = 1, aliases = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (filters[i] != filter0)
+      continue;
+    if (unlikely(aliases == 2))
+      return -(errno = EINVAL); // the destination given more than twice
+    if (aliases++ == 0)
+      first = i;
+    else
+      second = i;
+  }
+  if (aliases == 1)
+    second = (first == 0) ? 1 : 0;
+
+  uint64_t total = 0;
+  for (size_t i = 0; i < count; i++)
+    total += filters[i]->count;
+  filter0->count = (op == BITCACHE_FILTER_OR) ? total : 0;
+
+  if (unlikely(filter0->dirty != NULL))
+    bitcache_filter_touch_all(filter0);
+
+  // fold every source into one destination chunk at a time, rather than
+  // chaining pairwise merges over the whole bitmap through temporaries:
+  for (size_t offset = 0; offset < filter0->size; offset += BITCACHE_FILTER_CHUNK_SIZE) {
+    const size_t remaining = filter0->size - offset;
+    const size_t n = (remaining < BITCACHE_FILTER_CHUNK_SIZE) ? remaining : BITCACHE_FILTER_CHUNK_SIZE;
+    uint8_t* const chunk = filter0->bitmap + offset;
+
+    if (count == 1) {
+      memmove(chunk, filters[0]->bitmap + offset, n);
+      continue;
+    }
+
+    kernel(chunk, filters[first]->bitmap + offset, filters[second]->bitmap + offset, n);
+    for (size_t i = 0; i < count; i++) {
+      if (i != first && i != second)
+        kernel(chunk, chunk, filters[i]->bitmap + offset, n);
+    }
   }
 
   return 0;
 }
 
-static inline NONNULL int
-bitcache_filter_load_from_file(bitcache_filter_t* filter, const int fd, const off_t off) {
-  if (likely(filter->size == 0)) {
-    struct stat sb;
-    if (unlikely(fstat(fd, &sb) == -1)) {
-      return -errno;
+//////////////////////////////////////////////////////////////////////////////
+// Filter statistics
+
+// The number of blocks counted per call to the popcount kernel.
+#define BITCACHE_FILTER_SCAN_BLOCKS 256
+
+typedef struct {
+  uint64_t bits;      // number of bits set
+  double cardinality; // estimated number of distinct identifiers
+  double fp_rate;     // estimated false-positive rate
+} bitcache_filter_scan_t;
+
+// Scans the bitmap of a filter, or the union of two filters' bitmaps, in a
+// single pass.
+//
+// Classic filters use the Swamidass-Baldi estimate `-(m/k) ln(1 - X/m)` of
+// the cardinality over the whole bitmap. Blocked filters apply it to each
+// block and sum the results, since identifiers are spread unevenly between
+// blocks; likewise, their false-positive rate is averaged over the blocks.
+static void
+bitcache_filter_scan(const bitcache_filter_t* filter1, const bitcache_filter_t* filter2, bitcache_filter_scan_t* scan) {
+  const bool blocked = (filter1->layout == BITCACHE_FILTER_BLOCKED);
+  const unsigned int bits_per_block = BITCACHE_FILTER_BLOCK_SIZE * 8;
+
+  // per-block estimates only ever take one of 513 values, so look them up
+  // (a saturated block is counted as one bit short of full):
+  double cardinality_table[BITCACHE_FILTER_BLOCK_SIZE * 8 + 1];
+  double fp_rate_table[BITCACHE_FILTER_BLOCK_SIZE * 8 + 1];
+  if (blocked) {
+    for (unsigned int x = 0; x <= bits_per_block; x++) {
+      const unsigned int y = (x < bits_per_block) ? x : bits_per_block - 1;
+      cardinality_table[x] = -((double)bits_per_block / filter1->k) * log1p(-(double)y / bits_per_block);
+      fp_rate_table[x] = pow((double)x / bits_per_block, filter1->k);
+    }
+  }
+
+  const uint8_t* const src1 = filter1->bitmap;
+  const uint8_t* const src2 = (filter2 != NULL) ? filter2->bitmap : NULL;
+  const size_t blocks = filter1->size / BITCACHE_FILTER_BLOCK_SIZE;
+
+  uint64_t bits = 0;
+  double cardinality = 0, fp_rate = 0;
+  uint16_t counts[BITCACHE_FILTER_SCAN_BLOCKS];
+  for (size_t j = 0; j < blocks; j += BITCACHE_FILTER_SCAN_BLOCKS) {
+    const size_t n = (blocks - j < BITCACHE_FILTER_SCAN_BLOCKS) ? blocks - j : BITCACHE_FILTER_SCAN_BLOCKS;
+    const size_t offset = j * BITCACHE_FILTER_BLOCK_SIZE;
+    bitcache_filter_popcount_kernel(src1 + offset, (src2 != NULL) ? src2 + offset : NULL, n, counts);
+    for (size_t i = 0; i < n; i++) {
+      bits += counts[i];
+      if (blocked) {
+        cardinality += cardinality_table[counts[i]];
+        fp_rate += fp_rate_table[counts[i]];
+      }
+    }
+  }
+
+  // classic bitmaps needn't be a whole number of blocks:
+  for (size_t i = blocks * BITCACHE_FILTER_BLOCK_SIZE; i < filter1->size; i++)
+    bits += __builtin_popcount(src1[i] | ((src2 != NULL) ? src2[i] : 0));
+
+  scan->bits = bits;
+  if (blocked) {
+    scan->cardinality = cardinality;
+    scan->fp_rate = (blocks > 0) ? fp_rate / blocks : 0;
+  }
+  else {
+    const double m = (double)bitcache_filter_bits(filter1);
+    const double x = (bits < m) ? (double)bits : m - 1;
+    scan->cardinality = (m > 0) ? -(m / filter1->k) * log1p(-x / m) : 0;
+    scan->fp_rate = (m > 0) ? pow(bits / m, filter1->k) : 0;
+  }
+}
+
+long
+bitcache_filter_popcount(const bitcache_filter_t* filter) {
+  validate_with_errno_return(filter != NULL && filter->bitmap != NULL);
+
+  bitcache_filter_scan_t scan;
+  bitcache_filter_scan(filter, NULL, &scan);
+  return scan.bits;
+}
+
+long
+bitcache_filter_cardinality(const bitcache_filter_t* filter) {
+  validate_with_errno_return(filter != NULL && filter->bitmap != NULL && filter->k > 0);
+
+  bitcache_filter_scan_t scan;
+  bitcache_filter_scan(filter, NULL, &scan);
+  return lround(scan.cardinality);
+}
+
+int
+bitcache_filter_fp_rate(const bitcache_filter_t* filter, double* fp_rate) {
+  validate_with_errno_return(filter != NULL && filter->bitmap != NULL && fp_rate != NULL);
+
+  bitcache_filter_scan_t scan;
+  bitcache_filter_scan(filter, NULL, &scan);
+  *fp_rate = scan.fp_rate;
+  return 0;
+}
+
+long
+bitcache_filter_union_cardinality(const bitcache_filter_t* filter1, const bitcache_filter_t* filter2) {
+  validate_with_errno_return(filter1 != NULL && filter1->bitmap != NULL && filter1->k > 0);
+  validate_with_errno_return(filter2 != NULL && filter2->bitmap != NULL);
+  validate_with_errno_return(filter1->size == filter2->size);
+  validate_with_errno_return(filter1->layout == filter2->layout && filter1->k == filter2->k);
+
+  bitcache_filter_scan_t scan;
+  bitcache_filter_scan(filter1, filter2, &scan);
+  return lround(scan.cardinality);
+}
+
+long
+bitcache_filter_intersection_cardinality(const bitcache_filter_t* filter1, const bitcache_filter_t* filter2) {
+  validate_with_errno_return(filter1 != NULL && filter1->bitmap != NULL && filter1->k > 0);
+  validate_with_errno_return(filter2 != NULL && filter2->bitmap != NULL);
+  validate_with_errno_return(filter1->size == filter2->size);
+  validate_with_errno_return(filter1->layout == filter2->layout && filter1->k == filter2->k);
+
+  // by inclusion-exclusion, as ANDed bitmaps overestimate the intersection:
+  bitcache_filter_scan_t scan1, scan2, scan12;
+  bitcache_filter_scan(filter1, NULL, &scan1);
+  bitcache_filter_scan(filter2, NULL, &scan2);
+  bitcache_filter_scan(filter1, filter2, &scan12);
+
+  const double cardinality = scan1.cardinality + scan2.cardinality - scan12.cardinality;
+  return (cardinality > 0) ? lround(cardinality) : 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Filter I/O
+
+// Returns `TRUE` if a bitmap of the given size can back a filter of the
+// given layout; blocked filters need a whole number of blocks, as many as
+// a block index can address.
+static inline bool
+bitcache_filter_size_valid(const bitcache_filter_layout_t layout, const uint64_t size) {
+  if (layout == BITCACHE_FILTER_BLOCKED)
+    return size > 0 && size % BITCACHE_FILTER_BLOCK_SIZE == 0 &&
+      size / BITCACHE_FILTER_BLOCK_SIZE < UINT32_MAX;
+  return size > 0;
+}
+
+static inline NONNULL bool
+bitcache_filter_header_magic(const bitcache_filter_header_t* header) {
+  return memcmp(header->magic, BITCACHE_FILTER_MAGIC, sizeof(header->magic)) == 0;
+}
+
+static inline NONNULL bool
+bitcache_filter_header_valid(const bitcache_filter_header_t* header) {
+  return header->version >= 1 && header->version <= BITCACHE_FILTER_VERSION &&
+    ((header->layout == BITCACHE_FILTER_CLASSIC && header->k <= BITCACHE_FILTER_K_MAX) ||
+     (header->layout == BITCACHE_FILTER_BLOCKED && header->k <= BITCACHE_FILTER_BLOCKED_K_MAX)) &&
+    header->k > 0 && bitcache_filter_size_valid(header->layout, header->size);
+}
+
+static inline NONNULL void
+bitcache_filter_header_apply(bitcache_filter_t* filter, const bitcache_filter_header_t* header) {
+  filter->layout = header->layout;
+  filter->k = header->k;
+  filter->size = header->size;
+  filter->count = (header->version >= 2) ? header->count : 0;
+  filter->checksum = header->checksum;
+}
+
+// The number of bytes requested per read() when streaming in a filter.
+#define BITCACHE_FILTER_READ_SIZE (1 << 20)
+
+// Copies the bitmap of a file at the given offset into a heap bitmap,
+// verifying the checksum along the way.
+static NONNULL long
+bitcache_filter_load_into_heap(bitcache_filter_t* filter, const int fd, const off_t off) {
+  filter->bitmap = filter->dirty = NULL;
+  filter->mapping = NULL, filter->mapping_size = 0;
+
+  long rc = bitcache_filter_alloc(filter, filter->size);
+  if (unlikely(rc < 0))
+    return rc; // cannot allocate memory
+
+  uint32_t checksum = 0;
+  for (size_t offset = 0; offset < filter->size; ) {
+    const size_t chunk = (filter->size - offset < BITCACHE_FILTER_READ_SIZE) ? filter->size - offset : BITCACHE_FILTER_READ_SIZE;
+    const ssize_t bytes_read = pread(fd, filter->bitmap + offset, chunk, off + offset);
+    if (unlikely(bytes_read == -1)) {
+      if (errno == EINTR || errno == EAGAIN)
+        continue; // retry the pread()
+      rc = -errno;
+      goto failure;
     }
+    if (unlikely(bytes_read == 0)) {
+      rc = -(errno = EINVAL); // truncated file
+      goto failure;
+    }
+    checksum = bitcache_crc32c(checksum, filter->bitmap + offset, bytes_read);
+    offset += bytes_read;
+  }
+  if (unlikely(filter->checksum != 0 && filter->checksum != checksum)) {
+    rc = -(errno = EBADMSG); // checksum mismatch
+    goto failure;
+  }
+  filter->checksum = 0; // verified already, and the bitmap is free to change
+  return filter->size;
+
+failure:
+  bitcache_filter_free(filter);
+  return rc;
+}
+
+static inline NONNULL long
+bitcache_filter_load_from_file(bitcache_filter_t* filter, const int fd, const off_t off) {
+  struct stat sb;
+  if (unlikely(fstat(fd, &sb) == -1)) {
+    return -errno;
+  }
+
+  // check whether the file starts with a header, or is a raw bitmap:
+  size_t header_size = 0;
+  bitcache_filter_header_t header;
+  if (sb.st_size - off >= (off_t)sizeof(header) &&
+      pread(fd, &header, sizeof(header), off) == sizeof(header) &&
+      bitcache_filter_header_magic(&header)) {
+    if (unlikely(!bitcache_filter_header_valid(&header)))
+      return -(errno = EINVAL); // malformed header
+    if (unlikely(header.size > (uint64_t)(sb.st_size - off) - sizeof(header)))
+      return -(errno = EINVAL); // truncated file
+    header_size = sizeof(header);
+    bitcache_filter_header_apply(filter, &header);
+  }
+  else if (likely(filter->size == 0)) {
     filter->size = sb.st_size - off;
   }
 
-  void* base = mmap(NULL, filter->size, PROT_READ, MAP_SHARED, fd, off);
+  if (unlikely(!bitcache_filter_size_valid(filter->layout, filter->size)))
+    return -(errno = EINVAL); // no whole number of blocks
+
+  if (filter->k == 0)
+    filter->k = BITCACHE_FILTER_K_DEFAULT;
+
+  const bool writable = (filter->options & BITCACHE_FILTER_WRITABLE) != 0;
+  if (unlikely(writable && header_size == 0))
+    return -(errno = EINVAL); // the header is needed to record the count
+
+  // huge pages only back anonymous and tmpfs mappings, so a read-only load
+  // asking for them copies the bitmap into an advised heap bitmap instead:
+  if ((filter->options & BITCACHE_FILTER_HUGEPAGES) && !writable &&
+      filter->size >= BITCACHE_FILTER_HUGEPAGE_SIZE)
+    return bitcache_filter_load_into_heap(filter, fd, off + header_size);
+
+  // mmap() requires a page-aligned file offset:
+  const off_t page_off = off & ~((off_t)getpagesize() - 1);
+  const size_t mapping_size = (off - page_off) + header_size + filter->size;
+
+  int flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+  if (filter->options & BITCACHE_FILTER_POPULATE)
+    flags |= MAP_POPULATE; // prefault the page tables now, not on first probe
+#endif
+
+  void* base = mmap(NULL, mapping_size, writable ? PROT_READ | PROT_WRITE : PROT_READ, flags, fd, page_off);
   if (unlikely(base == MAP_FAILED)) {
     return -errno;
   }
 
-  filter->bitmap = base;
+#ifdef MADV_HUGEPAGE
+  if (filter->options & BITCACHE_FILTER_HUGEPAGES)
+    madvise(base, mapping_size, MADV_HUGEPAGE); // best effort, on tmpfs only
+#endif
+
+  filter->mapping = base;
+  filter->mapping_size = mapping_size;
+  filter->dirty = NULL;
+  filter->bitmap = (uint8_t*)base + (off - page_off) + header_size;
+
+  if (filter->options & BITCACHE_FILTER_VERIFY) {
+    const int rc = bitcache_filter_verify(filter);
+    if (unlikely(rc < 0)) {
+      bitcache_filter_free(filter);
+      return rc;
+    }
+  }
+
+  if (writable) {
+    bitcache_filter_page_shift = __builtin_ctz(getpagesize());
+    const size_t pages = (mapping_size >> bitcache_filter_page_shift) + 1;
+    if (unlikely((filter->dirty = calloc((pages + 7) / 8, 1)) == NULL)) {
+      bitcache_filter_free(filter);
+      return -(errno = ENOMEM); // cannot allocate memory
+    }
+
+    // the checksum won't survive the first insert, so drop it right away
+    // rather than risk leaving a stale one behind after a crash:
+    bitcache_filter_header_t* const header =
+      (bitcache_filter_header_t*)(filter->bitmap - sizeof(bitcache_filter_header_t));
+    header->checksum = filter->checksum = 0;
+    bitcache_filter_touch(filter, header);
+  }
+
   return filter->size;
 }
 
-static inline NONNULL int
+// Streams exactly `size` bytes into `bitmap`, updating a running checksum.
+static NONNULL long
+bitcache_filter_read(const int fd, uint8_t* bitmap, const size_t size, uint32_t* checksum) {
+  for (size_t offset = 0; offset < size; ) {
+    const size_t chunk = (size - offset < BITCACHE_FILTER_READ_SIZE) ? size - offset : BITCACHE_FILTER_READ_SIZE;
+    const ssize_t bytes_read = bitcache_read(fd, bitmap + offset, chunk);
+    if (unlikely(bytes_read < 0))
+      return bytes_read;
+    if (unlikely(bytes_read == 0))
+      return -(errno = EINVAL); // truncated stream
+    *checksum = bitcache_crc32c(*checksum, bitmap + offset, bytes_read);
+    offset += bytes_read;
+  }
+  return size;
+}
+
+static inline NONNULL long
 bitcache_filter_load_from_pipe(bitcache_filter_t* filter, const int fd) {
-  (void)filter, (void)fd; // silence unused parameter warnings
-  return -(errno = ENOTSUP); // not supported
+  // a stream can't be rewound, so read what may be a header and then
+  // treat those bytes as the start of the bitmap if it isn't one:
+  bitcache_filter_header_t header;
+  const ssize_t header_read = bitcache_read(fd, &header, sizeof(header));
+  if (unlikely(header_read < 0))
+    return header_read;
+
+  uint32_t checksum = 0;
+  long rc = 0;
+
+  filter->bitmap = filter->dirty = NULL;
+  filter->mapping = NULL, filter->mapping_size = 0;
+
+  if (header_read == sizeof(header) && bitcache_filter_header_magic(&header)) {
+    if (unlikely(!bitcache_filter_header_valid(&header)))
+      return -(errno = EINVAL); // malformed header
+    // the header tells us exactly how large a buffer to allocate:
+    if (unlikely((rc = bitcache_filter_alloc(filter, header.size)) < 0))
+      return rc; // cannot allocate memory
+    if (unlikely((rc = bitcache_filter_read(fd, filter->bitmap, header.size, &checksum)) < 0))
+      goto failure;
+    if (unlikely(header.checksum != 0 && header.checksum != checksum)) {
+      rc = -(errno = EBADMSG); // checksum mismatch
+      goto failure;
+    }
+    bitcache_filter_header_apply(filter, &header);
+    filter->checksum = 0; // verified already, and the bitmap is free to change
+  }
+  else if (filter->size > 0) {
+    // a raw bitmap of known size:
+    if (unlikely(filter->size < (size_t)header_read))
+      return -(errno = EINVAL); // the stream is larger than expected
+    if (unlikely((rc = bitcache_filter_alloc(filter, filter->size)) < 0))
+      return rc; // cannot allocate memory
+    memcpy(filter->bitmap, &header, header_read);
+    if (unlikely((rc = bitcache_filter_read(fd, filter->bitmap + header_read, filter->size - header_read, &checksum)) < 0))
+      goto failure;
+  }
+  else {
+    // a raw bitmap of unknown size, read until the end of the stream:
+    size_t capacity = BITCACHE_FILTER_READ_SIZE, size = header_read;
+    if (unlikely((rc = bitcache_filter_alloc(filter, capacity)) < 0))
+      return rc; // cannot allocate memory
+    memcpy(filter->bitmap, &header, header_read);
+    for (ssize_t bytes_read = header_read; bytes_read > 0; size += bytes_read) {
+      if (size == capacity) {
+        bitcache_filter_t larger;
+        bzero(&larger, sizeof(larger));
+        if (unlikely((rc = bitcache_filter_alloc(&larger, capacity * 2)) < 0))
+          goto failure; // cannot allocate memory
+        memcpy(larger.bitmap, filter->bitmap, size);
+        bitcache_filter_free(filter);
+        filter->bitmap = larger.bitmap;
+        filter->mapping = larger.mapping, filter->mapping_size = larger.mapping_size;
+        capacity *= 2;
+      }
+      const size_t chunk = (capacity - size < BITCACHE_FILTER_READ_SIZE) ? capacity - size : BITCACHE_FILTER_READ_SIZE;
+      if (unlikely((bytes_read = bitcache_read(fd, filter->bitmap + size, chunk)) < 0)) {
+        rc = bytes_read;
+        goto failure;
+      }
+    }
+    if (unlikely(size == 0)) {
+      rc = -(errno = EINVAL); // empty stream
+      goto failure;
+    }
+    filter->size = size;
+  }
+
+  if (unlikely(!bitcache_filter_size_valid(filter->layout, filter->size))) {
+    rc = -(errno = EINVAL); // no whole number of blocks
+    goto failure;
+  }
+
+  if (filter->k == 0)
+    filter->k = BITCACHE_FILTER_K_DEFAULT;
+  return filter->size;
+
+failure:
+  bitcache_filter_free(filter);
+  return rc;
 }
 
-int COLD
+long COLD
 bitcache_filter_load(bitcache_filter_t* filter, const int fd) {
   validate_with_errno_return(filter != NULL && fd >= 0);
 
@@ -186,28 +1141,80 @@ bitcache_filter_load(bitcache_filter_t* filter, const int fd) {
 }
 
 int COLD
-bitcache_filter_dump(const bitcache_filter_t* filter, const int fd) {
-  validate_with_errno_return(filter != NULL);
-  validate_with_errno_return(filter != NULL && filter->bitmap != NULL && fd >= 0);
+bitcache_filter_verify(const bitcache_filter_t* filter) {
+  validate_with_errno_return(filter != NULL && filter->bitmap != NULL);
 
-  uint8_t* buffer = filter->bitmap;
-  ssize_t buffer_size = filter->size;
-  ssize_t bytes_written = 0;
-
-  while (bytes_written < buffer_size) {
-    bytes_written = write(fd, buffer, buffer_size);
-    if (unlikely(bytes_written == -1)) {
-      switch (errno) {
-        case EINTR:
-        case EAGAIN:
-          continue; // retry the write()
-        default:
-          return -errno;
-      }
+  if (filter->checksum == 0)
+    return 0; // no checksum was recorded
+
+  if (unlikely(bitcache_crc32c(0, filter->bitmap, filter->size) != filter->checksum))
+    return -(errno = EBADMSG); // checksum mismatch
+
+  return 0;
+}
+
+long COLD
+bitcache_filter_sync(bitcache_filter_t* filter, const bool wait) {
+  validate_with_errno_return(filter != NULL && filter->bitmap != NULL);
+
+  if (filter->dirty == NULL)
+    return 0; // nothing to sync
+
+  bitcache_filter_header_t* const header =
+    (bitcache_filter_header_t*)(filter->bitmap - sizeof(bitcache_filter_header_t));
+  if (header->count != filter->count) {
+    header->count = filter->count;
+    bitcache_filter_touch(filter, header);
+  }
+
+  // flush each run of consecutive dirty pages with a single msync():
+  const size_t pages = (filter->mapping_size >> bitcache_filter_page_shift) + 1;
+  long synced = 0;
+  for (size_t page = 0; page < pages; ) {
+    if ((filter->dirty[page >> 3] & (1 << (page & 7))) == 0) {
+      page += (filter->dirty[page >> 3] == 0) ? 8 - (page & 7) : 1;
+      continue;
     }
-    buffer += bytes_written;
-    buffer_size -= bytes_written;
+
+    size_t end = page;
+    while (end < pages && (filter->dirty[end >> 3] & (1 << (end & 7))) != 0)
+      end++;
+
+    const size_t start = page << bitcache_filter_page_shift;
+    const size_t stop = (end << bitcache_filter_page_shift < filter->mapping_size) ?
+      end << bitcache_filter_page_shift : filter->mapping_size;
+    if (unlikely(msync((uint8_t*)filter->mapping + start, stop - start, wait ? MS_SYNC : MS_ASYNC) == -1))
+      return -errno;
+
+    for (; page < end; page++)
+      filter->dirty[page >> 3] &= ~(1 << (page & 7));
+    synced += stop - start;
   }
 
-  return filter->size;
+  return synced;
+}
+
+long COLD
+bitcache_filter_dump(const bitcache_filter_t* filter, const int fd) {
+  validate_with_errno_return(filter != NULL && filter->bitmap != NULL && fd >= 0);
+
+  bitcache_filter_header_t header;
+  bzero(&header, sizeof(header));
+  memcpy(header.magic, BITCACHE_FILTER_MAGIC, sizeof(header.magic));
+  header.version  = BITCACHE_FILTER_VERSION;
+  header.layout   = filter->layout;
+  header.k        = filter->k;
+  header.size     = filter->size;
+  header.count    = filter->count;
+  header.checksum = bitcache_crc32c(0, filter->bitmap, filter->size);
+
+  int rc = bitcache_write(fd, &header, sizeof(header));
+  if (unlikely(rc < 0))
+    return rc;
+
+  rc = bitcache_write(fd, filter->bitmap, filter->size);
+  if (unlikely(rc < 0))
+    return rc;
+
+  return sizeof(header) + filter->size;
 }
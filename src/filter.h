@@ -12,19 +12,90 @@ extern "C" {
 #include <stdint.h>  /* for uint8_t, uint32_t */
 
 /**
- * Defines the number of hashes used in a Bitcache filter.
+ * Defines the default number of hashes used in a Bitcache filter.
  */
-#define BITCACHE_FILTER_K_MAX \
+#define BITCACHE_FILTER_K_DEFAULT \
   (sizeof(bitcache_id_t) / sizeof(uint32_t)) /* k=5 for SHA-1 */
 
+/**
+ * Defines the maximum number of hashes used in a classic Bitcache filter.
+ */
+#define BITCACHE_FILTER_K_MAX 32
+
+/**
+ * Defines the maximum number of hashes used in a blocked Bitcache filter.
+ */
+#define BITCACHE_FILTER_BLOCKED_K_MAX 14
+
+/**
+ * Defines the block size (in bytes) used by the blocked filter layout.
+ */
+#define BITCACHE_FILTER_BLOCK_SIZE 64 /* one cache line */
+
+/**
+ * Defines the magic bytes at the start of a dumped filter header.
+ */
+#define BITCACHE_FILTER_MAGIC "BCFILTER"
+
+/**
+ * Defines the current version of the dumped filter header format.
+ */
+#define BITCACHE_FILTER_VERSION 2
+
+/**
+ * Represents a Bitcache filter's bitmap layout.
+ */
+typedef enum {
+  BITCACHE_FILTER_CLASSIC = 0, /* k bits spread across the whole bitmap */
+  BITCACHE_FILTER_BLOCKED = 1, /* k bits confined to one 64-byte block */
+} bitcache_filter_layout_t;
+
+/**
+ * Represents options for loading a Bitcache filter.
+ */
+typedef enum {
+  BITCACHE_FILTER_POPULATE  = 1 << 0, /* prefault the whole mapping */
+  BITCACHE_FILTER_HUGEPAGES = 1 << 1, /* back the bitmap with huge pages, if possible */
+  BITCACHE_FILTER_VERIFY    = 1 << 2, /* verify the checksum while loading */
+  BITCACHE_FILTER_WRITABLE  = 1 << 3, /* map the file read-write, for inserts */
+} bitcache_filter_option_t;
+
 /**
  * Represents a Bitcache filter.
  */
 typedef struct {
   size_t size;
   uint8_t* bitmap;
+  bitcache_filter_layout_t layout;
+  unsigned int k;      /* number of hashes */
+  unsigned int options;
+  uint32_t checksum;   /* CRC-32C recorded in the loaded header, if any */
+  uint64_t count;      /* number of insertions */
+  void* mapping;       /* the mmap() region backing the bitmap, if any */
+  size_t mapping_size;
+  uint8_t* dirty;      /* one bit per page of a writable mapping */
 } bitcache_filter_t;
 
+/**
+ * Represents the header preceding the bitmap of a dumped filter.
+ *
+ * Raw bitmaps without a header, as dumped by earlier versions for the
+ * classic layout, are still loaded. The header is padded to one block so
+ * that an mmap()ed bitmap remains block-aligned. Fields are stored in host
+ * byte order. A checksum of zero means that none was recorded; version 1
+ * headers did not record the count.
+ */
+typedef struct {
+  char     magic[8];   /* BITCACHE_FILTER_MAGIC */
+  uint32_t version;    /* BITCACHE_FILTER_VERSION */
+  uint32_t layout;     /* bitcache_filter_layout_t */
+  uint32_t k;          /* number of hashes */
+  uint32_t checksum;   /* CRC-32C of the bitmap */
+  uint64_t size;       /* bitmap size (in bytes) */
+  uint64_t count;      /* number of insertions */
+  uint8_t  reserved[24];
+} bitcache_filter_header_t;
+
 /**
  * Represents a Bitcache filter operation.
  */
@@ -36,10 +107,27 @@ typedef enum {
 } bitcache_filter_op_t;
 
 /**
- * Initializes a filter using a given bitmap size (in bytes).
+ * Computes the bitmap size (in bytes) and number of hashes that a filter
+ * with a given layout needs to hold a given number of identifiers at a
+ * given false-positive rate.
+ */
+extern int bitcache_filter_sizing(const uint64_t count,
+  const double fp_rate,
+  const bitcache_filter_layout_t layout,
+  size_t* size,
+  unsigned int* k);
+
+/**
+ * Initializes a filter using a given bitmap size (in bytes), layout, and
+ * number of hashes (zero selecting `BITCACHE_FILTER_K_DEFAULT`).
+ *
+ * For the blocked layout, the size is rounded up to a whole number of
+ * blocks.
  */
 extern int bitcache_filter_init(bitcache_filter_t* filter,
-  const size_t size);
+  const size_t size,
+  const bitcache_filter_layout_t layout,
+  const unsigned int k);
 
 /**
  * Resets a filter back to an uninitialized state.
@@ -68,12 +156,45 @@ extern long bitcache_filter_count(const bitcache_filter_t* filter,
 extern bool bitcache_filter_lookup(const bitcache_filter_t* filter,
   const bitcache_id_t* id);
 
+/**
+ * Checks whether a filter recognizes each of an array of identifiers.
+ *
+ * Sets bit `i` of `results` (which must hold at least `(count + 7) / 8`
+ * bytes) if the filter recognizes `ids[i]`, and clears it otherwise.
+ * Returns the number of identifiers recognized.
+ */
+extern long bitcache_filter_lookup_many(const bitcache_filter_t* filter,
+  const bitcache_id_t* ids,
+  const size_t count,
+  uint8_t* results);
+
 /**
  * Inserts a given identifier into a filter.
  */
 extern int bitcache_filter_insert(bitcache_filter_t* filter,
   const bitcache_id_t* id);
 
+/**
+ * Inserts a given identifier into a filter that other threads may be
+ * inserting into, or looking up in, at the same time.
+ *
+ * Plain inserts must not run concurrently with atomic ones.
+ */
+extern int bitcache_filter_insert_atomic(bitcache_filter_t* filter,
+  const bitcache_id_t* id);
+
+/**
+ * Inserts an array of identifiers into a filter, spreading the work across
+ * a given number of threads (zero selecting one per online CPU).
+ *
+ * Small arrays use fewer threads than requested; when built with
+ * `--disable-threads`, the calling thread does all the work.
+ */
+extern int bitcache_filter_build(bitcache_filter_t* filter,
+  const bitcache_id_t* ids,
+  const size_t count,
+  const unsigned int threads);
+
 /**
  * Compares two filters for equality.
  */
@@ -88,16 +209,100 @@ extern int bitcache_filter_merge(bitcache_filter_t* filter0,
   const bitcache_filter_t* filter1,
   const bitcache_filter_t* filter2);
 
+/**
+ * Merges any number of filters into a given filter using a specific
+ * operation, reading each source filter only once. The given filter may
+ * itself be one of the sources, but no more than twice.
+ */
+extern int bitcache_filter_merge_many(bitcache_filter_t* filter0,
+  const bitcache_filter_op_t op,
+  const bitcache_filter_t* const filters[],
+  const size_t count);
+
+/**
+ * Returns the number of bits set in the bitmap of a filter.
+ */
+extern long bitcache_filter_popcount(const bitcache_filter_t* filter);
+
+/**
+ * Estimates the number of distinct identifiers inserted into a filter from
+ * the number of bits set in its bitmap.
+ */
+extern long bitcache_filter_cardinality(const bitcache_filter_t* filter);
+
+/**
+ * Estimates the current false-positive rate of a filter from the number of
+ * bits set in its bitmap.
+ */
+extern int bitcache_filter_fp_rate(const bitcache_filter_t* filter,
+  double* fp_rate);
+
+/**
+ * Estimates the number of distinct identifiers in the union of two
+ * compatible filters, without materializing the merged bitmap.
+ */
+extern long bitcache_filter_union_cardinality(const bitcache_filter_t* filter1,
+  const bitcache_filter_t* filter2);
+
+/**
+ * Estimates the number of distinct identifiers in the intersection of two
+ * compatible filters, without materializing the merged bitmap.
+ */
+extern long bitcache_filter_intersection_cardinality(const bitcache_filter_t* filter1,
+  const bitcache_filter_t* filter2);
+
 /**
  * Reads in a filter from a file descriptor.
+ *
+ * If the file starts with a filter header, the header determines the
+ * layout, number of hashes, and bitmap size; otherwise the file is treated
+ * as a raw bitmap using the layout, number of hashes, and size (each if
+ * non-zero) preset in `filter`.
+ *
+ * Files are mmap()ed read-only, honoring the `BITCACHE_FILTER_POPULATE`
+ * and `BITCACHE_FILTER_VERIFY` options preset in `filter`; without the
+ * latter, the checksum is only verified once `bitcache_filter_verify()` is
+ * called. As huge pages can't back mappings of regular files, bitmaps of
+ * 2 MiB or more loaded with the `BITCACHE_FILTER_HUGEPAGES` option are
+ * instead copied into a heap bitmap advised to use them, verifying the
+ * checksum along the way, after which none is kept. Pipes, sockets and FIFOs are read
+ * in large chunks into a heap bitmap, always verifying the checksum along
+ * the way, after which none is kept; a raw bitmap of unknown size is read
+ * until the end of the stream.
+ *
+ * With the `BITCACHE_FILTER_WRITABLE` option, a file (which must have been
+ * opened read-write, and must start with a filter header) is instead
+ * mapped shared and read-write, so that inserts, clears and merges go
+ * straight to the file. Pages written to are tracked until the next call
+ * to `bitcache_filter_sync()`; the recorded checksum is cleared, as it
+ * would no longer match. The `BITCACHE_FILTER_HUGEPAGES` option then only
+ * has an effect on tmpfs.
  */
-extern int bitcache_filter_load(bitcache_filter_t* filter,
+extern long bitcache_filter_load(bitcache_filter_t* filter,
   const int fd);
 
+/**
+ * Verifies the bitmap of a loaded filter against the checksum recorded in
+ * its header, failing with `EBADMSG` on a mismatch.
+ */
+extern int bitcache_filter_verify(const bitcache_filter_t* filter);
+
+/**
+ * Flushes the pages of a writable filter modified since the last sync back
+ * to its file, along with an updated header. Returns the number of bytes
+ * flushed.
+ *
+ * If `wait` is false, the writeback is only scheduled, which is cheap
+ * enough to do periodically; otherwise, this blocks until it completes.
+ * Filters that are not writable have nothing to sync.
+ */
+extern long bitcache_filter_sync(bitcache_filter_t* filter,
+  const bool wait);
+
 /**
  * Writes out a filter to a file descriptor.
  */
-extern int bitcache_filter_dump(const bitcache_filter_t* filter,
+extern long bitcache_filter_dump(const bitcache_filter_t* filter,
   const int fd);
 
 #ifdef __cplusplus
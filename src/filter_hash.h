@@ -0,0 +1,83 @@
+/* This is free and unencumbered software released into the public domain. */
+
+#ifndef _BITCACHE_FILTER_HASH_H
+#define _BITCACHE_FILTER_HASH_H
+
+#include <stdbool.h> /* for bool */
+#include <stdint.h>  /* for uint32_t, uint64_t */
+
+//////////////////////////////////////////////////////////////////////////////
+// Filter hashing (shared by every filter that uses the Bloom bit mapping)
+
+// The number of bits (or counters) per block in the blocked layout.
+#define BITCACHE_FILTER_BLOCK_BITS (BITCACHE_FILTER_BLOCK_SIZE * 8)
+
+__extension__ typedef unsigned __int128 bitcache_filter_uint128_t;
+
+static inline uint32_t
+bitcache_filter_word(const bitcache_id_t* id, const size_t k) {
+  return ((const uint32_t*)id)[k];
+}
+
+static inline uint64_t
+bitcache_filter_dword(const bitcache_id_t* id, const size_t k) {
+  return bitcache_filter_word(id, k) | ((uint64_t)bitcache_filter_word(id, k + 1) << 32);
+}
+
+// Maps a hash uniformly onto [0, n) without a division.
+// @see http://lemire.me/blog/2016/06/27/a-fast-alternative-to-the-modulo-reduction/
+static inline uint32_t
+bitcache_filter_range(const uint32_t hash, const uint32_t n) {
+  return (uint32_t)(((uint64_t)hash * n) >> 32);
+}
+
+static inline uint64_t
+bitcache_filter_range64(const uint64_t hash, const uint64_t n) {
+  return (uint64_t)(((bitcache_filter_uint128_t)hash * n) >> 64);
+}
+
+// Computes `hash % d` using a precomputed `m = UINT64_MAX / d + 1`.
+// @see http://arxiv.org/abs/1902.01961
+static inline uint32_t
+bitcache_filter_fastmod(const uint32_t hash, const uint64_t m, const uint32_t d) {
+  return (uint32_t)(((bitcache_filter_uint128_t)(m * hash) * d) >> 64);
+}
+
+// Classic filters of up to 2^32 bits using at most one hash per digest word
+// keep the original mapping of `word[k] % m`, so that existing bitmaps
+// remain valid; anything larger uses Kirsch-Mitzenmacher double hashing.
+static inline bool
+bitcache_filter_legacy(const uint64_t m, const unsigned int k) {
+  return m <= UINT32_MAX && k <= BITCACHE_FILTER_K_DEFAULT;
+}
+
+// In the blocked layout, the first word of the digest selects the block
+// and the remaining 128 bits supply up to 14 offsets of 9 bits into it.
+static inline uint32_t
+bitcache_filter_block_index(const bitcache_id_t* id, const uint64_t blocks) {
+  return bitcache_filter_range(bitcache_filter_word(id, 0), blocks);
+}
+
+static inline uint32_t
+bitcache_filter_block_offset(const bitcache_id_t* id, const size_t i) {
+  return (i < 7) ?
+    (bitcache_filter_dword(id, 1) >> (9 * i)) & (BITCACHE_FILTER_BLOCK_BITS - 1) :
+    (bitcache_filter_dword(id, 3) >> (9 * (i - 7))) & (BITCACHE_FILTER_BLOCK_BITS - 1);
+}
+
+// Returns the index of the i-th of k bits of an identifier in a filter of m bits.
+static inline uint64_t
+bitcache_filter_probe(const bitcache_id_t* id, const uint64_t m, const unsigned int k,
+                      const bitcache_filter_layout_t layout, const size_t i) {
+  if (layout == BITCACHE_FILTER_BLOCKED) {
+    const uint64_t block = bitcache_filter_block_index(id, m / BITCACHE_FILTER_BLOCK_BITS);
+    return block * BITCACHE_FILTER_BLOCK_BITS + bitcache_filter_block_offset(id, i);
+  }
+  if (bitcache_filter_legacy(m, k))
+    return bitcache_filter_word(id, i) % (uint32_t)m;
+  const uint64_t h1 = bitcache_filter_dword(id, 0);
+  const uint64_t h2 = bitcache_filter_dword(id, 2) | 1;
+  return bitcache_filter_range64(h1 + i * h2, m);
+}
+
+#endif /* _BITCACHE_FILTER_HASH_H */
@@ -1,8 +1,10 @@
 /* This is free and unencumbered software released into the public domain. */
 
 #include "build.h"
+#include "thread.h"
 #include <assert.h>
 #include <errno.h>
+#include <stdlib.h>
 #include <string.h>
 #include <strings.h>
 
@@ -145,3 +147,189 @@ bitcache_id_hash(const bitcache_id_t* id) {
 
   return id->digest.hash; // the first 4 bytes of the identifier digest
 }
+
+//////////////////////////////////////////////////////////////////////////////
+// Identifier Array API
+//
+// Identifiers are sorted by an MSD radix sort on their digest bytes, which
+// are uniformly distributed, so that each pass splits its input evenly
+// 256 ways and a few passes leave buckets small enough to finish off by
+// insertion sort. Each pass scatters from one buffer into the other, and
+// back again a byte later. The first pass is shared between the threads,
+// which each then sort a run of whole buckets.
+
+// Buckets no larger than this are insertion sorted.
+#define BITCACHE_ID_SORT_INSERTION 32
+
+// The fewest identifiers worth handing to a thread of their own.
+#define BITCACHE_ID_SORT_PARALLEL_MIN 65536
+
+static inline int
+bitcache_id_sort_compare(const bitcache_id_t* id1, const bitcache_id_t* id2, const size_t depth) {
+  return memcmp(id1->digest.data + depth, id2->digest.data + depth, sizeof(bitcache_id_t) - depth);
+}
+
+static int
+bitcache_id_sort_compare_q(const void* id1, const void* id2) {
+  return memcmp(id1, id2, sizeof(bitcache_id_t));
+}
+
+// Sorts identifiers that agree on their first `depth` bytes. They start
+// out in `a`, with `b` as scratch space of the same size, and end up in `a`
+// or, if `into_b` is set, in `b`.
+static void
+bitcache_id_sort_msd(bitcache_id_t* a, bitcache_id_t* b, const size_t count, const size_t depth, const bool into_b) {
+  if (count <= BITCACHE_ID_SORT_INSERTION || depth == sizeof(bitcache_id_t)) {
+    for (size_t i = 1; i < count; i++) {
+      bitcache_id_t id = a[i];
+      size_t j = i;
+      for (; j > 0 && bitcache_id_sort_compare(&a[j - 1], &id, depth) > 0; j--)
+        a[j] = a[j - 1];
+      a[j] = id;
+    }
+    if (into_b && count > 0)
+      memcpy(b, a, count * sizeof(bitcache_id_t));
+    return;
+  }
+
+  size_t offsets[257] = {0};
+  for (size_t i = 0; i < count; i++)
+    offsets[a[i].digest.data[depth] + 1]++;
+  for (size_t k = 1; k <= 256; k++)
+    offsets[k] += offsets[k - 1];
+
+  // should they all share this byte, there is nothing to scatter:
+  const uint8_t byte = a[0].digest.data[depth];
+  if (offsets[byte + 1] - offsets[byte] == count) {
+    bitcache_id_sort_msd(a, b, count, depth + 1, into_b);
+    return;
+  }
+
+  size_t cursors[256];
+  memcpy(cursors, offsets, sizeof(cursors));
+  for (size_t i = 0; i < count; i++)
+    b[cursors[a[i].digest.data[depth]]++] = a[i];
+
+  for (size_t k = 0; k < 256; k++) {
+    const size_t lo = offsets[k], size = offsets[k + 1] - offsets[k];
+    if (size > 0)
+      bitcache_id_sort_msd(b + lo, a + lo, size, depth + 1, !into_b);
+  }
+}
+
+// Represents one thread's share of a sort: a slice of the input, for the
+// first pass, then a run of first-byte buckets.
+typedef struct {
+  bitcache_id_t* ids;       // the input, and eventually the output
+  bitcache_id_t* scratch;
+  size_t lo, hi;            // this thread's slice of the input
+  size_t counts[256];       // the slice's first bytes, then where they go
+  const size_t* offsets;    // where each bucket starts
+  size_t first, last;       // this thread's buckets
+} bitcache_id_sort_t;
+
+static void*
+bitcache_id_sort_count(void* arg) {
+  bitcache_id_sort_t* const job = arg;
+  for (size_t i = job->lo; i < job->hi; i++)
+    job->counts[job->ids[i].digest.data[0]]++;
+  return NULL;
+}
+
+static void*
+bitcache_id_sort_scatter(void* arg) {
+  bitcache_id_sort_t* const job = arg;
+  for (size_t i = job->lo; i < job->hi; i++)
+    job->scratch[job->counts[job->ids[i].digest.data[0]]++] = job->ids[i];
+  return NULL;
+}
+
+static void*
+bitcache_id_sort_buckets(void* arg) {
+  bitcache_id_sort_t* const job = arg;
+  for (size_t k = job->first; k < job->last; k++) {
+    const size_t lo = job->offsets[k], size = job->offsets[k + 1] - job->offsets[k];
+    if (size > 0)
+      bitcache_id_sort_msd(job->scratch + lo, job->ids + lo, size, 1, TRUE);
+  }
+  return NULL;
+}
+
+int
+bitcache_id_sort(bitcache_id_t* ids, const size_t count, const unsigned int threads) {
+  validate_with_errno_return(ids != NULL || count == 0);
+
+  if (count <= BITCACHE_ID_SORT_INSERTION) {
+    bitcache_id_sort_msd(ids, NULL, count, 0, FALSE);
+    return 0;
+  }
+
+  bitcache_id_t* const scratch = malloc(count * sizeof(bitcache_id_t));
+  if (unlikely(scratch == NULL)) {
+    // short of memory, fall back to sorting in place:
+    qsort(ids, count, sizeof(bitcache_id_t), bitcache_id_sort_compare_q);
+    return 0;
+  }
+
+  size_t n = bitcache_thread_count(threads, count, BITCACHE_ID_SORT_PARALLEL_MIN);
+  if (n > 1 && n > count / BITCACHE_ID_SORT_PARALLEL_MIN)
+    n = count / BITCACHE_ID_SORT_PARALLEL_MIN; // only whole shares of the minimum
+  if (n > 256)
+    n = 256; // no more threads than first-byte buckets
+
+  bitcache_id_sort_t* const jobs = calloc(n, sizeof(bitcache_id_sort_t));
+  if (unlikely(jobs == NULL)) {
+    free(scratch);
+    qsort(ids, count, sizeof(bitcache_id_t), bitcache_id_sort_compare_q);
+    return 0;
+  }
+
+  // the first pass: count the first bytes of each slice, then scatter the
+  // slices into the scratch space by first byte:
+  for (size_t t = 0; t < n; t++) {
+    jobs[t].ids = ids, jobs[t].scratch = scratch;
+    jobs[t].lo = (count * t) / n, jobs[t].hi = (count * (t + 1)) / n;
+  }
+  bitcache_thread_run(bitcache_id_sort_count, jobs, sizeof(jobs[0]), n);
+
+  size_t offsets[257];
+  offsets[0] = 0;
+  for (size_t k = 0; k < 256; k++) {
+    offsets[k + 1] = offsets[k];
+    for (size_t t = 0; t < n; t++) {
+      const size_t size = jobs[t].counts[k];
+      jobs[t].counts[k] = offsets[k + 1];
+      offsets[k + 1] += size;
+    }
+  }
+  bitcache_thread_run(bitcache_id_sort_scatter, jobs, sizeof(jobs[0]), n);
+
+  // then hand each thread a run of buckets holding about its share:
+  for (size_t t = 0, k = 0; t < n; t++) {
+    jobs[t].offsets = offsets;
+    jobs[t].first = k;
+    while (k < 256 && (t + 1 == n || offsets[k + 1] <= (count * (t + 1)) / n))
+      k++;
+    jobs[t].last = k;
+  }
+  bitcache_thread_run(bitcache_id_sort_buckets, jobs, sizeof(jobs[0]), n);
+
+  free(jobs);
+  free(scratch);
+  return 0;
+}
+
+long
+bitcache_id_unique(bitcache_id_t* ids, const size_t count) {
+  validate_with_errno_return(ids != NULL || count == 0);
+
+  size_t n = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (n == 0 || memcmp(&ids[n - 1], &ids[i], sizeof(bitcache_id_t)) != 0) {
+      if (n < i)
+        ids[n] = ids[i];
+      n++;
+    }
+  }
+  return n;
+}
@@ -24,6 +24,15 @@ typedef struct bitcache_id_t {
   } digest;
 } bitcache_id_t;
 
+/**
+ * Represents the encodings of the sorted identifier arrays in dumped sets
+ * and maps.
+ */
+typedef enum {
+  BITCACHE_ID_PLAIN = 0, /* 20 bytes per identifier, usable in place */
+  BITCACHE_ID_DELTA = 1, /* leading 8 bytes as Rice-coded deltas, saving a few bytes each */
+} bitcache_id_encoding_t;
+
 /**
  * Allocates heap memory for a new identifier.
  */
@@ -92,6 +101,26 @@ extern int bitcache_id_compare(const bitcache_id_t* id1,
  */
 extern uint32_t bitcache_id_hash(const bitcache_id_t* id);
 
+/**
+ * Sorts an array of identifiers in ascending order, using a given number
+ * of threads (zero selecting one per online CPU).
+ *
+ * This is a radix sort on the digest bytes, which takes scratch space the
+ * size of the array. The threads share the first pass, which partitions
+ * the identifiers by their first byte, and then sort whole partitions of
+ * their own.
+ */
+extern int bitcache_id_sort(bitcache_id_t* ids,
+  const size_t count,
+  const unsigned int threads);
+
+/**
+ * Drops repeated identifiers from a sorted array of identifiers, moving
+ * the distinct ones to the front. Returns their number.
+ */
+extern long bitcache_id_unique(bitcache_id_t* ids,
+  const size_t count);
+
 #ifdef __cplusplus
 }
 #endif
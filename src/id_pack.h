@@ -0,0 +1,284 @@
+/* This is free and unencumbered software released into the public domain. */
+
+#ifndef _BITCACHE_ID_PACK_H
+#define _BITCACHE_ID_PACK_H
+
+#include "crc32c.h"
+#include "io.h"
+#include <errno.h>  /* for errno */
+#include <stdint.h> /* for uint8_t, uint32_t, uint64_t */
+#include <stdlib.h> /* for free(), malloc() */
+#include <string.h> /* for memcmp(), memcpy() */
+
+//////////////////////////////////////////////////////////////////////////////
+// Packed identifier arrays (shared by dumped sets and maps)
+//
+// A packed array holds distinct identifiers in ascending order, either
+// plainly, 20 bytes apiece, or delta-coded. Delta coding keeps the trailing
+// 12 bytes of every identifier as they are, followed by a byte giving a
+// parameter k and then a bit stream of the differences between successive
+// leading 8-byte prefixes, each Rice-coded: the difference shifted right by
+// k bits in unary, then its low k bits. As identifiers are uniformly
+// distributed, choosing k near log2 of the mean difference saves close to
+// log2(n) - 2 bits per identifier, about three bytes each for a billion.
+
+// The size of the buffer that packed arrays are written out through.
+#define BITCACHE_ID_PACK_BUFFER 65536
+
+// The size of the part of an identifier that delta coding leaves alone.
+#define BITCACHE_ID_PACK_SUFFIX (sizeof(bitcache_id_t) - sizeof(uint64_t))
+
+// Returns the leading 8 bytes of an identifier as a big-endian integer.
+static inline uint64_t
+bitcache_id_pack_prefix(const bitcache_id_t* id) {
+  uint64_t prefix;
+  memcpy(&prefix, id->digest.data, sizeof(prefix));
+  return __builtin_bswap64(prefix);
+}
+
+static inline void
+bitcache_id_pack_set_prefix(bitcache_id_t* id, const uint64_t prefix) {
+  const uint64_t data = __builtin_bswap64(prefix);
+  memcpy(id->digest.data, &data, sizeof(data));
+}
+
+// Streams a packed array out to a file descriptor, or nowhere (given -1)
+// while only its size and checksum are wanted.
+typedef struct {
+  int fd;
+  uint32_t crc;
+  uint64_t size;      // number of bytes packed so far
+  uint8_t* buffer;
+  size_t used;
+  uint64_t bits;      // pending bits, least significant first
+  unsigned int nbits;
+} bitcache_id_pack_writer_t;
+
+static int
+bitcache_id_pack_flush(bitcache_id_pack_writer_t* writer) {
+  if (writer->used == 0)
+    return 0;
+  writer->crc = bitcache_crc32c(writer->crc, writer->buffer, writer->used);
+  const int rc = (writer->fd >= 0) ? bitcache_write(writer->fd, writer->buffer, writer->used) : 0;
+  writer->used = 0;
+  return rc;
+}
+
+static int
+bitcache_id_pack_emit(bitcache_id_pack_writer_t* writer, const void* data, const size_t size) {
+  writer->size += size;
+
+  if (size >= BITCACHE_ID_PACK_BUFFER) {
+    // large runs bypass the buffer:
+    const int rc = bitcache_id_pack_flush(writer);
+    if (unlikely(rc < 0))
+      return rc;
+    writer->crc = bitcache_crc32c(writer->crc, data, size);
+    return (writer->fd >= 0) ? bitcache_write(writer->fd, data, size) : 0;
+  }
+
+  if (writer->used + size > BITCACHE_ID_PACK_BUFFER) {
+    const int rc = bitcache_id_pack_flush(writer);
+    if (unlikely(rc < 0))
+      return rc;
+  }
+  memcpy(writer->buffer + writer->used, data, size);
+  writer->used += size;
+  return 0;
+}
+
+// Appends the low `width` (at most 32) bits of a value to the bit stream.
+static inline int
+bitcache_id_pack_put_bits(bitcache_id_pack_writer_t* writer, const uint64_t value, const unsigned int width) {
+  writer->bits |= (value & ((UINT64_C(1) << width) - 1)) << writer->nbits;
+  writer->nbits += width;
+  while (writer->nbits >= 8) {
+    const uint8_t byte = writer->bits & 0xff;
+    const int rc = bitcache_id_pack_emit(writer, &byte, 1);
+    if (unlikely(rc < 0))
+      return rc;
+    writer->bits >>= 8;
+    writer->nbits -= 8;
+  }
+  return 0;
+}
+
+// Returns the Rice parameter for a sorted array of identifiers.
+static unsigned int
+bitcache_id_pack_parameter(const bitcache_id_t* ids, const size_t count) {
+  if (count == 0)
+    return 0;
+  const uint64_t mean = bitcache_id_pack_prefix(&ids[count - 1]) / count;
+  return (mean > 1) ? 63 - __builtin_clzll(mean) : 0;
+}
+
+// Packs a sorted array of distinct identifiers. Returns the packed size
+// (in bytes), or a negative error; `*crc` is extended over the bytes.
+static long
+bitcache_id_pack_write(const int fd, const bitcache_id_t* ids, const size_t count, const bitcache_id_encoding_t encoding, uint32_t* crc) {
+  if (encoding == BITCACHE_ID_PLAIN) {
+    const size_t size = count * sizeof(bitcache_id_t);
+    if (size > 0) {
+      *crc = bitcache_crc32c(*crc, ids, size);
+      const int rc = (fd >= 0) ? bitcache_write(fd, ids, size) : 0;
+      if (unlikely(rc < 0))
+        return rc;
+    }
+    return size;
+  }
+
+  if (unlikely(encoding != BITCACHE_ID_DELTA))
+    return -(errno = EINVAL);
+
+  bitcache_id_pack_writer_t writer = {.fd = fd, .crc = *crc};
+  if (unlikely((writer.buffer = malloc(BITCACHE_ID_PACK_BUFFER)) == NULL))
+    return -errno; // cannot allocate memory
+
+  int rc = 0;
+  for (size_t i = 0; i < count && rc == 0; i++)
+    rc = bitcache_id_pack_emit(&writer, &ids[i].digest.data[sizeof(uint64_t)], BITCACHE_ID_PACK_SUFFIX);
+
+  const unsigned int k = bitcache_id_pack_parameter(ids, count);
+  const uint8_t parameter = k;
+  if (likely(rc == 0))
+    rc = bitcache_id_pack_emit(&writer, &parameter, 1);
+
+  uint64_t previous = 0;
+  for (size_t i = 0; i < count && rc == 0; i++) {
+    const uint64_t prefix = bitcache_id_pack_prefix(&ids[i]);
+    const uint64_t delta = prefix - previous;
+    previous = prefix;
+
+    // the quotient in unary, as that many zero bits and a one bit:
+    uint64_t q = delta >> k;
+    for (; q >= 32 && rc == 0; q -= 32)
+      rc = bitcache_id_pack_put_bits(&writer, 0, 32);
+    if (likely(rc == 0))
+      rc = bitcache_id_pack_put_bits(&writer, UINT64_C(1) << q, q + 1);
+
+    // then the remainder, in at most two pieces:
+    if (k > 32 && rc == 0) {
+      if (likely((rc = bitcache_id_pack_put_bits(&writer, delta, 32)) == 0))
+        rc = bitcache_id_pack_put_bits(&writer, delta >> 32, k - 32);
+    }
+    else if (rc == 0) {
+      rc = bitcache_id_pack_put_bits(&writer, delta, k);
+    }
+  }
+
+  if (writer.nbits > 0 && rc == 0)
+    rc = bitcache_id_pack_put_bits(&writer, 0, 8 - writer.nbits); // pad out the last byte
+  if (likely(rc == 0))
+    rc = bitcache_id_pack_flush(&writer);
+
+  free(writer.buffer);
+
+  if (unlikely(rc < 0))
+    return rc;
+  *crc = writer.crc;
+  return writer.size;
+}
+
+// Reads a packed bit stream back in.
+typedef struct {
+  const uint8_t* p;
+  const uint8_t* end;
+  uint64_t bits;
+  unsigned int nbits;
+} bitcache_id_pack_reader_t;
+
+static inline void
+bitcache_id_pack_refill(bitcache_id_pack_reader_t* reader) {
+  while (reader->nbits <= 56 && reader->p < reader->end) {
+    reader->bits |= (uint64_t)*reader->p++ << reader->nbits;
+    reader->nbits += 8;
+  }
+}
+
+// Takes `width` (at most 32) bits from the bit stream; returns false
+// should it run out.
+static inline bool
+bitcache_id_pack_get_bits(bitcache_id_pack_reader_t* reader, const unsigned int width, uint64_t* value) {
+  bitcache_id_pack_refill(reader);
+  if (unlikely(reader->nbits < width))
+    return false;
+  *value = reader->bits & ((UINT64_C(1) << width) - 1);
+  reader->bits >>= width;
+  reader->nbits -= width;
+  return true;
+}
+
+static inline bool
+bitcache_id_pack_get_unary(bitcache_id_pack_reader_t* reader, uint64_t* value) {
+  uint64_t q = 0;
+  for (;;) {
+    bitcache_id_pack_refill(reader);
+    if (unlikely(reader->nbits == 0))
+      return false;
+    if (reader->bits == 0) {
+      q += reader->nbits;
+      reader->nbits = 0;
+      continue;
+    }
+    const unsigned int zeros = __builtin_ctzll(reader->bits);
+    q += zeros;
+    reader->bits = (zeros < 63) ? reader->bits >> (zeros + 1) : 0;
+    reader->nbits -= zeros + 1;
+    *value = q;
+    return true;
+  }
+}
+
+// Unpacks `count` identifiers from a packed array of `size` bytes, which
+// must hold exactly them, in ascending order. Returns zero, or -EINVAL.
+static int
+bitcache_id_pack_read(const uint8_t* body, const uint64_t size, const bitcache_id_encoding_t encoding, bitcache_id_t* ids, const size_t count) {
+  if (encoding == BITCACHE_ID_PLAIN) {
+    if (unlikely(size != count * sizeof(bitcache_id_t)))
+      return -(errno = EINVAL);
+    if (count > 0)
+      memcpy(ids, body, size);
+  }
+  else if (encoding == BITCACHE_ID_DELTA) {
+    if (unlikely(size < count * BITCACHE_ID_PACK_SUFFIX + 1))
+      return -(errno = EINVAL);
+    for (size_t i = 0; i < count; i++)
+      memcpy(&ids[i].digest.data[sizeof(uint64_t)], body + i * BITCACHE_ID_PACK_SUFFIX, BITCACHE_ID_PACK_SUFFIX);
+
+    const unsigned int k = body[count * BITCACHE_ID_PACK_SUFFIX];
+    if (unlikely(k > 63))
+      return -(errno = EINVAL);
+
+    bitcache_id_pack_reader_t reader = {
+      .p   = body + count * BITCACHE_ID_PACK_SUFFIX + 1,
+      .end = body + size,
+    };
+    uint64_t prefix = 0;
+    for (size_t i = 0; i < count; i++) {
+      uint64_t q, low = 0, high = 0;
+      if (unlikely(!bitcache_id_pack_get_unary(&reader, &q) || q > (UINT64_MAX >> k)))
+        return -(errno = EINVAL);
+      const bool ok = (k > 32) ?
+        bitcache_id_pack_get_bits(&reader, 32, &low) && bitcache_id_pack_get_bits(&reader, k - 32, &high) :
+        bitcache_id_pack_get_bits(&reader, k, &low);
+      const uint64_t delta = (q << k) | (high << 32) | low;
+      if (unlikely(!ok || prefix + delta < prefix))
+        return -(errno = EINVAL);
+      prefix += delta;
+      bitcache_id_pack_set_prefix(&ids[i], prefix);
+    }
+    if (unlikely(reader.p != reader.end || reader.nbits >= 8))
+      return -(errno = EINVAL); // trailing garbage
+  }
+  else {
+    return -(errno = EINVAL);
+  }
+
+  for (size_t i = 1; i < count; i++) {
+    if (unlikely(memcmp(&ids[i - 1], &ids[i], sizeof(bitcache_id_t)) >= 0))
+      return -(errno = EINVAL); // out of order
+  }
+  return 0;
+}
+
+#endif /* _BITCACHE_ID_PACK_H */
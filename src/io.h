@@ -0,0 +1,59 @@
+/* This is free and unencumbered software released into the public domain. */
+
+#ifndef _BITCACHE_IO_H
+#define _BITCACHE_IO_H
+
+#include <errno.h>  /* for errno */
+#include <stdint.h> /* for uint8_t */
+#include <unistd.h> /* for read(), write() */
+
+//////////////////////////////////////////////////////////////////////////////
+// I/O helpers (shared by every structure that can be dumped)
+
+// Writes out an entire buffer, retrying after short or interrupted writes.
+static inline int
+bitcache_write(const int fd, const void* buffer, size_t buffer_size) {
+  const uint8_t* p = buffer;
+  while (buffer_size > 0) {
+    const ssize_t bytes_written = write(fd, p, buffer_size);
+    if (unlikely(bytes_written == -1)) {
+      switch (errno) {
+        case EINTR:
+        case EAGAIN:
+          continue; // retry the write()
+        default:
+          return -errno;
+      }
+    }
+    p += bytes_written;
+    buffer_size -= bytes_written;
+  }
+  return 0;
+}
+
+// Reads into an entire buffer, retrying after short or interrupted reads;
+// returns the number of bytes read, which is less than requested only at
+// the end of the file.
+static inline ssize_t
+bitcache_read(const int fd, void* buffer, size_t buffer_size) {
+  uint8_t* p = buffer;
+  while (buffer_size > 0) {
+    const ssize_t bytes_read = read(fd, p, buffer_size);
+    if (unlikely(bytes_read == -1)) {
+      switch (errno) {
+        case EINTR:
+        case EAGAIN:
+          continue; // retry the read()
+        default:
+          return -errno;
+      }
+    }
+    if (bytes_read == 0)
+      break; // end of file
+    p += bytes_read;
+    buffer_size -= bytes_read;
+  }
+  return p - (uint8_t*)buffer;
+}
+
+#endif /* _BITCACHE_IO_H */
@@ -1,42 +1,579 @@
 /* This is free and unencumbered software released into the public domain. */
 
 #include "build.h"
-#include <assert.h>
+#include "epoch.h"
+#include "id_pack.h"
+#include "map_table.h"
+#include "thread.h"
 #include <errno.h>
 #include <strings.h>
+#include <sys/mman.h> /* for mmap(), munmap() */
+#include <sys/stat.h> /* for fstat() */
+#include <unistd.h>   /* for getpagesize(), lseek(), pread() */
 
 #if 1
-#  define BITCACHE_MAP_LOCK_INIT   MUTEX_INIT
-#  define bitcache_map_crlock(map) rwlock_init(&(map)->lock)
-#  define bitcache_map_rmlock(map) rwlock_dispose(&(map)->lock)
-#  define bitcache_map_rdlock(map) rwlock_rdlock(&(map)->lock)
-#  define bitcache_map_wrlock(map) rwlock_wrlock(&(map)->lock)
-#  define bitcache_map_unlock(map) rwlock_unlock(&(map)->lock)
+#  define BITCACHE_MAP_LOCK_INIT       MUTEX_INIT
+#  define bitcache_map_crlock(shard)   rwlock_init(&(shard)->lock)
+#  define bitcache_map_rmlock(shard)   rwlock_dispose(&(shard)->lock)
+#  define bitcache_map_rdlock(shard)   rwlock_rdlock(&(shard)->lock)
+#  define bitcache_map_wrlock(shard)   rwlock_wrlock(&(shard)->lock)
+#  define bitcache_map_unlock(shard)   rwlock_unlock(&(shard)->lock)
 #else
-#  define BITCACHE_MAP_LOCK_INIT   NULL
-#  define bitcache_map_crlock(map)
-#  define bitcache_map_rmlock(map)
-#  define bitcache_map_rdlock(map)
-#  define bitcache_map_wrlock(map)
-#  define bitcache_map_unlock(map)
+#  define BITCACHE_MAP_LOCK_INIT       NULL
+#  define bitcache_map_crlock(shard)
+#  define bitcache_map_rmlock(shard)
+#  define bitcache_map_rdlock(shard)
+#  define bitcache_map_wrlock(shard)
+#  define bitcache_map_unlock(shard)
 #endif /* HAVE_PTHREAD_H */
 
+// The cache line size that shards are padded to.
+#define BITCACHE_MAP_CACHE_LINE 64
+
+// How many keys ahead batch operations prefetch table groups for.
+#define BITCACHE_MAP_PREFETCH_DISTANCE 8
+
+// The fewest keys worth handing to a thread of their own in a build.
+#define BITCACHE_MAP_BUILD_MIN 65536
+
+// Tracks a shard's arrays as of the moment that snapshots were taken, by
+// way of shadows of the table's arrays and of any it is migrating from.
+// Guarded by the lock of the shard that the arrays were frozen in.
+typedef struct bitcache_map_frozen_t {
+  unsigned long refs; // number of snapshots sharing the arrays
+  bitcache_map_table_shadow_t shadows[2];
+} bitcache_map_frozen_t;
+
+// Eviction bookkeeping is kept in each slot's meta field: a reference
+// count (a single bit for CLOCK, up to 3 for S3-FIFO), and whether the
+// mapping is in S3-FIFO's small queue.
+#define BITCACHE_MAP_META_FREQ  0x3u
+#define BITCACHE_MAP_META_SMALL 0x4u
+
+// Tracks a bounded shard's usage and eviction state. Guarded by the shard
+// lock.
+typedef struct bitcache_map_cache_t {
+  size_t budget;         // in mappings, or in bytes given a size function
+  size_t used;
+  size_t small_used;     // S3-FIFO: how much of that is in the small queue
+  size_t hand;           // CLOCK: the next slot to consider for eviction
+  bitcache_id_t* small;  // S3-FIFO: ring of the keys in the small queue
+  size_t small_head;
+  size_t small_size;
+  size_t small_capacity; // a power of two
+  uint64_t* ghost;       // S3-FIFO: direct-mapped hashes of keys evicted
+  size_t ghost_size;     // from the small queue; a power of two
+} bitcache_map_cache_t;
+
+// A snapshot is a view of each shard's table as of the moment it was taken.
+// It is scanned a chunk at a time, each copied out of the shared arrays or
+// their shadows.
+typedef struct bitcache_map_snapshot_t {
+  size_t shards;
+  size_t begin;        // index of the first slot copied out, or SIZE_MAX
+  size_t end;
+  uint8_t ctrl[BITCACHE_MAP_TABLE_CHUNK];
+  bitcache_map_slot_t slots[BITCACHE_MAP_TABLE_CHUNK];
+  struct {
+    bitcache_map_table_t table;
+    bitcache_map_frozen_t* frozen;
+  } entries[];
+} bitcache_map_snapshot_t;
+
 //////////////////////////////////////////////////////////////////////////////
-// Map API
+// Map helpers
+
+static inline size_t
+bitcache_map_shard_count(const bitcache_map_t* map) {
+  return (size_t)1 << map->shard_bits;
+}
+
+static inline bitcache_map_shard_t*
+bitcache_map_shard_at(const bitcache_map_t* map, const size_t i) {
+  return (bitcache_map_shard_t*)(map->shards + i * map->shard_size);
+}
+
+// Returns the index of the shard for a key, picked by the leading bits of
+// its digest.
+static inline size_t
+bitcache_map_shard_index(const bitcache_map_t* map, const bitcache_id_t* key) {
+  if (map->shard_bits == 0)
+    return 0;
+  const uint8_t* const d = key->digest.data;
+  const uint32_t prefix = ((uint32_t)d[0] << 24) | ((uint32_t)d[1] << 16) | ((uint32_t)d[2] << 8) | d[3];
+  return prefix >> (32 - map->shard_bits);
+}
+
+static inline bitcache_map_shard_t*
+bitcache_map_shard(const bitcache_map_t* map, const bitcache_id_t* key) {
+  return bitcache_map_shard_at(map, bitcache_map_shard_index(map, key));
+}
+
+// Readers in read-mostly mode validate what they read against the shard's
+// sequence number, which writers make odd for the duration of a change.
+static inline uint64_t
+bitcache_map_read_begin(const bitcache_map_shard_t* shard) {
+  uint64_t sequence;
+  while ((sequence = __atomic_load_n(&shard->sequence, __ATOMIC_ACQUIRE)) & 1)
+    ; // a writer is busy with this shard
+  return sequence;
+}
+
+static inline bool
+bitcache_map_read_retry(const bitcache_map_shard_t* shard, const uint64_t sequence) {
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return __atomic_load_n(&shard->sequence, __ATOMIC_RELAXED) != sequence;
+}
+
+static inline void
+bitcache_map_write_begin(bitcache_map_shard_t* shard) {
+  __atomic_store_n(&shard->sequence, shard->sequence + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void
+bitcache_map_write_end(bitcache_map_shard_t* shard) {
+  __atomic_store_n(&shard->sequence, shard->sequence + 1, __ATOMIC_RELEASE);
+}
+
+// Returns a mapping's eviction bookkeeping, which lookups may be updating
+// at the same time.
+static inline uint32_t
+bitcache_map_meta(const bitcache_map_slot_t* slot) {
+  return __atomic_load_n(&slot->meta, __ATOMIC_RELAXED);
+}
+
+// Marks a mapping as referenced. Lookups may race with each other (and, in
+// read-mostly mode, with writers) here, at the worst losing a reference.
+static inline void
+bitcache_map_touch(const bitcache_map_t* map, bitcache_map_slot_t* slot) {
+  if (likely(map->policy == BITCACHE_MAP_EVICT_NONE))
+    return;
+  const uint32_t max = (map->policy == BITCACHE_MAP_EVICT_CLOCK) ? 1 : BITCACHE_MAP_META_FREQ;
+  uint32_t meta = __atomic_load_n(&slot->meta, __ATOMIC_RELAXED);
+  if ((meta & BITCACHE_MAP_META_FREQ) < max)
+    __atomic_compare_exchange_n(&slot->meta, &meta, meta + 1, FALSE, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+// Looks up a key without taking the shard lock, retrying should a writer
+// change the shard meanwhile. Must be called within an epoch section.
+static inline bool
+bitcache_map_lookup_optimistic(const bitcache_map_t* map, const bitcache_map_shard_t* shard, const bitcache_id_t* key, void** value) {
+  for (;;) {
+    const uint64_t sequence = bitcache_map_read_begin(shard);
+    // take a consistent snapshot of the table before probing it, as a
+    // resize swaps out its arrays and capacity:
+    bitcache_map_table_t table;
+    bitcache_map_table_load(&shard->table, &table);
+    if (unlikely(bitcache_map_read_retry(shard, sequence)))
+      continue;
+    bitcache_map_slot_t* const slot = bitcache_map_table_find_shared(&table, key);
+    void* const result = (slot != NULL) ? bitcache_map_table_get_value(slot) : NULL;
+    if (likely(!bitcache_map_read_retry(shard, sequence))) {
+      if (slot != NULL)
+        bitcache_map_touch(map, slot);
+      *value = result;
+      return slot != NULL;
+    }
+  }
+}
+
+// Frees outgrown table memory once no lock-free reader can be probing it.
+static void
+bitcache_map_retire(void* memory) {
+  bitcache_epoch_retire(memory, free);
+}
+
+// Releases a value that was replaced or removed.
+static inline void
+bitcache_map_release(const bitcache_map_t* map, void* value) {
+  if (map->value_destroy_func == NULL)
+    return;
+  if (map->read_mostly)
+    bitcache_epoch_retire(value, map->value_destroy_func);
+  else
+    map->value_destroy_func(value);
+}
+
+// Readies the shadows of any arrays a shard shares with snapshots, before
+// it is modified. Must be called with the shard write-locked.
+static inline int
+bitcache_map_shard_thaw(bitcache_map_shard_t* shard) {
+  bitcache_map_frozen_t* const frozen = shard->frozen;
+  if (likely(frozen == NULL))
+    return 0;
+
+  for (size_t i = 0; i < 2; i++) {
+    if (frozen->shadows[i].ctrl == NULL)
+      continue;
+    const int rc = bitcache_map_table_shadow_alloc(&frozen->shadows[i]);
+    if (unlikely(rc < 0))
+      return rc; // cannot allocate memory
+  }
+
+  shard->frozen = NULL; // the snapshots now read the shadows where needed
+  return 0;
+}
+
+// Orders the keys of a batch by shard, using a counting sort, so that each
+// shard's lock need only be taken once. Returns NULL if the map has but one
+// shard, or if memory is short, in which case the batch is processed in
+// its given order, one lock per run of keys that share a shard.
+static size_t*
+bitcache_map_batch_order(const bitcache_map_t* map, const bitcache_id_t* keys, const size_t count) {
+  if (map->shard_bits == 0 || count < 2)
+    return NULL;
+
+  const size_t shards = bitcache_map_shard_count(map);
+  size_t* const offsets = calloc(shards + 1, sizeof(size_t));
+  size_t* const order = malloc(count * sizeof(size_t));
+  if (unlikely(offsets == NULL || order == NULL)) {
+    free(order), free(offsets);
+    return NULL;
+  }
+
+  for (size_t i = 0; i < count; i++)
+    offsets[bitcache_map_shard_index(map, &keys[i]) + 1]++;
+  for (size_t i = 1; i <= shards; i++)
+    offsets[i] += offsets[i - 1];
+  for (size_t i = 0; i < count; i++)
+    order[offsets[bitcache_map_shard_index(map, &keys[i])]++] = i;
+
+  free(offsets);
+  return order;
+}
+
+static inline size_t
+bitcache_map_batch_index(const size_t* order, const size_t i) {
+  return (order != NULL) ? order[i] : i;
+}
+
+// Returns the end of the run of batch keys, starting at `begin`, that fall
+// into the same shard.
+static inline size_t
+bitcache_map_batch_run(const bitcache_map_t* map, const bitcache_id_t* keys, const size_t* order, const size_t begin, const size_t count) {
+  const size_t shard = bitcache_map_shard_index(map, &keys[bitcache_map_batch_index(order, begin)]);
+  size_t end = begin + 1;
+  while (end < count && bitcache_map_shard_index(map, &keys[bitcache_map_batch_index(order, end)]) == shard)
+    end++;
+  return end;
+}
+
+// Prefetches the table groups for the first keys of a run.
+static inline void
+bitcache_map_batch_prefetch(const bitcache_map_table_t* table, const bitcache_id_t* keys, const size_t* order, const size_t begin, const size_t end) {
+  for (size_t i = begin; i < end && i < begin + BITCACHE_MAP_PREFETCH_DISTANCE; i++)
+    bitcache_map_table_prefetch(table, &keys[bitcache_map_batch_index(order, i)]);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Eviction
+
+static inline size_t
+bitcache_map_value_size(const bitcache_map_t* map, const void* value) {
+  return (map->value_size_func != NULL) ? map->value_size_func(value) : 1;
+}
+
+static inline void
+bitcache_map_cache_free(bitcache_map_cache_t* cache) {
+  if (cache != NULL) {
+    free(cache->ghost);
+    free(cache->small);
+    free(cache);
+  }
+}
+
+// Forgets about the usage of a mapping that is about to be erased.
+static inline void
+bitcache_map_forget(const bitcache_map_t* map, bitcache_map_shard_t* shard, const bitcache_map_slot_t* slot) {
+  bitcache_map_cache_t* const cache = shard->cache;
+  if (likely(cache == NULL))
+    return;
+  const size_t size = bitcache_map_value_size(map, slot->value);
+  cache->used -= (size < cache->used) ? size : cache->used;
+  if (bitcache_map_meta(slot) & BITCACHE_MAP_META_SMALL)
+    cache->small_used -= (size < cache->small_used) ? size : cache->small_used;
+}
 
-gboolean bitcache_id_equal_g(const bitcache_id_t* id1, const bitcache_id_t* id2);
+static void
+bitcache_map_evict_slot(bitcache_map_t* map, bitcache_map_shard_t* shard, bitcache_map_slot_t* slot) {
+  void* const value = slot->value;
+  bitcache_map_forget(map, shard, slot);
+  bitcache_map_table_erase(&shard->table, slot);
+  bitcache_map_release(map, value);
+}
+
+// Checks whether a key was recently evicted from the small queue.
+static inline bool
+bitcache_map_ghost_take(bitcache_map_cache_t* cache, const uint64_t hash) {
+  if (cache->ghost == NULL)
+    return FALSE;
+  uint64_t* const entry = &cache->ghost[(hash >> 32) & (cache->ghost_size - 1)];
+  if (*entry != (hash | 1))
+    return FALSE;
+  *entry = 0;
+  return TRUE;
+}
+
+// Remembers a key evicted from the small queue, until another key evicted
+// later lands on the same entry. The ghost is kept at about twice the size
+// of the shard, so that it remembers roughly as many keys as the main
+// queue holds.
+static inline void
+bitcache_map_ghost_put(bitcache_map_cache_t* cache, const uint64_t hash, const size_t count) {
+  if (cache->ghost_size < count) {
+    size_t size = 64;
+    while (size < 2 * count)
+      size <<= 1;
+    uint64_t* const ghost = calloc(size, sizeof(uint64_t));
+    if (likely(ghost != NULL)) {
+      free(cache->ghost);
+      cache->ghost = ghost, cache->ghost_size = size;
+    }
+  }
+  if (likely(cache->ghost != NULL))
+    cache->ghost[(hash >> 32) & (cache->ghost_size - 1)] = hash | 1;
+}
+
+static bool
+bitcache_map_small_push(bitcache_map_cache_t* cache, const bitcache_id_t* key) {
+  if (cache->small_size == cache->small_capacity) {
+    const size_t capacity = cache->small_capacity ? cache->small_capacity * 2 : 64;
+    bitcache_id_t* const small = malloc(capacity * sizeof(bitcache_id_t));
+    if (unlikely(small == NULL))
+      return FALSE; // cannot allocate memory
+    for (size_t i = 0; i < cache->small_size; i++)
+      small[i] = cache->small[(cache->small_head + i) & (cache->small_capacity - 1)];
+    free(cache->small);
+    cache->small = small, cache->small_head = 0, cache->small_capacity = capacity;
+  }
+  cache->small[(cache->small_head + cache->small_size++) & (cache->small_capacity - 1)] = *key;
+  return TRUE;
+}
+
+static inline bitcache_id_t
+bitcache_map_small_pop(bitcache_map_cache_t* cache) {
+  const bitcache_id_t key = cache->small[cache->small_head];
+  cache->small_head = (cache->small_head + 1) & (cache->small_capacity - 1);
+  cache->small_size--;
+  return key;
+}
+
+// Sweeps the clock hand over the slots, evicting the first mapping that
+// hasn't been referenced since the hand last passed over it. For S3-FIFO,
+// this is the main queue, and mappings in the small queue are skipped.
+static bool
+bitcache_map_evict_clock(bitcache_map_t* map, bitcache_map_shard_t* shard, const bitcache_map_slot_t* keep) {
+  bitcache_map_cache_t* const cache = shard->cache;
+  const bitcache_map_table_t* const table = &shard->table;
+  const size_t end = bitcache_map_table_end(table);
+
+  // each reference costs a mapping a full turn of the hand:
+  for (size_t n = 0; n <= (BITCACHE_MAP_META_FREQ + 1) * end; n++) {
+    if (cache->hand >= end)
+      cache->hand = 0;
+    const size_t i = cache->hand++;
+    if (bitcache_map_table_ctrl_at(table, i) & 0x80)
+      continue; // empty or deleted
+    bitcache_map_slot_t* const slot = bitcache_map_table_slot_at(table, i);
+    if (slot == keep || (bitcache_map_meta(slot) & BITCACHE_MAP_META_SMALL))
+      continue;
+    if (bitcache_map_meta(slot) & BITCACHE_MAP_META_FREQ) {
+      __atomic_fetch_sub(&slot->meta, 1, __ATOMIC_RELAXED);
+      continue;
+    }
+    bitcache_map_evict_slot(map, shard, slot);
+    return TRUE;
+  }
+  return FALSE;
+}
+
+// Evicts from the small queue while it holds more than a tenth of the
+// budget, promoting mappings that were referenced while on probation to
+// the main queue; otherwise, evicts from the main queue.
+static bool
+bitcache_map_evict_s3fifo(bitcache_map_t* map, bitcache_map_shard_t* shard, const bitcache_map_slot_t* keep) {
+  bitcache_map_cache_t* const cache = shard->cache;
+  const bitcache_map_table_t* const table = &shard->table;
+
+  if (cache->small_used >= cache->budget / 10 || cache->used == cache->small_used) {
+    while (cache->small_size > 0) {
+      const bitcache_id_t key = bitcache_map_small_pop(cache);
+      bitcache_map_slot_t* const slot = bitcache_map_table_find(table, &key);
+      if (slot == NULL || !(bitcache_map_meta(slot) & BITCACHE_MAP_META_SMALL))
+        continue; // removed, or promoted, since it was queued
+      if (slot == keep) {
+        bitcache_map_small_push(cache, &key); // cannot fail, having just popped
+        break;
+      }
+      if (bitcache_map_meta(slot) & BITCACHE_MAP_META_FREQ) {
+        const size_t size = bitcache_map_value_size(map, slot->value);
+        cache->small_used -= (size < cache->small_used) ? size : cache->small_used;
+        __atomic_store_n(&slot->meta, 0, __ATOMIC_RELAXED);
+        continue;
+      }
+      bitcache_map_ghost_put(cache, bitcache_map_table_hash(&key), table->count);
+      bitcache_map_evict_slot(map, shard, slot);
+      return TRUE;
+    }
+  }
+
+  return bitcache_map_evict_clock(map, shard, keep);
+}
+
+// Accounts for a value just stored into a slot of a bounded shard, then
+// evicts other mappings until the shard is back within its budget.
+static void
+bitcache_map_admit(bitcache_map_t* map, bitcache_map_shard_t* shard, bitcache_map_slot_t* slot, const bool inserted, const void* previous) {
+  bitcache_map_cache_t* const cache = shard->cache;
+  if (likely(cache == NULL))
+    return;
+
+  const size_t size = bitcache_map_value_size(map, slot->value);
+  if (inserted) {
+    cache->used += size;
+    // new keys start out on probation, unless they were evicted from it
+    // only recently:
+    if (map->policy == BITCACHE_MAP_EVICT_S3FIFO &&
+        !bitcache_map_ghost_take(cache, bitcache_map_table_hash(&slot->key)) &&
+        likely(bitcache_map_small_push(cache, &slot->key))) {
+      __atomic_store_n(&slot->meta, BITCACHE_MAP_META_SMALL, __ATOMIC_RELAXED);
+      cache->small_used += size;
+    }
+  }
+  else if (previous != slot->value) {
+    const size_t previous_size = bitcache_map_value_size(map, previous);
+    cache->used = cache->used - ((previous_size < cache->used) ? previous_size : cache->used) + size;
+    if (bitcache_map_meta(slot) & BITCACHE_MAP_META_SMALL)
+      cache->small_used = cache->small_used - ((previous_size < cache->small_used) ? previous_size : cache->small_used) + size;
+  }
+
+  while (cache->used > cache->budget) {
+    const bool evicted = (map->policy == BITCACHE_MAP_EVICT_CLOCK) ?
+      bitcache_map_evict_clock(map, shard, slot) : bitcache_map_evict_s3fifo(map, shard, slot);
+    if (!evicted)
+      break; // nothing left to evict but the new mapping itself
+  }
+}
+
+// Inserts a run of batch keys that share a shard, taking the shard's lock
+// once, and first making room for all of them if `reserve` is set. Values
+// replaced meanwhile are released once the shard has been unlocked, using
+// `replaced` (which has room for the run, if the map releases values).
+static int
+bitcache_map_insert_run(bitcache_map_t* map, const bitcache_id_t* keys, const size_t* order, const size_t begin, const size_t end, void* const* values, void** replaced, const bool reserve) {
+  bitcache_map_shard_t* const shard = bitcache_map_shard(map, &keys[bitcache_map_batch_index(order, begin)]);
+  const free_func_t release = map->read_mostly ? bitcache_map_retire : free;
+  size_t pending = 0;
+  int rc;
+
+  bitcache_map_wrlock(shard);
+  bitcache_map_write_begin(shard);
+  rc = bitcache_map_shard_thaw(shard);
+  if (reserve && shard->cache == NULL && rc == 0) {
+    bitcache_map_table_t* const table = &shard->table;
+    size_t capacity = (table->capacity > 0) ? table->capacity : BITCACHE_MAP_TABLE_GROUP;
+    while (bitcache_map_table_max_load(capacity) < table->count + (end - begin))
+      capacity *= 2;
+    if (capacity > table->capacity && (rc = bitcache_map_table_rehash(table, capacity, release)) == 0 && table->old_ctrl != NULL)
+      bitcache_map_table_migrate(table, table->old_capacity, release);
+  }
+  bitcache_map_batch_prefetch(&shard->table, keys, order, begin, end);
+  for (size_t j = begin; j < end && rc == 0; j++) {
+    if (j + BITCACHE_MAP_PREFETCH_DISTANCE < end)
+      bitcache_map_table_prefetch(&shard->table, &keys[bitcache_map_batch_index(order, j + BITCACHE_MAP_PREFETCH_DISTANCE)]);
+    const size_t i = bitcache_map_batch_index(order, j);
+    void* const value = (values != NULL) ? values[i] : NULL;
+    bool inserted;
+    bitcache_map_slot_t* const slot = bitcache_map_table_insert(&shard->table, &keys[i], &inserted, release);
+    if (unlikely(slot == NULL)) {
+      rc = -errno; // cannot allocate memory
+      break;
+    }
+    void* const previous = slot->value;
+    if (!inserted && previous != value && previous != NULL && replaced != NULL)
+      replaced[pending++] = previous;
+    bitcache_map_table_set_value(slot, value);
+    bitcache_map_admit(map, shard, slot, inserted, previous);
+  }
+  bitcache_map_write_end(shard);
+  bitcache_map_unlock(shard);
+
+  for (size_t j = 0; j < pending; j++)
+    bitcache_map_release(map, replaced[j]);
+
+  return rc;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Map API
 
 int
 bitcache_map_init(bitcache_map_t* map, const free_func_t key_destroy_func, const free_func_t value_destroy_func) {
+  return bitcache_map_init_sharded(map, 1, key_destroy_func, value_destroy_func);
+}
+
+int
+bitcache_map_init_sharded(bitcache_map_t* map, const size_t shards, const free_func_t key_destroy_func, const free_func_t value_destroy_func) {
   validate_with_errno_return(map != NULL);
+  validate_with_errno_return(shards > 0 && shards <= BITCACHE_MAP_SHARDS_MAX && (shards & (shards - 1)) == 0);
 
   bzero(map, sizeof(bitcache_map_t));
 
-  bitcache_map_crlock(map);
-  map->hash_table = g_hash_table_new_full(
-    (GHashFunc)bitcache_id_hash,
-    (GEqualFunc)bitcache_id_equal_g,
-    key_destroy_func, value_destroy_func);
+  map->shard_bits = __builtin_ctzl(shards);
+  map->shard_size = (sizeof(bitcache_map_shard_t) + BITCACHE_MAP_CACHE_LINE - 1) & ~(size_t)(BITCACHE_MAP_CACHE_LINE - 1);
+  void* memory = NULL;
+  if (unlikely(posix_memalign(&memory, BITCACHE_MAP_CACHE_LINE, shards * map->shard_size) != 0))
+    return -(errno = ENOMEM); // cannot allocate memory
+  bzero(memory, shards * map->shard_size);
+  map->shards = memory;
+
+  for (size_t i = 0; i < shards; i++) {
+    bitcache_map_crlock(bitcache_map_shard_at(map, i));
+  }
+  map->key_destroy_func = key_destroy_func;
+  map->value_destroy_func = value_destroy_func;
+
+  return 0;
+}
+
+int
+bitcache_map_set_read_mostly(bitcache_map_t* map, const bool read_mostly) {
+  validate_with_errno_return(map != NULL && map->shards != NULL);
+
+  map->read_mostly = read_mostly;
+
+  return 0;
+}
+
+int
+bitcache_map_set_bound(bitcache_map_t* map, const bitcache_map_evict_t policy, const size_t budget, const bitcache_map_size_func_t value_size_func) {
+  validate_with_errno_return(map != NULL && map->shards != NULL);
+  validate_with_errno_return(policy <= BITCACHE_MAP_EVICT_S3FIFO && (policy == BITCACHE_MAP_EVICT_NONE || budget > 0));
+
+  const size_t shards = bitcache_map_shard_count(map);
+  for (size_t i = 0; i < shards; i++)
+    validate_with_errno_return(bitcache_map_shard_at(map, i)->table.count == 0);
+
+  // each shard gets an equal part of the budget:
+  const size_t shard_budget = (budget >> map->shard_bits) ? (budget >> map->shard_bits) : 1;
+  for (size_t i = 0; i < shards; i++) {
+    bitcache_map_shard_t* const shard = bitcache_map_shard_at(map, i);
+    bitcache_map_cache_free(shard->cache), shard->cache = NULL;
+    if (policy == BITCACHE_MAP_EVICT_NONE)
+      continue;
+    if (unlikely((shard->cache = calloc(1, sizeof(bitcache_map_cache_t))) == NULL)) {
+      while (i-- > 0) {
+        bitcache_map_shard_t* const other = bitcache_map_shard_at(map, i);
+        bitcache_map_cache_free(other->cache), other->cache = NULL;
+      }
+      map->policy = BITCACHE_MAP_EVICT_NONE;
+      return -(errno = ENOMEM); // cannot allocate memory
+    }
+    shard->cache->budget = shard_budget;
+  }
+  map->policy = policy;
+  map->value_size_func = value_size_func;
 
   return 0;
 }
@@ -45,85 +582,375 @@ int
 bitcache_map_reset(bitcache_map_t* map) {
   validate_with_errno_return(map != NULL);
 
-  bitcache_map_rmlock(map);
-  if (likely(map->hash_table != NULL)) {
-    g_hash_table_destroy(map->hash_table);
-    map->hash_table = NULL;
+  if (likely(map->shards != NULL)) {
+    for (size_t i = 0; i < bitcache_map_shard_count(map); i++) {
+      bitcache_map_shard_t* const shard = bitcache_map_shard_at(map, i);
+      bitcache_map_rmlock(shard);
+      bitcache_map_table_clear(&shard->table, map->value_destroy_func, free);
+      bitcache_map_table_free(&shard->table);
+      bitcache_map_cache_free(shard->cache), shard->cache = NULL;
+    }
+    free(map->shards), map->shards = NULL;
   }
 
+  // make sure that anything retired earlier has been released, too:
+  if (map->read_mostly)
+    bitcache_epoch_barrier();
+
   return 0;
 }
 
 int
 bitcache_map_clear(bitcache_map_t* map) {
-  validate_with_errno_return(map != NULL);
+  validate_with_errno_return(map != NULL && map->shards != NULL);
 
-  bitcache_map_wrlock(map);
-  if (likely(map->hash_table != NULL)) {
-    g_hash_table_remove_all(map->hash_table);
+  for (size_t i = 0; i < bitcache_map_shard_count(map); i++) {
+    bitcache_map_shard_t* const shard = bitcache_map_shard_at(map, i);
+    bitcache_map_wrlock(shard);
+    bitcache_map_write_begin(shard);
+    if (map->read_mostly || shard->table.shadows != NULL) {
+      const bitcache_map_table_t* const table = &shard->table;
+      if (map->value_destroy_func != NULL) {
+        for (size_t j = bitcache_map_table_next(table, 0); j < bitcache_map_table_end(table); j = bitcache_map_table_next(table, j + 1))
+          bitcache_map_release(map, bitcache_map_table_slot_at(table, j)->value);
+      }
+      if (shard->table.shadows != NULL) {
+        // rather than shadowing every chunk only to empty it, leave the
+        // arrays to the snapshots and start over:
+        shard->frozen = NULL;
+        bitcache_map_table_abandon(&shard->table, map->read_mostly ? bitcache_map_retire : free);
+      }
+      else {
+        bitcache_map_table_clear(&shard->table, NULL, bitcache_map_retire);
+      }
+    }
+    else {
+      bitcache_map_table_clear(&shard->table, map->value_destroy_func, free);
+    }
+    if (shard->cache != NULL) {
+      bitcache_map_cache_t* const cache = shard->cache;
+      cache->used = cache->small_used = cache->hand = 0;
+      cache->small_head = cache->small_size = 0;
+    }
+    bitcache_map_write_end(shard);
+    bitcache_map_unlock(shard);
   }
-  bitcache_map_unlock(map);
 
   return 0;
 }
 
 long
 bitcache_map_count(bitcache_map_t* map) {
-  validate_with_errno_return(map != NULL);
+  validate_with_errno_return(map != NULL && map->shards != NULL);
 
   long count = 0;
 
-  bitcache_map_rdlock(map);
-  if (likely(map->hash_table != NULL)) {
-    count += g_hash_table_size(map->hash_table);
+  for (size_t i = 0; i < bitcache_map_shard_count(map); i++) {
+    bitcache_map_shard_t* const shard = bitcache_map_shard_at(map, i);
+    bitcache_map_rdlock(shard);
+    count += shard->table.count;
+    bitcache_map_unlock(shard);
   }
-  bitcache_map_unlock(map);
 
   return count;
 }
 
 bool
 bitcache_map_lookup(bitcache_map_t* map, const bitcache_id_t* key, void** value) {
-  validate_with_false_return(map != NULL && key != NULL);
+  validate_with_false_return(map != NULL && map->shards != NULL && key != NULL);
 
   bool found = FALSE;
+  bitcache_map_shard_t* const shard = bitcache_map_shard(map, key);
 
-  bitcache_map_rdlock(map);
-  if (likely(map->hash_table != NULL)) {
-    found = g_hash_table_lookup_extended(map->hash_table, key, NULL, value);
+  if (map->read_mostly) {
+    void* result;
+    bitcache_epoch_enter();
+    found = bitcache_map_lookup_optimistic(map, shard, key, &result);
+    bitcache_epoch_exit();
+    if (found && value != NULL)
+      *value = result;
+    return found;
   }
-  bitcache_map_unlock(map);
+
+  bitcache_map_rdlock(shard);
+  bitcache_map_slot_t* const slot = bitcache_map_table_find(&shard->table, key);
+  if (slot != NULL) {
+    bitcache_map_touch(map, slot);
+    if (value != NULL)
+      *value = slot->value;
+    found = TRUE;
+  }
+  bitcache_map_unlock(shard);
 
   return found;
 }
 
 int
 bitcache_map_insert(bitcache_map_t* map, const bitcache_id_t* key, const void* value) {
-  validate_with_errno_return(map != NULL && key != NULL);
+  validate_with_errno_return(map != NULL && map->shards != NULL && key != NULL);
+
+  int rc = 0;
+  bool inserted;
+  void* replaced = NULL;
+  bitcache_map_shard_t* const shard = bitcache_map_shard(map, key);
 
-  bitcache_map_wrlock(map);
-  if (likely(map->hash_table != NULL)) {
-    g_hash_table_insert(map->hash_table, (void*)key, (void*)value);
+  bitcache_map_wrlock(shard);
+  bitcache_map_write_begin(shard);
+  bitcache_map_slot_t* const slot = likely(bitcache_map_shard_thaw(shard) == 0) ?
+    bitcache_map_table_insert(&shard->table, key, &inserted, map->read_mostly ? bitcache_map_retire : free) : NULL;
+  if (likely(slot != NULL)) {
+    void* const previous = slot->value;
+    if (!inserted && previous != value)
+      replaced = previous;
+    bitcache_map_table_set_value(slot, value);
+    bitcache_map_admit(map, shard, slot, inserted, previous);
   }
   else {
-    assert(map->hash_table != NULL);
+    rc = -errno; // cannot allocate memory
   }
-  bitcache_map_unlock(map);
+  bitcache_map_write_end(shard);
+  bitcache_map_unlock(shard);
 
-  return 0;
+  // release the replaced value outside of the lock:
+  if (replaced != NULL)
+    bitcache_map_release(map, replaced);
+
+  // the key has been copied, so the map is done with it:
+  if (likely(rc == 0) && map->key_destroy_func != NULL)
+    map->key_destroy_func((void*)key);
+
+  return rc;
 }
 
 int
 bitcache_map_remove(bitcache_map_t* map, const bitcache_id_t* key) {
-  validate_with_errno_return(map != NULL && key != NULL);
+  validate_with_errno_return(map != NULL && map->shards != NULL && key != NULL);
+
+  int rc = 0;
+  void* value = NULL;
+  bool found = FALSE;
+  bitcache_map_shard_t* const shard = bitcache_map_shard(map, key);
 
-  bitcache_map_wrlock(map);
-  if (likely(map->hash_table != NULL)) {
-    g_hash_table_remove(map->hash_table, (void*)key);
+  bitcache_map_wrlock(shard);
+  bitcache_map_slot_t* slot = bitcache_map_table_find(&shard->table, key);
+  if (slot != NULL) {
+    bitcache_map_write_begin(shard);
+    if (unlikely(shard->frozen != NULL)) {
+      rc = bitcache_map_shard_thaw(shard);
+      slot = likely(rc == 0) ? bitcache_map_table_find(&shard->table, key) : NULL;
+    }
+    if (likely(slot != NULL)) {
+      value = slot->value;
+      bitcache_map_forget(map, shard, slot);
+      bitcache_map_table_erase(&shard->table, slot);
+      found = TRUE;
+    }
+    bitcache_map_write_end(shard);
   }
-  bitcache_map_unlock(map);
+  bitcache_map_unlock(shard);
 
-  return 0;
+  // release the value outside of the lock:
+  if (found)
+    bitcache_map_release(map, value);
+
+  return rc;
+}
+
+long
+bitcache_map_lookup_many(bitcache_map_t* map, const bitcache_id_t* keys, const size_t count, void** values, bool* found) {
+  validate_with_errno_return(map != NULL && map->shards != NULL && (keys != NULL || count == 0));
+
+  long hits = 0;
+
+  if (map->read_mostly) {
+    bitcache_epoch_enter();
+    for (size_t i = 0; i < count; i++) {
+      void* value = NULL;
+      const bool hit = bitcache_map_lookup_optimistic(map, bitcache_map_shard(map, &keys[i]), &keys[i], &value);
+      if (values != NULL)
+        values[i] = value;
+      if (found != NULL)
+        found[i] = hit;
+      hits += hit;
+    }
+    bitcache_epoch_exit();
+    return hits;
+  }
+
+  size_t* const order = bitcache_map_batch_order(map, keys, count);
+
+  for (size_t begin = 0, end; begin < count; begin = end) {
+    end = bitcache_map_batch_run(map, keys, order, begin, count);
+    bitcache_map_shard_t* const shard = bitcache_map_shard(map, &keys[bitcache_map_batch_index(order, begin)]);
+
+    bitcache_map_rdlock(shard);
+    const bitcache_map_table_t* const table = &shard->table;
+    bitcache_map_batch_prefetch(table, keys, order, begin, end);
+    for (size_t j = begin; j < end; j++) {
+      if (j + BITCACHE_MAP_PREFETCH_DISTANCE < end)
+        bitcache_map_table_prefetch(table, &keys[bitcache_map_batch_index(order, j + BITCACHE_MAP_PREFETCH_DISTANCE)]);
+      const size_t i = bitcache_map_batch_index(order, j);
+      bitcache_map_slot_t* const slot = bitcache_map_table_find(table, &keys[i]);
+      if (slot != NULL)
+        bitcache_map_touch(map, slot);
+      if (values != NULL)
+        values[i] = (slot != NULL) ? slot->value : NULL;
+      if (found != NULL)
+        found[i] = (slot != NULL);
+      hits += (slot != NULL);
+    }
+    bitcache_map_unlock(shard);
+  }
+
+  free(order);
+  return hits;
+}
+
+int
+bitcache_map_insert_many(bitcache_map_t* map, const bitcache_id_t* keys, const size_t count, void* const* values) {
+  validate_with_errno_return(map != NULL && map->shards != NULL && (keys != NULL || count == 0));
+
+  // replaced values are released only once their shard has been unlocked:
+  void** replaced = NULL;
+  if (map->value_destroy_func != NULL && count > 0) {
+    replaced = malloc(count * sizeof(void*));
+    if (unlikely(replaced == NULL))
+      return -errno; // cannot allocate memory
+  }
+
+  int rc = 0;
+  size_t* const order = bitcache_map_batch_order(map, keys, count);
+
+  for (size_t begin = 0, end; begin < count && rc == 0; begin = end) {
+    end = bitcache_map_batch_run(map, keys, order, begin, count);
+    rc = bitcache_map_insert_run(map, keys, order, begin, end, values, replaced, FALSE);
+  }
+
+  free(order);
+  free(replaced);
+  return rc;
+}
+
+// Represents the runs of a bulk build that one thread inserts: those that
+// start from `begin` up to `end`.
+typedef struct {
+  bitcache_map_t* map;
+  const bitcache_id_t* keys;
+  const size_t* order;
+  size_t count;
+  void* const* values;
+  void** replaced;
+  size_t begin, end;
+  int rc;
+} bitcache_map_build_t;
+
+static void*
+bitcache_map_build_runs(void* arg) {
+  bitcache_map_build_t* const job = arg;
+  for (size_t begin = job->begin, end; begin < job->end && job->rc == 0; begin = end) {
+    end = bitcache_map_batch_run(job->map, job->keys, job->order, begin, job->count);
+    job->rc = bitcache_map_insert_run(job->map, job->keys, job->order, begin, end, job->values,
+      (job->replaced != NULL) ? &job->replaced[begin] : NULL, TRUE);
+  }
+  return NULL;
+}
+
+int
+bitcache_map_build(bitcache_map_t* map, const bitcache_id_t* keys, const size_t count, void* const* values, const unsigned int threads) {
+  validate_with_errno_return(map != NULL && map->shards != NULL && (keys != NULL || count == 0));
+
+  int rc = bitcache_map_clear(map);
+  if (unlikely(rc < 0) || count == 0)
+    return rc;
+
+  void** replaced = NULL;
+  if (map->value_destroy_func != NULL) {
+    replaced = malloc(count * sizeof(void*));
+    if (unlikely(replaced == NULL))
+      return -errno; // cannot allocate memory
+  }
+
+  // one thread per CPU, and per shard, at most:
+  size_t n = bitcache_thread_count(threads, count, BITCACHE_MAP_BUILD_MIN);
+  if (n > bitcache_map_shard_count(map))
+    n = bitcache_map_shard_count(map);
+
+  // split the keys, ordered by shard, into as many ranges, each extended
+  // to the end of the run it ends in so that no shard is shared:
+  size_t* const order = bitcache_map_batch_order(map, keys, count);
+  bitcache_map_build_t jobs[n];
+  size_t begin = 0;
+  for (size_t t = 0; t < n; t++) {
+    size_t end = (count * (t + 1)) / n;
+    if (begin < end && end < count)
+      end = bitcache_map_batch_run(map, keys, order, end - 1, count);
+    if (end < begin)
+      end = begin;
+    jobs[t] = (bitcache_map_build_t){
+      .map = map, .keys = keys, .order = order, .count = count,
+      .values = values, .replaced = replaced,
+      .begin = begin, .end = end, .rc = 0,
+    };
+    begin = end;
+  }
+
+  bitcache_thread_run(bitcache_map_build_runs, jobs, sizeof(jobs[0]), n);
+
+  for (size_t t = 0; t < n && rc == 0; t++)
+    rc = jobs[t].rc;
+
+  free(order);
+  free(replaced);
+  return rc;
+}
+
+long
+bitcache_map_remove_many(bitcache_map_t* map, const bitcache_id_t* keys, const size_t count) {
+  validate_with_errno_return(map != NULL && map->shards != NULL && (keys != NULL || count == 0));
+
+  // removed values are released only once their shard has been unlocked:
+  void** removed = NULL;
+  if (map->value_destroy_func != NULL && count > 0) {
+    removed = malloc(count * sizeof(void*));
+    if (unlikely(removed == NULL))
+      return -errno; // cannot allocate memory
+  }
+
+  int rc = 0;
+  long hits = 0;
+  size_t* const order = bitcache_map_batch_order(map, keys, count);
+
+  for (size_t begin = 0, end; begin < count && rc == 0; begin = end) {
+    end = bitcache_map_batch_run(map, keys, order, begin, count);
+    bitcache_map_shard_t* const shard = bitcache_map_shard(map, &keys[bitcache_map_batch_index(order, begin)]);
+    size_t pending = 0;
+
+    bitcache_map_wrlock(shard);
+    bitcache_map_write_begin(shard);
+    rc = bitcache_map_shard_thaw(shard);
+    bitcache_map_batch_prefetch(&shard->table, keys, order, begin, end);
+    for (size_t j = begin; j < end && rc == 0; j++) {
+      if (j + BITCACHE_MAP_PREFETCH_DISTANCE < end)
+        bitcache_map_table_prefetch(&shard->table, &keys[bitcache_map_batch_index(order, j + BITCACHE_MAP_PREFETCH_DISTANCE)]);
+      bitcache_map_slot_t* const slot = bitcache_map_table_find(&shard->table, &keys[bitcache_map_batch_index(order, j)]);
+      if (slot == NULL)
+        continue;
+      if (removed != NULL)
+        removed[pending++] = slot->value;
+      bitcache_map_forget(map, shard, slot);
+      bitcache_map_table_erase(&shard->table, slot);
+      hits++;
+    }
+    bitcache_map_write_end(shard);
+    bitcache_map_unlock(shard);
+
+    for (size_t j = 0; j < pending; j++)
+      bitcache_map_release(map, removed[j]);
+  }
+
+  free(order);
+  free(removed);
+  return (rc < 0) ? rc : hits;
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -131,43 +958,385 @@ bitcache_map_remove(bitcache_map_t* map, const bitcache_id_t* key) {
 
 int
 bitcache_map_iter_init(bitcache_map_iter_t* iter, bitcache_map_t* map) {
-  validate_with_errno_return(iter != NULL && map != NULL);
+  validate_with_errno_return(iter != NULL && map != NULL && map->shards != NULL);
 
   bzero(iter, sizeof(bitcache_map_iter_t));
   iter->map = map;
-  g_hash_table_iter_init(&iter->hash_table_iter, map->hash_table);
+  iter->shard = 0;
+  iter->slot = SIZE_MAX; // before the first slot
 
   return 0;
 }
 
+int
+bitcache_map_iter_init_snapshot(bitcache_map_iter_t* iter, bitcache_map_t* map) {
+  validate_with_errno_return(iter != NULL && map != NULL && map->shards != NULL);
+
+  const size_t shards = bitcache_map_shard_count(map);
+  bitcache_map_snapshot_t* const snapshot = malloc(sizeof(bitcache_map_snapshot_t) + shards * sizeof(snapshot->entries[0]));
+  bitcache_map_frozen_t** const spares = calloc(shards, sizeof(bitcache_map_frozen_t*));
+  if (unlikely(snapshot == NULL || spares == NULL)) {
+    free(spares), free(snapshot);
+    return -(errno = ENOMEM); // cannot allocate memory
+  }
+  // allocate up front whatever bookkeeping freezing the shards may need,
+  // so as not to fail with every shard locked:
+  for (size_t i = 0; i < shards; i++) {
+    if (unlikely((spares[i] = calloc(1, sizeof(bitcache_map_frozen_t))) == NULL)) {
+      while (i-- > 0)
+        free(spares[i]);
+      free(spares), free(snapshot);
+      return -(errno = ENOMEM); // cannot allocate memory
+    }
+  }
+  snapshot->shards = shards;
+  snapshot->begin = snapshot->end = SIZE_MAX;
+
+  // lock every shard at once, in order, for a consistent point in time:
+  for (size_t i = 0; i < shards; i++)
+    bitcache_map_wrlock(bitcache_map_shard_at(map, i));
+  for (size_t i = 0; i < shards; i++) {
+    bitcache_map_shard_t* const shard = bitcache_map_shard_at(map, i);
+    snapshot->entries[i].table = shard->table;
+    snapshot->entries[i].frozen = NULL;
+    if (shard->table.capacity == 0)
+      continue; // nothing to freeze
+    if (shard->frozen == NULL) {
+      // the shard has changed since any earlier snapshot, so shadow its
+      // arrays anew:
+      bitcache_map_table_t* const table = &shard->table;
+      bitcache_map_frozen_t* const frozen = spares[i];
+      spares[i] = NULL;
+      frozen->shadows[0].ctrl = table->ctrl;
+      frozen->shadows[0].capacity = table->capacity;
+      frozen->shadows[0].next = table->shadows;
+      table->shadows = &frozen->shadows[0];
+      if (table->old_ctrl != NULL) {
+        frozen->shadows[1].ctrl = table->old_ctrl;
+        frozen->shadows[1].capacity = table->old_capacity;
+        frozen->shadows[1].next = table->shadows;
+        table->shadows = &frozen->shadows[1];
+      }
+      shard->frozen = frozen;
+    }
+    shard->frozen->refs++;
+    snapshot->entries[i].frozen = shard->frozen;
+  }
+  for (size_t i = shards; i-- > 0; )
+    bitcache_map_unlock(bitcache_map_shard_at(map, i));
+
+  for (size_t i = 0; i < shards; i++)
+    free(spares[i]);
+  free(spares);
+
+  bzero(iter, sizeof(bitcache_map_iter_t));
+  iter->map = map;
+  iter->shard = 0;
+  iter->slot = SIZE_MAX; // before the first slot
+  iter->snapshot = snapshot;
+
+  return 0;
+}
+
+// Copies out the chunk of a snapshot's shard that holds a given slot, as it
+// was when the snapshot was taken, unless it is the one copied out last.
+static void
+bitcache_map_snapshot_load(bitcache_map_snapshot_t* snapshot, const size_t shard, const size_t i) {
+  if (i >= snapshot->begin && i < snapshot->end)
+    return;
+
+  const bitcache_map_table_t* const table = &snapshot->entries[shard].table;
+  const bitcache_map_frozen_t* const frozen = snapshot->entries[shard].frozen;
+  const bool old = (i >= table->capacity);
+  const uint8_t* const ctrl = old ? table->old_ctrl : table->ctrl;
+  const size_t capacity = old ? table->old_capacity : table->capacity;
+  const size_t base = old ? table->capacity : 0;
+  const size_t begin = (i - base) & ~(size_t)(BITCACHE_MAP_TABLE_CHUNK - 1);
+
+  bitcache_map_table_shadow_read(&frozen->shadows[old ? 1 : 0], ctrl, capacity, begin, snapshot->ctrl, snapshot->slots);
+  snapshot->begin = base + begin;
+  snapshot->end = base + begin + ((capacity - begin < BITCACHE_MAP_TABLE_CHUNK) ? capacity - begin : BITCACHE_MAP_TABLE_CHUNK);
+}
+
+static bool
+bitcache_map_snapshot_next(bitcache_map_iter_t* iter, bitcache_id_t** key, void** value) {
+  bitcache_map_snapshot_t* const snapshot = iter->snapshot;
+  for (; iter->shard < snapshot->shards; iter->shard++, iter->slot = SIZE_MAX, snapshot->begin = snapshot->end = SIZE_MAX) {
+    const size_t end = bitcache_map_table_end(&snapshot->entries[iter->shard].table);
+    for (size_t i = iter->slot + 1; i < end; i = snapshot->end) {
+      bitcache_map_snapshot_load(snapshot, iter->shard, i);
+      for (; i < snapshot->end; i++) {
+        if (snapshot->ctrl[i - snapshot->begin] & 0x80)
+          continue; // empty or deleted
+        bitcache_map_slot_t* const slot = &snapshot->slots[i - snapshot->begin];
+        iter->slot = i;
+        iter->position++;
+        if (key != NULL)
+          *key = &slot->key;
+        if (value != NULL)
+          *value = slot->value;
+        return TRUE;
+      }
+    }
+  }
+
+  return FALSE;
+}
+
 bool
 bitcache_map_iter_next(bitcache_map_iter_t* iter, bitcache_id_t** key, void** value) {
   validate_with_false_return(iter != NULL && iter->map != NULL);
 
-  int more = FALSE;
+  if (iter->snapshot != NULL)
+    return bitcache_map_snapshot_next(iter, key, value);
 
-  if (likely(g_hash_table_iter_next(&iter->hash_table_iter, (void**)key, value) != FALSE)) {
-    iter->position++;
-    more = TRUE;
+  const bitcache_map_t* const map = iter->map;
+  for (; iter->shard < bitcache_map_shard_count(map); iter->shard++, iter->slot = SIZE_MAX) {
+    const bitcache_map_table_t* const table = &bitcache_map_shard_at(map, iter->shard)->table;
+    const size_t i = bitcache_map_table_next(table, iter->slot + 1);
+    if (i < bitcache_map_table_end(table)) {
+      bitcache_map_slot_t* const slot = bitcache_map_table_slot_at(table, i);
+      iter->slot = i;
+      iter->position++;
+      if (key != NULL)
+        *key = &slot->key;
+      if (value != NULL)
+        *value = slot->value;
+      return TRUE;
+    }
   }
 
-  return more;
+  return FALSE;
 }
 
 int
 bitcache_map_iter_remove(bitcache_map_iter_t* iter) {
   validate_with_errno_return(iter != NULL && iter->map != NULL);
 
-  g_hash_table_iter_remove(&iter->hash_table_iter);
+  bitcache_map_t* const map = iter->map;
+  validate_with_errno_return(iter->shard < bitcache_map_shard_count(map));
 
-  return 0;
+  const bitcache_map_snapshot_t* const snapshot = iter->snapshot;
+  if (snapshot != NULL) { // the snapshot itself stays as it was
+    validate_with_errno_return(iter->slot >= snapshot->begin && iter->slot < snapshot->end &&
+      (snapshot->ctrl[iter->slot - snapshot->begin] & 0x80) == 0);
+    return bitcache_map_remove(map, &snapshot->slots[iter->slot - snapshot->begin].key);
+  }
+
+  const bitcache_map_table_t* const table = &bitcache_map_shard_at(map, iter->shard)->table;
+  validate_with_errno_return(iter->slot < bitcache_map_table_end(table) &&
+    (bitcache_map_table_ctrl_at(table, iter->slot) & 0x80) == 0);
+
+  int rc;
+  void* value = NULL;
+  bitcache_map_shard_t* const shard = bitcache_map_shard_at(map, iter->shard);
+
+  bitcache_map_wrlock(shard);
+  bitcache_map_write_begin(shard);
+  if (likely((rc = bitcache_map_shard_thaw(shard)) == 0)) {
+    bitcache_map_slot_t* const slot = bitcache_map_table_slot_at(&shard->table, iter->slot);
+    value = slot->value;
+    bitcache_map_forget(map, shard, slot);
+    bitcache_map_table_erase(&shard->table, slot);
+  }
+  bitcache_map_write_end(shard);
+  bitcache_map_unlock(shard);
+
+  if (likely(rc == 0))
+    bitcache_map_release(map, value);
+
+  return rc;
 }
 
 int
 bitcache_map_iter_done(bitcache_map_iter_t* iter) {
   validate_with_errno_return(iter != NULL && iter->map != NULL);
 
+  bitcache_map_snapshot_t* const snapshot = iter->snapshot;
+  if (snapshot != NULL) {
+    const bitcache_map_t* const map = iter->map;
+    const free_func_t release = map->read_mostly ? bitcache_map_retire : free;
+    for (size_t i = 0; i < snapshot->shards; i++) {
+      bitcache_map_frozen_t* const frozen = snapshot->entries[i].frozen;
+      if (frozen == NULL)
+        continue;
+
+      bitcache_map_shard_t* const shard = bitcache_map_shard_at(map, i);
+      bitcache_map_wrlock(shard);
+      const bool last = (--frozen->refs == 0);
+      if (last) {
+        if (shard->frozen == frozen)
+          shard->frozen = NULL; // the map never changed the arrays
+        for (size_t j = 0; j < 2; j++) {
+          if (frozen->shadows[j].ctrl != NULL)
+            bitcache_map_table_unshadow(&shard->table, &frozen->shadows[j], release);
+        }
+      }
+      bitcache_map_unlock(shard);
+
+      if (last)
+        free(frozen);
+    }
+    free(snapshot);
+  }
+
   bzero(iter, sizeof(bitcache_map_iter_t));
 
   return 0;
 }
+
+//////////////////////////////////////////////////////////////////////////////
+// Map Serialization API
+
+// Pairs a key with its value while a dump sorts them.
+typedef struct {
+  bitcache_id_t key;
+  uint64_t value;
+} bitcache_map_entry_t;
+
+static int
+bitcache_map_entry_compare(const void* entry1, const void* entry2) {
+  return memcmp(entry1, entry2, sizeof(bitcache_id_t));
+}
+
+long COLD
+bitcache_map_dump(bitcache_map_t* map, const int fd, const bitcache_id_encoding_t encoding) {
+  validate_with_errno_return(map != NULL && map->shards != NULL && fd >= 0 &&
+    (encoding == BITCACHE_ID_PLAIN || encoding == BITCACHE_ID_DELTA));
+
+  // copy the mappings out of a snapshot, then sort them by key:
+  bitcache_map_iter_t iter;
+  long rc = bitcache_map_iter_init_snapshot(&iter, map);
+  if (unlikely(rc < 0))
+    return rc;
+
+  size_t count = 0, capacity = bitcache_map_count(map) + 1;
+  bitcache_map_entry_t* entries = malloc(capacity * sizeof(bitcache_map_entry_t));
+  bitcache_id_t* key;
+  void* value;
+  while (likely(entries != NULL) && bitcache_map_iter_next(&iter, &key, &value)) {
+    if (unlikely(count == capacity)) {
+      bitcache_map_entry_t* const more = realloc(entries, (capacity *= 2) * sizeof(bitcache_map_entry_t));
+      if (unlikely(more == NULL)) {
+        free(entries), entries = NULL;
+        break;
+      }
+      entries = more;
+    }
+    entries[count].key = *key;
+    entries[count].value = (uintptr_t)value;
+    count++;
+  }
+  bitcache_map_iter_done(&iter);
+  if (unlikely(entries == NULL))
+    return -(errno = ENOMEM); // cannot allocate memory
+
+  qsort(entries, count, sizeof(bitcache_map_entry_t), bitcache_map_entry_compare);
+
+  // then split them back up into keys and values:
+  bitcache_id_t* const keys = malloc((count > 0 ? count : 1) * sizeof(bitcache_id_t));
+  uint64_t* const values = malloc((count > 0 ? count : 1) * sizeof(uint64_t));
+  if (unlikely(keys == NULL || values == NULL)) {
+    free(values), free(keys), free(entries);
+    return -(errno = ENOMEM); // cannot allocate memory
+  }
+  for (size_t i = 0; i < count; i++)
+    keys[i] = entries[i].key, values[i] = entries[i].value;
+  free(entries);
+
+  // the keys are packed twice, the first time only to checksum them:
+  uint32_t checksum = 0;
+  const long keys_size = bitcache_id_pack_write(-1, keys, count, encoding, &checksum);
+  if (unlikely((rc = keys_size) < 0))
+    goto done;
+
+  bitcache_map_header_t header;
+  bzero(&header, sizeof(header));
+  memcpy(header.magic, BITCACHE_MAP_MAGIC, sizeof(header.magic));
+  header.version   = BITCACHE_MAP_VERSION;
+  header.checksum  = bitcache_crc32c(checksum, values, count * sizeof(uint64_t));
+  header.count     = count;
+  header.keys_size = keys_size;
+  header.encoding  = encoding;
+
+  if (unlikely((rc = bitcache_write(fd, &header, sizeof(header))) < 0))
+    goto done;
+  if (unlikely((rc = bitcache_id_pack_write(fd, keys, count, encoding, &checksum)) < 0))
+    goto done;
+  if (unlikely((rc = bitcache_write(fd, values, count * sizeof(uint64_t))) < 0))
+    goto done;
+
+  rc = sizeof(header) + keys_size + count * sizeof(uint64_t);
+
+done:
+  free(values);
+  free(keys);
+  return rc;
+}
+
+long COLD
+bitcache_map_load(bitcache_map_t* map, const int fd) {
+  validate_with_errno_return(map != NULL && map->shards != NULL && fd >= 0);
+
+  off_t off = lseek(fd, 0, SEEK_CUR);
+  if (unlikely(off == -1)) {
+    return -errno; // pipes, sockets and FIFOs are not supported
+  }
+
+  struct stat sb;
+  if (unlikely(fstat(fd, &sb) == -1)) {
+    return -errno;
+  }
+
+  bitcache_map_header_t header;
+  if (unlikely(sb.st_size - off < (off_t)sizeof(header) ||
+      pread(fd, &header, sizeof(header), off) != sizeof(header) ||
+      memcmp(header.magic, BITCACHE_MAP_MAGIC, sizeof(header.magic)) != 0 ||
+      header.version < 1 || header.version > BITCACHE_MAP_VERSION ||
+      (header.encoding != BITCACHE_ID_PLAIN && header.encoding != BITCACHE_ID_DELTA) ||
+      header.count > SIZE_MAX / sizeof(bitcache_map_entry_t) ||
+      header.keys_size > (uint64_t)(sb.st_size - off) - sizeof(header) ||
+      header.count > ((uint64_t)(sb.st_size - off) - sizeof(header) - header.keys_size) / sizeof(uint64_t))) {
+    return -(errno = EINVAL); // not a map
+  }
+
+  // mmap() requires a page-aligned file offset:
+  const off_t page_off = off & ~((off_t)getpagesize() - 1);
+  const size_t body_off = (off - page_off) + sizeof(header);
+  const size_t body_size = header.keys_size + header.count * sizeof(uint64_t);
+  const size_t mapping_size = body_off + body_size;
+
+  void* base = mmap(NULL, mapping_size, PROT_READ, MAP_PRIVATE, fd, page_off);
+  if (unlikely(base == MAP_FAILED)) {
+    return -errno;
+  }
+  const uint8_t* const body = (uint8_t*)base + body_off;
+
+  long rc = 0;
+  const size_t count = header.count;
+  bitcache_id_t* const keys = malloc((count > 0 ? count : 1) * sizeof(bitcache_id_t));
+  void** const values = malloc((count > 0 ? count : 1) * sizeof(void*));
+  if (unlikely(keys == NULL || values == NULL)) {
+    rc = -(errno = ENOMEM); // cannot allocate memory
+  }
+  else if (unlikely(bitcache_crc32c(0, body, body_size) != header.checksum)) {
+    rc = -(errno = EBADMSG); // corrupted
+  }
+  else if (likely((rc = bitcache_id_pack_read(body, header.keys_size, header.encoding, keys, count)) == 0)) {
+    for (size_t i = 0; i < count; i++) {
+      uint64_t word;
+      memcpy(&word, body + header.keys_size + i * sizeof(uint64_t), sizeof(word));
+      values[i] = (void*)(uintptr_t)word;
+    }
+  }
+  munmap(base, mapping_size);
+
+  if (likely(rc == 0))
+    rc = bitcache_map_clear(map);
+  if (likely(rc == 0))
+    rc = bitcache_map_insert_many(map, keys, count, values);
+
+  free(values);
+  free(keys);
+  return (rc < 0) ? rc : (long)count;
+}
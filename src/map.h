@@ -8,36 +8,186 @@ extern "C" {
 #endif
 
 #include <stdbool.h> /* for bool */
+#include <stddef.h>  /* for size_t */
+#include <stdint.h>  /* for uint8_t, uint32_t, uint64_t */
 
 #include <cprime.h>  /* for rwlock_t, free_func_t */
-#include <glib.h>    /* for GHashTable, GHashTableIter */
 
 /**
- * Represents a Bitcache map.
+ * Represents a slot in a Bitcache map table, holding an identifier inline.
+ */
+typedef struct {
+  bitcache_id_t key;
+  uint32_t meta;       /* eviction bookkeeping, in what would be padding */
+  void* value;
+} bitcache_map_slot_t;
+
+/**
+ * Represents the open-addressing hash table underlying a Bitcache map.
+ *
+ * Large tables are resized incrementally: the outgrown arrays are kept
+ * around, and consulted by lookups, while each insert migrates a bounded
+ * number of their slots into the new arrays.
  */
 typedef struct {
-  GHashTable* hash_table;
+  size_t capacity;     /* number of slots */
+  size_t count;        /* number of full slots, old ones included */
+  size_t growth_left;  /* number of empty slots that may yet be filled */
+  uint8_t* ctrl;       /* one control byte per slot */
+  bitcache_map_slot_t* slots;
+  size_t old_capacity; /* number of slots being migrated, if resizing */
+  size_t migrated;     /* number of old slots migrated so far */
+  uint8_t* old_ctrl;
+  bitcache_map_slot_t* old_slots;
+  struct bitcache_map_table_shadow_t* shadows; /* kept for snapshots, if any */
+} bitcache_map_table_t;
+
+/**
+ * Defines the eviction policies of a bounded Bitcache map.
+ */
+typedef enum {
+  BITCACHE_MAP_EVICT_NONE = 0,  /* unbounded */
+  BITCACHE_MAP_EVICT_CLOCK,     /* second chance for referenced mappings */
+  BITCACHE_MAP_EVICT_S3FIFO,    /* small probationary FIFO ahead of CLOCK */
+} bitcache_map_evict_t;
+
+/**
+ * Returns the size (in bytes) that a value counts for against the budget
+ * of a bounded map.
+ */
+typedef size_t (*bitcache_map_size_func_t)(const void* value);
+
+/**
+ * Defines the maximum number of shards in a Bitcache map.
+ */
+#define BITCACHE_MAP_SHARDS_MAX 65536
+
+/**
+ * Represents a shard of a Bitcache map: a table with a lock of its own.
+ * Shards are padded to whole cache lines, so that threads working on
+ * different shards don't contend for the same line.
+ */
+typedef struct {
+  bitcache_map_table_t table;
+  uint64_t sequence;   /* bumped before and after every change; odd during one */
+  struct bitcache_map_frozen_t* frozen; /* set while snapshots share the table's arrays */
+  struct bitcache_map_cache_t* cache;   /* eviction state, if bounded */
 #if 1
   rwlock_t lock;
 #endif
+} bitcache_map_shard_t;
+
+/**
+ * Represents a Bitcache map.
+ *
+ * A map partitions identifiers into shards by their leading bits.
+ */
+typedef struct {
+  unsigned int shard_bits;    /* log2 of the number of shards */
+  size_t shard_size;          /* shard size (in bytes), padding included */
+  uint8_t* shards;
+  free_func_t key_destroy_func;
+  free_func_t value_destroy_func;
+  bool read_mostly;           /* whether lookups take no lock */
+  bitcache_map_evict_t policy;
+  bitcache_map_size_func_t value_size_func;
 } bitcache_map_t;
 
+/**
+ * Defines the magic bytes at the start of a dumped map header.
+ */
+#define BITCACHE_MAP_MAGIC "BCMAPIDS"
+
+/**
+ * Defines the current version of the dumped map header format.
+ */
+#define BITCACHE_MAP_VERSION 1
+
+/**
+ * Represents the header preceding the body of a dumped map: its keys in
+ * ascending order, followed by one 64-bit word per key for its value.
+ * Fields are stored in host byte order.
+ */
+typedef struct {
+  char     magic[8];   /* BITCACHE_MAP_MAGIC */
+  uint32_t version;    /* BITCACHE_MAP_VERSION */
+  uint32_t checksum;   /* CRC-32C of the body */
+  uint64_t count;      /* number of mappings */
+  uint64_t keys_size;  /* size of the keys (in bytes) */
+  uint32_t encoding;   /* bitcache_id_encoding_t of the keys */
+  uint8_t  reserved[28];
+} bitcache_map_header_t;
+
 /**
  * Represents a Bitcache map iterator.
  */
 typedef struct {
   long position;
   bitcache_map_t* map;
-  GHashTableIter hash_table_iter;
+  size_t shard;
+  size_t slot;
+  struct bitcache_map_snapshot_t* snapshot; /* set for a snapshot iterator */
 } bitcache_map_iter_t;
 
 /**
- * Initializes a map.
+ * Initializes a map with a single shard.
+ *
+ * Identifiers are copied into the map, so a key handed to
+ * `bitcache_map_insert()` is released with `key_destroy_func` (if given)
+ * as soon as it has been copied. Values are released with
+ * `value_destroy_func` (if given) when they are replaced or removed.
  */
 extern int bitcache_map_init(bitcache_map_t* map,
   const free_func_t key_destroy_func,
   const free_func_t value_destroy_func);
 
+/**
+ * Initializes a map with a given number of shards, a power of two no
+ * larger than `BITCACHE_MAP_SHARDS_MAX`.
+ *
+ * Each shard has a lock of its own, so that operations on identifiers in
+ * different shards proceed in parallel.
+ */
+extern int bitcache_map_init_sharded(bitcache_map_t* map,
+  const size_t shards,
+  const free_func_t key_destroy_func,
+  const free_func_t value_destroy_func);
+
+/**
+ * Switches a map into or out of read-mostly mode, which must be done
+ * before the map is shared between threads.
+ *
+ * In read-mostly mode, lookups take no lock at all: they read a shard
+ * optimistically and retry should a writer have changed it meanwhile.
+ * Writers still serialize on the shard lock. Tables outgrown by a resize,
+ * and values that are replaced or removed, are only released once every
+ * lookup that might still see them has finished.
+ */
+extern int bitcache_map_set_read_mostly(bitcache_map_t* map,
+  const bool read_mostly);
+
+/**
+ * Bounds an empty map to a given budget, evicting mappings as needed to
+ * stay within it.
+ *
+ * The budget counts mappings or, given a `value_size_func`, the bytes that
+ * the values take up. It is split evenly between shards, each of which
+ * does its own bookkeeping. Lookups merely mark a mapping as referenced,
+ * and inserts evict mappings from the same shard. Evicted values are
+ * released with the map's `value_destroy_func`, while the shard is still
+ * locked, so that function must not call back into the map.
+ *
+ * CLOCK evicts the first mapping its hand finds unreferenced since the hand
+ * last passed. S3-FIFO first admits new mappings to a small FIFO queue,
+ * evicting those that see no reuse there (and remembering their keys for a
+ * while), and promotes the rest to a main queue run as CLOCK; it resists
+ * being flushed by scans and one-hit wonders.
+ */
+extern int bitcache_map_set_bound(bitcache_map_t* map,
+  const bitcache_map_evict_t policy,
+  const size_t budget,
+  const bitcache_map_size_func_t value_size_func);
+
 /**
  * Resets a map back to an uninitialized state.
  */
@@ -73,21 +223,113 @@ extern int bitcache_map_insert(bitcache_map_t* map,
 extern int bitcache_map_remove(bitcache_map_t* map,
   const bitcache_id_t* key);
 
+/**
+ * Looks up a batch of identifiers in a map, taking each shard's lock once.
+ *
+ * For each identifier, stores its value (or NULL) into `values` and
+ * whether it was found into `found`; either array may be NULL. Returns
+ * the number of identifiers found.
+ */
+extern long bitcache_map_lookup_many(bitcache_map_t* map,
+  const bitcache_id_t* keys,
+  const size_t count,
+  void** values,
+  bool* found);
+
+/**
+ * Inserts a batch of identifier-to-value mappings into a map, taking each
+ * shard's lock once. A NULL `values` array maps every identifier to NULL.
+ *
+ * The identifiers are copied; the key destroy function is not called.
+ */
+extern int bitcache_map_insert_many(bitcache_map_t* map,
+  const bitcache_id_t* keys,
+  const size_t count,
+  void* const* values);
+
+/**
+ * Builds a map from a batch of identifier-to-value mappings, replacing its
+ * contents, using a given number of threads (zero selecting one per online
+ * CPU). A NULL `values` array maps every identifier to NULL.
+ *
+ * The keys are ordered by shard, and the shards split between the threads,
+ * each of which sizes its shards' tables for their keys up front before
+ * filling them, taking each shard's lock once. Builds are parallel only
+ * for maps with several shards.
+ */
+extern int bitcache_map_build(bitcache_map_t* map,
+  const bitcache_id_t* keys,
+  const size_t count,
+  void* const* values,
+  const unsigned int threads);
+
+/**
+ * Removes a batch of identifiers from a map, taking each shard's lock
+ * once. Returns the number of mappings removed.
+ */
+extern long bitcache_map_remove_many(bitcache_map_t* map,
+  const bitcache_id_t* keys,
+  const size_t count);
+
+/**
+ * Writes out a map to a file descriptor, as its keys in ascending order,
+ * in a given encoding, and their values. Returns the number of bytes
+ * written.
+ *
+ * Values are written out as the words they are, so that dumps are only
+ * meaningful for maps whose values are integers, or offsets, rather than
+ * pointers. The map is read from a snapshot, taking no lock for long.
+ */
+extern long bitcache_map_dump(bitcache_map_t* map,
+  const int fd,
+  const bitcache_id_encoding_t encoding);
+
+/**
+ * Reads in a map from a file descriptor, replacing its contents. Returns
+ * the number of mappings read.
+ *
+ * The dump is verified against its checksum, failing with `EBADMSG` on a
+ * mismatch, then inserted a shard at a time. The map's value destroy
+ * function, if any, is called on the values of the replaced mappings.
+ */
+extern long bitcache_map_load(bitcache_map_t* map,
+  const int fd);
+
 /**
  * Initializes a map iterator for a given map.
  */
 extern int bitcache_map_iter_init(bitcache_map_iter_t* iter,
   bitcache_map_t* map);
 
+/**
+ * Initializes a map iterator over a snapshot of a given map, as of the
+ * moment of the call.
+ *
+ * The scan takes no locks, and may run alongside writers: the shards'
+ * arrays are shared rather than copied, and writers keep aside the
+ * previous contents of whichever chunk of 1024 slots they are about to
+ * change, the first time they change it, for the snapshot to read instead.
+ * Taking the snapshot briefly locks every shard. Values removed from the
+ * map meanwhile may already have been released. The iterator must be
+ * disposed of with `bitcache_map_iter_done()`, and before the map is reset.
+ */
+extern int bitcache_map_iter_init_snapshot(bitcache_map_iter_t* iter,
+  bitcache_map_t* map);
+
 /**
  * Advances a map iterator to the next mapping in the map.
+ *
+ * The returned key points into the map, and remains valid only until the
+ * map is next modified other than through the iterator; for a snapshot
+ * iterator, it remains valid until the iterator is next advanced.
  */
 extern bool bitcache_map_iter_next(bitcache_map_iter_t* iter,
   bitcache_id_t** key,
   void** value);
 
 /**
- * Removes the current mapping pointed to by a map iterator.
+ * Removes the current mapping pointed to by a map iterator. For a snapshot
+ * iterator, the mapping is removed from the map, not from the snapshot.
  */
 extern int bitcache_map_iter_remove(bitcache_map_iter_t* iter);
 
@@ -0,0 +1,644 @@
+/* This is free and unencumbered software released into the public domain. */
+
+#ifndef _BITCACHE_MAP_TABLE_H
+#define _BITCACHE_MAP_TABLE_H
+
+#include <stdbool.h> /* for bool */
+#include <stdint.h>  /* for uint8_t, uint64_t */
+#include <stdlib.h>  /* for free(), posix_memalign() */
+#include <string.h>  /* for memcmp(), memcpy(), memset() */
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+//////////////////////////////////////////////////////////////////////////////
+// Map table (an open-addressing table in the style of Abseil's Swiss tables)
+//
+// Slots are probed a group of 16 at a time. Each slot has a control byte
+// holding either a marker or, for a full slot, a 7-bit tag of its key's
+// hash, so that a single SIMD compare finds the few slots in a group that
+// are worth comparing keys for. Groups are aligned, and probed
+// quadratically; the number of groups is a power of two.
+
+#define BITCACHE_MAP_TABLE_GROUP    16
+#define BITCACHE_MAP_TABLE_EMPTY    ((uint8_t)0x80)
+#define BITCACHE_MAP_TABLE_DELETED  ((uint8_t)0xfe)
+
+// Tables are grown once they would be more than 7/8 full.
+#define bitcache_map_table_max_load(capacity) ((capacity) - (capacity) / 8)
+
+// Tables with at least this many slots are resized incrementally, each
+// insert migrating this many old slots. A resize doubles the capacity at
+// most, so the migration finishes long before the new arrays fill up.
+#define BITCACHE_MAP_TABLE_INCREMENTAL  16384
+#define BITCACHE_MAP_TABLE_MIGRATE      64
+
+// Hashes a key. Digests are already uniformly distributed, so the hash is
+// simply bytes 8..15, which stay independent of the leading bytes used to
+// pick a shard or partition.
+static inline uint64_t
+bitcache_map_table_hash(const bitcache_id_t* key) {
+  uint64_t hash;
+  memcpy(&hash, key->digest.data + 8, sizeof(hash));
+  return hash;
+}
+
+static inline uint8_t
+bitcache_map_table_tag(const uint64_t hash) {
+  return (uint8_t)(hash >> 57);
+}
+
+static inline bool
+bitcache_map_table_key_equal(const bitcache_id_t* key1, const bitcache_id_t* key2) {
+  return memcmp(key1, key2, sizeof(bitcache_id_t)) == 0;
+}
+
+// Returns a bitmask of the slots in a group whose control byte is `value`.
+static inline uint32_t
+bitcache_map_table_match(const uint8_t* group, const uint8_t value) {
+#ifdef __SSE2__
+  const __m128i ctrl = _mm_load_si128((const __m128i*)group);
+  return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)value)));
+#else
+  uint32_t mask = 0;
+  for (unsigned int i = 0; i < BITCACHE_MAP_TABLE_GROUP; i++)
+    mask |= (uint32_t)(group[i] == value) << i;
+  return mask;
+#endif
+}
+
+// Returns a bitmask of the slots in a group that are empty or deleted,
+// i.e. whose control byte has its high bit set.
+static inline uint32_t
+bitcache_map_table_match_free(const uint8_t* group) {
+#ifdef __SSE2__
+  return (uint32_t)_mm_movemask_epi8(_mm_load_si128((const __m128i*)group));
+#else
+  uint32_t mask = 0;
+  for (unsigned int i = 0; i < BITCACHE_MAP_TABLE_GROUP; i++)
+    mask |= (uint32_t)(group[i] >> 7) << i;
+  return mask;
+#endif
+}
+
+static inline size_t
+bitcache_map_table_groups(const bitcache_map_table_t* table) {
+  return table->capacity / BITCACHE_MAP_TABLE_GROUP;
+}
+
+// Returns the slot holding a given key in one set of arrays, or NULL.
+static inline bitcache_map_slot_t*
+bitcache_map_table_probe(const uint8_t* ctrl, bitcache_map_slot_t* slots, const size_t capacity, const bitcache_id_t* key) {
+  const uint64_t hash = bitcache_map_table_hash(key);
+  const uint8_t tag = bitcache_map_table_tag(hash);
+  const size_t mask = capacity / BITCACHE_MAP_TABLE_GROUP - 1;
+
+  // the probe sequence visits every group once, should a reader racing
+  // with writers never happen to see an empty slot:
+  for (size_t i = 0, g = hash & mask; i <= mask; g = (g + ++i) & mask) {
+    const uint8_t* const group = ctrl + g * BITCACHE_MAP_TABLE_GROUP;
+    for (uint32_t m = bitcache_map_table_match(group, tag); m != 0; m &= m - 1) {
+      bitcache_map_slot_t* const slot = &slots[g * BITCACHE_MAP_TABLE_GROUP + __builtin_ctz(m)];
+      if (likely(bitcache_map_table_key_equal(&slot->key, key)))
+        return slot;
+    }
+    if (likely(bitcache_map_table_match(group, BITCACHE_MAP_TABLE_EMPTY) != 0))
+      return NULL; // the key would have been placed in this group
+  }
+  return NULL;
+}
+
+// Returns the slot holding a given key, or NULL. While a resize is under
+// way, keys not yet migrated are found in the old arrays.
+static inline bitcache_map_slot_t*
+bitcache_map_table_find(const bitcache_map_table_t* table, const bitcache_id_t* key) {
+  if (unlikely(table->capacity == 0))
+    return NULL;
+
+  bitcache_map_slot_t* const slot = bitcache_map_table_probe(table->ctrl, table->slots, table->capacity, key);
+  if (likely(slot != NULL) || likely(table->old_ctrl == NULL))
+    return slot;
+  return bitcache_map_table_probe(table->old_ctrl, table->old_slots, table->old_capacity, key);
+}
+
+// Prefetches the first group and slots that a lookup of a key will probe.
+static inline void
+bitcache_map_table_prefetch(const bitcache_map_table_t* table, const bitcache_id_t* key) {
+  if (unlikely(table->capacity == 0))
+    return;
+  const uint64_t hash = bitcache_map_table_hash(key);
+  const size_t g = hash & (bitcache_map_table_groups(table) - 1);
+  prefetch(table->ctrl + g * BITCACHE_MAP_TABLE_GROUP);
+  prefetch(&table->slots[g * BITCACHE_MAP_TABLE_GROUP]);
+}
+
+static inline void
+bitcache_map_table_free(bitcache_map_table_t* table) {
+  free(table->old_ctrl);
+  table->old_ctrl = NULL, table->old_slots = NULL;
+  table->old_capacity = table->migrated = 0;
+  free(table->ctrl);
+  table->ctrl = NULL, table->slots = NULL;
+  table->capacity = table->count = table->growth_left = 0;
+}
+
+// The control bytes and slots share one allocation, the slots starting on
+// the first cache line after the control bytes.
+static inline size_t
+bitcache_map_table_ctrl_size(const size_t capacity) {
+  return (capacity + 63) & ~(size_t)63;
+}
+
+static inline size_t
+bitcache_map_table_memory_size(const size_t capacity) {
+  return bitcache_map_table_ctrl_size(capacity) + capacity * sizeof(bitcache_map_slot_t);
+}
+
+// Lock-free readers of a read-mostly map probe a table while a writer may
+// be changing it, only validating what they found afterwards (see map.c).
+// So that their reads are well defined, writers store whatever such a
+// reader loads atomically: the arrays and capacities, the control bytes,
+// and the slots' keys and values. Reads under the lock need no such care.
+
+typedef uint32_t __attribute__((__may_alias__)) bitcache_map_table_word_t;
+typedef uint64_t __attribute__((__may_alias__)) bitcache_map_table_dword_t;
+
+#define BITCACHE_MAP_TABLE_KEY_WORDS (sizeof(bitcache_id_t) / sizeof(uint32_t))
+
+static inline void
+bitcache_map_table_set_ctrl(uint8_t* ctrl, const size_t i, const uint8_t value) {
+  __atomic_store_n(&ctrl[i], value, __ATOMIC_RELAXED);
+}
+
+// Marks every slot of a set of arrays empty, in place.
+static inline void
+bitcache_map_table_set_empty(uint8_t* ctrl, const size_t capacity) {
+  bitcache_map_table_dword_t* const words = (bitcache_map_table_dword_t*)ctrl;
+  for (size_t i = 0; i < capacity / sizeof(uint64_t); i++)
+    __atomic_store_n(&words[i], 0x8080808080808080ULL, __ATOMIC_RELAXED);
+}
+
+static inline void
+bitcache_map_table_set_key(bitcache_map_slot_t* slot, const bitcache_id_t* key) {
+  bitcache_map_table_word_t* const words = (bitcache_map_table_word_t*)&slot->key;
+  const bitcache_map_table_word_t* const source = (const bitcache_map_table_word_t*)key;
+  for (size_t i = 0; i < BITCACHE_MAP_TABLE_KEY_WORDS; i++)
+    __atomic_store_n(&words[i], source[i], __ATOMIC_RELAXED);
+}
+
+// Stores a slot's value, releasing whatever the value points to along with
+// it, to readers that load it with bitcache_map_table_get_value().
+static inline void
+bitcache_map_table_set_value(bitcache_map_slot_t* slot, const void* value) {
+  __atomic_store_n(&slot->value, (void*)value, __ATOMIC_RELEASE);
+}
+
+static inline void*
+bitcache_map_table_get_value(const bitcache_map_slot_t* slot) {
+  return __atomic_load_n(&slot->value, __ATOMIC_ACQUIRE);
+}
+
+// Points a table at a new set of arrays, or none.
+static inline void
+bitcache_map_table_set_arrays(bitcache_map_table_t* table, uint8_t* ctrl, const size_t capacity) {
+  bitcache_map_slot_t* const slots = (ctrl != NULL) ? (bitcache_map_slot_t*)(ctrl + bitcache_map_table_ctrl_size(capacity)) : NULL;
+  __atomic_store_n(&table->capacity, capacity, __ATOMIC_RELAXED);
+  __atomic_store_n(&table->slots, slots, __ATOMIC_RELEASE);
+  __atomic_store_n(&table->ctrl, ctrl, __ATOMIC_RELEASE);
+}
+
+// Points a table at the arrays it is migrating from, or none.
+static inline void
+bitcache_map_table_set_old_arrays(bitcache_map_table_t* table, uint8_t* ctrl, const size_t capacity) {
+  bitcache_map_slot_t* const slots = (ctrl != NULL) ? (bitcache_map_slot_t*)(ctrl + bitcache_map_table_ctrl_size(capacity)) : NULL;
+  __atomic_store_n(&table->old_capacity, capacity, __ATOMIC_RELAXED);
+  __atomic_store_n(&table->old_slots, slots, __ATOMIC_RELEASE);
+  __atomic_store_n(&table->old_ctrl, ctrl, __ATOMIC_RELEASE);
+}
+
+// Loads as much of a table as a lookup needs, as a lock-free reader. The
+// other fields of the copy are left as they were.
+static inline void
+bitcache_map_table_load(const bitcache_map_table_t* table, bitcache_map_table_t* copy) {
+  copy->ctrl = __atomic_load_n(&table->ctrl, __ATOMIC_ACQUIRE);
+  copy->slots = __atomic_load_n(&table->slots, __ATOMIC_ACQUIRE);
+  copy->capacity = __atomic_load_n(&table->capacity, __ATOMIC_RELAXED);
+  copy->old_ctrl = __atomic_load_n(&table->old_ctrl, __ATOMIC_ACQUIRE);
+  copy->old_slots = __atomic_load_n(&table->old_slots, __ATOMIC_ACQUIRE);
+  copy->old_capacity = __atomic_load_n(&table->old_capacity, __ATOMIC_RELAXED);
+}
+
+// As bitcache_map_table_match(), for a lock-free reader.
+static inline uint32_t
+bitcache_map_table_match_shared(const uint8_t* group, const uint8_t value) {
+#ifdef __SSE2__
+  const bitcache_map_table_dword_t* const words = (const bitcache_map_table_dword_t*)group;
+  const __m128i ctrl = _mm_set_epi64x((long long)__atomic_load_n(&words[1], __ATOMIC_RELAXED),
+    (long long)__atomic_load_n(&words[0], __ATOMIC_RELAXED));
+  return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)value)));
+#else
+  uint32_t mask = 0;
+  for (unsigned int i = 0; i < BITCACHE_MAP_TABLE_GROUP; i++)
+    mask |= (uint32_t)(__atomic_load_n(&group[i], __ATOMIC_RELAXED) == value) << i;
+  return mask;
+#endif
+}
+
+static inline bool
+bitcache_map_table_key_equal_shared(const bitcache_map_slot_t* slot, const bitcache_id_t* key) {
+  const bitcache_map_table_word_t* const words = (const bitcache_map_table_word_t*)&slot->key;
+  const bitcache_map_table_word_t* const expected = (const bitcache_map_table_word_t*)key;
+  uint32_t diff = 0;
+  for (size_t i = 0; i < BITCACHE_MAP_TABLE_KEY_WORDS; i++)
+    diff |= __atomic_load_n(&words[i], __ATOMIC_RELAXED) ^ expected[i];
+  return diff == 0;
+}
+
+// As bitcache_map_table_probe(), for a lock-free reader.
+static inline bitcache_map_slot_t*
+bitcache_map_table_probe_shared(const uint8_t* ctrl, bitcache_map_slot_t* slots, const size_t capacity, const bitcache_id_t* key) {
+  const uint64_t hash = bitcache_map_table_hash(key);
+  const uint8_t tag = bitcache_map_table_tag(hash);
+  const size_t mask = capacity / BITCACHE_MAP_TABLE_GROUP - 1;
+
+  for (size_t i = 0, g = hash & mask; i <= mask; g = (g + ++i) & mask) {
+    const uint8_t* const group = ctrl + g * BITCACHE_MAP_TABLE_GROUP;
+    for (uint32_t m = bitcache_map_table_match_shared(group, tag); m != 0; m &= m - 1) {
+      bitcache_map_slot_t* const slot = &slots[g * BITCACHE_MAP_TABLE_GROUP + __builtin_ctz(m)];
+      if (likely(bitcache_map_table_key_equal_shared(slot, key)))
+        return slot;
+    }
+    if (likely(bitcache_map_table_match_shared(group, BITCACHE_MAP_TABLE_EMPTY) != 0))
+      return NULL;
+  }
+  return NULL;
+}
+
+// As bitcache_map_table_find(), for a lock-free reader, given a table
+// loaded with bitcache_map_table_load().
+static inline bitcache_map_slot_t*
+bitcache_map_table_find_shared(const bitcache_map_table_t* table, const bitcache_id_t* key) {
+  if (unlikely(table->capacity == 0))
+    return NULL;
+
+  bitcache_map_slot_t* const slot = bitcache_map_table_probe_shared(table->ctrl, table->slots, table->capacity, key);
+  if (likely(slot != NULL) || likely(table->old_ctrl == NULL))
+    return slot;
+  return bitcache_map_table_probe_shared(table->old_ctrl, table->old_slots, table->old_capacity, key);
+}
+
+// Allocates an empty table with a given capacity, a power of two no
+// smaller than a group.
+static inline int
+bitcache_map_table_alloc(bitcache_map_table_t* table, const size_t capacity) {
+  void* memory = NULL;
+  if (unlikely(posix_memalign(&memory, 64, bitcache_map_table_memory_size(capacity)) != 0))
+    return -(errno = ENOMEM); // cannot allocate memory
+
+  memset(memory, BITCACHE_MAP_TABLE_EMPTY, capacity);
+  bitcache_map_table_set_arrays(table, memory, capacity);
+  table->count = 0;
+  table->growth_left = bitcache_map_table_max_load(capacity);
+  return 0;
+}
+
+// Snapshots share a table's arrays rather than copying them. Before the
+// table writes to a chunk of slots that a snapshot may still be reading,
+// it keeps the chunk's previous contents in a shadow of the arrays, once
+// per snapshot, so that a write costs a chunk's copy at the most. Arrays
+// that the table is done with are left to a shadow still needing them.
+// Shadows are guarded by the table's lock, except for their copies and
+// flags, which snapshots read without it.
+
+#define BITCACHE_MAP_TABLE_CHUNK 1024
+
+typedef struct bitcache_map_table_shadow_t {
+  struct bitcache_map_table_shadow_t* next;
+  uint8_t* ctrl;   // the arrays shadowed
+  size_t capacity;
+  uint8_t* copy;   // laid out as the arrays, filled in a chunk at a time
+  uint8_t* saved;  // one flag per chunk, set once the chunk is in the copy
+  bool owned;      // whether the table has left the arrays to this shadow
+} bitcache_map_table_shadow_t;
+
+static inline size_t
+bitcache_map_table_chunks(const size_t capacity) {
+  return (capacity + BITCACHE_MAP_TABLE_CHUNK - 1) / BITCACHE_MAP_TABLE_CHUNK;
+}
+
+// Allocates the copy of a set of arrays that a shadow keeps chunks in. The
+// copy is only written to a chunk at a time, so that a large one costs
+// next to nothing until the table changes.
+static inline int
+bitcache_map_table_shadow_alloc(bitcache_map_table_shadow_t* shadow) {
+  if (shadow->saved != NULL)
+    return 0;
+  void* copy = shadow->copy;
+  if (copy == NULL && unlikely(posix_memalign(&copy, 64, bitcache_map_table_memory_size(shadow->capacity)) != 0))
+    return -(errno = ENOMEM); // cannot allocate memory
+  shadow->copy = copy;
+  uint8_t* const saved = calloc(bitcache_map_table_chunks(shadow->capacity), 1);
+  if (unlikely(saved == NULL))
+    return -(errno = ENOMEM); // cannot allocate memory
+  __atomic_store_n(&shadow->saved, saved, __ATOMIC_RELEASE);
+  return 0;
+}
+
+// Copies `n` slots of a set of arrays, control bytes and all, from slot
+// `begin` on, into separate control bytes and slots.
+static inline void
+bitcache_map_table_copy_out(const uint8_t* ctrl, const size_t capacity, const size_t begin, const size_t n, uint8_t* ctrl_out, bitcache_map_slot_t* slots_out) {
+  const bitcache_map_slot_t* const slots = (const bitcache_map_slot_t*)(ctrl + bitcache_map_table_ctrl_size(capacity));
+  memcpy(ctrl_out, ctrl + begin, n);
+  memcpy(slots_out, slots + begin, n * sizeof(bitcache_map_slot_t));
+}
+
+// Keeps the chunk holding slot `i` of a set of arrays in every shadow of
+// them that doesn't have it yet, before the table writes to the chunk.
+static inline void
+bitcache_map_table_preserve(const bitcache_map_table_t* table, const uint8_t* ctrl, const size_t capacity, const size_t i) {
+  if (likely(table->shadows == NULL))
+    return;
+  const size_t chunk = i / BITCACHE_MAP_TABLE_CHUNK;
+  const size_t begin = chunk * BITCACHE_MAP_TABLE_CHUNK;
+  const size_t n = (capacity - begin < BITCACHE_MAP_TABLE_CHUNK) ? capacity - begin : BITCACHE_MAP_TABLE_CHUNK;
+  for (bitcache_map_table_shadow_t* shadow = table->shadows; shadow != NULL; shadow = shadow->next) {
+    if (shadow->ctrl != ctrl || shadow->saved == NULL || shadow->saved[chunk] != 0)
+      continue;
+    bitcache_map_table_copy_out(ctrl, capacity, begin, n, shadow->copy + begin,
+      (bitcache_map_slot_t*)(shadow->copy + bitcache_map_table_ctrl_size(capacity)) + begin);
+    __atomic_store_n(&shadow->saved[chunk], 1, __ATOMIC_RELEASE);
+  }
+  // order the flags before the writes that follow, so that a snapshot that
+  // sees any of those writes also sees the flags:
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+// Copies the chunk of slots from `begin` on out of a set of arrays, as of
+// when a shadow of them was made, racing with any writes to the table.
+static inline void
+bitcache_map_table_shadow_read(const bitcache_map_table_shadow_t* shadow, const uint8_t* ctrl, const size_t capacity, const size_t begin, uint8_t* ctrl_out, bitcache_map_slot_t* slots_out) {
+  const size_t chunk = begin / BITCACHE_MAP_TABLE_CHUNK;
+  const size_t n = (capacity - begin < BITCACHE_MAP_TABLE_CHUNK) ? capacity - begin : BITCACHE_MAP_TABLE_CHUNK;
+  for (bool retry = FALSE; ; retry = TRUE) {
+    const uint8_t* const saved = (shadow != NULL) ? __atomic_load_n(&shadow->saved, __ATOMIC_ACQUIRE) : NULL;
+    if (saved != NULL && __atomic_load_n(&saved[chunk], __ATOMIC_ACQUIRE) != 0) {
+      bitcache_map_table_copy_out(shadow->copy, capacity, begin, n, ctrl_out, slots_out);
+      return;
+    }
+    if (retry)
+      return; // unchanged while it was being copied
+    bitcache_map_table_copy_out(ctrl, capacity, begin, n, ctrl_out, slots_out);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  }
+}
+
+// Hands a set of arrays that the table is done with to `release`, unless a
+// shadow still needs them, in which case they're left to the shadow.
+static inline void
+bitcache_map_table_release(const bitcache_map_table_t* table, uint8_t* ctrl, const free_func_t release) {
+  for (bitcache_map_table_shadow_t* shadow = table->shadows; shadow != NULL; shadow = shadow->next) {
+    if (shadow->ctrl == ctrl) {
+      shadow->owned = TRUE;
+      return;
+    }
+  }
+  release(ctrl);
+}
+
+// Unlinks a shadow from a table once no snapshot needs it, then releases
+// the arrays, if they were left to it and no other shadow needs them.
+static inline void
+bitcache_map_table_unshadow(bitcache_map_table_t* table, bitcache_map_table_shadow_t* shadow, const free_func_t release) {
+  for (bitcache_map_table_shadow_t** p = &table->shadows; *p != NULL; p = &(*p)->next) {
+    if (*p == shadow) {
+      *p = shadow->next;
+      break;
+    }
+  }
+  if (shadow->owned)
+    bitcache_map_table_release(table, shadow->ctrl, release);
+  free(shadow->copy);
+  free(shadow->saved);
+  shadow->copy = shadow->saved = NULL;
+  shadow->ctrl = NULL, shadow->owned = FALSE;
+}
+
+// Returns the first free slot in the probe sequence for a hash.
+static inline size_t
+bitcache_map_table_find_free(const bitcache_map_table_t* table, const uint64_t hash) {
+  const size_t mask = bitcache_map_table_groups(table) - 1;
+  for (size_t i = 0, g = hash & mask; ; g = (g + ++i) & mask) {
+    const uint32_t m = bitcache_map_table_match_free(table->ctrl + g * BITCACHE_MAP_TABLE_GROUP);
+    if (likely(m != 0))
+      return g * BITCACHE_MAP_TABLE_GROUP + __builtin_ctz(m);
+  }
+}
+
+// Moves up to `budget` old slots into the new arrays, releasing the old
+// arrays once all of them have been moved. Migrated old slots are marked
+// deleted, so that probes for keys still to be migrated carry on past them.
+static inline void
+bitcache_map_table_migrate(bitcache_map_table_t* table, const size_t budget, const free_func_t release) {
+  const size_t end = (budget < table->old_capacity - table->migrated) ? table->migrated + budget : table->old_capacity;
+  for (size_t i = table->migrated; i < end; i++) {
+    if (table->old_ctrl[i] & 0x80)
+      continue; // empty or deleted
+    const uint64_t hash = bitcache_map_table_hash(&table->old_slots[i].key);
+    const size_t j = bitcache_map_table_find_free(table, hash);
+    bitcache_map_table_preserve(table, table->old_ctrl, table->old_capacity, i);
+    bitcache_map_table_preserve(table, table->ctrl, table->capacity, j);
+    if (table->ctrl[j] == BITCACHE_MAP_TABLE_EMPTY)
+      table->growth_left--;
+    bitcache_map_slot_t* const slot = &table->slots[j];
+    bitcache_map_table_set_key(slot, &table->old_slots[i].key);
+    __atomic_store_n(&slot->meta, table->old_slots[i].meta, __ATOMIC_RELAXED);
+    bitcache_map_table_set_value(slot, table->old_slots[i].value);
+    bitcache_map_table_set_ctrl(table->ctrl, j, bitcache_map_table_tag(hash));
+    bitcache_map_table_set_ctrl(table->old_ctrl, i, BITCACHE_MAP_TABLE_DELETED);
+  }
+  table->migrated = end;
+
+  if (table->migrated == table->old_capacity) {
+    bitcache_map_table_release(table, table->old_ctrl, release);
+    bitcache_map_table_set_old_arrays(table, NULL, 0);
+    table->migrated = 0;
+  }
+}
+
+// Rebuilds a table with a given capacity, dropping any deleted markers. The
+// old control bytes and slots are handed to `release`, which may defer
+// freeing them until no reader can still be probing them. Large tables are
+// only switched over to the new arrays here, and migrated incrementally.
+static inline int
+bitcache_map_table_rehash(bitcache_map_table_t* table, const size_t capacity, const free_func_t release) {
+  const bitcache_map_table_t old = *table;
+  const int rc = bitcache_map_table_alloc(table, capacity);
+  if (unlikely(rc < 0))
+    return rc; // the table is left as it was
+
+  table->count = old.count;
+  table->migrated = 0;
+  bitcache_map_table_set_old_arrays(table, old.ctrl, old.capacity);
+
+  if (old.capacity < BITCACHE_MAP_TABLE_INCREMENTAL)
+    bitcache_map_table_migrate(table, old.capacity, release);
+  return 0;
+}
+
+// Makes room for one more key, either by doubling the table or, if it is
+// mostly deleted markers, by rebuilding it at the same capacity.
+static inline int
+bitcache_map_table_reserve(bitcache_map_table_t* table, const free_func_t release) {
+  if (likely(table->growth_left > 0))
+    return 0;
+  if (unlikely(table->old_ctrl != NULL)) {
+    // should inserts ever outpace the migration, finish it first:
+    bitcache_map_table_migrate(table, table->old_capacity, release);
+    if (table->growth_left > 0)
+      return 0;
+  }
+  if (table->capacity == 0)
+    return bitcache_map_table_alloc(table, BITCACHE_MAP_TABLE_GROUP);
+  if (table->count * 2 <= bitcache_map_table_max_load(table->capacity))
+    return bitcache_map_table_rehash(table, table->capacity, release);
+  return bitcache_map_table_rehash(table, table->capacity * 2, release);
+}
+
+// Keeps the chunk holding a given slot, in either set of arrays, for any
+// snapshot still reading it.
+static inline void
+bitcache_map_table_preserve_slot(const bitcache_map_table_t* table, const bitcache_map_slot_t* slot) {
+  if (table->old_ctrl != NULL && slot >= table->old_slots && slot < table->old_slots + table->old_capacity)
+    bitcache_map_table_preserve(table, table->old_ctrl, table->old_capacity, slot - table->old_slots);
+  else
+    bitcache_map_table_preserve(table, table->ctrl, table->capacity, slot - table->slots);
+}
+
+// Returns the slot for a given key, claiming a free slot (with the key
+// copied into it) if the key is not yet present; returns NULL if the table
+// could not grow.
+static inline bitcache_map_slot_t*
+bitcache_map_table_insert(bitcache_map_table_t* table, const bitcache_id_t* key, bool* inserted, const free_func_t release) {
+  bitcache_map_slot_t* slot = bitcache_map_table_find(table, key);
+  if (slot != NULL) {
+    // the caller is about to store a new value:
+    if (unlikely(table->shadows != NULL))
+      bitcache_map_table_preserve_slot(table, slot);
+    *inserted = FALSE;
+    return slot;
+  }
+
+  if (unlikely(table->old_ctrl != NULL))
+    bitcache_map_table_migrate(table, BITCACHE_MAP_TABLE_MIGRATE, release);
+
+  if (unlikely(bitcache_map_table_reserve(table, release) < 0))
+    return NULL; // cannot allocate memory
+
+  const uint64_t hash = bitcache_map_table_hash(key);
+  const size_t i = bitcache_map_table_find_free(table, hash);
+  bitcache_map_table_preserve(table, table->ctrl, table->capacity, i);
+  if (table->ctrl[i] == BITCACHE_MAP_TABLE_EMPTY)
+    table->growth_left--; // reusing a deleted slot costs nothing
+  table->count++;
+
+  slot = &table->slots[i];
+  bitcache_map_table_set_key(slot, key);
+  __atomic_store_n(&slot->meta, 0, __ATOMIC_RELAXED);
+  bitcache_map_table_set_value(slot, NULL);
+  bitcache_map_table_set_ctrl(table->ctrl, i, bitcache_map_table_tag(hash));
+  *inserted = TRUE;
+  return slot;
+}
+
+// Frees up a full slot. Probes stop at the first group with an empty slot,
+// so the slot can only become empty again if its group already has one;
+// otherwise, it is marked deleted so that probes carry on past it.
+static inline void
+bitcache_map_table_erase(bitcache_map_table_t* table, bitcache_map_slot_t* slot) {
+  if (unlikely(table->shadows != NULL))
+    bitcache_map_table_preserve_slot(table, slot);
+
+  if (unlikely(table->old_ctrl != NULL) &&
+      slot >= table->old_slots && slot < table->old_slots + table->old_capacity) {
+    // not yet migrated; the old arrays are never inserted into again:
+    bitcache_map_table_set_ctrl(table->old_ctrl, slot - table->old_slots, BITCACHE_MAP_TABLE_DELETED);
+    table->count--;
+    return;
+  }
+
+  const size_t i = slot - table->slots;
+  const uint8_t* const group = table->ctrl + (i & ~(size_t)(BITCACHE_MAP_TABLE_GROUP - 1));
+  if (bitcache_map_table_match(group, BITCACHE_MAP_TABLE_EMPTY) != 0) {
+    bitcache_map_table_set_ctrl(table->ctrl, i, BITCACHE_MAP_TABLE_EMPTY);
+    table->growth_left++;
+  }
+  else {
+    bitcache_map_table_set_ctrl(table->ctrl, i, BITCACHE_MAP_TABLE_DELETED);
+  }
+  table->count--;
+}
+
+// Leaves a table's arrays to the shadows still needing them, or else
+// releases them, and starts the table over empty.
+static inline void
+bitcache_map_table_abandon(bitcache_map_table_t* table, const free_func_t release) {
+  if (table->old_ctrl != NULL)
+    bitcache_map_table_release(table, table->old_ctrl, release);
+  if (table->ctrl != NULL)
+    bitcache_map_table_release(table, table->ctrl, release);
+  bitcache_map_table_set_old_arrays(table, NULL, 0);
+  bitcache_map_table_set_arrays(table, NULL, 0);
+  table->count = table->growth_left = table->migrated = 0;
+}
+
+// Slots are indexed across both sets of arrays while a resize is under
+// way: the new slots first, then the old ones.
+static inline size_t
+bitcache_map_table_end(const bitcache_map_table_t* table) {
+  return table->capacity + table->old_capacity;
+}
+
+static inline uint8_t
+bitcache_map_table_ctrl_at(const bitcache_map_table_t* table, const size_t i) {
+  return (i < table->capacity) ? table->ctrl[i] : table->old_ctrl[i - table->capacity];
+}
+
+static inline bitcache_map_slot_t*
+bitcache_map_table_slot_at(const bitcache_map_table_t* table, const size_t i) {
+  return (i < table->capacity) ? &table->slots[i] : &table->old_slots[i - table->capacity];
+}
+
+// Returns the index of the first full slot at or after `i`, or the end
+// index if there is none.
+static inline size_t
+bitcache_map_table_next(const bitcache_map_table_t* table, size_t i) {
+  const size_t end = bitcache_map_table_end(table);
+  while (i < end && (bitcache_map_table_ctrl_at(table, i) & 0x80) != 0)
+    i++;
+  return i;
+}
+
+// Destroys every value in a table, then empties it, handing any arrays
+// being migrated from to `release`. Tables still shadowed for snapshots
+// are better abandoned, sparing the shadows a copy of every chunk.
+static inline void
+bitcache_map_table_clear(bitcache_map_table_t* table, const free_func_t value_destroy_func, const free_func_t release) {
+  if (table->capacity == 0)
+    return;
+  if (value_destroy_func != NULL) {
+    for (size_t i = bitcache_map_table_next(table, 0); i < bitcache_map_table_end(table); i = bitcache_map_table_next(table, i + 1))
+      value_destroy_func(bitcache_map_table_slot_at(table, i)->value);
+  }
+  if (table->old_ctrl != NULL) {
+    bitcache_map_table_release(table, table->old_ctrl, release);
+    bitcache_map_table_set_old_arrays(table, NULL, 0);
+    table->migrated = 0;
+  }
+  bitcache_map_table_set_empty(table->ctrl, table->capacity);
+  table->count = 0;
+  table->growth_left = bitcache_map_table_max_load(table->capacity);
+}
+
+#endif /* _BITCACHE_MAP_TABLE_H */
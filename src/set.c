@@ -1,7 +1,16 @@
 /* This is free and unencumbered software released into the public domain. */
 
 #include "build.h"
+#include "filter_hash.h" /* for bitcache_filter_range64() */
+#include "id_pack.h"
+#include "set_flat.h"
+#include "set_frozen.h"
 #include "set_hash.h"
+#include "set_sorted.h"
+#include "thread.h"
+#include <sys/mman.h> /* for mmap(), munmap() */
+#include <sys/stat.h> /* for fstat() */
+#include <unistd.h>   /* for getpagesize(), lseek(), pread() */
 
 //////////////////////////////////////////////////////////////////////////////
 // Set API
@@ -142,6 +151,643 @@ bitcache_set_replace(bitcache_set_t* set, const bitcache_id_t* restrict id1, con
   return -(errno = ENOTSUP); // operation not supported
 }
 
+long
+bitcache_set_lookup_many(bitcache_set_t* set, const bitcache_id_t* ids, const size_t count, bool* found) {
+  validate_with_errno_return(set != NULL && (ids != NULL || count == 0));
+
+  const bitcache_set_class_t* const class = set->class;
+
+  if (likely(class == NULL)) // static dispatch
+    return bitcache_set_hash_lookup_many(set, ids, count, found);
+
+  if (likely(class->lookup_many != NULL)) // virtual dispatch
+    return class->lookup_many(set, ids, count, found);
+
+  if (likely(class->lookup != NULL)) { // one identifier at a time
+    long hits = 0;
+    for (size_t i = 0; i < count; i++) {
+      const bool hit = class->lookup(set, &ids[i]);
+      if (found != NULL)
+        found[i] = hit;
+      hits += hit;
+    }
+    return hits;
+  }
+
+  return -(errno = ENOTSUP); // operation not supported
+}
+
+int
+bitcache_set_insert_many(bitcache_set_t* set, const bitcache_id_t* ids, const size_t count) {
+  validate_with_errno_return(set != NULL && (ids != NULL || count == 0));
+
+  const bitcache_set_class_t* const class = set->class;
+
+  if (likely(class == NULL)) // static dispatch
+    return bitcache_set_hash_insert_many(set, ids, count);
+
+  if (likely(class->insert_many != NULL)) // virtual dispatch
+    return class->insert_many(set, ids, count);
+
+  return -(errno = ENOTSUP); // operation not supported
+}
+
+long
+bitcache_set_remove_many(bitcache_set_t* set, const bitcache_id_t* ids, const size_t count) {
+  validate_with_errno_return(set != NULL && (ids != NULL || count == 0));
+
+  const bitcache_set_class_t* const class = set->class;
+
+  if (likely(class == NULL)) // static dispatch
+    return bitcache_set_hash_remove_many(set, ids, count);
+
+  if (likely(class->remove_many != NULL)) // virtual dispatch
+    return class->remove_many(set, ids, count);
+
+  if (likely(class->lookup != NULL && class->remove != NULL)) { // one identifier at a time
+    long hits = 0;
+    for (size_t i = 0; i < count; i++) {
+      if (!class->lookup(set, &ids[i]))
+        continue;
+      const int rc = class->remove(set, &ids[i]);
+      if (unlikely(rc < 0))
+        return rc;
+      hits++;
+    }
+    return hits;
+  }
+
+  return -(errno = ENOTSUP); // operation not supported
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Set Algebra API
+
+#define bitcache_set_is_sorted(set) ((set)->class == &bitcache_set_sorted)
+
+// The fewest identifiers worth probing for on a thread of their own.
+#define BITCACHE_SET_PROBE_MIN 16384
+
+// Copies the identifiers of a set into a fresh array, which the caller
+// frees. Returns their number, or a negative error.
+static long
+bitcache_set_collect(bitcache_set_t* set, bitcache_id_t** ids) {
+  const bitcache_set_class_t* const class = set->class;
+
+  if (likely(class == NULL || class == &bitcache_set_hash))
+    return bitcache_set_hash_collect(set, ids);
+
+  if (class == &bitcache_set_sorted)
+    return bitcache_set_sorted_collect(set, ids);
+
+  if (class == &bitcache_set_flat)
+    return bitcache_set_flat_collect(set, ids);
+
+  if (class == &bitcache_set_frozen)
+    return bitcache_set_frozen_collect(set, ids);
+
+  return (*ids = NULL), -(errno = ENOTSUP); // operation not supported
+}
+
+// Replaces the contents of a set with an array of distinct identifiers,
+// taking ownership of the array.
+static int
+bitcache_set_assign(bitcache_set_t* set, bitcache_id_t* ids, const size_t count, const bool sorted) {
+  if (sorted && bitcache_set_is_sorted(set))
+    return bitcache_set_sorted_adopt(set, ids, count), 0;
+
+  int rc = bitcache_set_clear(set);
+  if (likely(rc == 0))
+    rc = bitcache_set_insert_many(set, ids, count);
+  free(ids);
+  return rc;
+}
+
+// Packs the identifiers that were, or were not, found to the front of an
+// array, preserving their order. Returns their number.
+static size_t
+bitcache_set_select(bitcache_id_t* ids, const size_t count, const bool* found, const bool wanted) {
+  size_t n = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (found[i] == wanted)
+      ids[n++] = ids[i];
+  }
+  return n;
+}
+
+typedef struct {
+  bitcache_set_t* set;
+  const bitcache_id_t* ids;
+  size_t count;
+  bool* found;
+  long hits;
+} bitcache_set_probe_t;
+
+static void*
+bitcache_set_probe_slice(void* arg) {
+  bitcache_set_probe_t* const slice = arg;
+  slice->hits = bitcache_set_lookup_many(slice->set, slice->ids, slice->count, slice->found);
+  return NULL;
+}
+
+// Looks up a batch of identifiers in a set, on a given number of threads
+// (zero selecting one per online CPU). Returns the number found, or a
+// negative error.
+static long
+bitcache_set_probe(bitcache_set_t* set, const bitcache_id_t* ids, const size_t count, bool* found, const unsigned int threads) {
+  const size_t n = bitcache_thread_count(threads, count, BITCACHE_SET_PROBE_MIN);
+  if (n <= 1)
+    return bitcache_set_lookup_many(set, ids, count, found);
+
+  bitcache_set_probe_t slices[n];
+  for (size_t t = 0; t < n; t++) {
+    const size_t lo = (count * t) / n;
+    slices[t].set = set;
+    slices[t].ids = ids + lo;
+    slices[t].count = (count * (t + 1)) / n - lo;
+    slices[t].found = (found != NULL) ? found + lo : NULL;
+    slices[t].hits = 0;
+  }
+
+  bitcache_thread_run(bitcache_set_probe_slice, slices, sizeof(slices[0]), n);
+
+  long hits = 0;
+  for (size_t t = 0; t < n; t++) {
+    if (unlikely(slices[t].hits < 0))
+      return slices[t].hits;
+    hits += slices[t].hits;
+  }
+  return hits;
+}
+
+int
+bitcache_set_union(bitcache_set_t* result, bitcache_set_t* set1, bitcache_set_t* set2, const unsigned int threads) {
+  validate_with_errno_return(result != NULL && set1 != NULL && set2 != NULL);
+
+  bitcache_id_t* ids = NULL;
+  long n;
+
+  if (bitcache_set_is_sorted(set1) && bitcache_set_is_sorted(set2)) { // merge
+    if (unlikely((n = bitcache_set_sorted_combine(set1, set2, BITCACHE_SET_SORTED_UNION, threads, &ids)) < 0))
+      return free(ids), n;
+    return bitcache_set_assign(result, ids, n, TRUE);
+  }
+
+  if (result == set2) { // the union is symmetric
+    bitcache_set_t* const set = set1;
+    set1 = set2, set2 = set;
+  }
+
+  if (unlikely((n = bitcache_set_collect(set2, &ids)) < 0))
+    return free(ids), n;
+
+  int rc = 0;
+  if (result != set1) { // start over from a copy of the first set
+    bitcache_id_t* ids1 = NULL;
+    const long n1 = bitcache_set_collect(set1, &ids1);
+    if (unlikely(n1 < 0))
+      rc = n1, free(ids1);
+    else
+      rc = bitcache_set_assign(result, ids1, n1, bitcache_set_is_sorted(set1));
+  }
+  if (likely(rc == 0))
+    rc = bitcache_set_insert_many(result, ids, n);
+  free(ids);
+  return rc;
+}
+
+int
+bitcache_set_intersect(bitcache_set_t* result, bitcache_set_t* set1, bitcache_set_t* set2, const unsigned int threads) {
+  validate_with_errno_return(result != NULL && set1 != NULL && set2 != NULL);
+
+  bitcache_id_t* ids = NULL;
+  long n;
+
+  if (bitcache_set_is_sorted(set1) && bitcache_set_is_sorted(set2)) { // merge
+    if (unlikely((n = bitcache_set_sorted_combine(set1, set2, BITCACHE_SET_SORTED_INTERSECTION, threads, &ids)) < 0))
+      return free(ids), n;
+    return bitcache_set_assign(result, ids, n, TRUE);
+  }
+
+  // probe the larger set for the identifiers of the smaller one:
+  const long count1 = bitcache_set_count(set1), count2 = bitcache_set_count(set2);
+  if (unlikely(count1 < 0 || count2 < 0))
+    return (count1 < 0) ? count1 : count2;
+  bitcache_set_t* const small = (count2 < count1) ? set2 : set1;
+  bitcache_set_t* const large = (count2 < count1) ? set1 : set2;
+
+  if (unlikely((n = bitcache_set_collect(small, &ids)) < 0))
+    return free(ids), n;
+
+  long rc = 0;
+  bool* const found = malloc(n > 0 ? n : 1);
+  if (unlikely(found == NULL))
+    rc = -errno; // cannot allocate memory
+  else if (likely((rc = bitcache_set_probe(large, ids, n, found, threads)) >= 0)) {
+    if (result == small) { // drop what the larger set lacks
+      rc = bitcache_set_remove_many(result, ids, bitcache_set_select(ids, n, found, FALSE));
+    }
+    else {
+      rc = bitcache_set_assign(result, ids, bitcache_set_select(ids, n, found, TRUE), bitcache_set_is_sorted(small));
+      ids = NULL;
+    }
+  }
+  free(found);
+  free(ids);
+  return (rc < 0) ? rc : 0;
+}
+
+int
+bitcache_set_difference(bitcache_set_t* result, bitcache_set_t* set1, bitcache_set_t* set2, const unsigned int threads) {
+  validate_with_errno_return(result != NULL && set1 != NULL && set2 != NULL);
+
+  bitcache_id_t* ids = NULL;
+  long n;
+
+  if (unlikely(set1 == set2))
+    return bitcache_set_clear(result);
+
+  if (bitcache_set_is_sorted(set1) && bitcache_set_is_sorted(set2)) { // merge
+    if (unlikely((n = bitcache_set_sorted_combine(set1, set2, BITCACHE_SET_SORTED_DIFFERENCE, threads, &ids)) < 0))
+      return free(ids), n;
+    return bitcache_set_assign(result, ids, n, TRUE);
+  }
+
+  long rc = 0;
+
+  if (result == set1 && result != set2) {
+    const long count1 = bitcache_set_count(set1), count2 = bitcache_set_count(set2);
+    if (unlikely(count1 < 0 || count2 < 0))
+      return (count1 < 0) ? count1 : count2;
+    if (count2 < count1) { // remove the smaller set from the larger one
+      if (unlikely((n = bitcache_set_collect(set2, &ids)) < 0))
+        return free(ids), n;
+      rc = bitcache_set_remove_many(result, ids, n);
+      free(ids);
+      return (rc < 0) ? rc : 0;
+    }
+  }
+
+  // probe the second set for the identifiers of the first one:
+  if (unlikely((n = bitcache_set_collect(set1, &ids)) < 0))
+    return free(ids), n;
+
+  bool* const found = malloc(n > 0 ? n : 1);
+  if (unlikely(found == NULL))
+    rc = -errno; // cannot allocate memory
+  else if (likely((rc = bitcache_set_probe(set2, ids, n, found, threads)) >= 0)) {
+    if (result == set1) { // drop what the second set has
+      rc = bitcache_set_remove_many(result, ids, bitcache_set_select(ids, n, found, TRUE));
+    }
+    else {
+      rc = bitcache_set_assign(result, ids, bitcache_set_select(ids, n, found, FALSE), bitcache_set_is_sorted(set1));
+      ids = NULL;
+    }
+  }
+  free(found);
+  free(ids);
+  return (rc < 0) ? rc : 0;
+}
+
+bool
+bitcache_set_is_subset(bitcache_set_t* set1, bitcache_set_t* set2, const unsigned int threads) {
+  validate_with_false_return(set1 != NULL && set2 != NULL);
+
+  if (unlikely(set1 == set2))
+    return TRUE;
+
+  const long count1 = bitcache_set_count(set1), count2 = bitcache_set_count(set2);
+  if (unlikely(count1 < 0 || count2 < 0) || count1 > count2)
+    return FALSE;
+
+  if (bitcache_set_is_sorted(set1) && bitcache_set_is_sorted(set2)) // merge
+    return bitcache_set_sorted_combine(set1, set2, BITCACHE_SET_SORTED_DIFFERENCE, threads, NULL) == 0;
+
+  // probe the second set for the identifiers of the first one:
+  bitcache_id_t* ids = NULL;
+  const long n = bitcache_set_collect(set1, &ids);
+  const bool subset = (n >= 0 && bitcache_set_probe(set2, ids, n, NULL, threads) == n);
+  free(ids);
+  return subset;
+}
+
+int
+bitcache_set_frozen_build_from(bitcache_set_t* set, bitcache_set_t* source) {
+  validate_with_errno_return(set != NULL && source != NULL);
+
+  bitcache_id_t* ids = NULL;
+  const long count = bitcache_set_collect(source, &ids);
+  const int rc = (count < 0) ? (int)count : bitcache_set_frozen_build(set, ids, count);
+  free(ids);
+  return rc;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Set Build API
+//
+// A bulk build partitions the identifiers on as many threads as it uses:
+// each thread counts how many identifiers of its slice of the input fall
+// into each partition, then scatters them to their partitions, and finally
+// builds one partition. Sorted sets are partitioned by identifier prefix,
+// so that the sorted partitions need only be packed together; flat sets
+// are partitioned by the range of table groups their probes start in.
+
+// The fewest identifiers worth handing to a thread of their own.
+#define BITCACHE_SET_BUILD_MIN 65536
+
+typedef struct {
+  const bitcache_id_t* ids;  // this thread's slice of the input
+  size_t count;
+  size_t n;                  // number of partitions, one per thread
+  size_t* cursors;           // where this slice goes in each partition
+  bitcache_id_t* out;        // the partitioned identifiers
+  bitcache_set_flat_t* flat; // the table being filled, if any
+  unsigned int bits;         // log2 of the number of groups in the table
+  size_t part;               // this thread's partition, out[lo..hi)
+  size_t lo, hi;
+  size_t kept;               // distinct (sorted) or deferred (flat) identifiers
+  size_t placed;             // number of slots filled (flat)
+} bitcache_set_build_t;
+
+// Returns the partition of an identifier.
+static inline size_t
+bitcache_set_build_part(const bitcache_set_build_t* job, const bitcache_id_t* id) {
+  if (job->flat == NULL)
+    return bitcache_filter_range64(bitcache_set_sorted_prefix(id), job->n);
+  const size_t g = bitcache_map_table_hash(id) & (((size_t)1 << job->bits) - 1);
+  return (g * job->n) >> job->bits;
+}
+
+static void*
+bitcache_set_build_count(void* arg) {
+  bitcache_set_build_t* const job = arg;
+  for (size_t i = 0; i < job->count; i++)
+    job->cursors[bitcache_set_build_part(job, &job->ids[i])]++;
+  return NULL;
+}
+
+static void*
+bitcache_set_build_scatter(void* arg) {
+  bitcache_set_build_t* const job = arg;
+  for (size_t i = 0; i < job->count; i++)
+    memcpy(&job->out[job->cursors[bitcache_set_build_part(job, &job->ids[i])]++], &job->ids[i], sizeof(bitcache_id_t));
+  return NULL;
+}
+
+static void*
+bitcache_set_build_sort(void* arg) {
+  bitcache_set_build_t* const job = arg;
+  bitcache_id_t* const ids = &job->out[job->lo];
+  const size_t count = job->hi - job->lo;
+  bitcache_id_sort(ids, count, 1); // the partitions already have a thread each
+  job->kept = bitcache_id_unique(ids, count);
+  return NULL;
+}
+
+static void*
+bitcache_set_build_fill(void* arg) {
+  bitcache_set_build_t* const job = arg;
+  // the groups whose identifiers fall into this job's partition:
+  const size_t groups = (size_t)1 << job->bits;
+  const size_t lo = (job->part * groups + job->n - 1) / job->n;
+  const size_t hi = ((job->part + 1) * groups + job->n - 1) / job->n;
+  job->kept = bitcache_set_flat_fill(job->flat, &job->out[job->lo], job->hi - job->lo, lo, hi, &job->placed);
+  return NULL;
+}
+
+// Partitions a batch of identifiers into `out`, on `n` threads.
+static void
+bitcache_set_build_partition(bitcache_set_build_t* jobs, const size_t n, size_t* cursors,
+                             const bitcache_id_t* ids, const size_t count, bitcache_id_t* out,
+                             bitcache_set_flat_t* flat) {
+  bzero(cursors, n * n * sizeof(size_t));
+  for (size_t t = 0; t < n; t++) {
+    const size_t lo = (count * t) / n;
+    jobs[t].ids = ids + lo;
+    jobs[t].count = (count * (t + 1)) / n - lo;
+    jobs[t].n = n;
+    jobs[t].part = t;
+    jobs[t].cursors = &cursors[t * n];
+    jobs[t].out = out;
+    jobs[t].flat = flat;
+    jobs[t].bits = (flat != NULL) ? __builtin_ctzll(flat->capacity / BITCACHE_MAP_TABLE_GROUP) : 0;
+    jobs[t].kept = jobs[t].placed = 0;
+  }
+  bitcache_thread_run(bitcache_set_build_count, jobs, sizeof(jobs[0]), n);
+
+  // turn the counts into offsets, partition by partition:
+  size_t offset = 0;
+  for (size_t p = 0; p < n; p++) {
+    jobs[p].lo = offset;
+    for (size_t t = 0; t < n; t++) {
+      const size_t size = cursors[t * n + p];
+      cursors[t * n + p] = offset;
+      offset += size;
+    }
+    jobs[p].hi = offset;
+  }
+  bitcache_thread_run(bitcache_set_build_scatter, jobs, sizeof(jobs[0]), n);
+}
+
+int
+bitcache_set_build(bitcache_set_t* set, const bitcache_id_t* ids, const size_t count, const unsigned int threads) {
+  validate_with_errno_return(set != NULL && set->instance != NULL && (ids != NULL || count == 0));
+
+  if (set->class == &bitcache_set_frozen)
+    return bitcache_set_frozen_build(set, ids, count);
+
+  if (!bitcache_set_is_sorted(set) && set->class != &bitcache_set_flat) {
+    const int rc = bitcache_set_clear(set);
+    return (rc < 0) ? rc : bitcache_set_insert_many(set, ids, count);
+  }
+
+  const size_t n = bitcache_thread_count(threads, count, BITCACHE_SET_BUILD_MIN);
+  bitcache_set_build_t jobs[n];
+  size_t* const cursors = malloc(n * n * sizeof(size_t));
+  bitcache_id_t* const out = malloc((count > 0 ? count : 1) * sizeof(bitcache_id_t));
+  if (unlikely(cursors == NULL || out == NULL)) {
+    free(out), free(cursors);
+    return -(errno = ENOMEM); // cannot allocate memory
+  }
+
+  int rc = 0;
+
+  if (bitcache_set_is_sorted(set)) {
+    bitcache_set_build_partition(jobs, n, cursors, ids, count, out, NULL);
+    bitcache_thread_run(bitcache_set_build_sort, jobs, sizeof(jobs[0]), n);
+
+    // pack the sorted partitions together:
+    size_t total = jobs[0].kept;
+    for (size_t t = 1; t < n; t++) {
+      memmove(&out[total], &out[jobs[t].lo], jobs[t].kept * sizeof(bitcache_id_t));
+      total += jobs[t].kept;
+    }
+    free(cursors);
+    bitcache_set_sorted_adopt(set, out, total);
+    return 0;
+  }
+
+  bitcache_set_flat_t* const flat = set->instance;
+  bitcache_set_flat_wrlock(flat);
+  if (likely((rc = bitcache_set_flat_prepare(flat, count)) == 0)) {
+    bitcache_set_build_partition(jobs, n, cursors, ids, count, out, flat);
+    bitcache_thread_run(bitcache_set_build_fill, jobs, sizeof(jobs[0]), n);
+
+    // then place whatever would have probed past its partition:
+    for (size_t t = 0; t < n; t++) {
+      flat->count += jobs[t].placed;
+      flat->growth_left -= jobs[t].placed;
+    }
+    for (size_t t = 0; t < n; t++) {
+      for (size_t i = 0; i < jobs[t].kept; i++) {
+        const bitcache_id_t* const id = &out[jobs[t].lo + i];
+        if (bitcache_set_flat_find(flat, id) == NULL)
+          bitcache_set_flat_place(flat, id);
+      }
+    }
+  }
+  bitcache_set_flat_unlock(flat);
+
+  free(out);
+  free(cursors);
+  return rc;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Set Serialization API
+
+// Writes out a header and a sorted array of distinct identifiers. The array
+// is packed twice, the first time only to checksum it.
+static long
+bitcache_set_pack(const int fd, const bitcache_id_t* ids, const size_t count, const bitcache_id_encoding_t encoding) {
+  uint32_t checksum = 0;
+  const long size = bitcache_id_pack_write(-1, ids, count, encoding, &checksum);
+  if (unlikely(size < 0))
+    return size;
+
+  bitcache_set_header_t header;
+  bzero(&header, sizeof(header));
+  memcpy(header.magic, BITCACHE_SET_MAGIC, sizeof(header.magic));
+  header.version  = BITCACHE_SET_VERSION;
+  header.checksum = checksum;
+  header.count    = count;
+  header.size     = size;
+  header.encoding = encoding;
+
+  const int rc = bitcache_write(fd, &header, sizeof(header));
+  if (unlikely(rc < 0))
+    return rc;
+
+  uint32_t crc = 0;
+  const long written = bitcache_id_pack_write(fd, ids, count, encoding, &crc);
+  if (unlikely(written < 0))
+    return written;
+
+  return sizeof(header) + written;
+}
+
+long COLD
+bitcache_set_dump(bitcache_set_t* set, const int fd, const bitcache_id_encoding_t encoding) {
+  validate_with_errno_return(set != NULL && set->instance != NULL && fd >= 0 &&
+    (encoding == BITCACHE_ID_PLAIN || encoding == BITCACHE_ID_DELTA));
+
+  if (bitcache_set_is_sorted(set)) {
+    // sorted sets are written out as they are, without a copy:
+    bitcache_set_sorted_t* const sorted = set->instance;
+    bitcache_set_sorted_rdlock(sorted);
+    const long rc = bitcache_set_pack(fd, sorted->ids, sorted->count, encoding);
+    bitcache_set_sorted_unlock(sorted);
+    return rc;
+  }
+
+  bitcache_id_t* ids = NULL;
+  long rc = bitcache_set_collect(set, &ids);
+  if (likely(rc >= 0)) {
+    bitcache_id_sort(ids, rc, 0);
+    rc = bitcache_set_pack(fd, ids, rc, encoding);
+  }
+  free(ids);
+  return rc;
+}
+
+long COLD
+bitcache_set_load(bitcache_set_t* set, const int fd) {
+  validate_with_errno_return(set != NULL && set->instance != NULL && fd >= 0);
+
+  off_t off = lseek(fd, 0, SEEK_CUR);
+  if (unlikely(off == -1)) {
+    return -errno; // pipes, sockets and FIFOs are not supported
+  }
+
+  struct stat sb;
+  if (unlikely(fstat(fd, &sb) == -1)) {
+    return -errno;
+  }
+
+  bitcache_set_header_t header;
+  if (unlikely(sb.st_size - off < (off_t)sizeof(header) ||
+      pread(fd, &header, sizeof(header), off) != sizeof(header))) {
+    return -(errno = EINVAL); // not a set
+  }
+
+  if (set->class == &bitcache_set_frozen &&
+      memcmp(header.magic, BITCACHE_SET_FROZEN_MAGIC, sizeof(header.magic)) == 0) {
+    return bitcache_set_frozen_load(set, fd);
+  }
+
+  if (unlikely(memcmp(header.magic, BITCACHE_SET_MAGIC, sizeof(header.magic)) != 0 ||
+      header.version < 1 || header.version > BITCACHE_SET_VERSION ||
+      (header.encoding != BITCACHE_ID_PLAIN && header.encoding != BITCACHE_ID_DELTA) ||
+      header.count > SIZE_MAX / sizeof(bitcache_id_t) ||
+      header.size > (uint64_t)(sb.st_size - off) - sizeof(header) ||
+      (header.encoding == BITCACHE_ID_PLAIN && header.size != header.count * sizeof(bitcache_id_t)) ||
+      (header.encoding == BITCACHE_ID_DELTA && (header.size == 0 || (header.size - 1) / BITCACHE_ID_PACK_SUFFIX < header.count)))) {
+    return -(errno = EINVAL); // not a set
+  }
+
+  // mmap() requires a page-aligned file offset:
+  const off_t page_off = off & ~((off_t)getpagesize() - 1);
+  const size_t body_off = (off - page_off) + sizeof(header);
+  const size_t mapping_size = body_off + header.size;
+
+  // sorted sets use plain identifiers in place, if suitably aligned:
+  const bool in_place = bitcache_set_is_sorted(set) &&
+    header.encoding == BITCACHE_ID_PLAIN && body_off % __alignof__(bitcache_id_t) == 0;
+
+  void* base = mmap(NULL, mapping_size, in_place ? PROT_READ | PROT_WRITE : PROT_READ, MAP_PRIVATE, fd, page_off);
+  if (unlikely(base == MAP_FAILED)) {
+    return -errno;
+  }
+  const uint8_t* const body = (uint8_t*)base + body_off;
+
+  if (in_place) {
+    bitcache_set_sorted_attach(set, base, mapping_size, (bitcache_id_t*)body, header.count);
+    return header.count;
+  }
+
+  long rc = 0;
+  bitcache_id_t* const ids = malloc((header.count > 0 ? header.count : 1) * sizeof(bitcache_id_t));
+  if (unlikely(ids == NULL))
+    rc = -errno; // cannot allocate memory
+  else if (unlikely(bitcache_crc32c(0, body, header.size) != header.checksum))
+    rc = -(errno = EBADMSG); // corrupted
+  else
+    rc = bitcache_id_pack_read(body, header.size, header.encoding, ids, header.count);
+  munmap(base, mapping_size);
+
+  if (unlikely(rc < 0))
+    return free(ids), rc;
+
+  if (set->class == &bitcache_set_frozen) {
+    rc = bitcache_set_frozen_build(set, ids, header.count);
+    free(ids);
+  }
+  else {
+    rc = bitcache_set_assign(set, ids, header.count, TRUE);
+  }
+  return (rc < 0) ? rc : (long)header.count;
+}
+
 //////////////////////////////////////////////////////////////////////////////
 // Set Iterator API
 
@@ -8,6 +8,8 @@ extern "C" {
 #endif
 
 #include <stdbool.h> /* for bool */
+#include <stddef.h>  /* for size_t */
+#include <stdint.h>  /* for uint8_t, uint32_t, uint64_t */
 
 #include <cprime.h>  /* for free_func_t */
 
@@ -47,6 +49,12 @@ typedef struct bitcache_set_class_t {
   int (*remove)(bitcache_set_t* set, const bitcache_id_t* id);
   int (*replace)(bitcache_set_t* set, const bitcache_id_t* id1,
                                       const bitcache_id_t* id2);
+  long (*lookup_many)(bitcache_set_t* set, const bitcache_id_t* ids,
+                                           const size_t count, bool* found);
+  int (*insert_many)(bitcache_set_t* set, const bitcache_id_t* ids,
+                                          const size_t count);
+  long (*remove_many)(bitcache_set_t* set, const bitcache_id_t* ids,
+                                           const size_t count);
 } bitcache_set_class_t;
 
 /**
@@ -73,6 +81,106 @@ extern const bitcache_set_class_t bitcache_set_hash;
  */
 extern const bitcache_set_iter_class_t bitcache_set_iter_hash;
 
+/**
+ * The virtual dispatch table for Bitcache sets kept in a flat hash table.
+ *
+ * Flat sets store identifiers by value, copying them on insertion, in an
+ * open-addressing table like the one underlying maps: 21 bytes per slot,
+ * with tables kept between 7/16 and 7/8 full. Large tables grow
+ * incrementally, as map tables do. (The default hash sets keep a pointer
+ * to a separately allocated identifier per member.)
+ */
+extern const bitcache_set_class_t bitcache_set_flat;
+
+/**
+ * The virtual dispatch table for flat set iterators.
+ */
+extern const bitcache_set_iter_class_t bitcache_set_iter_flat;
+
+/**
+ * The virtual dispatch table for Bitcache sets kept as a sorted array of
+ * identifiers.
+ *
+ * Sorted sets take 20 bytes per identifier, which they copy, and nothing
+ * else. Lookups interpolate on the identifiers' leading bytes, which are
+ * uniformly distributed, before bisecting. Inserting and removing single
+ * identifiers takes linear time, so sorted sets are best built in batches.
+ * Set operations on two sorted sets merge them.
+ */
+extern const bitcache_set_class_t bitcache_set_sorted;
+
+/**
+ * The virtual dispatch table for sorted set iterators, which visit
+ * identifiers in ascending order.
+ */
+extern const bitcache_set_iter_class_t bitcache_set_iter_sorted;
+
+/**
+ * The virtual dispatch table for frozen Bitcache sets, which are built
+ * once from a fixed set of identifiers and cannot be updated afterwards.
+ *
+ * Frozen sets store identifiers densely, in the order given by a minimal
+ * perfect hash function over them, which takes about 0.75 bytes more per
+ * identifier. A lookup hashes the identifier once and compares it with the
+ * one identifier stored where it would be, taking no lock. A frozen set can
+ * be dumped to a file, and loaded back in with a single mmap().
+ */
+extern const bitcache_set_class_t bitcache_set_frozen;
+
+/**
+ * The virtual dispatch table for frozen set iterators.
+ */
+extern const bitcache_set_iter_class_t bitcache_set_iter_frozen;
+
+/**
+ * Defines the magic bytes at the start of a dumped frozen set header.
+ */
+#define BITCACHE_SET_FROZEN_MAGIC "BCFROZEN"
+
+/**
+ * Defines the current version of the dumped frozen set header format.
+ */
+#define BITCACHE_SET_FROZEN_VERSION 1
+
+/**
+ * Represents the header preceding the body of a dumped frozen set.
+ * Fields are stored in host byte order.
+ */
+typedef struct {
+  char     magic[8];   /* BITCACHE_SET_FROZEN_MAGIC */
+  uint32_t version;    /* BITCACHE_SET_FROZEN_VERSION */
+  uint32_t checksum;   /* CRC-32C of the body */
+  uint64_t seed;       /* hash seed */
+  uint64_t count;      /* number of identifiers */
+  uint64_t buckets;    /* number of pilots */
+  uint64_t table_size; /* number of positions pilots pick from */
+  uint8_t  reserved[16];
+} bitcache_set_frozen_header_t;
+
+/**
+ * Defines the magic bytes at the start of a dumped set header.
+ */
+#define BITCACHE_SET_MAGIC "BCSETIDS"
+
+/**
+ * Defines the current version of the dumped set header format.
+ */
+#define BITCACHE_SET_VERSION 1
+
+/**
+ * Represents the header preceding the identifiers of a dumped set, which
+ * follow in ascending order. Fields are stored in host byte order.
+ */
+typedef struct {
+  char     magic[8];   /* BITCACHE_SET_MAGIC */
+  uint32_t version;    /* BITCACHE_SET_VERSION */
+  uint32_t checksum;   /* CRC-32C of the body */
+  uint64_t count;      /* number of identifiers */
+  uint64_t size;       /* body size (in bytes) */
+  uint32_t encoding;   /* bitcache_id_encoding_t */
+  uint8_t  reserved[28];
+} bitcache_set_header_t;
+
 /**
  * Allocates heap memory for a new set.
  */
@@ -129,6 +237,151 @@ extern int bitcache_set_replace(bitcache_set_t* set,
   const bitcache_id_t* restrict id1,
   const bitcache_id_t* restrict id2);
 
+/**
+ * Looks up a batch of identifiers in a set, storing whether each was found
+ * into `found`, which may be NULL. Returns the number of identifiers found.
+ */
+extern long bitcache_set_lookup_many(bitcache_set_t* set,
+  const bitcache_id_t* ids,
+  const size_t count,
+  bool* found);
+
+/**
+ * Inserts a batch of identifiers into a set. The identifiers are copied.
+ */
+extern int bitcache_set_insert_many(bitcache_set_t* set,
+  const bitcache_id_t* ids,
+  const size_t count);
+
+/**
+ * Removes a batch of identifiers from a set. Returns the number of
+ * identifiers removed.
+ */
+extern long bitcache_set_remove_many(bitcache_set_t* set,
+  const bitcache_id_t* ids,
+  const size_t count);
+
+/**
+ * Builds a set holding a given batch of identifiers, which may contain
+ * duplicates, replacing its contents, using a given number of threads
+ * (zero selecting one per online CPU).
+ *
+ * Sorted and flat sets are built in parallel: the identifiers are
+ * partitioned between the threads, by prefix for sorted sets and by table
+ * range for flat sets, and each thread sorts or fills its partition
+ * without locking, the set being locked once for the whole build. Frozen
+ * sets are built as by `bitcache_set_frozen_build()`; other sets have the
+ * batch inserted.
+ */
+extern int bitcache_set_build(bitcache_set_t* set,
+  const bitcache_id_t* ids,
+  const size_t count,
+  const unsigned int threads);
+
+/**
+ * Stores the union of two sets into a given set, which may be either of
+ * them, using a given number of threads (zero selecting one per online
+ * CPU).
+ *
+ * The set operations pick an algorithm by the classes of the sets
+ * involved. Two sorted sets are merged, galloping past runs of identifiers
+ * that the other set has nothing between, and large merges are split into
+ * ranges of identifier prefixes merged on threads of their own. Otherwise
+ * the identifiers of the smaller set are looked up in the larger one, in
+ * batches spread over the threads. The operations are not atomic: the
+ * input sets must not change meanwhile.
+ */
+extern int bitcache_set_union(bitcache_set_t* result,
+  bitcache_set_t* set1,
+  bitcache_set_t* set2,
+  const unsigned int threads);
+
+/**
+ * Stores the intersection of two sets into a given set, which may be
+ * either of them.
+ */
+extern int bitcache_set_intersect(bitcache_set_t* result,
+  bitcache_set_t* set1,
+  bitcache_set_t* set2,
+  const unsigned int threads);
+
+/**
+ * Stores the identifiers of a set that are not in another set into a given
+ * set, which may be either of them.
+ */
+extern int bitcache_set_difference(bitcache_set_t* result,
+  bitcache_set_t* set1,
+  bitcache_set_t* set2,
+  const unsigned int threads);
+
+/**
+ * Checks whether every identifier of a set is also in another set.
+ */
+extern bool bitcache_set_is_subset(bitcache_set_t* set1,
+  bitcache_set_t* set2,
+  const unsigned int threads);
+
+/**
+ * Writes out a set to a file descriptor, as its identifiers in ascending
+ * order, in a given encoding. Returns the number of bytes written.
+ *
+ * Sets of any class are dumped the same way; frozen sets can also be
+ * dumped as they are, with `bitcache_set_frozen_dump()`.
+ */
+extern long bitcache_set_dump(bitcache_set_t* set,
+  const int fd,
+  const bitcache_id_encoding_t encoding);
+
+/**
+ * Reads in a set from a file descriptor, replacing its contents. Returns
+ * the number of identifiers read.
+ *
+ * A sorted set loading a plainly encoded dump uses the file in place: it
+ * is mapped copy-on-write, without being read or verified up front, so
+ * that loading takes constant time. Otherwise the dump is verified against
+ * its checksum, failing with `EBADMSG` on a mismatch, and decoded into the
+ * set; frozen sets are built from it, and also load frozen set dumps.
+ */
+extern long bitcache_set_load(bitcache_set_t* set,
+  const int fd);
+
+/**
+ * Builds a frozen set holding a given array of identifiers, which may
+ * contain duplicates, replacing its contents.
+ *
+ * The set must have been initialized with the `bitcache_set_frozen` class,
+ * and must not be shared between threads until built.
+ */
+extern int bitcache_set_frozen_build(bitcache_set_t* set,
+  const bitcache_id_t* ids,
+  const size_t count);
+
+/**
+ * Builds a frozen set holding the identifiers of a given set.
+ */
+extern int bitcache_set_frozen_build_from(bitcache_set_t* set,
+  bitcache_set_t* source);
+
+/**
+ * Reads in a frozen set from a file descriptor, replacing its contents.
+ *
+ * The set is mapped read-only, and used in place.
+ */
+extern long bitcache_set_frozen_load(bitcache_set_t* set,
+  const int fd);
+
+/**
+ * Verifies the body of a loaded frozen set against the checksum recorded
+ * in its header, failing with `EBADMSG` on a mismatch.
+ */
+extern int bitcache_set_frozen_verify(bitcache_set_t* set);
+
+/**
+ * Writes out a frozen set to a file descriptor.
+ */
+extern long bitcache_set_frozen_dump(bitcache_set_t* set,
+  const int fd);
+
 /**
  * Initializes a set iterator for a given set.
  */
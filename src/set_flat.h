@@ -0,0 +1,619 @@
+/* This is free and unencumbered software released into the public domain. */
+
+#include "build.h"
+#include "map_table.h" /* for bitcache_map_table_match(), etc. */
+#include <assert.h> /* for assert() */
+#include <cprime.h> /* for rwlock_t */
+#include <stdlib.h> /* for free(), malloc(), posix_memalign() */
+#include <string.h> /* for memcpy(), memset() */
+
+#if 1
+#  define bitcache_set_flat_crlock(set) rwlock_init(&(set)->lock)
+#  define bitcache_set_flat_rmlock(set) rwlock_dispose(&(set)->lock)
+#  define bitcache_set_flat_rdlock(set) rwlock_rdlock(&(set)->lock)
+#  define bitcache_set_flat_wrlock(set) rwlock_wrlock(&(set)->lock)
+#  define bitcache_set_flat_unlock(set) rwlock_unlock(&(set)->lock)
+#else
+#  define bitcache_set_flat_crlock(set)
+#  define bitcache_set_flat_rmlock(set)
+#  define bitcache_set_flat_rdlock(set)
+#  define bitcache_set_flat_wrlock(set)
+#  define bitcache_set_flat_unlock(set)
+#endif /* HAVE_PTHREAD_H */
+
+// How many identifiers ahead batch lookups prefetch.
+#define BITCACHE_SET_FLAT_PREFETCH_DISTANCE 8
+
+//////////////////////////////////////////////////////////////////////////////
+// Flat table helpers
+//
+// A flat set is a map table without the values: identifiers are stored by
+// value in slots of their own, 20 bytes each, next to one control byte per
+// slot, and probed a group at a time exactly as map tables are. Large
+// tables are resized incrementally the same way too, keeping the outgrown
+// arrays around until inserts have migrated every identifier out of them.
+
+typedef struct {
+  size_t capacity;     // number of slots
+  size_t count;        // number of full slots, old ones included
+  size_t growth_left;  // number of empty slots that may yet be filled
+  uint8_t* ctrl;       // one control byte per slot
+  bitcache_id_t* slots;
+  size_t old_capacity; // number of slots being migrated, if resizing
+  size_t migrated;     // number of old slots migrated so far
+  uint8_t* old_ctrl;
+  bitcache_id_t* old_slots;
+#if 1
+  rwlock_t lock;
+#endif
+} bitcache_set_flat_t;
+
+static inline size_t
+bitcache_set_flat_memory_size(const size_t capacity) {
+  return bitcache_map_table_ctrl_size(capacity) + capacity * sizeof(bitcache_id_t);
+}
+
+// Returns the slot holding a given identifier in one set of arrays, or NULL.
+static inline bitcache_id_t*
+bitcache_set_flat_probe(const uint8_t* ctrl, bitcache_id_t* slots, const size_t capacity, const bitcache_id_t* id) {
+  const uint64_t hash = bitcache_map_table_hash(id);
+  const uint8_t tag = bitcache_map_table_tag(hash);
+  const size_t mask = capacity / BITCACHE_MAP_TABLE_GROUP - 1;
+
+  for (size_t i = 0, g = hash & mask; i <= mask; g = (g + ++i) & mask) {
+    const uint8_t* const group = ctrl + g * BITCACHE_MAP_TABLE_GROUP;
+    for (uint32_t m = bitcache_map_table_match(group, tag); m != 0; m &= m - 1) {
+      bitcache_id_t* const slot = &slots[g * BITCACHE_MAP_TABLE_GROUP + __builtin_ctz(m)];
+      if (likely(bitcache_map_table_key_equal(slot, id)))
+        return slot;
+    }
+    if (likely(bitcache_map_table_match(group, BITCACHE_MAP_TABLE_EMPTY) != 0))
+      return NULL; // the identifier would have been placed in this group
+  }
+  return NULL;
+}
+
+// Returns the slot holding a given identifier, or NULL. While a resize is
+// under way, identifiers not yet migrated are found in the old arrays.
+static inline bitcache_id_t*
+bitcache_set_flat_find(const bitcache_set_flat_t* flat, const bitcache_id_t* id) {
+  if (unlikely(flat->capacity == 0))
+    return NULL;
+
+  bitcache_id_t* const slot = bitcache_set_flat_probe(flat->ctrl, flat->slots, flat->capacity, id);
+  if (likely(slot != NULL) || likely(flat->old_ctrl == NULL))
+    return slot;
+  return bitcache_set_flat_probe(flat->old_ctrl, flat->old_slots, flat->old_capacity, id);
+}
+
+// Prefetches the first group and slots that a lookup of an identifier will probe.
+static inline void
+bitcache_set_flat_prefetch(const bitcache_set_flat_t* flat, const bitcache_id_t* id) {
+  if (unlikely(flat->capacity == 0))
+    return;
+  const size_t g = bitcache_map_table_hash(id) & (flat->capacity / BITCACHE_MAP_TABLE_GROUP - 1);
+  prefetch(flat->ctrl + g * BITCACHE_MAP_TABLE_GROUP);
+  prefetch(&flat->slots[g * BITCACHE_MAP_TABLE_GROUP]);
+}
+
+// Returns the first free slot in the probe sequence for a hash.
+static inline size_t
+bitcache_set_flat_find_free(const bitcache_set_flat_t* flat, const uint64_t hash) {
+  const size_t mask = flat->capacity / BITCACHE_MAP_TABLE_GROUP - 1;
+  for (size_t i = 0, g = hash & mask; ; g = (g + ++i) & mask) {
+    const uint32_t m = bitcache_map_table_match_free(flat->ctrl + g * BITCACHE_MAP_TABLE_GROUP);
+    if (likely(m != 0))
+      return g * BITCACHE_MAP_TABLE_GROUP + __builtin_ctz(m);
+  }
+}
+
+// Copies an identifier into a free slot, known not to hold it already.
+static inline void
+bitcache_set_flat_place(bitcache_set_flat_t* flat, const bitcache_id_t* id) {
+  const uint64_t hash = bitcache_map_table_hash(id);
+  const size_t i = bitcache_set_flat_find_free(flat, hash);
+  if (flat->ctrl[i] == BITCACHE_MAP_TABLE_EMPTY)
+    flat->growth_left--; // reusing a deleted slot costs nothing
+  flat->ctrl[i] = bitcache_map_table_tag(hash);
+  memcpy(&flat->slots[i], id, sizeof(bitcache_id_t));
+  flat->count++;
+}
+
+static inline void
+bitcache_set_flat_release_old(bitcache_set_flat_t* flat) {
+  free(flat->old_ctrl);
+  flat->old_ctrl = NULL, flat->old_slots = NULL;
+  flat->old_capacity = flat->migrated = 0;
+}
+
+// Moves up to `budget` old slots into the new arrays, freeing the old
+// arrays once all of them have been moved. Migrated old slots are marked
+// deleted, as in map tables, so that the copies left behind are never
+// found again.
+static void
+bitcache_set_flat_migrate(bitcache_set_flat_t* flat, const size_t budget) {
+  const size_t end = (budget < flat->old_capacity - flat->migrated) ? flat->migrated + budget : flat->old_capacity;
+  for (size_t i = flat->migrated; i < end; i++) {
+    if (flat->old_ctrl[i] & 0x80)
+      continue; // empty or deleted
+    const uint64_t hash = bitcache_map_table_hash(&flat->old_slots[i]);
+    const size_t j = bitcache_set_flat_find_free(flat, hash);
+    if (flat->ctrl[j] == BITCACHE_MAP_TABLE_EMPTY)
+      flat->growth_left--;
+    flat->ctrl[j] = bitcache_map_table_tag(hash);
+    memcpy(&flat->slots[j], &flat->old_slots[i], sizeof(bitcache_id_t));
+    flat->old_ctrl[i] = BITCACHE_MAP_TABLE_DELETED;
+  }
+  flat->migrated = end;
+
+  if (flat->migrated == flat->old_capacity)
+    bitcache_set_flat_release_old(flat);
+}
+
+// Rebuilds a table with a given capacity, a power of two no smaller than a
+// group, dropping any deleted markers. Tables of at least
+// `BITCACHE_MAP_TABLE_INCREMENTAL` slots are only switched over to the new
+// arrays here, and migrated incrementally by later inserts.
+static int
+bitcache_set_flat_rehash(bitcache_set_flat_t* flat, const size_t capacity) {
+  void* memory = NULL;
+  if (unlikely(posix_memalign(&memory, 64, bitcache_set_flat_memory_size(capacity)) != 0))
+    return -(errno = ENOMEM); // cannot allocate memory
+
+  if (unlikely(flat->old_ctrl != NULL))
+    bitcache_set_flat_migrate(flat, flat->old_capacity); // one resize at a time
+
+  flat->old_ctrl = flat->ctrl;
+  flat->old_slots = flat->slots;
+  flat->old_capacity = flat->capacity;
+  flat->migrated = 0;
+
+  flat->ctrl = memory;
+  flat->slots = (bitcache_id_t*)((uint8_t*)memory + bitcache_map_table_ctrl_size(capacity));
+  flat->capacity = capacity;
+  flat->growth_left = bitcache_map_table_max_load(capacity);
+  memset(flat->ctrl, BITCACHE_MAP_TABLE_EMPTY, capacity);
+
+  if (flat->old_capacity < BITCACHE_MAP_TABLE_INCREMENTAL)
+    bitcache_set_flat_migrate(flat, flat->old_capacity);
+  return 0;
+}
+
+// Makes room for a number of identifiers more, growing the table to the
+// smallest capacity that holds them all or, if the table is mostly deleted
+// markers, rebuilding it at the same capacity.
+static int
+bitcache_set_flat_reserve(bitcache_set_flat_t* flat, const size_t count) {
+  if (likely(flat->growth_left >= count))
+    return 0;
+  if (unlikely(flat->old_ctrl != NULL)) {
+    // should inserts ever outpace the migration, finish it first:
+    bitcache_set_flat_migrate(flat, flat->old_capacity);
+    if (flat->growth_left >= count)
+      return 0;
+  }
+  size_t capacity = (flat->capacity > 0) ? flat->capacity : BITCACHE_MAP_TABLE_GROUP;
+  while (bitcache_map_table_max_load(capacity) < flat->count + count)
+    capacity *= 2;
+  if (capacity == flat->capacity && flat->count * 2 > bitcache_map_table_max_load(capacity))
+    capacity *= 2; // rebuilding would barely help
+  return bitcache_set_flat_rehash(flat, capacity);
+}
+
+// Inserts an identifier known not to be present, migrating a few old slots
+// first while a resize is under way.
+static inline int
+bitcache_set_flat_add(bitcache_set_flat_t* flat, const bitcache_id_t* id) {
+  if (unlikely(flat->old_ctrl != NULL))
+    bitcache_set_flat_migrate(flat, BITCACHE_MAP_TABLE_MIGRATE);
+
+  const int rc = bitcache_set_flat_reserve(flat, 1);
+  if (likely(rc == 0))
+    bitcache_set_flat_place(flat, id);
+  return rc;
+}
+
+// Frees up a full slot, as map tables do.
+static inline void
+bitcache_set_flat_erase(bitcache_set_flat_t* flat, const bitcache_id_t* slot) {
+  if (unlikely(flat->old_ctrl != NULL) &&
+      slot >= flat->old_slots && slot < flat->old_slots + flat->old_capacity) {
+    // not yet migrated; the old arrays are never inserted into again:
+    flat->old_ctrl[slot - flat->old_slots] = BITCACHE_MAP_TABLE_DELETED;
+    flat->count--;
+    return;
+  }
+
+  const size_t i = slot - flat->slots;
+  const uint8_t* const group = flat->ctrl + (i & ~(size_t)(BITCACHE_MAP_TABLE_GROUP - 1));
+  if (bitcache_map_table_match(group, BITCACHE_MAP_TABLE_EMPTY) != 0) {
+    flat->ctrl[i] = BITCACHE_MAP_TABLE_EMPTY;
+    flat->growth_left++;
+  }
+  else {
+    flat->ctrl[i] = BITCACHE_MAP_TABLE_DELETED;
+  }
+  flat->count--;
+}
+
+// Slots are indexed across both sets of arrays while a resize is under
+// way: the new slots first, then the old ones.
+static inline size_t
+bitcache_set_flat_end(const bitcache_set_flat_t* flat) {
+  return flat->capacity + flat->old_capacity;
+}
+
+static inline uint8_t
+bitcache_set_flat_ctrl_at(const bitcache_set_flat_t* flat, const size_t i) {
+  return (i < flat->capacity) ? flat->ctrl[i] : flat->old_ctrl[i - flat->capacity];
+}
+
+static inline bitcache_id_t*
+bitcache_set_flat_slot_at(const bitcache_set_flat_t* flat, const size_t i) {
+  return (i < flat->capacity) ? &flat->slots[i] : &flat->old_slots[i - flat->capacity];
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Set API (flat table implementation)
+
+static int
+bitcache_set_flat_init(bitcache_set_t* set) {
+  bitcache_set_flat_t* flat = calloc(1, sizeof(bitcache_set_flat_t));
+  if (unlikely(flat == NULL))
+    return -errno; // cannot allocate memory
+
+  bitcache_set_flat_crlock(flat);
+  set->instance = flat;
+
+  return 0;
+}
+
+static int
+bitcache_set_flat_reset(bitcache_set_t* set) {
+  bitcache_set_flat_t* flat = set->instance;
+  assert(flat != NULL);
+
+  set->instance = NULL;
+
+  bitcache_set_flat_rmlock(flat);
+  free(flat->old_ctrl);
+  free(flat->ctrl);
+  free(flat);
+
+  return 0;
+}
+
+static int
+bitcache_set_flat_clear(bitcache_set_t* set) {
+  bitcache_set_flat_t* flat = set->instance;
+  assert(flat != NULL);
+
+  bitcache_set_flat_wrlock(flat);
+  bitcache_set_flat_release_old(flat);
+  if (likely(flat->capacity > 0)) {
+    memset(flat->ctrl, BITCACHE_MAP_TABLE_EMPTY, flat->capacity);
+    flat->count = 0;
+    flat->growth_left = bitcache_map_table_max_load(flat->capacity);
+  }
+  bitcache_set_flat_unlock(flat);
+
+  return 0;
+}
+
+static long
+bitcache_set_flat_count(bitcache_set_t* set) {
+  bitcache_set_flat_t* flat = set->instance;
+  assert(flat != NULL);
+
+  bitcache_set_flat_rdlock(flat);
+  const long count = flat->count;
+  bitcache_set_flat_unlock(flat);
+
+  return count;
+}
+
+static bool
+bitcache_set_flat_lookup(bitcache_set_t* set, const bitcache_id_t* restrict id) {
+  bitcache_set_flat_t* flat = set->instance;
+  assert(flat != NULL);
+
+  bitcache_set_flat_rdlock(flat);
+  const bool found = (bitcache_set_flat_find(flat, id) != NULL);
+  bitcache_set_flat_unlock(flat);
+
+  return found;
+}
+
+static int
+bitcache_set_flat_insert(bitcache_set_t* set, const bitcache_id_t* restrict id) {
+  bitcache_set_flat_t* flat = set->instance;
+  assert(flat != NULL);
+
+  int rc = 0;
+
+  bitcache_set_flat_wrlock(flat);
+  if (bitcache_set_flat_find(flat, id) == NULL)
+    rc = bitcache_set_flat_add(flat, id);
+  bitcache_set_flat_unlock(flat);
+
+  return rc;
+}
+
+static int
+bitcache_set_flat_remove(bitcache_set_t* set, const bitcache_id_t* restrict id) {
+  bitcache_set_flat_t* flat = set->instance;
+  assert(flat != NULL);
+
+  bitcache_set_flat_wrlock(flat);
+  const bitcache_id_t* const slot = bitcache_set_flat_find(flat, id);
+  if (slot != NULL)
+    bitcache_set_flat_erase(flat, slot);
+  bitcache_set_flat_unlock(flat);
+
+  return 0;
+}
+
+static int
+bitcache_set_flat_replace(bitcache_set_t* set, const bitcache_id_t* restrict id1, const bitcache_id_t* restrict id2) {
+  bitcache_set_flat_t* flat = set->instance;
+  assert(flat != NULL);
+
+  int rc = 0;
+
+  bitcache_set_flat_wrlock(flat);
+  const bitcache_id_t* const slot = bitcache_set_flat_find(flat, id1);
+  if (slot != NULL)
+    bitcache_set_flat_erase(flat, slot);
+  if (id2 != NULL && bitcache_set_flat_find(flat, id2) == NULL)
+    rc = bitcache_set_flat_add(flat, id2);
+  bitcache_set_flat_unlock(flat);
+
+  return rc;
+}
+
+static long
+bitcache_set_flat_lookup_many(bitcache_set_t* set, const bitcache_id_t* ids, const size_t count, bool* found) {
+  bitcache_set_flat_t* flat = set->instance;
+  assert(flat != NULL);
+
+  long hits = 0;
+
+  bitcache_set_flat_rdlock(flat);
+  for (size_t i = 0; i < count; i++) {
+    if (likely(i + BITCACHE_SET_FLAT_PREFETCH_DISTANCE < count))
+      bitcache_set_flat_prefetch(flat, &ids[i + BITCACHE_SET_FLAT_PREFETCH_DISTANCE]);
+    const bool hit = (bitcache_set_flat_find(flat, &ids[i]) != NULL);
+    if (found != NULL)
+      found[i] = hit;
+    hits += hit;
+  }
+  bitcache_set_flat_unlock(flat);
+
+  return hits;
+}
+
+// Inserting a batch into an empty set sizes the table for all of it up
+// front, rather than growing it step by step.
+static int
+bitcache_set_flat_insert_many(bitcache_set_t* set, const bitcache_id_t* ids, const size_t count) {
+  bitcache_set_flat_t* flat = set->instance;
+  assert(flat != NULL);
+
+  int rc = 0;
+
+  bitcache_set_flat_wrlock(flat);
+  if (flat->count == 0)
+    rc = bitcache_set_flat_reserve(flat, count);
+  for (size_t i = 0; i < count && likely(rc == 0); i++) {
+    if (likely(i + BITCACHE_SET_FLAT_PREFETCH_DISTANCE < count))
+      bitcache_set_flat_prefetch(flat, &ids[i + BITCACHE_SET_FLAT_PREFETCH_DISTANCE]);
+    if (bitcache_set_flat_find(flat, &ids[i]) == NULL)
+      rc = bitcache_set_flat_add(flat, &ids[i]);
+  }
+  bitcache_set_flat_unlock(flat);
+
+  return rc;
+}
+
+static long
+bitcache_set_flat_remove_many(bitcache_set_t* set, const bitcache_id_t* ids, const size_t count) {
+  bitcache_set_flat_t* flat = set->instance;
+  assert(flat != NULL);
+
+  long hits = 0;
+
+  bitcache_set_flat_wrlock(flat);
+  for (size_t i = 0; i < count; i++) {
+    if (likely(i + BITCACHE_SET_FLAT_PREFETCH_DISTANCE < count))
+      bitcache_set_flat_prefetch(flat, &ids[i + BITCACHE_SET_FLAT_PREFETCH_DISTANCE]);
+    const bitcache_id_t* const slot = bitcache_set_flat_find(flat, &ids[i]);
+    if (slot != NULL) {
+      bitcache_set_flat_erase(flat, slot);
+      hits++;
+    }
+  }
+  bitcache_set_flat_unlock(flat);
+
+  return hits;
+}
+
+const bitcache_set_class_t bitcache_set_flat = {
+  .super   = NULL,
+  .name    = "bitcache_set_flat",
+  .options = 0,
+  .free    = bitcache_set_free,
+  .init    = bitcache_set_flat_init,
+  .reset   = bitcache_set_flat_reset,
+  .clear   = bitcache_set_flat_clear,
+  .count   = bitcache_set_flat_count,
+  .lookup  = bitcache_set_flat_lookup,
+  .insert  = bitcache_set_flat_insert,
+  .remove  = bitcache_set_flat_remove,
+  .replace = bitcache_set_flat_replace,
+  .lookup_many = bitcache_set_flat_lookup_many,
+  .insert_many = bitcache_set_flat_insert_many,
+  .remove_many = bitcache_set_flat_remove_many,
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// Set algebra (flat table implementation)
+
+// Copies the identifiers of a flat set into a fresh array. Returns their
+// number, or a negative error.
+static long
+bitcache_set_flat_collect(bitcache_set_t* set, bitcache_id_t** result) {
+  bitcache_set_flat_t* const flat = set->instance;
+  assert(flat != NULL);
+
+  long rc = 0;
+
+  bitcache_set_flat_rdlock(flat);
+  bitcache_id_t* const ids = malloc((flat->count > 0 ? flat->count : 1) * sizeof(bitcache_id_t));
+  if (likely(ids != NULL)) {
+    for (size_t i = 0; i < bitcache_set_flat_end(flat); i++) {
+      if ((bitcache_set_flat_ctrl_at(flat, i) & 0x80) == 0)
+        ids[rc++] = *bitcache_set_flat_slot_at(flat, i);
+    }
+  }
+  else {
+    rc = -errno; // cannot allocate memory
+  }
+  bitcache_set_flat_unlock(flat);
+
+  *result = ids;
+  return rc;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Bulk construction (flat table implementation)
+//
+// A bulk build empties the table, sizing it for all of the identifiers up
+// front, then fills it a partition at a time, on as many threads. Each
+// partition is a range of groups, holding the identifiers whose probe
+// sequences start within it, and its probes never leave the range. As the
+// table only fills up meanwhile, every identifier still ends up in the
+// first group on its probe sequence that had a free slot, just as if it
+// had been inserted alone.
+
+// Empties a flat set into a fresh table with room for a given number of
+// identifiers.
+static int
+bitcache_set_flat_prepare(bitcache_set_flat_t* flat, const size_t count) {
+  size_t capacity = BITCACHE_MAP_TABLE_GROUP;
+  while (bitcache_map_table_max_load(capacity) < count)
+    capacity *= 2;
+
+  bitcache_set_flat_release_old(flat);
+  free(flat->ctrl);
+  flat->ctrl = NULL, flat->slots = NULL;
+  flat->capacity = flat->count = flat->growth_left = 0;
+  return bitcache_set_flat_rehash(flat, capacity);
+}
+
+// Places the identifiers of one partition, whose probe sequences start in
+// the groups from `lo` up to `hi`, into a prepared table, without locking.
+// Identifiers whose probes would leave the range are moved to the front of
+// the array, to be placed once every partition has been filled; returns
+// their number. `*placed` receives the number of slots filled.
+static size_t
+bitcache_set_flat_fill(bitcache_set_flat_t* flat, bitcache_id_t* ids, const size_t count,
+                       const size_t lo, const size_t hi, size_t* placed) {
+  const size_t mask = flat->capacity / BITCACHE_MAP_TABLE_GROUP - 1;
+  size_t deferred = 0, filled = 0;
+
+  for (size_t j = 0; j < count; j++) {
+    if (j + BITCACHE_SET_FLAT_PREFETCH_DISTANCE < count)
+      bitcache_set_flat_prefetch(flat, &ids[j + BITCACHE_SET_FLAT_PREFETCH_DISTANCE]);
+
+    const uint64_t hash = bitcache_map_table_hash(&ids[j]);
+    const uint8_t tag = bitcache_map_table_tag(hash);
+    for (size_t i = 0, g = hash & mask; ; g = (g + ++i) & mask) {
+      if (unlikely(g < lo || g >= hi || i > mask)) {
+        if (deferred < j)
+          memcpy(&ids[deferred], &ids[j], sizeof(bitcache_id_t));
+        deferred++;
+        break;
+      }
+      uint8_t* const group = flat->ctrl + g * BITCACHE_MAP_TABLE_GROUP;
+      bool duplicate = FALSE;
+      for (uint32_t m = bitcache_map_table_match(group, tag); m != 0 && !duplicate; m &= m - 1)
+        duplicate = bitcache_map_table_key_equal(&flat->slots[g * BITCACHE_MAP_TABLE_GROUP + __builtin_ctz(m)], &ids[j]);
+      if (duplicate)
+        break;
+      const uint32_t m = bitcache_map_table_match_free(group);
+      if (likely(m != 0)) {
+        const size_t k = g * BITCACHE_MAP_TABLE_GROUP + __builtin_ctz(m);
+        flat->ctrl[k] = tag;
+        memcpy(&flat->slots[k], &ids[j], sizeof(bitcache_id_t));
+        filled++;
+        break;
+      }
+    }
+  }
+
+  *placed = filled;
+  return deferred;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Set Iterator API (flat table implementation)
+
+// Flat iterators need no state of their own: the position is the index of
+// the slot to resume scanning from. Removing the current identifier leaves
+// every other one in place.
+
+static int
+bitcache_set_iter_flat_init(bitcache_set_iter_t* iter, bitcache_set_t* restrict set) {
+  (void)set;
+  iter->instance = NULL;
+  return 0;
+}
+
+static int
+bitcache_set_iter_flat_reset(bitcache_set_iter_t* iter) {
+#ifndef NDEBUG
+  bzero(iter, sizeof(bitcache_set_iter_t));
+#endif
+  (void)iter;
+  return 0;
+}
+
+static bool
+bitcache_set_iter_flat_next(bitcache_set_iter_t* iter) {
+  const bitcache_set_flat_t* const flat = iter->set->instance;
+  assert(flat != NULL);
+
+  const size_t end = bitcache_set_flat_end(flat);
+  size_t i = iter->position;
+  while (i < end && (bitcache_set_flat_ctrl_at(flat, i) & 0x80) != 0)
+    i++;
+  if (i >= end)
+    return iter->position = i, FALSE;
+
+  iter->id = bitcache_set_flat_slot_at(flat, i);
+  iter->position = i + 1;
+  return TRUE;
+}
+
+static int
+bitcache_set_iter_flat_remove(bitcache_set_iter_t* iter) {
+  bitcache_set_flat_t* const flat = iter->set->instance;
+  assert(flat != NULL);
+  validate_with_errno_return(iter->id != NULL && iter->position > 0 && (size_t)iter->position <= bitcache_set_flat_end(flat));
+  validate_with_errno_return((bitcache_set_flat_ctrl_at(flat, iter->position - 1) & 0x80) == 0);
+
+  bitcache_set_flat_erase(flat, bitcache_set_flat_slot_at(flat, iter->position - 1));
+  iter->id = NULL;
+
+  return 0;
+}
+
+const bitcache_set_iter_class_t bitcache_set_iter_flat = {
+  .super   = NULL,
+  .name    = "bitcache_set_iter_flat",
+  .options = 0,
+  .init    = bitcache_set_iter_flat_init,
+  .reset   = bitcache_set_iter_flat_reset,
+  .next    = bitcache_set_iter_flat_next,
+  .remove  = bitcache_set_iter_flat_remove,
+};
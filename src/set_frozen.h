@@ -0,0 +1,580 @@
+/* This is free and unencumbered software released into the public domain. */
+
+#include "build.h"
+#include "crc32c.h"
+#include "filter_hash.h" /* for bitcache_filter_dword(), bitcache_filter_range64() */
+#include "io.h"
+#include <assert.h>   /* for assert() */
+#include <stdlib.h>   /* for calloc(), free(), malloc(), qsort() */
+#include <string.h>   /* for memcmp(), memcpy() */
+#include <sys/mman.h> /* for mmap(), munmap() */
+#include <sys/stat.h> /* for fstat() */
+#include <unistd.h>   /* for getpagesize(), lseek(), pread() */
+
+//////////////////////////////////////////////////////////////////////////////
+// Frozen set helpers
+//
+// A frozen set is a minimal perfect hash function over its identifiers,
+// in the style of PTHash, and the identifiers themselves stored densely in
+// the order that function assigns them. Keys are hashed into buckets, 60%
+// of them into the first 30% of the buckets; each bucket then has a pilot
+// chosen, largest bucket first, that sends all of its keys to distinct
+// free positions in a table slightly larger than the set. Positions past
+// the end of the set are remapped to the free positions left within it.
+//
+// A lookup hashes the identifier once, reads its bucket's pilot (and maybe
+// a remapped position), and compares the identifier stored there.
+
+// The average number of keys per bucket.
+#define BITCACHE_SET_FROZEN_BUCKET_SIZE 4
+
+// The number of seeds tried before construction gives up; an attempt only
+// fails should some bucket run out of pilots, which is very unlikely.
+#define BITCACHE_SET_FROZEN_MAX_ATTEMPTS 16
+
+// How many identifiers ahead batch lookups prefetch.
+#define BITCACHE_SET_FROZEN_PREFETCH_DISTANCE 8
+
+typedef struct {
+  uint64_t count;       // number of identifiers
+  uint64_t buckets;     // number of pilots
+  uint64_t table_size;  // number of positions pilots may pick from
+  uint64_t seed;
+  const uint64_t* remap;     // the position of each key placed past the end
+  const uint16_t* pilots;
+  const bitcache_id_t* ids;
+  void* body;           // remap, pilots and identifiers, in one block
+  size_t body_size;
+  uint32_t checksum;    // CRC-32C recorded for a loaded set, or zero
+  void* mapping;        // the mmap() region backing a loaded set, if any
+  size_t mapping_size;
+} bitcache_set_frozen_t;
+
+// The MurmurHash3 finalizer, for rehashing a key under a new seed.
+static inline uint64_t
+bitcache_set_frozen_mix(uint64_t h) {
+  h ^= h >> 33;
+  h *= UINT64_C(0xff51afd7ed558ccd);
+  h ^= h >> 33;
+  h *= UINT64_C(0xc4ceb9fe1a85ec53);
+  h ^= h >> 33;
+  return h;
+}
+
+// Hashes an identifier. Both of its leading words take part, so that
+// identifiers colliding under one seed are separated under another.
+static inline uint64_t
+bitcache_set_frozen_hash(const bitcache_id_t* id, const uint64_t seed) {
+  return bitcache_set_frozen_mix(bitcache_filter_dword(id, 0) ^ seed) ^ bitcache_filter_dword(id, 2);
+}
+
+// Maps a hash onto a bucket: 60% of hashes onto the first 30% of buckets.
+static inline uint64_t
+bitcache_set_frozen_bucket(const uint64_t hash, const uint64_t buckets) {
+  const uint64_t dense = (buckets * 3) / 10;
+  return ((uint32_t)hash < UINT32_C(0x9999999a)) ?
+    bitcache_filter_range64(hash, dense) :
+    dense + bitcache_filter_range64(hash, buckets - dense);
+}
+
+static inline uint64_t
+bitcache_set_frozen_position(const uint64_t hash, const uint16_t pilot, const uint64_t table_size) {
+  return bitcache_filter_range64(bitcache_set_frozen_mix(hash ^ (pilot * UINT64_C(0x9e3779b97f4a7c15))), table_size);
+}
+
+// The body starts with the remapped positions, then the pilots, padded to
+// a multiple of eight bytes, then the identifiers.
+static inline size_t
+bitcache_set_frozen_body_size(const uint64_t count, const uint64_t buckets, const uint64_t table_size) {
+  return (table_size - count) * sizeof(uint64_t) +
+    ((buckets * sizeof(uint16_t) + 7) & ~(uint64_t)7) +
+    count * sizeof(bitcache_id_t);
+}
+
+static inline void
+bitcache_set_frozen_attach(bitcache_set_frozen_t* frozen, void* body) {
+  frozen->body = body;
+  frozen->body_size = bitcache_set_frozen_body_size(frozen->count, frozen->buckets, frozen->table_size);
+  frozen->remap = body;
+  frozen->pilots = (const uint16_t*)(frozen->remap + (frozen->table_size - frozen->count));
+  frozen->ids = (const bitcache_id_t*)((const uint8_t*)frozen->pilots + ((frozen->buckets * sizeof(uint16_t) + 7) & ~(uint64_t)7));
+}
+
+// A loaded set is used in place wherever in the file it starts, so its
+// pilots and remapped positions may well be misaligned.
+static inline uint16_t
+bitcache_set_frozen_pilot(const bitcache_set_frozen_t* frozen, const uint64_t bucket) {
+  uint16_t pilot;
+  memcpy(&pilot, &frozen->pilots[bucket], sizeof(pilot));
+  return pilot;
+}
+
+static inline uint64_t
+bitcache_set_frozen_remap(const bitcache_set_frozen_t* frozen, const uint64_t position) {
+  uint64_t remapped;
+  memcpy(&remapped, &frozen->remap[position - frozen->count], sizeof(remapped));
+  return remapped;
+}
+
+// Returns the only slot that may hold a given identifier.
+static inline const bitcache_id_t*
+bitcache_set_frozen_slot(const bitcache_set_frozen_t* frozen, const bitcache_id_t* id) {
+  const uint64_t hash = bitcache_set_frozen_hash(id, frozen->seed);
+  const uint16_t pilot = bitcache_set_frozen_pilot(frozen, bitcache_set_frozen_bucket(hash, frozen->buckets));
+  const uint64_t position = bitcache_set_frozen_position(hash, pilot, frozen->table_size);
+  if (unlikely(position >= frozen->count))
+    return &frozen->ids[bitcache_set_frozen_remap(frozen, position)];
+  return &frozen->ids[position];
+}
+
+static inline bool
+bitcache_set_frozen_find(const bitcache_set_frozen_t* frozen, const bitcache_id_t* id) {
+  if (unlikely(frozen->count == 0))
+    return FALSE;
+  return memcmp(bitcache_set_frozen_slot(frozen, id), id, sizeof(bitcache_id_t)) == 0;
+}
+
+static void
+bitcache_set_frozen_release(bitcache_set_frozen_t* frozen) {
+  if (frozen->mapping != NULL)
+    munmap(frozen->mapping, frozen->mapping_size);
+  else
+    free(frozen->body);
+  bzero(frozen, sizeof(bitcache_set_frozen_t));
+}
+
+typedef struct {
+  uint64_t hash;
+  uint64_t index;       // of the identifier in the input array
+} bitcache_set_frozen_key_t;
+
+static int
+bitcache_set_frozen_key_compare(const void* a, const void* b) {
+  const uint64_t x = ((const bitcache_set_frozen_key_t*)a)->hash;
+  const uint64_t y = ((const bitcache_set_frozen_key_t*)b)->hash;
+  return (x > y) - (x < y);
+}
+
+// Tries to build a frozen set under a given seed. Returns -EAGAIN should
+// the seed not do, in which case another one will.
+static int
+bitcache_set_frozen_try(bitcache_set_frozen_t* frozen, const bitcache_id_t* ids, const size_t count,
+                        bitcache_set_frozen_key_t* keys, const uint64_t seed) {
+  for (size_t j = 0; j < count; j++) {
+    keys[j].hash = bitcache_set_frozen_hash(&ids[j], seed);
+    keys[j].index = j;
+  }
+  qsort(keys, count, sizeof(bitcache_set_frozen_key_t), bitcache_set_frozen_key_compare);
+
+  // drop duplicates, which hash alike under every seed:
+  size_t n = 0;
+  for (size_t j = 0; j < count; j++) {
+    if (n > 0 && keys[j].hash == keys[n - 1].hash) {
+      if (memcmp(&ids[keys[j].index], &ids[keys[n - 1].index], sizeof(bitcache_id_t)) == 0)
+        continue;
+      return -(errno = EAGAIN); // distinct identifiers colliding
+    }
+    keys[n++] = keys[j];
+  }
+
+  const uint64_t buckets = (n + BITCACHE_SET_FROZEN_BUCKET_SIZE - 1) / BITCACHE_SET_FROZEN_BUCKET_SIZE;
+  const uint64_t table_size = n + (n + 31) / 32; // about 97% full
+
+  int rc = 0;
+  size_t* sizes = NULL;
+  size_t* starts = calloc(buckets + 1, sizeof(size_t));
+  bitcache_set_frozen_key_t* bucketed = malloc((n > 0 ? n : 1) * sizeof(bitcache_set_frozen_key_t));
+  uint64_t* order = malloc((buckets > 0 ? buckets : 1) * sizeof(uint64_t));
+  uint64_t* taken = calloc((table_size + 63) / 64 + 1, sizeof(uint64_t));
+  uint8_t* body = malloc(bitcache_set_frozen_body_size(n, buckets, table_size) + 1);
+  if (unlikely(starts == NULL || bucketed == NULL || order == NULL || taken == NULL || body == NULL)) {
+    rc = -(errno = ENOMEM); // cannot allocate memory
+    goto cleanup;
+  }
+
+  bitcache_set_frozen_t result = {.count = n, .buckets = buckets, .table_size = table_size, .seed = seed};
+  bitcache_set_frozen_attach(&result, body);
+  uint16_t* const pilots = (uint16_t*)result.pilots;
+  uint64_t* const remap = (uint64_t*)result.remap;
+  bitcache_id_t* const slots = (bitcache_id_t*)result.ids;
+
+  // group the keys by bucket:
+  size_t largest = 0;
+  for (size_t j = 0; j < n; j++)
+    starts[bitcache_set_frozen_bucket(keys[j].hash, buckets) + 1]++;
+  for (uint64_t b = 0; b < buckets; b++) {
+    if (starts[b + 1] > largest)
+      largest = starts[b + 1];
+    starts[b + 1] += starts[b];
+  }
+  for (size_t j = 0; j < n; j++)
+    bucketed[starts[bitcache_set_frozen_bucket(keys[j].hash, buckets)]++] = keys[j];
+  for (uint64_t b = buckets; b > 0; b--)
+    starts[b] = starts[b - 1];
+  starts[0] = 0;
+
+  // order the buckets by decreasing size:
+  sizes = calloc(largest + 2, sizeof(size_t));
+  if (unlikely(sizes == NULL)) {
+    rc = -(errno = ENOMEM); // cannot allocate memory
+    goto cleanup;
+  }
+  for (uint64_t b = 0; b < buckets; b++)
+    sizes[largest - (starts[b + 1] - starts[b]) + 1]++;
+  for (size_t s = 0; s <= largest; s++)
+    sizes[s + 1] += sizes[s];
+  for (uint64_t b = 0; b < buckets; b++)
+    order[sizes[largest - (starts[b + 1] - starts[b])]++] = b;
+
+  // pick a pilot for each bucket in turn:
+  for (uint64_t k = 0; k < buckets; k++) {
+    const uint64_t b = order[k];
+    const bitcache_set_frozen_key_t* const bucket = &bucketed[starts[b]];
+    const size_t size = starts[b + 1] - starts[b];
+    if (size == 0)
+      break; // every bucket left is empty
+
+    uint32_t pilot = 0;
+    for (; pilot <= UINT16_MAX; pilot++) {
+      size_t i = 0;
+      for (; i < size; i++) {
+        const uint64_t position = bitcache_set_frozen_position(bucket[i].hash, pilot, table_size);
+        if (taken[position / 64] & (UINT64_C(1) << (position % 64)))
+          break;
+        taken[position / 64] |= UINT64_C(1) << (position % 64);
+      }
+      if (i == size)
+        break; // every key found a position of its own
+      while (i-- > 0) {
+        const uint64_t position = bitcache_set_frozen_position(bucket[i].hash, pilot, table_size);
+        taken[position / 64] &= ~(UINT64_C(1) << (position % 64));
+      }
+    }
+    if (unlikely(pilot > UINT16_MAX)) {
+      rc = -(errno = EAGAIN); // no pilot would do
+      goto cleanup;
+    }
+    pilots[b] = pilot;
+  }
+  for (uint64_t b = 0; b < buckets; b++) {
+    if (starts[b + 1] == starts[b])
+      pilots[b] = 0;
+  }
+
+  // pair the positions taken past the end with those left free before it:
+  for (uint64_t position = n, free_position = 0; position < table_size; position++) {
+    remap[position - n] = 0;
+    if (taken[position / 64] & (UINT64_C(1) << (position % 64))) {
+      while (taken[free_position / 64] & (UINT64_C(1) << (free_position % 64)))
+        free_position++;
+      remap[position - n] = free_position++;
+    }
+  }
+
+  for (size_t j = 0; j < n; j++) {
+    const bitcache_set_frozen_key_t* const key = &bucketed[j];
+    const uint16_t pilot = pilots[bitcache_set_frozen_bucket(key->hash, buckets)];
+    uint64_t position = bitcache_set_frozen_position(key->hash, pilot, table_size);
+    if (position >= n)
+      position = remap[position - n];
+    slots[position] = ids[key->index];
+  }
+
+  *frozen = result;
+  body = NULL;
+
+cleanup:
+  free(body);
+  free(taken);
+  free(order);
+  free(bucketed);
+  free(starts);
+  free(sizes);
+  return rc;
+}
+
+// Builds a frozen set holding a given array of identifiers, which may
+// contain duplicates.
+static int
+bitcache_set_frozen_init_ids(bitcache_set_frozen_t* frozen, const bitcache_id_t* ids, const size_t count) {
+  bzero(frozen, sizeof(bitcache_set_frozen_t));
+
+  bitcache_set_frozen_key_t* keys = malloc((count > 0 ? count : 1) * sizeof(bitcache_set_frozen_key_t));
+  if (unlikely(keys == NULL))
+    return -errno; // cannot allocate memory
+
+  int rc = -(errno = EAGAIN);
+  uint64_t seed = UINT64_C(0x9e3779b97f4a7c15);
+  for (unsigned int attempt = 0; attempt < BITCACHE_SET_FROZEN_MAX_ATTEMPTS && rc == -EAGAIN; attempt++) {
+    rc = bitcache_set_frozen_try(frozen, ids, count, keys, seed);
+    seed = bitcache_set_frozen_mix(seed);
+  }
+
+  free(keys);
+  return rc;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Set API (frozen implementation)
+
+// Frozen sets never change once built, so they take no locks at all.
+
+static int
+bitcache_set_frozen_init(bitcache_set_t* set) {
+  bitcache_set_frozen_t* frozen = calloc(1, sizeof(bitcache_set_frozen_t));
+  if (unlikely(frozen == NULL))
+    return -errno; // cannot allocate memory
+
+  set->instance = frozen;
+
+  return 0;
+}
+
+static int
+bitcache_set_frozen_reset(bitcache_set_t* set) {
+  bitcache_set_frozen_t* frozen = set->instance;
+  assert(frozen != NULL);
+
+  set->instance = NULL;
+
+  bitcache_set_frozen_release(frozen);
+  free(frozen);
+
+  return 0;
+}
+
+static long
+bitcache_set_frozen_count(bitcache_set_t* set) {
+  const bitcache_set_frozen_t* frozen = set->instance;
+  assert(frozen != NULL);
+
+  return frozen->count;
+}
+
+static bool
+bitcache_set_frozen_lookup(bitcache_set_t* set, const bitcache_id_t* restrict id) {
+  const bitcache_set_frozen_t* frozen = set->instance;
+  assert(frozen != NULL);
+
+  return bitcache_set_frozen_find(frozen, id);
+}
+
+static long
+bitcache_set_frozen_lookup_many(bitcache_set_t* set, const bitcache_id_t* ids, const size_t count, bool* found) {
+  const bitcache_set_frozen_t* frozen = set->instance;
+  assert(frozen != NULL);
+
+  long hits = 0;
+
+  for (size_t i = 0; i < count; i++) {
+    // fetch pilots twice as far ahead as the identifiers they lead to:
+    if (likely(i + 2 * BITCACHE_SET_FROZEN_PREFETCH_DISTANCE < count) && likely(frozen->count > 0)) {
+      const uint64_t hash = bitcache_set_frozen_hash(&ids[i + 2 * BITCACHE_SET_FROZEN_PREFETCH_DISTANCE], frozen->seed);
+      prefetch(&frozen->pilots[bitcache_set_frozen_bucket(hash, frozen->buckets)]);
+    }
+    if (likely(i + BITCACHE_SET_FROZEN_PREFETCH_DISTANCE < count) && likely(frozen->count > 0))
+      prefetch(bitcache_set_frozen_slot(frozen, &ids[i + BITCACHE_SET_FROZEN_PREFETCH_DISTANCE]));
+    const bool hit = bitcache_set_frozen_find(frozen, &ids[i]);
+    if (found != NULL)
+      found[i] = hit;
+    hits += hit;
+  }
+
+  return hits;
+}
+
+const bitcache_set_class_t bitcache_set_frozen = {
+  .super   = NULL,
+  .name    = "bitcache_set_frozen",
+  .options = 0,
+  .free    = bitcache_set_free,
+  .init    = bitcache_set_frozen_init,
+  .reset   = bitcache_set_frozen_reset,
+  .count   = bitcache_set_frozen_count,
+  .lookup  = bitcache_set_frozen_lookup,
+  .lookup_many = bitcache_set_frozen_lookup_many,
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// Set algebra (frozen implementation)
+
+// Copies the identifiers of a frozen set into a fresh array. Returns their
+// number, or a negative error.
+static long
+bitcache_set_frozen_collect(bitcache_set_t* set, bitcache_id_t** result) {
+  const bitcache_set_frozen_t* const frozen = set->instance;
+  assert(frozen != NULL);
+
+  bitcache_id_t* const ids = malloc((frozen->count > 0 ? frozen->count : 1) * sizeof(bitcache_id_t));
+  *result = ids;
+  if (unlikely(ids == NULL))
+    return -errno; // cannot allocate memory
+  if (frozen->count > 0)
+    memcpy(ids, frozen->ids, frozen->count * sizeof(bitcache_id_t));
+  return frozen->count;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Frozen set API
+
+int
+bitcache_set_frozen_build(bitcache_set_t* set, const bitcache_id_t* ids, const size_t count) {
+  validate_with_errno_return(set != NULL && set->class == &bitcache_set_frozen && set->instance != NULL);
+  validate_with_errno_return(ids != NULL || count == 0);
+
+  bitcache_set_frozen_t frozen;
+  const int rc = bitcache_set_frozen_init_ids(&frozen, ids, count);
+  if (unlikely(rc < 0))
+    return rc;
+
+  bitcache_set_frozen_release(set->instance);
+  *(bitcache_set_frozen_t*)set->instance = frozen;
+  return 0;
+}
+
+long COLD
+bitcache_set_frozen_load(bitcache_set_t* set, const int fd) {
+  validate_with_errno_return(set != NULL && set->class == &bitcache_set_frozen && set->instance != NULL && fd >= 0);
+
+  off_t off = lseek(fd, 0, SEEK_CUR);
+  if (unlikely(off == -1)) {
+    return -errno; // pipes, sockets and FIFOs are not supported
+  }
+
+  struct stat sb;
+  if (unlikely(fstat(fd, &sb) == -1)) {
+    return -errno;
+  }
+
+  bitcache_set_frozen_header_t header;
+  if (unlikely(sb.st_size - off < (off_t)sizeof(header) ||
+      pread(fd, &header, sizeof(header), off) != sizeof(header) ||
+      memcmp(header.magic, BITCACHE_SET_FROZEN_MAGIC, sizeof(header.magic)) != 0 ||
+      header.version < 1 || header.version > BITCACHE_SET_FROZEN_VERSION ||
+      header.table_size < header.count || header.table_size - header.count > header.count ||
+      header.buckets != (header.count + BITCACHE_SET_FROZEN_BUCKET_SIZE - 1) / BITCACHE_SET_FROZEN_BUCKET_SIZE ||
+      header.count > ((uint64_t)(sb.st_size - off) - sizeof(header)) / sizeof(bitcache_id_t) ||
+      bitcache_set_frozen_body_size(header.count, header.buckets, header.table_size) >
+        (uint64_t)(sb.st_size - off) - sizeof(header))) {
+    return -(errno = EINVAL); // not a frozen set
+  }
+
+  // mmap() requires a page-aligned file offset:
+  const off_t page_off = off & ~((off_t)getpagesize() - 1);
+  const size_t body_size = bitcache_set_frozen_body_size(header.count, header.buckets, header.table_size);
+  const size_t mapping_size = (off - page_off) + sizeof(header) + body_size;
+
+  void* base = mmap(NULL, mapping_size, PROT_READ, MAP_SHARED, fd, page_off);
+  if (unlikely(base == MAP_FAILED)) {
+    return -errno;
+  }
+
+  bitcache_set_frozen_t loaded = {
+    .count      = header.count,
+    .buckets    = header.buckets,
+    .table_size = header.table_size,
+    .seed       = header.seed,
+    .checksum   = header.checksum,
+  };
+  bitcache_set_frozen_attach(&loaded, (uint8_t*)base + (off - page_off) + sizeof(header));
+  loaded.mapping = base;
+  loaded.mapping_size = mapping_size;
+
+  // lookups index the identifiers by remapped position unchecked, so make
+  // sure that every one of them (about one per 32 identifiers) is in range:
+  for (uint64_t position = loaded.count; position < loaded.table_size; position++) {
+    if (unlikely(bitcache_set_frozen_remap(&loaded, position) >= loaded.count)) {
+      munmap(base, mapping_size);
+      return -(errno = EINVAL); // corrupted remap table
+    }
+  }
+
+  bitcache_set_frozen_t* const frozen = set->instance;
+  bitcache_set_frozen_release(frozen);
+  *frozen = loaded;
+  return frozen->count;
+}
+
+int COLD
+bitcache_set_frozen_verify(bitcache_set_t* set) {
+  validate_with_errno_return(set != NULL && set->class == &bitcache_set_frozen && set->instance != NULL);
+
+  const bitcache_set_frozen_t* const frozen = set->instance;
+  if (frozen->checksum == 0)
+    return 0; // no checksum was recorded
+
+  if (unlikely(bitcache_crc32c(0, frozen->body, frozen->body_size) != frozen->checksum))
+    return -(errno = EBADMSG); // checksum mismatch
+
+  return 0;
+}
+
+long COLD
+bitcache_set_frozen_dump(bitcache_set_t* set, const int fd) {
+  validate_with_errno_return(set != NULL && set->class == &bitcache_set_frozen && set->instance != NULL && fd >= 0);
+
+  const bitcache_set_frozen_t* const frozen = set->instance;
+
+  bitcache_set_frozen_header_t header;
+  bzero(&header, sizeof(header));
+  memcpy(header.magic, BITCACHE_SET_FROZEN_MAGIC, sizeof(header.magic));
+  header.version    = BITCACHE_SET_FROZEN_VERSION;
+  header.checksum   = bitcache_crc32c(0, frozen->body, frozen->body_size);
+  header.seed       = frozen->seed;
+  header.count      = frozen->count;
+  header.buckets    = frozen->buckets;
+  header.table_size = frozen->table_size;
+
+  int rc = bitcache_write(fd, &header, sizeof(header));
+  if (unlikely(rc < 0))
+    return rc;
+
+  rc = bitcache_write(fd, frozen->body, frozen->body_size);
+  if (unlikely(rc < 0))
+    return rc;
+
+  return sizeof(header) + frozen->body_size;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Set Iterator API (frozen implementation)
+
+// Frozen iterators need no state of their own: the position is the index
+// of the next identifier.
+
+static int
+bitcache_set_iter_frozen_init(bitcache_set_iter_t* iter, bitcache_set_t* restrict set) {
+  (void)set;
+  iter->instance = NULL;
+  return 0;
+}
+
+static int
+bitcache_set_iter_frozen_reset(bitcache_set_iter_t* iter) {
+#ifndef NDEBUG
+  bzero(iter, sizeof(bitcache_set_iter_t));
+#endif
+  (void)iter;
+  return 0;
+}
+
+static bool
+bitcache_set_iter_frozen_next(bitcache_set_iter_t* iter) {
+  const bitcache_set_frozen_t* const frozen = iter->set->instance;
+  assert(frozen != NULL);
+
+  if ((uint64_t)iter->position >= frozen->count)
+    return FALSE;
+
+  iter->id = (bitcache_id_t*)&frozen->ids[iter->position++];
+  return TRUE;
+}
+
+const bitcache_set_iter_class_t bitcache_set_iter_frozen = {
+  .super   = NULL,
+  .name    = "bitcache_set_iter_frozen",
+  .options = 0,
+  .init    = bitcache_set_iter_frozen_init,
+  .reset   = bitcache_set_iter_frozen_reset,
+  .next    = bitcache_set_iter_frozen_next,
+};
@@ -163,6 +163,79 @@ bitcache_set_hash_replace(bitcache_set_t* set, const bitcache_id_t* restrict id1
   return 0;
 }
 
+static long
+bitcache_set_hash_lookup_many(bitcache_set_t* set, const bitcache_id_t* ids, const size_t count, bool* found) {
+  bitcache_set_hash_t* hash_table = set->instance;
+  assert(hash_table != NULL);
+
+  long hits = 0;
+
+  bitcache_set_rdlock(hash_table);
+  if (likely(hash_table->data != NULL)) {
+    for (size_t i = 0; i < count; i++) {
+      const bool hit = g_hash_table_lookup_extended(hash_table->data, &ids[i], NULL, NULL);
+      if (found != NULL)
+        found[i] = hit;
+      hits += hit;
+    }
+  }
+  bitcache_set_unlock(hash_table);
+
+  return hits;
+}
+
+static int
+bitcache_set_hash_insert_many(bitcache_set_t* set, const bitcache_id_t* ids, const size_t count) {
+  bitcache_set_hash_t* hash_table = set->instance;
+  assert(hash_table != NULL);
+
+  // the table takes ownership of its keys, so copy them before locking:
+  bitcache_id_t** copies = malloc((count > 0 ? count : 1) * sizeof(bitcache_id_t*));
+  if (unlikely(copies == NULL))
+    return -errno; // cannot allocate memory
+  for (size_t i = 0; i < count; i++) {
+    copies[i] = malloc(sizeof(bitcache_id_t));
+    if (unlikely(copies[i] == NULL)) {
+      while (i-- > 0)
+        free(copies[i]);
+      free(copies);
+      return -(errno = ENOMEM); // cannot allocate memory
+    }
+    memcpy(copies[i], &ids[i], sizeof(bitcache_id_t));
+  }
+
+  bitcache_set_wrlock(hash_table);
+  if (likely(hash_table->data != NULL)) {
+    for (size_t i = 0; i < count; i++)
+      g_hash_table_insert(hash_table->data, copies[i], NULL);
+  }
+  else {
+    assert(hash_table->data != NULL);
+  }
+  bitcache_set_unlock(hash_table);
+
+  free(copies);
+
+  return 0;
+}
+
+static long
+bitcache_set_hash_remove_many(bitcache_set_t* set, const bitcache_id_t* ids, const size_t count) {
+  bitcache_set_hash_t* hash_table = set->instance;
+  assert(hash_table != NULL);
+
+  long hits = 0;
+
+  bitcache_set_wrlock(hash_table);
+  if (likely(hash_table->data != NULL)) {
+    for (size_t i = 0; i < count; i++)
+      hits += g_hash_table_remove(hash_table->data, &ids[i]);
+  }
+  bitcache_set_unlock(hash_table);
+
+  return hits;
+}
+
 const bitcache_set_class_t bitcache_set_hash = {
   .super   = NULL,
   .name    = "bitcache_set_hash",
@@ -176,8 +249,44 @@ const bitcache_set_class_t bitcache_set_hash = {
   .insert  = bitcache_set_hash_insert,
   .remove  = bitcache_set_hash_remove,
   .replace = bitcache_set_hash_replace,
+  .lookup_many = bitcache_set_hash_lookup_many,
+  .insert_many = bitcache_set_hash_insert_many,
+  .remove_many = bitcache_set_hash_remove_many,
 };
 
+//////////////////////////////////////////////////////////////////////////////
+// Set algebra (hash table implementation)
+
+// Copies the identifiers of a hash set into a fresh array. Returns their
+// number, or a negative error.
+static long
+bitcache_set_hash_collect(bitcache_set_t* set, bitcache_id_t** result) {
+  bitcache_set_hash_t* hash_table = set->instance;
+  assert(hash_table != NULL);
+
+  long rc = 0;
+
+  bitcache_set_rdlock(hash_table);
+  const size_t count = (hash_table->data != NULL) ? g_hash_table_size(hash_table->data) : 0;
+  bitcache_id_t* const ids = malloc((count > 0 ? count : 1) * sizeof(bitcache_id_t));
+  if (likely(ids != NULL)) {
+    if (likely(count > 0)) {
+      GHashTableIter hash_table_iter;
+      bitcache_id_t* id;
+      g_hash_table_iter_init(&hash_table_iter, hash_table->data);
+      while (g_hash_table_iter_next(&hash_table_iter, (void**)&id, NULL) != FALSE)
+        ids[rc++] = *id;
+    }
+  }
+  else {
+    rc = -errno; // cannot allocate memory
+  }
+  bitcache_set_unlock(hash_table);
+
+  *result = ids;
+  return rc;
+}
+
 //////////////////////////////////////////////////////////////////////////////
 // Set Iterator API (hash table implementation)
 
@@ -0,0 +1,716 @@
+/* This is free and unencumbered software released into the public domain. */
+
+#include "build.h"
+#include "thread.h"
+#include <assert.h> /* for assert() */
+#include <cprime.h> /* for rwlock_t */
+#include <stdlib.h> /* for malloc(), realloc() */
+#include <string.h> /* for memcmp(), memcpy(), memmove() */
+#include <sys/mman.h> /* for munmap() */
+
+#if 1
+#  define bitcache_set_sorted_crlock(set) rwlock_init(&(set)->lock)
+#  define bitcache_set_sorted_rmlock(set) rwlock_dispose(&(set)->lock)
+#  define bitcache_set_sorted_rdlock(set) rwlock_rdlock(&(set)->lock)
+#  define bitcache_set_sorted_wrlock(set) rwlock_wrlock(&(set)->lock)
+#  define bitcache_set_sorted_unlock(set) rwlock_unlock(&(set)->lock)
+#else
+#  define bitcache_set_sorted_crlock(set)
+#  define bitcache_set_sorted_rmlock(set)
+#  define bitcache_set_sorted_rdlock(set)
+#  define bitcache_set_sorted_wrlock(set)
+#  define bitcache_set_sorted_unlock(set)
+#endif /* HAVE_PTHREAD_H */
+
+// Searches narrower than this fall back from interpolation to bisection.
+#define BITCACHE_SET_SORTED_BISECT 16
+
+// The number of interpolation steps tried before bisecting regardless.
+#define BITCACHE_SET_SORTED_INTERPOLATE 4
+
+//////////////////////////////////////////////////////////////////////////////
+// Sorted array helpers
+
+typedef struct {
+  bitcache_id_t* ids; // in ascending order, without duplicates
+  size_t count;
+  size_t capacity;
+  void* mapping;      // the mmap() region backing the identifiers, if loaded
+  size_t mapping_size;
+#if 1
+  rwlock_t lock;
+#endif
+} bitcache_set_sorted_t;
+
+static inline int
+bitcache_set_sorted_compare(const bitcache_id_t* id1, const bitcache_id_t* id2) {
+  return memcmp(id1->digest.data, id2->digest.data, sizeof(bitcache_id_t));
+}
+
+// Returns the leading 8 bytes of an identifier as a big-endian integer,
+// which orders identifiers the same way their digests do.
+static inline uint64_t
+bitcache_set_sorted_prefix(const bitcache_id_t* id) {
+  uint64_t prefix;
+  memcpy(&prefix, id->digest.data, sizeof(prefix));
+  return __builtin_bswap64(prefix);
+}
+
+// Returns the index of the first identifier in `ids[lo, hi)` that is not
+// less than `id`, or `hi`, bisecting.
+static inline size_t
+bitcache_set_sorted_bisect(const bitcache_id_t* ids, size_t lo, size_t hi, const bitcache_id_t* id) {
+  while (lo < hi) {
+    const size_t mid = lo + (hi - lo) / 2;
+    if (bitcache_set_sorted_compare(&ids[mid], id) < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+// Returns the index of the first identifier in `ids` that is not less than
+// `id`. Digests are uniformly distributed, so interpolating on their
+// leading bytes lands next to the answer in a step or two on average.
+static size_t
+bitcache_set_sorted_search(const bitcache_id_t* ids, const size_t count, const bitcache_id_t* id) {
+  const uint64_t key = bitcache_set_sorted_prefix(id);
+  size_t lo = 0, hi = count;
+
+  for (unsigned int step = 0; step < BITCACHE_SET_SORTED_INTERPOLATE && hi - lo > BITCACHE_SET_SORTED_BISECT; step++) {
+    const uint64_t first = bitcache_set_sorted_prefix(&ids[lo]);
+    const uint64_t last = bitcache_set_sorted_prefix(&ids[hi - 1]);
+    if (key < first)
+      return lo;
+    if (key > last)
+      return hi;
+    if (first == last)
+      break;
+
+    size_t guess = lo + (size_t)((double)(key - first) / (double)(last - first) * (double)(hi - 1 - lo));
+    if (guess > hi - 1)
+      guess = hi - 1;
+    const int cmp = bitcache_set_sorted_compare(&ids[guess], id);
+    if (cmp == 0)
+      return guess;
+    if (cmp < 0)
+      lo = guess + 1;
+    else
+      hi = guess;
+  }
+
+  return bitcache_set_sorted_bisect(ids, lo, hi, id);
+}
+
+// Returns the index of the first identifier in `ids[lo, hi)` that is not
+// less than `id`, probing 1, 2, 4, ... identifiers ahead of `lo` first, so
+// that the cost is logarithmic in the distance skipped rather than in the
+// size of the array.
+static inline size_t
+bitcache_set_sorted_gallop(const bitcache_id_t* ids, size_t lo, const size_t hi, const bitcache_id_t* id) {
+  size_t step = 1;
+  while (lo + step <= hi && bitcache_set_sorted_compare(&ids[lo + step - 1], id) < 0) {
+    lo += step;
+    step *= 2;
+  }
+  return bitcache_set_sorted_bisect(ids, lo, (lo + step - 1 < hi) ? lo + step - 1 : hi, id);
+}
+
+// Releases the identifiers of a sorted set, which were either allocated or
+// mapped in by bitcache_set_load().
+static void
+bitcache_set_sorted_release(bitcache_set_sorted_t* sorted) {
+  if (sorted->mapping != NULL)
+    munmap(sorted->mapping, sorted->mapping_size);
+  else
+    free(sorted->ids);
+  sorted->ids = NULL;
+  sorted->count = sorted->capacity = 0;
+  sorted->mapping = NULL;
+  sorted->mapping_size = 0;
+}
+
+static int
+bitcache_set_sorted_reserve(bitcache_set_sorted_t* sorted, const size_t capacity) {
+  if (likely(capacity <= sorted->capacity))
+    return 0;
+  size_t new_capacity = sorted->capacity ? sorted->capacity : 16;
+  while (new_capacity < capacity)
+    new_capacity *= 2;
+
+  if (sorted->mapping != NULL) {
+    // a mapped-in set moves to the heap once it outgrows its mapping:
+    bitcache_id_t* const ids = malloc(new_capacity * sizeof(bitcache_id_t));
+    if (unlikely(ids == NULL))
+      return -errno; // cannot allocate memory
+    const size_t count = sorted->count;
+    if (count > 0)
+      memcpy(ids, sorted->ids, count * sizeof(bitcache_id_t));
+    bitcache_set_sorted_release(sorted);
+    sorted->ids = ids, sorted->count = count, sorted->capacity = new_capacity;
+    return 0;
+  }
+
+  bitcache_id_t* const ids = realloc(sorted->ids, new_capacity * sizeof(bitcache_id_t));
+  if (unlikely(ids == NULL))
+    return -errno; // cannot allocate memory
+  sorted->ids = ids, sorted->capacity = new_capacity;
+  return 0;
+}
+
+// Sorts a copy of a batch of identifiers, dropping duplicates. Returns the
+// number of distinct identifiers, or a negative error.
+static long
+bitcache_set_sorted_normalize(const bitcache_id_t* ids, const size_t count, bitcache_id_t** result) {
+  bitcache_id_t* const batch = malloc((count > 0 ? count : 1) * sizeof(bitcache_id_t));
+  if (unlikely(batch == NULL))
+    return -errno; // cannot allocate memory
+  if (count > 0)
+    memcpy(batch, ids, count * sizeof(bitcache_id_t));
+  bitcache_id_sort(batch, count, 1);
+
+  *result = batch;
+  return bitcache_id_unique(batch, count);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Sorted array merges
+//
+// Each merge gallops through runs of identifiers that the other array has
+// nothing between, so that merging a small array into a large one costs
+// time logarithmic, not linear, in the large one per small identifier,
+// while interleaved arrays of similar size still merge in linear time.
+
+// Writes the union of two sorted arrays to `out`, which has room for
+// `count1 + count2` identifiers. Returns the size of the union.
+static size_t
+bitcache_set_sorted_merge_union(const bitcache_id_t* ids1, const size_t count1,
+                                const bitcache_id_t* ids2, const size_t count2,
+                                bitcache_id_t* out) {
+  size_t i = 0, j = 0, n = 0;
+  while (i < count1 && j < count2) {
+    const int cmp = bitcache_set_sorted_compare(&ids1[i], &ids2[j]);
+    if (cmp < 0) {
+      const size_t k = bitcache_set_sorted_gallop(ids1, i, count1, &ids2[j]);
+      memcpy(&out[n], &ids1[i], (k - i) * sizeof(bitcache_id_t));
+      n += k - i, i = k;
+    }
+    else if (cmp > 0) {
+      const size_t k = bitcache_set_sorted_gallop(ids2, j, count2, &ids1[i]);
+      memcpy(&out[n], &ids2[j], (k - j) * sizeof(bitcache_id_t));
+      n += k - j, j = k;
+    }
+    else {
+      out[n++] = ids1[i++], j++;
+    }
+  }
+  if (i < count1)
+    memcpy(&out[n], &ids1[i], (count1 - i) * sizeof(bitcache_id_t)), n += count1 - i;
+  if (j < count2)
+    memcpy(&out[n], &ids2[j], (count2 - j) * sizeof(bitcache_id_t)), n += count2 - j;
+  return n;
+}
+
+// Writes the intersection of two sorted arrays to `out` (if not NULL),
+// which has room for the smaller of the two. Returns its size.
+static size_t
+bitcache_set_sorted_merge_intersection(const bitcache_id_t* ids1, const size_t count1,
+                                       const bitcache_id_t* ids2, const size_t count2,
+                                       bitcache_id_t* out) {
+  size_t i = 0, j = 0, n = 0;
+  while (i < count1 && j < count2) {
+    const int cmp = bitcache_set_sorted_compare(&ids1[i], &ids2[j]);
+    if (cmp < 0) {
+      i = bitcache_set_sorted_gallop(ids1, i, count1, &ids2[j]);
+    }
+    else if (cmp > 0) {
+      j = bitcache_set_sorted_gallop(ids2, j, count2, &ids1[i]);
+    }
+    else {
+      if (out != NULL)
+        out[n] = ids1[i];
+      n++, i++, j++;
+    }
+  }
+  return n;
+}
+
+// Writes the identifiers of one sorted array that are not in another to
+// `out` (if not NULL), which has room for `count1` identifiers. Returns
+// their number.
+static size_t
+bitcache_set_sorted_merge_difference(const bitcache_id_t* ids1, const size_t count1,
+                                     const bitcache_id_t* ids2, const size_t count2,
+                                     bitcache_id_t* out) {
+  size_t i = 0, j = 0, n = 0;
+  while (i < count1 && j < count2) {
+    const int cmp = bitcache_set_sorted_compare(&ids1[i], &ids2[j]);
+    if (cmp < 0) {
+      const size_t k = bitcache_set_sorted_gallop(ids1, i, count1, &ids2[j]);
+      if (out != NULL)
+        memmove(&out[n], &ids1[i], (k - i) * sizeof(bitcache_id_t));
+      n += k - i, i = k;
+    }
+    else if (cmp > 0) {
+      j = bitcache_set_sorted_gallop(ids2, j, count2, &ids1[i]);
+    }
+    else {
+      i++, j++;
+    }
+  }
+  if (out != NULL && i < count1)
+    memmove(&out[n], &ids1[i], (count1 - i) * sizeof(bitcache_id_t));
+  return n + (count1 - i);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Set API (sorted array implementation)
+
+static int
+bitcache_set_sorted_init(bitcache_set_t* set) {
+  bitcache_set_sorted_t* sorted = calloc(1, sizeof(bitcache_set_sorted_t));
+  if (unlikely(sorted == NULL))
+    return -errno; // cannot allocate memory
+
+  bitcache_set_sorted_crlock(sorted);
+  set->instance = sorted;
+
+  return 0;
+}
+
+static int
+bitcache_set_sorted_reset(bitcache_set_t* set) {
+  bitcache_set_sorted_t* sorted = set->instance;
+  assert(sorted != NULL);
+
+  set->instance = NULL;
+
+  bitcache_set_sorted_rmlock(sorted);
+  bitcache_set_sorted_release(sorted);
+  free(sorted);
+
+  return 0;
+}
+
+static int
+bitcache_set_sorted_clear(bitcache_set_t* set) {
+  bitcache_set_sorted_t* sorted = set->instance;
+  assert(sorted != NULL);
+
+  bitcache_set_sorted_wrlock(sorted);
+  sorted->count = 0;
+  bitcache_set_sorted_unlock(sorted);
+
+  return 0;
+}
+
+static long
+bitcache_set_sorted_count(bitcache_set_t* set) {
+  bitcache_set_sorted_t* sorted = set->instance;
+  assert(sorted != NULL);
+
+  bitcache_set_sorted_rdlock(sorted);
+  const long count = sorted->count;
+  bitcache_set_sorted_unlock(sorted);
+
+  return count;
+}
+
+static bool
+bitcache_set_sorted_lookup(bitcache_set_t* set, const bitcache_id_t* restrict id) {
+  bitcache_set_sorted_t* sorted = set->instance;
+  assert(sorted != NULL);
+
+  bitcache_set_sorted_rdlock(sorted);
+  const size_t i = bitcache_set_sorted_search(sorted->ids, sorted->count, id);
+  const bool found = (i < sorted->count && bitcache_set_sorted_compare(&sorted->ids[i], id) == 0);
+  bitcache_set_sorted_unlock(sorted);
+
+  return found;
+}
+
+static int
+bitcache_set_sorted_insert(bitcache_set_t* set, const bitcache_id_t* restrict id) {
+  bitcache_set_sorted_t* sorted = set->instance;
+  assert(sorted != NULL);
+
+  int rc = 0;
+
+  bitcache_set_sorted_wrlock(sorted);
+  const size_t i = bitcache_set_sorted_search(sorted->ids, sorted->count, id);
+  if (i == sorted->count || bitcache_set_sorted_compare(&sorted->ids[i], id) != 0) {
+    if (likely((rc = bitcache_set_sorted_reserve(sorted, sorted->count + 1)) == 0)) {
+      memmove(&sorted->ids[i + 1], &sorted->ids[i], (sorted->count - i) * sizeof(bitcache_id_t));
+      sorted->ids[i] = *id;
+      sorted->count++;
+    }
+  }
+  bitcache_set_sorted_unlock(sorted);
+
+  return rc;
+}
+
+static int
+bitcache_set_sorted_remove(bitcache_set_t* set, const bitcache_id_t* restrict id) {
+  bitcache_set_sorted_t* sorted = set->instance;
+  assert(sorted != NULL);
+
+  bitcache_set_sorted_wrlock(sorted);
+  const size_t i = bitcache_set_sorted_search(sorted->ids, sorted->count, id);
+  if (i < sorted->count && bitcache_set_sorted_compare(&sorted->ids[i], id) == 0) {
+    memmove(&sorted->ids[i], &sorted->ids[i + 1], (sorted->count - i - 1) * sizeof(bitcache_id_t));
+    sorted->count--;
+  }
+  bitcache_set_sorted_unlock(sorted);
+
+  return 0;
+}
+
+static int
+bitcache_set_sorted_replace(bitcache_set_t* set, const bitcache_id_t* restrict id1, const bitcache_id_t* restrict id2) {
+  const int rc = bitcache_set_sorted_remove(set, id1);
+  if (unlikely(rc < 0) || id2 == NULL)
+    return rc;
+  return bitcache_set_sorted_insert(set, id2);
+}
+
+static long
+bitcache_set_sorted_lookup_many(bitcache_set_t* set, const bitcache_id_t* ids, const size_t count, bool* found) {
+  bitcache_set_sorted_t* sorted = set->instance;
+  assert(sorted != NULL);
+
+  long hits = 0;
+
+  bitcache_set_sorted_rdlock(sorted);
+  for (size_t i = 0; i < count; i++) {
+    const size_t j = bitcache_set_sorted_search(sorted->ids, sorted->count, &ids[i]);
+    const bool hit = (j < sorted->count && bitcache_set_sorted_compare(&sorted->ids[j], &ids[i]) == 0);
+    if (found != NULL)
+      found[i] = hit;
+    hits += hit;
+  }
+  bitcache_set_sorted_unlock(sorted);
+
+  return hits;
+}
+
+// Inserting a batch sorts it, then merges it into the set in one pass.
+static int
+bitcache_set_sorted_insert_many(bitcache_set_t* set, const bitcache_id_t* ids, const size_t count) {
+  bitcache_set_sorted_t* sorted = set->instance;
+  assert(sorted != NULL);
+
+  bitcache_id_t* batch = NULL;
+  const long n = bitcache_set_sorted_normalize(ids, count, &batch);
+  if (unlikely(n < 0))
+    return n; // cannot allocate memory
+
+  int rc = 0;
+
+  bitcache_set_sorted_wrlock(sorted);
+  const size_t capacity = (sorted->count + n > 0) ? sorted->count + n : 1;
+  bitcache_id_t* const out = malloc(capacity * sizeof(bitcache_id_t));
+  if (likely(out != NULL)) {
+    const size_t merged = bitcache_set_sorted_merge_union(sorted->ids, sorted->count, batch, n, out);
+    bitcache_set_sorted_release(sorted);
+    sorted->ids = out;
+    sorted->count = merged;
+    sorted->capacity = capacity;
+  }
+  else {
+    rc = -errno; // cannot allocate memory
+  }
+  bitcache_set_sorted_unlock(sorted);
+
+  free(batch);
+
+  return rc;
+}
+
+// Removing a batch sorts it, then sweeps it out of the set in one pass.
+static long
+bitcache_set_sorted_remove_many(bitcache_set_t* set, const bitcache_id_t* ids, const size_t count) {
+  bitcache_set_sorted_t* sorted = set->instance;
+  assert(sorted != NULL);
+
+  bitcache_id_t* batch = NULL;
+  const long n = bitcache_set_sorted_normalize(ids, count, &batch);
+  if (unlikely(n < 0))
+    return n; // cannot allocate memory
+
+  bitcache_set_sorted_wrlock(sorted);
+  const size_t before = sorted->count;
+  sorted->count = bitcache_set_sorted_merge_difference(sorted->ids, sorted->count, batch, n, sorted->ids);
+  const long hits = before - sorted->count;
+  bitcache_set_sorted_unlock(sorted);
+
+  free(batch);
+
+  return hits;
+}
+
+const bitcache_set_class_t bitcache_set_sorted = {
+  .super   = NULL,
+  .name    = "bitcache_set_sorted",
+  .options = 0,
+  .free    = bitcache_set_free,
+  .init    = bitcache_set_sorted_init,
+  .reset   = bitcache_set_sorted_reset,
+  .clear   = bitcache_set_sorted_clear,
+  .count   = bitcache_set_sorted_count,
+  .lookup  = bitcache_set_sorted_lookup,
+  .insert  = bitcache_set_sorted_insert,
+  .remove  = bitcache_set_sorted_remove,
+  .replace = bitcache_set_sorted_replace,
+  .lookup_many = bitcache_set_sorted_lookup_many,
+  .insert_many = bitcache_set_sorted_insert_many,
+  .remove_many = bitcache_set_sorted_remove_many,
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// Set algebra (sorted array implementation)
+
+typedef enum {
+  BITCACHE_SET_SORTED_UNION,
+  BITCACHE_SET_SORTED_INTERSECTION,
+  BITCACHE_SET_SORTED_DIFFERENCE,
+} bitcache_set_sorted_op_t;
+
+// The fewest identifiers worth handing to a thread of their own.
+#define BITCACHE_SET_SORTED_PARALLEL_MIN 65536
+
+// Represents the identifiers of two sorted sets within one range of
+// prefixes, and where their merge goes.
+typedef struct {
+  bitcache_set_sorted_op_t op;
+  const bitcache_id_t* ids1;
+  size_t count1;
+  const bitcache_id_t* ids2;
+  size_t count2;
+  bitcache_id_t* out; // NULL when only counting
+  size_t count;       // the size of the merge
+} bitcache_set_sorted_part_t;
+
+static void*
+bitcache_set_sorted_merge_part(void* arg) {
+  bitcache_set_sorted_part_t* const part = arg;
+  switch (part->op) {
+    case BITCACHE_SET_SORTED_UNION:
+      part->count = bitcache_set_sorted_merge_union(part->ids1, part->count1, part->ids2, part->count2, part->out);
+      break;
+    case BITCACHE_SET_SORTED_INTERSECTION:
+      part->count = bitcache_set_sorted_merge_intersection(part->ids1, part->count1, part->ids2, part->count2, part->out);
+      break;
+    case BITCACHE_SET_SORTED_DIFFERENCE:
+      part->count = bitcache_set_sorted_merge_difference(part->ids1, part->count1, part->ids2, part->count2, part->out);
+      break;
+  }
+  return NULL;
+}
+
+// Merges two sorted arrays, split into `n` ranges of identifier prefixes
+// that are merged independently, on as many threads. The merged ranges
+// are written to `out` (if not NULL) at the offsets their inputs start at,
+// then packed together. Returns the size of the merge.
+static size_t
+bitcache_set_sorted_merge_parts(const bitcache_set_sorted_op_t op, size_t n,
+                                const bitcache_id_t* ids1, const size_t count1,
+                                const bitcache_id_t* ids2, const size_t count2,
+                                bitcache_id_t* out) {
+  bitcache_set_sorted_part_t parts[n];
+  size_t lo1 = 0, lo2 = 0;
+  for (size_t t = 0; t < n; t++) {
+    size_t hi1 = count1, hi2 = count2;
+    if (t + 1 < n) {
+      // the first identifier of the next range of prefixes:
+      bitcache_id_t bound;
+      bzero(&bound, sizeof(bound));
+      const uint64_t prefix = __builtin_bswap64((t + 1) * (UINT64_MAX / n));
+      memcpy(bound.digest.data, &prefix, sizeof(prefix));
+      hi1 = lo1 + bitcache_set_sorted_search(&ids1[lo1], count1 - lo1, &bound);
+      hi2 = lo2 + bitcache_set_sorted_search(&ids2[lo2], count2 - lo2, &bound);
+    }
+    parts[t].op = op;
+    parts[t].ids1 = &ids1[lo1], parts[t].count1 = hi1 - lo1;
+    parts[t].ids2 = &ids2[lo2], parts[t].count2 = hi2 - lo2;
+    parts[t].out = (out == NULL) ? NULL : &out[(op == BITCACHE_SET_SORTED_UNION) ? lo1 + lo2 : lo1];
+    parts[t].count = 0;
+    lo1 = hi1, lo2 = hi2;
+  }
+
+  bitcache_thread_run(bitcache_set_sorted_merge_part, parts, sizeof(parts[0]), n);
+
+  size_t count = 0;
+  for (size_t t = 0; t < n; t++) {
+    if (out != NULL && parts[t].out != &out[count] && parts[t].count > 0)
+      memmove(&out[count], parts[t].out, parts[t].count * sizeof(bitcache_id_t));
+    count += parts[t].count;
+  }
+  return count;
+}
+
+// Merges two sorted sets into a fresh array, under their read locks, on a
+// given number of threads (zero selecting one per online CPU). Returns the
+// size of the merge, or a negative error.
+static long
+bitcache_set_sorted_combine(bitcache_set_t* set1, bitcache_set_t* set2, const bitcache_set_sorted_op_t op,
+                            const unsigned int threads, bitcache_id_t** result) {
+  bitcache_set_sorted_t* const sorted1 = set1->instance;
+  bitcache_set_sorted_t* const sorted2 = set2->instance;
+  assert(sorted1 != NULL && sorted2 != NULL);
+
+  long rc = 0;
+
+  // lock in address order, lest two merges of the same sets in opposite
+  // order deadlock behind a writer:
+  bitcache_set_sorted_rdlock(sorted1 < sorted2 ? sorted1 : sorted2);
+  if (sorted2 != sorted1)
+    bitcache_set_sorted_rdlock(sorted1 < sorted2 ? sorted2 : sorted1);
+
+  const size_t total = sorted1->count + sorted2->count;
+  const size_t n = bitcache_thread_count(threads, total, BITCACHE_SET_SORTED_PARALLEL_MIN);
+
+  bitcache_id_t* out = NULL;
+  if (result != NULL) {
+    const size_t room = (op == BITCACHE_SET_SORTED_UNION) ? total : sorted1->count;
+    out = malloc((room > 0 ? room : 1) * sizeof(bitcache_id_t));
+    if (unlikely(out == NULL))
+      rc = -errno; // cannot allocate memory
+  }
+  if (likely(rc == 0)) {
+    rc = (n > 1) ?
+      bitcache_set_sorted_merge_parts(op, n, sorted1->ids, sorted1->count, sorted2->ids, sorted2->count, out) :
+      (op == BITCACHE_SET_SORTED_UNION) ?
+        bitcache_set_sorted_merge_union(sorted1->ids, sorted1->count, sorted2->ids, sorted2->count, out) :
+      (op == BITCACHE_SET_SORTED_INTERSECTION) ?
+        bitcache_set_sorted_merge_intersection(sorted1->ids, sorted1->count, sorted2->ids, sorted2->count, out) :
+        bitcache_set_sorted_merge_difference(sorted1->ids, sorted1->count, sorted2->ids, sorted2->count, out);
+  }
+
+  if (sorted2 != sorted1)
+    bitcache_set_sorted_unlock(sorted2);
+  bitcache_set_sorted_unlock(sorted1);
+
+  if (result != NULL)
+    *result = out;
+  return rc;
+}
+
+// Replaces the contents of a sorted set with a sorted array of distinct
+// identifiers, taking ownership of the array.
+static void
+bitcache_set_sorted_adopt(bitcache_set_t* set, bitcache_id_t* ids, const size_t count) {
+  bitcache_set_sorted_t* const sorted = set->instance;
+  assert(sorted != NULL);
+
+  bitcache_set_sorted_wrlock(sorted);
+  bitcache_set_sorted_release(sorted);
+  sorted->ids = ids;
+  sorted->count = count;
+  sorted->capacity = count;
+  bitcache_set_sorted_unlock(sorted);
+}
+
+// Replaces the contents of a sorted set with a sorted array of distinct
+// identifiers mapped in from a file, taking ownership of the mapping. The
+// mapping must be private and writable: removals then modify it in place,
+// copy-on-write, while insertions move the identifiers to the heap.
+static void
+bitcache_set_sorted_attach(bitcache_set_t* set, void* mapping, const size_t mapping_size, bitcache_id_t* ids, const size_t count) {
+  bitcache_set_sorted_t* const sorted = set->instance;
+  assert(sorted != NULL);
+
+  bitcache_set_sorted_wrlock(sorted);
+  bitcache_set_sorted_release(sorted);
+  sorted->ids = ids;
+  sorted->count = count;
+  sorted->capacity = count;
+  sorted->mapping = mapping;
+  sorted->mapping_size = mapping_size;
+  bitcache_set_sorted_unlock(sorted);
+}
+
+// Copies the identifiers of a sorted set into a fresh array. Returns their
+// number, or a negative error.
+static long
+bitcache_set_sorted_collect(bitcache_set_t* set, bitcache_id_t** result) {
+  bitcache_set_sorted_t* const sorted = set->instance;
+  assert(sorted != NULL);
+
+  long rc;
+
+  bitcache_set_sorted_rdlock(sorted);
+  bitcache_id_t* const ids = malloc((sorted->count > 0 ? sorted->count : 1) * sizeof(bitcache_id_t));
+  if (likely(ids != NULL)) {
+    if (sorted->count > 0)
+      memcpy(ids, sorted->ids, sorted->count * sizeof(bitcache_id_t));
+    rc = sorted->count;
+  }
+  else {
+    rc = -errno; // cannot allocate memory
+  }
+  bitcache_set_sorted_unlock(sorted);
+
+  *result = ids;
+  return rc;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Set Iterator API (sorted array implementation)
+
+// Sorted iterators need no state of their own: the position is the index
+// of the next identifier.
+
+static int
+bitcache_set_iter_sorted_init(bitcache_set_iter_t* iter, bitcache_set_t* restrict set) {
+  (void)set;
+  iter->instance = NULL;
+  return 0;
+}
+
+static int
+bitcache_set_iter_sorted_reset(bitcache_set_iter_t* iter) {
+#ifndef NDEBUG
+  bzero(iter, sizeof(bitcache_set_iter_t));
+#endif
+  (void)iter;
+  return 0;
+}
+
+static bool
+bitcache_set_iter_sorted_next(bitcache_set_iter_t* iter) {
+  const bitcache_set_sorted_t* const sorted = iter->set->instance;
+  assert(sorted != NULL);
+
+  if ((size_t)iter->position >= sorted->count)
+    return FALSE;
+
+  iter->id = &sorted->ids[iter->position++];
+  return TRUE;
+}
+
+static int
+bitcache_set_iter_sorted_remove(bitcache_set_iter_t* iter) {
+  bitcache_set_sorted_t* const sorted = iter->set->instance;
+  assert(sorted != NULL);
+  validate_with_errno_return(iter->position > 0 && (size_t)iter->position <= sorted->count);
+
+  // the next identifier moves down into the current one's place:
+  const size_t i = --iter->position;
+  memmove(&sorted->ids[i], &sorted->ids[i + 1], (sorted->count - i - 1) * sizeof(bitcache_id_t));
+  sorted->count--;
+  iter->id = NULL;
+
+  return 0;
+}
+
+const bitcache_set_iter_class_t bitcache_set_iter_sorted = {
+  .super   = NULL,
+  .name    = "bitcache_set_iter_sorted",
+  .options = 0,
+  .init    = bitcache_set_iter_sorted_init,
+  .reset   = bitcache_set_iter_sorted_reset,
+  .next    = bitcache_set_iter_sorted_next,
+  .remove  = bitcache_set_iter_sorted_remove,
+};
@@ -0,0 +1,633 @@
+/* This is free and unencumbered software released into the public domain. */
+
+#include "test.h"
+#include "thread.h"
+#include <strings.h> /* for bzero() */
+#include <sys/wait.h> /* for waitpid() */
+
+//////////////////////////////////////////////////////////////////////////////
+// Filter tests
+
+#define COUNT 10000
+
+// Every dumped filter header starts with 8 magic bytes and a version.
+#define VERSION_OFFSET 8
+
+static void
+test_layout(const bitcache_filter_layout_t layout) {
+  bitcache_id_t* const ids = test_ids(0, 2 * COUNT);
+  bitcache_filter_t filter;
+  check(bitcache_filter_init(&filter, 64 * 1024, layout, 0) == 0);
+  for (size_t i = 0; i < COUNT; i++)
+    check(bitcache_filter_insert(&filter, &ids[i]) == 0);
+
+  size_t missing = 0, false_positives = 0;
+  for (size_t i = 0; i < COUNT; i++)
+    missing += !bitcache_filter_lookup(&filter, &ids[i]);
+  for (size_t i = COUNT; i < 2 * COUNT; i++)
+    false_positives += bitcache_filter_lookup(&filter, &ids[i]);
+  check(missing == 0);
+  check(false_positives < COUNT / 100);
+
+  check(bitcache_filter_clear(&filter) == 0);
+  check(!bitcache_filter_lookup(&filter, &ids[0]));
+  check(bitcache_filter_reset(&filter) == 0);
+
+  // blocked filters are rounded up to whole blocks:
+  check(bitcache_filter_init(&filter, 1000, layout, 0) == 0);
+  check(filter.size == (layout == BITCACHE_FILTER_BLOCKED ? 1024 : 1000));
+  check(bitcache_filter_reset(&filter) == 0);
+  free(ids);
+}
+
+static void
+test_lookup_many(const bitcache_filter_layout_t layout) {
+  const size_t count = 2 * COUNT + 5; // not a whole number of bytes
+  bitcache_id_t* const ids = test_ids(0, count);
+  bitcache_filter_t filter;
+  check(bitcache_filter_init(&filter, 64 * 1024, layout, 0) == 0);
+  for (size_t i = 0; i < COUNT; i++)
+    check(bitcache_filter_insert(&filter, &ids[i]) == 0);
+
+  // every result agrees with a lookup of its own, whatever was there before:
+  uint8_t* const results = malloc((count + 7) / 8);
+  memset(results, 0xaa, (count + 7) / 8);
+  size_t expected = 0, mismatches = 0;
+  for (size_t i = 0; i < count; i++)
+    expected += bitcache_filter_lookup(&filter, &ids[i]);
+  check(bitcache_filter_lookup_many(&filter, ids, count, results) == (long)expected);
+  for (size_t i = 0; i < count; i++)
+    mismatches += ((results[i / 8] >> (i % 8)) & 1) != bitcache_filter_lookup(&filter, &ids[i]);
+  check(mismatches == 0);
+  check(expected >= COUNT);
+
+  check(bitcache_filter_clear(&filter) == 0);
+  check(bitcache_filter_lookup_many(&filter, ids, count, results) == 0);
+  check(results[0] == 0 && results[count / 16] == 0);
+
+  free(results);
+  check(bitcache_filter_reset(&filter) == 0);
+  free(ids);
+}
+
+static void
+test_dump(const bitcache_filter_layout_t layout) {
+  bitcache_id_t* const ids = test_ids(0, COUNT);
+  bitcache_filter_t filter, loaded;
+  check(bitcache_filter_init(&filter, 64 * 1024, layout, 0) == 0);
+  for (size_t i = 0; i < COUNT; i++)
+    check(bitcache_filter_insert(&filter, &ids[i]) == 0);
+
+  const int fd = test_file();
+  check(fd != -1);
+  check(bitcache_filter_dump(&filter, fd) > 0);
+  test_rewind(fd);
+  bzero(&loaded, sizeof(loaded));
+  check(bitcache_filter_load(&loaded, fd) > 0);
+  check(bitcache_filter_verify(&loaded) == 0);
+  check(bitcache_filter_compare(&filter, &loaded) == 0);
+  check(loaded.layout == layout && loaded.k == filter.k);
+  check(bitcache_filter_reset(&loaded) == 0);
+
+  // a corrupted bitmap is caught on verification, or while loading if
+  // asked for:
+  test_corrupt(fd, -1);
+  bzero(&loaded, sizeof(loaded));
+  check(bitcache_filter_load(&loaded, fd) > 0);
+  check(bitcache_filter_verify(&loaded) == -EBADMSG);
+  check(bitcache_filter_reset(&loaded) == 0);
+  bzero(&loaded, sizeof(loaded));
+  loaded.options = BITCACHE_FILTER_VERIFY;
+  check(bitcache_filter_load(&loaded, fd) == -EBADMSG);
+  test_corrupt(fd, -1);
+
+  // as is a corrupted or truncated header:
+  test_corrupt(fd, VERSION_OFFSET);
+  bzero(&loaded, sizeof(loaded));
+  check(bitcache_filter_load(&loaded, fd) == -EINVAL);
+  test_corrupt(fd, VERSION_OFFSET);
+  test_truncate(fd);
+  bzero(&loaded, sizeof(loaded));
+  check(bitcache_filter_load(&loaded, fd) == -EINVAL);
+
+  close(fd);
+  check(bitcache_filter_reset(&filter) == 0);
+  free(ids);
+}
+
+static void
+test_sync(const bitcache_filter_layout_t layout) {
+  bitcache_id_t* const ids = test_ids(0, 2 * COUNT);
+  bitcache_filter_t filter, writable, loaded;
+  check(bitcache_filter_init(&filter, 64 * 1024, layout, 0) == 0);
+  for (size_t i = 0; i < COUNT; i++)
+    check(bitcache_filter_insert(&filter, &ids[i]) == 0);
+
+  const int fd = test_file();
+  check(fd != -1);
+  check(bitcache_filter_dump(&filter, fd) > 0);
+  test_rewind(fd);
+  check(bitcache_filter_sync(&filter, true) == 0); // nothing to sync
+
+  // the stale checksum is dropped, and the header flushed, right away:
+  bzero(&writable, sizeof(writable));
+  writable.options = BITCACHE_FILTER_WRITABLE;
+  check(bitcache_filter_load(&writable, fd) == 64 * 1024);
+  check(writable.checksum == 0);
+  check(bitcache_filter_sync(&writable, false) > 0);
+  check(bitcache_filter_sync(&writable, true) == 0);
+
+  // inserts go straight to the file, along with the count once synced:
+  for (size_t i = COUNT; i < 2 * COUNT; i++) {
+    check(bitcache_filter_insert(&filter, &ids[i]) == 0);
+    check(bitcache_filter_insert(&writable, &ids[i]) == 0);
+  }
+  check(bitcache_filter_sync(&writable, true) > 0);
+  check(bitcache_filter_sync(&writable, true) == 0);
+  bzero(&loaded, sizeof(loaded));
+  loaded.options = BITCACHE_FILTER_VERIFY;
+  check(bitcache_filter_load(&loaded, fd) == 64 * 1024);
+  check(bitcache_filter_compare(&filter, &loaded) == 0);
+  check(loaded.count == 2 * COUNT);
+  check(bitcache_filter_reset(&loaded) == 0);
+
+  // clearing dirties every page:
+  check(bitcache_filter_clear(&writable) == 0);
+  check(bitcache_filter_sync(&writable, true) == (long)writable.mapping_size);
+  check(bitcache_filter_reset(&writable) == 0);
+
+  // a raw bitmap has no header to record the count in:
+  check(ftruncate(fd, 0) == 0);
+  check(write(fd, filter.bitmap, filter.size) == (ssize_t)filter.size);
+  test_rewind(fd);
+  bzero(&writable, sizeof(writable));
+  writable.options = BITCACHE_FILTER_WRITABLE;
+  check(bitcache_filter_load(&writable, fd) == -EINVAL);
+
+  close(fd);
+  check(bitcache_filter_reset(&filter) == 0);
+  free(ids);
+}
+
+// Initializes a filter holding `count` identifiers from the given one on.
+static void
+init_filter(bitcache_filter_t* filter, const size_t first, const size_t count) {
+  bitcache_id_t* const ids = test_ids(first, count);
+  check(bitcache_filter_init(filter, 64 * 1024, BITCACHE_FILTER_BLOCKED, 0) == 0);
+  for (size_t i = 0; i < count; i++)
+    check(bitcache_filter_insert(filter, &ids[i]) == 0);
+  free(ids);
+}
+
+// Represents one thread's share of the identifiers inserted atomically.
+typedef struct {
+  bitcache_filter_t* filter;
+  const bitcache_id_t* ids;
+  size_t count;
+} insert_job_t;
+
+static void*
+insert_atomic(void* arg) {
+  const insert_job_t* const job = arg;
+  for (size_t i = 0; i < job->count; i++)
+    check(bitcache_filter_insert_atomic(job->filter, &job->ids[i]) == 0);
+  return NULL;
+}
+
+static void
+test_build(const bitcache_filter_layout_t layout) {
+  const size_t count = 16 * COUNT;
+  bitcache_id_t* const ids = test_ids(0, count);
+  bitcache_filter_t expected, filter;
+  check(bitcache_filter_init(&expected, 256 * 1024, layout, 0) == 0);
+  for (size_t i = 0; i < count; i++)
+    check(bitcache_filter_insert(&expected, &ids[i]) == 0);
+
+  // builds come out the same however many threads they are spread over:
+  const unsigned int threads[] = {1, 4, 0};
+  for (size_t t = 0; t < sizeof(threads) / sizeof(threads[0]); t++) {
+    check(bitcache_filter_init(&filter, 256 * 1024, layout, 0) == 0);
+    check(bitcache_filter_build(&filter, ids, count, threads[t]) == 0);
+    check(bitcache_filter_compare(&expected, &filter) == 0);
+    check(filter.count == count);
+    check(bitcache_filter_reset(&filter) == 0);
+  }
+
+  // as do atomic inserts from several threads at once:
+  insert_job_t jobs[4];
+  check(bitcache_filter_init(&filter, 256 * 1024, layout, 0) == 0);
+  for (size_t t = 0; t < 4; t++)
+    jobs[t] = (insert_job_t){&filter, ids + (count * t) / 4, count / 4};
+  bitcache_thread_run(insert_atomic, jobs, sizeof(jobs[0]), 4);
+  check(bitcache_filter_compare(&expected, &filter) == 0);
+  check(filter.count == count);
+  check(bitcache_filter_reset(&filter) == 0);
+
+  check(bitcache_filter_reset(&expected) == 0);
+  free(ids);
+}
+
+// Returns `true` if an estimate lies within a given fraction of a value.
+static bool
+near(const double estimate, const double value, const double fraction) {
+  return estimate >= value * (1 - fraction) && estimate <= value * (1 + fraction);
+}
+
+static void
+test_cardinality(const bitcache_filter_layout_t layout) {
+  bitcache_id_t* const ids = test_ids(0, 6 * COUNT);
+  bitcache_filter_t a, b;
+  check(bitcache_filter_init(&a, 64 * 1024, layout, 0) == 0);
+  check(bitcache_filter_init(&b, 64 * 1024, layout, 0) == 0);
+
+  double fp_rate = 1;
+  check(bitcache_filter_popcount(&a) == 0);
+  check(bitcache_filter_cardinality(&a) == 0);
+  check(bitcache_filter_fp_rate(&a, &fp_rate) == 0 && fp_rate == 0);
+
+  for (size_t i = 0; i < 2 * COUNT; i++)
+    check(bitcache_filter_insert(&a, &ids[i]) == 0);
+  for (size_t i = COUNT; i < 3 * COUNT; i++)
+    check(bitcache_filter_insert(&b, &ids[i]) == 0);
+
+  long bits = 0;
+  for (size_t i = 0; i < a.size; i++)
+    bits += __builtin_popcount(a.bitmap[i]);
+  check(bitcache_filter_popcount(&a) == bits);
+
+  // the estimates track the identifiers actually inserted:
+  check(near(bitcache_filter_cardinality(&a), 2 * COUNT, 0.05));
+  check(near(bitcache_filter_union_cardinality(&a, &b), 3 * COUNT, 0.05));
+  check(near(bitcache_filter_intersection_cardinality(&a, &b), COUNT, 0.15));
+
+  // and the false-positive rate tracks the one measured, given a filter
+  // full enough to measure it:
+  bitcache_filter_t dense;
+  check(bitcache_filter_init(&dense, 16 * 1024, layout, 0) == 0);
+  for (size_t i = 0; i < 2 * COUNT; i++)
+    check(bitcache_filter_insert(&dense, &ids[i]) == 0);
+  size_t false_positives = 0;
+  for (size_t i = 2 * COUNT; i < 6 * COUNT; i++)
+    false_positives += bitcache_filter_lookup(&dense, &ids[i]);
+  check(bitcache_filter_fp_rate(&dense, &fp_rate) == 0);
+  check(near(fp_rate, (double)false_positives / (4 * COUNT), 0.2));
+  check(bitcache_filter_reset(&dense) == 0);
+
+  check(bitcache_filter_reset(&a) == 0);
+  check(bitcache_filter_reset(&b) == 0);
+  free(ids);
+}
+
+static void
+test_merge_many(void) {
+  const bitcache_filter_op_t ops[] = {BITCACHE_FILTER_OR, BITCACHE_FILTER_AND, BITCACHE_FILTER_XOR};
+  bitcache_filter_t a, b, c, f, expected;
+  init_filter(&a, 0, 2 * COUNT);
+  init_filter(&b, COUNT, 2 * COUNT);
+  init_filter(&c, 2 * COUNT, 2 * COUNT);
+
+  for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+    init_filter(&expected, 0, 0);
+    check(bitcache_filter_merge(&expected, ops[i], &a, &b) == 0);
+    check(bitcache_filter_merge(&expected, ops[i], &expected, &c) == 0);
+
+    // into a separate filter:
+    init_filter(&f, 0, 0);
+    const bitcache_filter_t* const sources[] = {&a, &b, &c};
+    check(bitcache_filter_merge_many(&f, ops[i], sources, 3) == 0);
+    check(bitcache_filter_compare(&f, &expected) == 0);
+    check(bitcache_filter_reset(&f) == 0);
+
+    // into one of the sources, wherever it is given:
+    init_filter(&f, 2 * COUNT, 2 * COUNT);
+    const bitcache_filter_t* const aliased[] = {&a, &b, &f};
+    check(bitcache_filter_merge_many(&f, ops[i], aliased, 3) == 0);
+    check(bitcache_filter_compare(&f, &expected) == 0);
+    check(bitcache_filter_reset(&f) == 0);
+
+    // or even twice:
+    init_filter(&f, COUNT, 2 * COUNT);
+    const bitcache_filter_t* const twice[] = {&a, &f, &f};
+    check(bitcache_filter_merge_many(&f, ops[i], twice, 3) == 0);
+    check(bitcache_filter_merge(&b, ops[i], &b, &b) == 0);
+    check(bitcache_filter_merge(&b, ops[i], &a, &b) == 0);
+    check(bitcache_filter_compare(&f, &b) == 0);
+    check(bitcache_filter_reset(&f) == 0);
+    check(bitcache_filter_reset(&b) == 0);
+    init_filter(&b, COUNT, 2 * COUNT);
+
+    check(bitcache_filter_reset(&expected) == 0);
+  }
+
+  // but no more than that:
+  const bitcache_filter_t* const thrice[] = {&a, &a, &a};
+  check(bitcache_filter_merge_many(&a, BITCACHE_FILTER_OR, thrice, 3) == -EINVAL);
+
+  check(bitcache_filter_reset(&a) == 0);
+  check(bitcache_filter_reset(&b) == 0);
+  check(bitcache_filter_reset(&c) == 0);
+}
+
+static void
+test_hugepages(const bitcache_filter_layout_t layout) {
+  const size_t size = 4 << 20; // large enough to be worth huge pages
+  bitcache_id_t* const ids = test_ids(0, 2 * COUNT);
+  bitcache_filter_t filter, loaded;
+  check(bitcache_filter_init(&filter, size, layout, 0) == 0);
+  for (size_t i = 0; i < COUNT; i++)
+    check(bitcache_filter_insert(&filter, &ids[i]) == 0);
+
+  const int fd = test_file();
+  check(fd != -1);
+  check(bitcache_filter_dump(&filter, fd) > 0);
+  test_rewind(fd);
+
+  // the bitmap is copied into the heap, verified, and free to change:
+  bzero(&loaded, sizeof(loaded));
+  loaded.options = BITCACHE_FILTER_HUGEPAGES;
+  check(bitcache_filter_load(&loaded, fd) == (long)size);
+  check(bitcache_filter_compare(&filter, &loaded) == 0);
+  check(loaded.layout == layout && loaded.k == filter.k);
+  check(bitcache_filter_verify(&loaded) == 0);
+  for (size_t i = COUNT; i < 2 * COUNT; i++)
+    check(bitcache_filter_insert(&loaded, &ids[i]) == 0);
+  for (size_t i = 0; i < 2 * COUNT; i++)
+    check(bitcache_filter_lookup(&loaded, &ids[i]));
+  check(bitcache_filter_reset(&loaded) == 0);
+
+  // a corrupted bitmap is caught while copying it:
+  test_corrupt(fd, -1);
+  bzero(&loaded, sizeof(loaded));
+  loaded.options = BITCACHE_FILTER_HUGEPAGES;
+  check(bitcache_filter_load(&loaded, fd) == -EBADMSG);
+
+  close(fd);
+  check(bitcache_filter_reset(&filter) == 0);
+  free(ids);
+}
+
+// Returns the reading end of a pipe that a child process feeds a buffer into.
+static int
+pipe_open(pid_t* child, const uint8_t* data, const size_t size) {
+  int fds[2];
+  if (pipe(fds) == -1 || (*child = fork()) == -1)
+    abort();
+  if (*child == 0) {
+    close(fds[0]);
+    for (size_t offset = 0; offset < size; ) {
+      const ssize_t written = write(fds[1], data + offset, size - offset);
+      if (written <= 0)
+        break;
+      offset += written;
+    }
+    _exit(0);
+  }
+  close(fds[1]);
+  return fds[0];
+}
+
+static void
+pipe_close(const pid_t child, const int fd) {
+  close(fd); // unblocks a child with more to write
+  waitpid(child, NULL, 0);
+}
+
+// Reads in the whole of a file.
+static uint8_t*
+read_file(const int fd, size_t* size) {
+  *size = test_rewind(fd);
+  uint8_t* const data = malloc(*size);
+  check(pread(fd, data, *size, 0) == (ssize_t)*size);
+  return data;
+}
+
+static void
+test_pipe(const bitcache_filter_layout_t layout) {
+  bitcache_id_t* const ids = test_ids(0, 2 * COUNT);
+  bitcache_filter_t filter, loaded;
+  check(bitcache_filter_init(&filter, 64 * 1024, layout, 0) == 0);
+  for (size_t i = 0; i < COUNT; i++)
+    check(bitcache_filter_insert(&filter, &ids[i]) == 0);
+
+  const int fd = test_file();
+  check(fd != -1);
+  check(bitcache_filter_dump(&filter, fd) > 0);
+  size_t size = 0;
+  uint8_t* const dump = read_file(fd, &size);
+  pid_t writer;
+  int in;
+
+  // a dump streamed in is verified on the way, and then free to change:
+  in = pipe_open(&writer, dump, size);
+  bzero(&loaded, sizeof(loaded));
+  check(bitcache_filter_load(&loaded, in) == 64 * 1024);
+  pipe_close(writer, in);
+  check(bitcache_filter_compare(&filter, &loaded) == 0);
+  check(loaded.layout == layout && loaded.k == filter.k);
+  check(bitcache_filter_verify(&loaded) == 0);
+  for (size_t i = COUNT; i < 2 * COUNT; i++)
+    check(bitcache_filter_insert(&loaded, &ids[i]) == 0);
+  check(bitcache_filter_verify(&loaded) == 0);
+  check(bitcache_filter_reset(&loaded) == 0);
+
+  // a corrupted dump, or one cut short, is rejected:
+  dump[size - 1] ^= 0xff;
+  in = pipe_open(&writer, dump, size);
+  bzero(&loaded, sizeof(loaded));
+  check(bitcache_filter_load(&loaded, in) == -EBADMSG);
+  pipe_close(writer, in);
+  dump[size - 1] ^= 0xff;
+  in = pipe_open(&writer, dump, size - 1);
+  bzero(&loaded, sizeof(loaded));
+  check(bitcache_filter_load(&loaded, in) == -EINVAL);
+  pipe_close(writer, in);
+
+  // raw bitmaps are read to their preset size, or else to the end:
+  const size_t header_size = sizeof(bitcache_filter_header_t);
+  in = pipe_open(&writer, dump + header_size, size - header_size);
+  bzero(&loaded, sizeof(loaded));
+  loaded.layout = layout, loaded.k = filter.k, loaded.size = size - header_size;
+  check(bitcache_filter_load(&loaded, in) == 64 * 1024);
+  pipe_close(writer, in);
+  check(bitcache_filter_compare(&filter, &loaded) == 0);
+  check(bitcache_filter_reset(&loaded) == 0);
+  in = pipe_open(&writer, dump + header_size, size - header_size);
+  bzero(&loaded, sizeof(loaded));
+  loaded.layout = layout, loaded.k = filter.k;
+  check(bitcache_filter_load(&loaded, in) == 64 * 1024);
+  pipe_close(writer, in);
+  check(bitcache_filter_compare(&filter, &loaded) == 0);
+  check(bitcache_filter_reset(&loaded) == 0);
+
+  free(dump);
+  close(fd);
+  check(bitcache_filter_reset(&filter) == 0);
+  free(ids);
+}
+
+static void
+test_counting_filter(const bitcache_filter_layout_t layout) {
+  bitcache_id_t* const ids = test_ids(0, COUNT);
+  bitcache_counting_filter_t filter, loaded;
+  check(bitcache_counting_filter_init(&filter, 64 * 1024, layout, 0) == 0);
+  for (size_t i = 0; i < COUNT; i++)
+    check(bitcache_counting_filter_insert(&filter, &ids[i]) == 0);
+  check(bitcache_counting_filter_insert(&filter, &ids[1]) == 0);
+  check(bitcache_counting_filter_count(&filter, &ids[1]) >= 2);
+
+  // removed identifiers go, and the others stay:
+  for (size_t i = 0; i < COUNT; i += 2)
+    check(bitcache_counting_filter_remove(&filter, &ids[i]) == 0);
+  size_t missing = 0, remaining = 0;
+  for (size_t i = 0; i < COUNT; i++) {
+    if (i % 2 == 1)
+      missing += !bitcache_counting_filter_lookup(&filter, &ids[i]);
+    else
+      remaining += bitcache_counting_filter_lookup(&filter, &ids[i]);
+  }
+  check(missing == 0);
+  check(remaining < COUNT / 100);
+
+  const int fd = test_file();
+  check(fd != -1);
+  check(bitcache_counting_filter_dump(&filter, fd) > 0);
+  test_rewind(fd);
+  bzero(&loaded, sizeof(loaded));
+  check(bitcache_counting_filter_load(&loaded, fd) > 0);
+  check(bitcache_counting_filter_verify(&loaded) == 0);
+  check(bitcache_counting_filter_compare(&filter, &loaded) == 0);
+  check(bitcache_counting_filter_reset(&loaded) == 0);
+
+  test_corrupt(fd, -1);
+  bzero(&loaded, sizeof(loaded));
+  check(bitcache_counting_filter_load(&loaded, fd) > 0);
+  check(bitcache_counting_filter_verify(&loaded) == -EBADMSG);
+  check(bitcache_counting_filter_reset(&loaded) == 0);
+  test_corrupt(fd, -1);
+
+  test_corrupt(fd, VERSION_OFFSET);
+  bzero(&loaded, sizeof(loaded));
+  check(bitcache_counting_filter_load(&loaded, fd) == -EINVAL);
+  test_corrupt(fd, VERSION_OFFSET);
+  test_truncate(fd);
+  bzero(&loaded, sizeof(loaded));
+  check(bitcache_counting_filter_load(&loaded, fd) == -EINVAL);
+
+  close(fd);
+  check(bitcache_counting_filter_reset(&filter) == 0);
+  free(ids);
+}
+
+static void
+test_cuckoo_filter(void) {
+  bitcache_id_t* const ids = test_ids(0, COUNT);
+  size_t size = 0;
+  unsigned int bits = 0;
+  check(bitcache_cuckoo_filter_sizing(COUNT, 0.001, &size, &bits) == 0);
+
+  bitcache_cuckoo_filter_t filter, loaded;
+  check(bitcache_cuckoo_filter_init(&filter, size, bits) == 0);
+  for (size_t i = 0; i < COUNT; i++)
+    check(bitcache_cuckoo_filter_insert(&filter, &ids[i]) == 0);
+  for (size_t i = 0; i < COUNT; i += 2)
+    check(bitcache_cuckoo_filter_remove(&filter, &ids[i]) == 0);
+  size_t missing = 0;
+  for (size_t i = 1; i < COUNT; i += 2)
+    missing += !bitcache_cuckoo_filter_lookup(&filter, &ids[i]);
+  check(missing == 0);
+
+  const int fd = test_file();
+  check(fd != -1);
+  check(bitcache_cuckoo_filter_dump(&filter, fd) > 0);
+  test_rewind(fd);
+  bzero(&loaded, sizeof(loaded));
+  check(bitcache_cuckoo_filter_load(&loaded, fd) > 0);
+  check(bitcache_cuckoo_filter_verify(&loaded) == 0);
+  check(bitcache_cuckoo_filter_compare(&filter, &loaded) == 0);
+  check(bitcache_cuckoo_filter_reset(&loaded) == 0);
+
+  test_corrupt(fd, -1);
+  bzero(&loaded, sizeof(loaded));
+  check(bitcache_cuckoo_filter_load(&loaded, fd) > 0);
+  check(bitcache_cuckoo_filter_verify(&loaded) == -EBADMSG);
+  check(bitcache_cuckoo_filter_reset(&loaded) == 0);
+  test_corrupt(fd, -1);
+
+  test_corrupt(fd, VERSION_OFFSET);
+  bzero(&loaded, sizeof(loaded));
+  check(bitcache_cuckoo_filter_load(&loaded, fd) == -EINVAL);
+  test_corrupt(fd, VERSION_OFFSET);
+  test_truncate(fd);
+  bzero(&loaded, sizeof(loaded));
+  check(bitcache_cuckoo_filter_load(&loaded, fd) == -EINVAL);
+
+  close(fd);
+  check(bitcache_cuckoo_filter_reset(&filter) == 0);
+  free(ids);
+}
+
+static void
+test_xor_filter(void) {
+  bitcache_id_t* const ids = test_ids(0, COUNT);
+  bitcache_xor_filter_t filter, loaded;
+  check(bitcache_xor_filter_init(&filter, ids, COUNT) == 0);
+  size_t missing = 0;
+  for (size_t i = 0; i < COUNT; i++)
+    missing += !bitcache_xor_filter_lookup(&filter, &ids[i]);
+  check(missing == 0);
+
+  const int fd = test_file();
+  check(fd != -1);
+  check(bitcache_xor_filter_dump(&filter, fd) > 0);
+  test_rewind(fd);
+  bzero(&loaded, sizeof(loaded));
+  check(bitcache_xor_filter_load(&loaded, fd) > 0);
+  check(bitcache_xor_filter_verify(&loaded) == 0);
+  check(bitcache_xor_filter_compare(&filter, &loaded) == 0);
+  check(bitcache_xor_filter_reset(&loaded) == 0);
+
+  test_corrupt(fd, -1);
+  bzero(&loaded, sizeof(loaded));
+  check(bitcache_xor_filter_load(&loaded, fd) > 0);
+  check(bitcache_xor_filter_verify(&loaded) == -EBADMSG);
+  check(bitcache_xor_filter_reset(&loaded) == 0);
+  test_corrupt(fd, -1);
+
+  test_corrupt(fd, VERSION_OFFSET);
+  bzero(&loaded, sizeof(loaded));
+  check(bitcache_xor_filter_load(&loaded, fd) == -EINVAL);
+  test_corrupt(fd, VERSION_OFFSET);
+  test_truncate(fd);
+  bzero(&loaded, sizeof(loaded));
+  check(bitcache_xor_filter_load(&loaded, fd) == -EINVAL);
+
+  close(fd);
+  check(bitcache_xor_filter_reset(&filter) == 0);
+  free(ids);
+}
+
+int
+main(void) {
+  test_layout(BITCACHE_FILTER_CLASSIC);
+  test_layout(BITCACHE_FILTER_BLOCKED);
+  test_lookup_many(BITCACHE_FILTER_CLASSIC);
+  test_lookup_many(BITCACHE_FILTER_BLOCKED);
+  test_dump(BITCACHE_FILTER_CLASSIC);
+  test_dump(BITCACHE_FILTER_BLOCKED);
+  test_build(BITCACHE_FILTER_CLASSIC);
+  test_build(BITCACHE_FILTER_BLOCKED);
+  test_merge_many();
+  test_cardinality(BITCACHE_FILTER_CLASSIC);
+  test_cardinality(BITCACHE_FILTER_BLOCKED);
+  test_sync(BITCACHE_FILTER_CLASSIC);
+  test_sync(BITCACHE_FILTER_BLOCKED);
+  test_hugepages(BITCACHE_FILTER_CLASSIC);
+  test_hugepages(BITCACHE_FILTER_BLOCKED);
+  test_pipe(BITCACHE_FILTER_CLASSIC);
+  test_pipe(BITCACHE_FILTER_BLOCKED);
+  test_counting_filter(BITCACHE_FILTER_CLASSIC);
+  test_counting_filter(BITCACHE_FILTER_BLOCKED);
+  test_cuckoo_filter();
+  test_xor_filter();
+  return test_status();
+}
@@ -0,0 +1,78 @@
+/* This is free and unencumbered software released into the public domain. */
+
+#include "test.h"
+#include <string.h> /* for memcmp(), memcpy(), memset() */
+
+//////////////////////////////////////////////////////////////////////////////
+// Identifier tests
+
+static int
+compare_ids(const void* id1, const void* id2) {
+  return memcmp(id1, id2, sizeof(bitcache_id_t));
+}
+
+// Checks bitcache_id_sort() against qsort() on a copy of the same input.
+static void
+check_sort(const bitcache_id_t* input, const size_t count, const unsigned int threads) {
+  bitcache_id_t* const ids = malloc((count > 0 ? count : 1) * sizeof(bitcache_id_t));
+  bitcache_id_t* const expected = malloc((count > 0 ? count : 1) * sizeof(bitcache_id_t));
+  if (count > 0) {
+    memcpy(ids, input, count * sizeof(bitcache_id_t));
+    memcpy(expected, input, count * sizeof(bitcache_id_t));
+  }
+  qsort(expected, count, sizeof(bitcache_id_t), compare_ids);
+
+  check(bitcache_id_sort(ids, count, threads) == 0);
+  check(count == 0 || memcmp(ids, expected, count * sizeof(bitcache_id_t)) == 0);
+
+  free(expected);
+  free(ids);
+}
+
+static void
+test_sort(void) {
+  static const size_t counts[] = {0, 1, 2, 31, 32, 33, 1000, 100000, 300000};
+  static const unsigned int threads[] = {1, 4, 0};
+
+  for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+    const size_t count = counts[c];
+    bitcache_id_t* const ids = test_ids(0, count);
+
+    for (size_t t = 0; t < sizeof(threads) / sizeof(threads[0]); t++) {
+      // random identifiers:
+      check_sort(ids, count, threads[t]);
+
+      // identifiers sharing long prefixes, and many duplicates:
+      bitcache_id_t* const skewed = test_ids(0, count);
+      for (size_t i = 0; i < count; i++) {
+        memset(skewed[i].digest.data, 0xab, 12);
+        skewed[i].digest.data[12] = i % 3;
+        if (i % 4 == 0)
+          skewed[i] = skewed[i / 2];
+      }
+      check_sort(skewed, count, threads[t]);
+      free(skewed);
+    }
+    free(ids);
+  }
+}
+
+static void
+test_unique(void) {
+  bitcache_id_t* const ids = test_ids(0, 1000);
+  for (size_t i = 500; i < 1000; i++)
+    ids[i] = ids[i % 250];
+  check(bitcache_id_sort(ids, 1000, 1) == 0);
+  check(bitcache_id_unique(ids, 1000) == 500);
+  for (size_t i = 1; i < 500; i++)
+    check(compare_ids(&ids[i - 1], &ids[i]) < 0);
+  check(bitcache_id_unique(ids, 0) == 0);
+  free(ids);
+}
+
+int
+main(void) {
+  test_sort();
+  test_unique();
+  return test_status();
+}
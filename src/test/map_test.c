@@ -0,0 +1,489 @@
+/* This is free and unencumbered software released into the public domain. */
+
+#include "test.h"
+#include "epoch.h"
+#include "thread.h"
+
+//////////////////////////////////////////////////////////////////////////////
+// Map tests
+
+// Large enough for the tables to resize incrementally.
+#define COUNT 100000
+
+static inline void*
+value_of(const size_t i) {
+  return (void*)(uintptr_t)(i + 1);
+}
+
+// Checks that a map holds the mappings of identifiers seeded [0, count),
+// other than every `stride`-th if `stride` is nonzero, and no others.
+static void
+check_contents(bitcache_map_t* map, const size_t count, const size_t stride) {
+  size_t expected = 0, found = 0, wrong = 0;
+  bitcache_id_t id;
+  for (size_t i = 0; i < count + 1000; i++) {
+    test_id(&id, i);
+    const bool present = i < count && (stride == 0 || i % stride != 0);
+    void* value = NULL;
+    expected += present;
+    if (bitcache_map_lookup(map, &id, &value) != present || (present && value != value_of(i)))
+      wrong++;
+  }
+  check(wrong == 0);
+  check(bitcache_map_count(map) == (long)expected);
+
+  bitcache_map_iter_t iter;
+  bitcache_id_t* key = NULL;
+  void* value = NULL;
+  check(bitcache_map_iter_init(&iter, map) == 0);
+  while (bitcache_map_iter_next(&iter, &key, &value)) {
+    void* looked_up = NULL;
+    found++;
+    if (!bitcache_map_lookup(map, key, &looked_up) || looked_up != value)
+      wrong++;
+  }
+  check(bitcache_map_iter_done(&iter) == 0);
+  check(wrong == 0);
+  check(found == expected);
+}
+
+// Fills a map with the mappings of identifiers seeded [0, count).
+static void
+fill_map(bitcache_map_t* map, const size_t count) {
+  bitcache_id_t id;
+  for (size_t i = 0; i < count; i++) {
+    test_id(&id, i);
+    check(bitcache_map_insert(map, &id, value_of(i)) == 0);
+  }
+}
+
+static void
+test_insert(const size_t shards) {
+  bitcache_map_t map;
+  check(bitcache_map_init_sharded(&map, shards, NULL, NULL) == 0);
+  fill_map(&map, COUNT);
+  check_contents(&map, COUNT, 0);
+
+  // replacing values leaves the count alone:
+  bitcache_id_t id;
+  for (size_t i = 0; i < COUNT; i += 7) {
+    test_id(&id, i);
+    check(bitcache_map_insert(&map, &id, value_of(i)) == 0);
+  }
+  check(bitcache_map_count(&map) == COUNT);
+
+  for (size_t i = 0; i < COUNT; i += 3) {
+    test_id(&id, i);
+    check(bitcache_map_remove(&map, &id) == 0);
+  }
+  check_contents(&map, COUNT, 3);
+
+  check(bitcache_map_clear(&map) == 0);
+  check_contents(&map, 0, 0);
+  check(bitcache_map_reset(&map) == 0);
+}
+
+static void
+test_iter_remove(const size_t shards) {
+  bitcache_map_t map;
+  check(bitcache_map_init_sharded(&map, shards, NULL, NULL) == 0);
+  fill_map(&map, COUNT);
+
+  // remove the mappings of odd values through the iterator:
+  bitcache_map_iter_t iter;
+  bitcache_id_t* key = NULL;
+  void* value = NULL;
+  check(bitcache_map_iter_init(&iter, &map) == 0);
+  while (bitcache_map_iter_next(&iter, &key, &value)) {
+    if ((uintptr_t)value % 2 == 1)
+      check(bitcache_map_iter_remove(&iter) == 0);
+  }
+  check(bitcache_map_iter_done(&iter) == 0);
+  check_contents(&map, COUNT, 2);
+
+  check(bitcache_map_reset(&map) == 0);
+}
+
+// Runs a snapshot iterator to its end, checking that it yields the
+// mappings of identifiers seeded [0, count), other than every `stride`-th
+// if `stride` is nonzero, each exactly once, and no others.
+static void
+check_snapshot(bitcache_map_iter_t* iter, bool* seen, const size_t count, const size_t stride) {
+  size_t wrong = 0;
+  bitcache_id_t* key = NULL;
+  void* value = NULL;
+  bitcache_id_t id;
+  while (bitcache_map_iter_next(iter, &key, &value)) {
+    const size_t i = (uintptr_t)value - 1;
+    test_id(&id, i);
+    if (i >= count || (stride != 0 && i % stride == 0) || seen[i] || bitcache_id_compare(key, &id) != 0)
+      wrong++;
+    else
+      seen[i] = TRUE;
+  }
+  for (size_t i = 0; i < count; i++)
+    wrong += (seen[i] != (stride == 0 || i % stride != 0));
+  check(wrong == 0);
+  check(bitcache_map_iter_done(iter) == 0);
+}
+
+static void
+test_snapshot(const size_t shards, const bool read_mostly) {
+  bitcache_map_t map;
+  check(bitcache_map_init_sharded(&map, shards, NULL, NULL) == 0);
+  check(bitcache_map_set_read_mostly(&map, read_mostly) == 0);
+  fill_map(&map, COUNT);
+
+  bool* const seen = calloc(2 * COUNT, sizeof(bool));
+  bool* const seen_later = calloc(2 * COUNT, sizeof(bool));
+  bitcache_map_iter_t iter, later;
+  bitcache_id_t* key = NULL;
+  void* value = NULL;
+  check(bitcache_map_iter_init_snapshot(&iter, &map) == 0);
+  for (size_t n = 0; n < COUNT / 2 && bitcache_map_iter_next(&iter, &key, &value); n++)
+    seen[(uintptr_t)value - 1] = TRUE;
+
+  // write all over the map, resizing it, halfway through the scan:
+  bitcache_id_t id;
+  for (size_t i = COUNT; i < 2 * COUNT; i++) {
+    test_id(&id, i);
+    check(bitcache_map_insert(&map, &id, value_of(i)) == 0);
+  }
+  for (size_t i = 0; i < 2 * COUNT; i += 3) {
+    test_id(&id, i);
+    check(bitcache_map_remove(&map, &id) == 0);
+  }
+  check_contents(&map, 2 * COUNT, 3);
+
+  // a later snapshot, overlapping the first, sees the writes:
+  check(bitcache_map_iter_init_snapshot(&later, &map) == 0);
+  for (size_t n = 0; n < COUNT / 2 && bitcache_map_iter_next(&later, &key, &value); n++)
+    seen_later[(uintptr_t)value - 1] = TRUE;
+
+  // and neither sees the values replaced, nor the map cleared and refilled:
+  for (size_t i = 1; i < 2 * COUNT; i += 3) {
+    test_id(&id, i);
+    check(bitcache_map_insert(&map, &id, value_of(i + 2 * COUNT)) == 0);
+  }
+  check(bitcache_map_clear(&map) == 0);
+  fill_map(&map, COUNT / 2);
+
+  check_snapshot(&iter, seen, COUNT, 0);
+  check_snapshot(&later, seen_later, 2 * COUNT, 3);
+  check_contents(&map, COUNT / 2, 0);
+
+  free(seen_later);
+  free(seen);
+  check(bitcache_map_reset(&map) == 0);
+}
+
+// Represents one thread's part in the read-mostly test: writers insert and
+// remove identifiers seeded from `first` on, while readers look up the
+// identifiers seeded [0, COUNT), which stay put, until the writers finish.
+typedef struct {
+  bitcache_map_t* map;
+  size_t first;
+  bool writer;
+  unsigned long* writers;
+  size_t wrong;
+} churn_job_t;
+
+static void*
+churn(void* arg) {
+  churn_job_t* const job = arg;
+  bitcache_id_t id;
+  if (job->writer) {
+    // enough, between the writers, to resize the tables:
+    for (size_t round = 0; round < 2; round++) {
+      for (size_t i = job->first; i < job->first + COUNT / 2; i++) {
+        test_id(&id, i);
+        size_t* const value = malloc(sizeof(size_t));
+        *value = i;
+        job->wrong += (bitcache_map_insert(job->map, &id, value) != 0);
+      }
+      for (size_t i = job->first; i < job->first + COUNT / 2; i++) {
+        test_id(&id, i);
+        job->wrong += (bitcache_map_remove(job->map, &id) != 0);
+      }
+    }
+    __atomic_sub_fetch(job->writers, 1, __ATOMIC_RELEASE);
+    return NULL;
+  }
+
+  // values outlive the lookup as long as the reader stays in its epoch:
+  do {
+    for (size_t i = 0; i < COUNT; i++) {
+      test_id(&id, i);
+      void* value = NULL;
+      bitcache_epoch_enter();
+      job->wrong += !bitcache_map_lookup(job->map, &id, &value) || *(size_t*)value != i;
+      bitcache_epoch_exit();
+    }
+  } while (__atomic_load_n(job->writers, __ATOMIC_ACQUIRE) > 0);
+  return NULL;
+}
+
+static void
+test_read_mostly(const size_t shards) {
+  bitcache_map_t map;
+  check(bitcache_map_init_sharded(&map, shards, NULL, free) == 0);
+  check(bitcache_map_set_read_mostly(&map, TRUE) == 0);
+  bitcache_id_t id;
+  for (size_t i = 0; i < COUNT; i++) {
+    test_id(&id, i);
+    size_t* const value = malloc(sizeof(size_t));
+    *value = i;
+    check(bitcache_map_insert(&map, &id, value) == 0);
+  }
+
+  // writers come first, so that they finish first without threads:
+  unsigned long writers = 2;
+  churn_job_t jobs[4];
+  for (size_t t = 0; t < 4; t++)
+    jobs[t] = (churn_job_t){&map, (t + 1) * COUNT, t < writers, &writers, 0};
+  bitcache_thread_run(churn, jobs, sizeof(jobs[0]), 4);
+  for (size_t t = 0; t < 4; t++)
+    check(jobs[t].wrong == 0);
+  check(bitcache_map_count(&map) == COUNT);
+
+  check(bitcache_map_reset(&map) == 0);
+}
+
+static size_t destroyed = 0;
+
+static void
+count_destroyed(void* value) {
+  (void)value;
+  destroyed++;
+}
+
+// Charges each value between 1 and 16 bytes against a map's budget.
+static size_t
+value_size(const void* value) {
+  return (uintptr_t)value % 16 + 1;
+}
+
+// Inserts the mappings of identifiers seeded [first, first + count).
+static void
+insert_range(bitcache_map_t* map, const size_t first, const size_t count) {
+  bitcache_id_t id;
+  for (size_t i = first; i < first + count; i++) {
+    test_id(&id, i);
+    check(bitcache_map_insert(map, &id, value_of(i)) == 0);
+  }
+}
+
+// Returns how many of the identifiers seeded [first, first + count) are in
+// a map.
+static size_t
+count_range(bitcache_map_t* map, const size_t first, const size_t count) {
+  size_t n = 0;
+  bitcache_id_t id;
+  for (size_t i = first; i < first + count; i++) {
+    test_id(&id, i);
+    n += bitcache_map_lookup(map, &id, NULL);
+  }
+  return n;
+}
+
+static void
+test_bound(const bitcache_map_evict_t policy, const size_t shards) {
+  bitcache_map_t map;
+  check(bitcache_map_init_sharded(&map, shards, NULL, count_destroyed) == 0);
+  check(bitcache_map_set_bound(&map, policy, 1000, NULL) == 0);
+
+  // the count never exceeds the budget, and evicted values are released:
+  destroyed = 0;
+  bitcache_id_t id;
+  size_t over = 0;
+  for (size_t i = 0; i < 10 * 1000; i++) {
+    test_id(&id, i);
+    check(bitcache_map_insert(&map, &id, value_of(i)) == 0);
+    over += (bitcache_map_count(&map) > 1000);
+  }
+  check(over == 0);
+  check(bitcache_map_count(&map) >= (long)(1000 - shards));
+  check(destroyed + (size_t)bitcache_map_count(&map) == 10 * 1000);
+  check(bitcache_map_reset(&map) == 0);
+
+  // as do the sizes of the values, given a size function:
+  check(bitcache_map_init_sharded(&map, shards, NULL, NULL) == 0);
+  check(bitcache_map_set_bound(&map, policy, 4000, value_size) == 0);
+  insert_range(&map, 0, 10 * 1000);
+  bitcache_map_iter_t iter;
+  void* value = NULL;
+  size_t used = 0;
+  check(bitcache_map_iter_init(&iter, &map) == 0);
+  while (bitcache_map_iter_next(&iter, NULL, &value))
+    used += value_size(value);
+  check(bitcache_map_iter_done(&iter) == 0);
+  check(used <= 4000 && used >= 4000 - 16 * shards);
+
+  // a map must be empty to be bounded:
+  check(bitcache_map_set_bound(&map, policy, 4000, NULL) == -EINVAL);
+  check(bitcache_map_reset(&map) == 0);
+}
+
+static void
+test_bound_clock(void) {
+  bitcache_map_t map;
+  check(bitcache_map_init(&map, NULL, NULL) == 0);
+  check(bitcache_map_set_bound(&map, BITCACHE_MAP_EVICT_CLOCK, 1000, NULL) == 0);
+
+  // hot keys looked up while a scan sweeps the hand over them repeatedly
+  // stay put, while keys inserted alongside them, but left alone, go:
+  insert_range(&map, 0, 100);       // hot
+  insert_range(&map, 100, 100);     // cold
+  insert_range(&map, 200, 800);
+  for (size_t i = 0; i < 10 * 1000; i += 100) {
+    check(count_range(&map, 0, 100) == 100);
+    insert_range(&map, 1000 + i, 100);
+  }
+  check(count_range(&map, 0, 100) == 100);
+  check(count_range(&map, 100, 100) == 0);
+  check(bitcache_map_count(&map) == 1000);
+
+  check(bitcache_map_reset(&map) == 0);
+}
+
+static void
+test_bound_s3fifo(void) {
+  bitcache_map_t map;
+  check(bitcache_map_init(&map, NULL, NULL) == 0);
+  check(bitcache_map_set_bound(&map, BITCACHE_MAP_EVICT_S3FIFO, 1000, NULL) == 0);
+
+  // keys evicted from the small queue without reuse are remembered...
+  insert_range(&map, 0, 950);
+  insert_range(&map, 950, 50);      // ghosts-to-be
+  insert_range(&map, 1000, 1000);
+  check(count_range(&map, 950, 50) == 0);
+
+  // ...so that, inserted again, they go straight to the main queue and
+  // survive a scan of one-hit wonders, unlike new keys inserted alongside:
+  insert_range(&map, 950, 50);
+  insert_range(&map, 2000, 50);     // new
+  insert_range(&map, 3000, 2000);
+  check(count_range(&map, 950, 50) >= 45); // but for ghosts lost to collisions
+  check(count_range(&map, 2000, 50) == 0);
+  check(bitcache_map_count(&map) == 1000);
+
+  check(bitcache_map_reset(&map) == 0);
+}
+
+static void
+test_batch(const size_t shards) {
+  bitcache_map_t map;
+  check(bitcache_map_init_sharded(&map, shards, NULL, NULL) == 0);
+
+  bitcache_id_t* const keys = test_ids(0, COUNT + 1000);
+  void** const values = malloc((COUNT + 1000) * sizeof(void*));
+  bool* const found = malloc((COUNT + 1000) * sizeof(bool));
+  for (size_t i = 0; i < COUNT; i++)
+    values[i] = value_of(i);
+
+  check(bitcache_map_insert_many(&map, keys, COUNT, values) == 0);
+  check_contents(&map, COUNT, 0);
+
+  // identifiers not in the map are reported as such:
+  check(bitcache_map_lookup_many(&map, keys, COUNT + 1000, values, found) == COUNT);
+  size_t wrong = 0;
+  for (size_t i = 0; i < COUNT + 1000; i++)
+    wrong += (found[i] != (i < COUNT)) || values[i] != (i < COUNT ? value_of(i) : NULL);
+  check(wrong == 0);
+
+  check(bitcache_map_remove_many(&map, keys, COUNT / 2) == COUNT / 2);
+  check(bitcache_map_remove_many(&map, keys, COUNT / 2) == 0);
+  check(bitcache_map_count(&map) == COUNT - COUNT / 2);
+
+  free(found);
+  free(values);
+  free(keys);
+  check(bitcache_map_reset(&map) == 0);
+}
+
+static void
+test_dump(const bitcache_id_encoding_t encoding) {
+  bitcache_map_t map, loaded;
+  check(bitcache_map_init_sharded(&map, 4, NULL, NULL) == 0);
+  check(bitcache_map_init(&loaded, NULL, NULL) == 0);
+
+  fill_map(&map, COUNT);
+
+  const int fd = test_file();
+  check(fd != -1);
+  check(bitcache_map_dump(&map, fd, encoding) > 0);
+  test_rewind(fd);
+  check(bitcache_map_load(&loaded, fd) == COUNT);
+  check_contents(&loaded, COUNT, 0);
+
+  // a corrupted dump is rejected, leaving the map as it was:
+  test_corrupt(fd, -1);
+  check(bitcache_map_load(&loaded, fd) == -EBADMSG);
+  test_corrupt(fd, -1);
+  test_corrupt(fd, 0);
+  check(bitcache_map_load(&loaded, fd) == -EINVAL);
+  test_corrupt(fd, 0);
+  test_truncate(fd);
+  check(bitcache_map_load(&loaded, fd) == -EINVAL);
+  check_contents(&loaded, COUNT, 0);
+
+  close(fd);
+  check(bitcache_map_reset(&loaded) == 0);
+  check(bitcache_map_reset(&map) == 0);
+}
+
+static void
+test_build(const size_t shards, const unsigned int threads) {
+  bitcache_map_t map;
+  check(bitcache_map_init_sharded(&map, shards, NULL, NULL) == 0);
+  bitcache_id_t id;
+  test_id(&id, COUNT + 5);
+  check(bitcache_map_insert(&map, &id, value_of(0)) == 0); // replaced by the build
+
+  bitcache_id_t* const keys = test_ids(0, COUNT);
+  void** const values = malloc(COUNT * sizeof(void*));
+  for (size_t i = 0; i < COUNT; i++)
+    values[i] = value_of(i);
+  check(bitcache_map_build(&map, keys, COUNT, values, threads) == 0);
+  check_contents(&map, COUNT, 0);
+
+  free(values);
+  free(keys);
+  check(bitcache_map_reset(&map) == 0);
+}
+
+static void
+test_shards(void) {
+  bitcache_map_t map;
+  check(bitcache_map_init_sharded(&map, 3, NULL, NULL) == -EINVAL);
+  check(bitcache_map_init_sharded(&map, 0, NULL, NULL) == -EINVAL);
+  check(bitcache_map_init_sharded(&map, BITCACHE_MAP_SHARDS_MAX * 2, NULL, NULL) == -EINVAL);
+}
+
+int
+main(void) {
+  test_insert(1);
+  test_insert(8);
+  test_batch(1);
+  test_batch(8);
+  test_build(1, 1);
+  test_build(8, 1);
+  test_build(8, 0);
+  test_iter_remove(1);
+  test_iter_remove(4);
+  test_snapshot(1, FALSE);
+  test_snapshot(4, FALSE);
+  test_snapshot(4, TRUE);
+  test_read_mostly(1);
+  test_read_mostly(4);
+  test_bound(BITCACHE_MAP_EVICT_CLOCK, 1);
+  test_bound(BITCACHE_MAP_EVICT_CLOCK, 4);
+  test_bound(BITCACHE_MAP_EVICT_S3FIFO, 1);
+  test_bound(BITCACHE_MAP_EVICT_S3FIFO, 4);
+  test_bound_clock();
+  test_bound_s3fifo();
+  test_shards();
+  test_dump(BITCACHE_ID_PLAIN);
+  test_dump(BITCACHE_ID_DELTA);
+  return test_status();
+}
@@ -0,0 +1,261 @@
+/* This is free and unencumbered software released into the public domain. */
+
+#include "test.h"
+#include <stddef.h> /* for offsetof() */
+
+//////////////////////////////////////////////////////////////////////////////
+// Set tests
+
+#define COUNT 20000
+
+static const bitcache_set_class_t* const classes[] = {
+  &bitcache_set_hash,
+  &bitcache_set_flat,
+  &bitcache_set_sorted,
+  &bitcache_set_frozen,
+};
+
+static const bitcache_set_iter_class_t* const iter_classes[] = {
+  &bitcache_set_iter_hash,
+  &bitcache_set_iter_flat,
+  &bitcache_set_iter_sorted,
+  &bitcache_set_iter_frozen,
+};
+
+#define CLASS_COUNT (sizeof(classes) / sizeof(classes[0]))
+
+static const bitcache_set_iter_class_t*
+iter_class_of(const bitcache_set_t* set) {
+  for (size_t i = 0; i < CLASS_COUNT; i++) {
+    if (set->class == classes[i])
+      return iter_classes[i];
+  }
+  return NULL;
+}
+
+// The sets operated on hold the identifiers seeded [0, COUNT), and those
+// seeded COUNT/2 + 2i for i in [0, COUNT), overlapping by COUNT/4.
+#define SEED_MAX (COUNT / 2 + 2 * COUNT)
+
+static bool in_a(const size_t i) { return i < COUNT; }
+static bool in_b(const size_t i) { return i >= COUNT / 2 && i < SEED_MAX && (i - COUNT / 2) % 2 == 0; }
+
+static bool in_union(const size_t i)        { return in_a(i) || in_b(i); }
+static bool in_intersection(const size_t i) { return in_a(i) && in_b(i); }
+static bool in_a_minus_b(const size_t i)    { return in_a(i) && !in_b(i); }
+static bool in_b_minus_a(const size_t i)    { return in_b(i) && !in_a(i); }
+
+static void
+init_set(bitcache_set_t* set, const bitcache_set_class_t* class, bool (*member)(size_t)) {
+  bitcache_id_t* const ids = malloc(SEED_MAX * sizeof(bitcache_id_t));
+  size_t count = 0;
+  for (size_t i = 0; i < SEED_MAX; i++) {
+    if (member(i))
+      test_id(&ids[count++], i);
+  }
+  check(bitcache_set_init(set, class) == 0);
+  if (class == &bitcache_set_frozen)
+    check(bitcache_set_frozen_build(set, ids, count) == 0);
+  else
+    check(bitcache_set_insert_many(set, ids, count) == 0);
+  free(ids);
+}
+
+// Checks that a set holds exactly the identifiers whose seeds are members.
+static void
+check_contents(bitcache_set_t* set, bool (*member)(size_t)) {
+  size_t expected = 0, found = 0, wrong = 0;
+  bitcache_id_t id;
+  for (size_t i = 0; i < SEED_MAX + 1000; i++) {
+    test_id(&id, i);
+    expected += member(i);
+    wrong += bitcache_set_lookup(set, &id) != member(i);
+  }
+  check(wrong == 0);
+  check(bitcache_set_count(set) == (long)expected);
+
+  bitcache_set_iter_t iter;
+  check(bitcache_set_iter_init(&iter, iter_class_of(set), set) == 0);
+  while (bitcache_set_iter_next(&iter)) {
+    found++;
+    wrong += !bitcache_set_lookup(set, iter.id);
+  }
+  check(bitcache_set_iter_reset(&iter) == 0);
+  check(wrong == 0);
+  check(found == expected);
+}
+
+static bool none(const size_t i) { (void)i; return FALSE; }
+
+static void
+test_algebra(const bitcache_set_class_t* class1, const bitcache_set_class_t* class2,
+    const bitcache_set_class_t* result_class, const unsigned int threads) {
+  bitcache_set_t a, b, result;
+  init_set(&a, class1, in_a);
+  init_set(&b, class2, in_b);
+  init_set(&result, result_class, none);
+
+  check(bitcache_set_union(&result, &a, &b, threads) == 0);
+  check_contents(&result, in_union);
+  check(bitcache_set_intersect(&result, &a, &b, threads) == 0);
+  check_contents(&result, in_intersection);
+  check(bitcache_set_is_subset(&result, &a, threads));
+  check(bitcache_set_is_subset(&result, &b, threads));
+  check(!bitcache_set_is_subset(&a, &b, threads));
+  check(bitcache_set_difference(&result, &a, &b, threads) == 0);
+  check_contents(&result, in_a_minus_b);
+  check(bitcache_set_difference(&result, &b, &a, threads) == 0);
+  check_contents(&result, in_b_minus_a);
+
+  // the result may be either operand:
+  if (class1 != &bitcache_set_frozen) {
+    check(bitcache_set_intersect(&a, &a, &b, threads) == 0);
+    check_contents(&a, in_intersection);
+  }
+  if (class2 != &bitcache_set_frozen) {
+    check(bitcache_set_difference(&b, &b, &a, threads) == 0);
+    check_contents(&b, in_b_minus_a);
+  }
+
+  check(bitcache_set_reset(&result) == 0);
+  check(bitcache_set_reset(&b) == 0);
+  check(bitcache_set_reset(&a) == 0);
+}
+
+static void
+test_dump(const bitcache_set_class_t* class, const bitcache_set_class_t* loaded_class,
+    const bitcache_id_encoding_t encoding) {
+  bitcache_set_t set, loaded;
+  init_set(&set, class, in_a);
+  init_set(&loaded, loaded_class, none);
+
+  const int fd = test_file();
+  check(fd != -1);
+  check(bitcache_set_dump(&set, fd, encoding) > 0);
+  test_rewind(fd);
+  check(bitcache_set_load(&loaded, fd) == COUNT);
+  check_contents(&loaded, in_a);
+  check(bitcache_set_reset(&loaded) == 0);
+
+  // a corrupted dump is rejected, leaving the set as it was, except that
+  // sorted sets use plain dumps in place, unverified:
+  init_set(&loaded, loaded_class, in_b);
+  if (loaded_class != &bitcache_set_sorted || encoding != BITCACHE_ID_PLAIN) {
+    test_corrupt(fd, -1);
+    check(bitcache_set_load(&loaded, fd) == -EBADMSG);
+    test_corrupt(fd, -1);
+  }
+  test_corrupt(fd, 0);
+  check(bitcache_set_load(&loaded, fd) == -EINVAL);
+  test_corrupt(fd, 0);
+  test_truncate(fd);
+  check(bitcache_set_load(&loaded, fd) == -EINVAL);
+  check_contents(&loaded, in_b);
+
+  close(fd);
+  check(bitcache_set_reset(&loaded) == 0);
+  check(bitcache_set_reset(&set) == 0);
+}
+
+// Overwrites the identifier count in the header of a dumped set.
+static void
+set_dump_count(const int fd, const uint64_t count) {
+  check(pwrite(fd, &count, sizeof(count), offsetof(bitcache_set_header_t, count)) == sizeof(count));
+  test_rewind(fd);
+}
+
+static void
+test_dump_count(const bitcache_id_encoding_t encoding) {
+  bitcache_set_t set, loaded;
+  init_set(&set, &bitcache_set_hash, in_a);
+  init_set(&loaded, &bitcache_set_hash, none);
+
+  // the header is not covered by the checksum, so a count the body cannot
+  // hold must be rejected before anything is allocated for it:
+  const int fd = test_file();
+  check(fd != -1);
+  check(bitcache_set_dump(&set, fd, encoding) > 0);
+  set_dump_count(fd, (uint64_t)1 << 40);
+  check(bitcache_set_load(&loaded, fd) == -EINVAL);
+  set_dump_count(fd, COUNT + 1);
+  check(bitcache_set_load(&loaded, fd) == -EINVAL);
+  set_dump_count(fd, COUNT);
+  check(bitcache_set_load(&loaded, fd) == COUNT);
+
+  close(fd);
+  check(bitcache_set_reset(&loaded) == 0);
+  check(bitcache_set_reset(&set) == 0);
+}
+
+static void
+test_frozen_dump(void) {
+  bitcache_set_t set, loaded;
+  init_set(&set, &bitcache_set_frozen, in_a);
+  check(bitcache_set_init(&loaded, &bitcache_set_frozen) == 0);
+
+  const int fd = test_file();
+  check(fd != -1);
+  check(bitcache_set_frozen_dump(&set, fd) > 0);
+  test_rewind(fd);
+  check(bitcache_set_frozen_load(&loaded, fd) >= 0);
+  check(bitcache_set_frozen_verify(&loaded) == 0);
+  check_contents(&loaded, in_a);
+  check(bitcache_set_reset(&loaded) == 0);
+
+  // a corrupted body is caught on verification:
+  check(bitcache_set_init(&loaded, &bitcache_set_frozen) == 0);
+  test_corrupt(fd, -1);
+  check(bitcache_set_frozen_load(&loaded, fd) >= 0);
+  check(bitcache_set_frozen_verify(&loaded) == -EBADMSG);
+  check(bitcache_set_reset(&loaded) == 0);
+  test_corrupt(fd, -1);
+
+  check(bitcache_set_init(&loaded, &bitcache_set_frozen) == 0);
+  test_corrupt(fd, 0);
+  check(bitcache_set_frozen_load(&loaded, fd) == -EINVAL);
+  test_corrupt(fd, 0);
+  test_truncate(fd);
+  check(bitcache_set_frozen_load(&loaded, fd) == -EINVAL);
+
+  close(fd);
+  check(bitcache_set_reset(&loaded) == 0);
+  check(bitcache_set_reset(&set) == 0);
+}
+
+static void
+test_build(const bitcache_set_class_t* class, const unsigned int threads) {
+  bitcache_id_t* const ids = test_ids(0, 2 * COUNT);
+  for (size_t i = COUNT; i < 2 * COUNT; i++)
+    ids[i] = ids[i % (COUNT / 2)]; // duplicates
+
+  bitcache_set_t set;
+  check(bitcache_set_init(&set, class) == 0);
+  check(bitcache_set_build(&set, ids, 2 * COUNT, threads) == 0);
+  check_contents(&set, in_a);
+  check(bitcache_set_reset(&set) == 0);
+  free(ids);
+}
+
+int
+main(void) {
+  for (size_t i = 0; i < CLASS_COUNT; i++) {
+    for (size_t j = 0; j < CLASS_COUNT; j++) {
+      for (size_t k = 0; k < CLASS_COUNT - 1; k++) { // frozen sets are immutable
+        test_algebra(classes[i], classes[j], classes[k], 1);
+        test_algebra(classes[i], classes[j], classes[k], 0);
+      }
+    }
+  }
+  for (size_t i = 0; i < CLASS_COUNT; i++) {
+    for (size_t j = 0; j < CLASS_COUNT; j++) {
+      test_dump(classes[i], classes[j], BITCACHE_ID_PLAIN);
+      test_dump(classes[i], classes[j], BITCACHE_ID_DELTA);
+    }
+    test_build(classes[i], 1);
+    test_build(classes[i], 0);
+  }
+  test_dump_count(BITCACHE_ID_PLAIN);
+  test_dump_count(BITCACHE_ID_DELTA);
+  test_frozen_dump();
+  return test_status();
+}
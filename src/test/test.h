@@ -0,0 +1,90 @@
+/* This is free and unencumbered software released into the public domain. */
+
+#ifndef _BITCACHE_TEST_H
+#define _BITCACHE_TEST_H
+
+#include "build.h"
+#include <stdio.h>  /* for fprintf() */
+#include <stdlib.h> /* for mkstemp() */
+#include <unistd.h> /* for ftruncate(), lseek(), pread(), pwrite(), unlink() */
+
+//////////////////////////////////////////////////////////////////////////////
+// Test helpers
+//
+// Each test program runs its checks in turn, reporting any that fail on
+// stderr, and exits with a nonzero status if any did, as `make check`
+// expects.
+
+static unsigned int test_failures = 0;
+
+#define check(expr) \
+  ((expr) ? (void)0 : (void)(test_failures++, \
+    fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #expr)))
+
+#define test_status() \
+  (test_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE)
+
+// Fills in an identifier with pseudorandom bytes determined by a seed; each
+// seed starts a stream of its own, so that no two identifiers share a run
+// of bytes at different offsets.
+static inline void
+test_id(bitcache_id_t* id, const uint64_t seed) {
+  uint64_t z = seed << 8;
+  for (size_t i = 0; i < sizeof(bitcache_id_t); i++) {
+    uint64_t x = (z += 0x9e3779b97f4a7c15ULL); // splitmix64
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    id->digest.data[i] = (x ^ (x >> 31)) >> 56;
+  }
+}
+
+// Returns an array of `count` identifiers, seeded `first` onwards.
+static inline bitcache_id_t*
+test_ids(const uint64_t first, const size_t count) {
+  bitcache_id_t* const ids = malloc((count > 0 ? count : 1) * sizeof(bitcache_id_t));
+  for (size_t i = 0; ids != NULL && i < count; i++)
+    test_id(&ids[i], first + i);
+  return ids;
+}
+
+// Returns a descriptor for a new, already unlinked, temporary file.
+static inline int
+test_file(void) {
+  char path[] = "/tmp/bitcache-test.XXXXXX";
+  const int fd = mkstemp(path);
+  if (fd != -1)
+    unlink(path);
+  return fd;
+}
+
+// Returns the size of a file, and rewinds it for reading.
+static inline off_t
+test_rewind(const int fd) {
+  const off_t size = lseek(fd, 0, SEEK_END);
+  lseek(fd, 0, SEEK_SET);
+  return size;
+}
+
+// Flips the bits of the byte at a given offset into a file, counting from
+// the end if negative, and rewinds it.
+static inline void
+test_corrupt(const int fd, const off_t offset) {
+  const off_t pos = (offset < 0) ? test_rewind(fd) + offset : offset;
+  uint8_t byte = 0;
+  if (pread(fd, &byte, 1, pos) == 1) {
+    byte ^= 0xff;
+    if (pwrite(fd, &byte, 1, pos) != 1)
+      abort();
+  }
+  test_rewind(fd);
+}
+
+// Cuts off the last byte of a file, and rewinds it.
+static inline void
+test_truncate(const int fd) {
+  if (ftruncate(fd, test_rewind(fd) - 1) == -1)
+    abort();
+  test_rewind(fd);
+}
+
+#endif /* _BITCACHE_TEST_H */
@@ -0,0 +1,66 @@
+/* This is free and unencumbered software released into the public domain. */
+
+#ifndef _BITCACHE_THREAD_H
+#define _BITCACHE_THREAD_H
+
+#include <stdbool.h> /* for bool */
+#include <stddef.h>  /* for size_t */
+#include <stdint.h>  /* for uint8_t */
+#include <unistd.h>  /* for sysconf() */
+
+#ifndef DISABLE_THREADS
+#include <pthread.h> /* for pthread_create(), pthread_join() */
+#endif
+
+//////////////////////////////////////////////////////////////////////////////
+// Thread helpers (shared by every bulk operation that spreads over threads)
+//
+// A bulk operation splits its work into one job per thread. The calling
+// thread runs the first job itself, as well as the job of any thread that
+// fails to start, so that running short of threads costs time but never
+// fails the operation.
+
+// Returns the number of threads to spread `count` items over, given a
+// requested number (zero selecting one per online CPU) and the fewest
+// items worth handing to a thread of their own.
+static inline size_t
+bitcache_thread_count(const unsigned int threads, const size_t count, const size_t min) {
+  size_t n = threads;
+#ifdef DISABLE_THREADS
+  (void)count, (void)min;
+  n = 1;
+#else
+  if (n == 0) {
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    n = (cpus > 0) ? (size_t)cpus : 1;
+  }
+  if (n > (count + min - 1) / min)
+    n = (count + min - 1) / min;
+#endif
+  return (n > 0) ? n : 1;
+}
+
+// Calls a function on each of `n` jobs, stored `size` bytes apart, one per
+// thread, and waits for them all to finish.
+static inline void
+bitcache_thread_run(void* (*func)(void*), void* jobs, const size_t size, const size_t n) {
+  uint8_t* const job = jobs;
+#ifndef DISABLE_THREADS
+  pthread_t workers[n];
+  bool started[n];
+  for (size_t t = 1; t < n; t++)
+    started[t] = (pthread_create(&workers[t], NULL, func, job + t * size) == 0);
+  func(job);
+  for (size_t t = 1; t < n; t++) {
+    if (likely(started[t]))
+      pthread_join(workers[t], NULL);
+    else
+      func(job + t * size);
+  }
+#else
+  for (size_t t = 0; t < n; t++)
+    func(job + t * size);
+#endif
+}
+
+#endif /* _BITCACHE_THREAD_H */
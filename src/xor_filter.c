@@ -0,0 +1,316 @@
+/* This is free and unencumbered software released into the public domain. */
+
+#include "build.h"
+#include "crc32c.h"
+#include "filter_hash.h"
+#include "io.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h> /* for mmap() */
+#include <sys/stat.h> /* for fstat() */
+#include <unistd.h>   /* for getpagesize(), lseek(), pread() */
+
+//////////////////////////////////////////////////////////////////////////////
+// Xor filter helpers
+
+// The number of seeds tried before construction gives up; each attempt
+// succeeds with a probability of about 0.85.
+#define BITCACHE_XOR_FILTER_MAX_ATTEMPTS 100
+
+// The MurmurHash3 finalizer, for rehashing a key under a new seed.
+static inline uint64_t
+bitcache_xor_filter_mix(uint64_t h) {
+  h ^= h >> 33;
+  h *= UINT64_C(0xff51afd7ed558ccd);
+  h ^= h >> 33;
+  h *= UINT64_C(0xc4ceb9fe1a85ec53);
+  h ^= h >> 33;
+  return h;
+}
+
+static inline uint64_t
+bitcache_xor_filter_hash(const uint64_t key, const uint64_t seed) {
+  return bitcache_xor_filter_mix(key + seed);
+}
+
+static inline uint8_t
+bitcache_xor_filter_fingerprint(const uint64_t hash) {
+  return (uint8_t)(hash ^ (hash >> 32));
+}
+
+// Returns the slot for a hash in segment `i` of three.
+static inline uint32_t
+bitcache_xor_filter_slot(const uint64_t hash, const unsigned int i, const uint32_t segment) {
+  const uint64_t h = (i == 0) ? hash : (hash << (21 * i)) | (hash >> (64 - 21 * i));
+  return bitcache_filter_range((uint32_t)h, segment) + i * segment;
+}
+
+static int
+bitcache_xor_filter_key_compare(const void* a, const void* b) {
+  const uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+  return (x > y) - (x < y);
+}
+
+typedef struct {
+  uint64_t hashes; // XOR of the hashes of every key mapped here
+  uint32_t count;  // number of keys mapped here
+} bitcache_xor_filter_set_t;
+
+typedef struct {
+  uint64_t hash;
+  uint32_t slot;
+} bitcache_xor_filter_entry_t;
+
+// Tries to peel every key off the 3-hypergraph under a given seed,
+// recording the order in which keys were peeled onto `stack`.
+static bool
+bitcache_xor_filter_peel(const uint64_t* keys, const size_t count, const uint64_t seed, const uint32_t segment,
+                         bitcache_xor_filter_set_t* sets, bitcache_xor_filter_entry_t* queue, bitcache_xor_filter_entry_t* stack) {
+  const size_t slots = (size_t)segment * 3;
+  bzero(sets, slots * sizeof(*sets));
+
+  for (size_t j = 0; j < count; j++) {
+    const uint64_t hash = bitcache_xor_filter_hash(keys[j], seed);
+    for (unsigned int i = 0; i < 3; i++) {
+      bitcache_xor_filter_set_t* const set = &sets[bitcache_xor_filter_slot(hash, i, segment)];
+      set->hashes ^= hash;
+      set->count++;
+    }
+  }
+
+  size_t queued = 0, peeled = 0;
+  for (uint32_t slot = 0; slot < slots; slot++) {
+    if (sets[slot].count == 1) {
+      queue[queued].slot = slot;
+      queue[queued].hash = sets[slot].hashes;
+      queued++;
+    }
+  }
+
+  while (queued > 0) {
+    const bitcache_xor_filter_entry_t entry = queue[--queued];
+    if (sets[entry.slot].count != 1)
+      continue; // already peeled by way of another slot
+    stack[peeled++] = entry;
+    for (unsigned int i = 0; i < 3; i++) {
+      const uint32_t slot = bitcache_xor_filter_slot(entry.hash, i, segment);
+      bitcache_xor_filter_set_t* const set = &sets[slot];
+      set->hashes ^= entry.hash;
+      if (--set->count == 1) {
+        queue[queued].slot = slot;
+        queue[queued].hash = set->hashes;
+        queued++;
+      }
+    }
+  }
+
+  return peeled == count;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Xor filter API
+
+int
+bitcache_xor_filter_init(bitcache_xor_filter_t* filter, const bitcache_id_t* ids, const size_t count) {
+  validate_with_errno_return(filter != NULL);
+  validate_with_errno_return(ids != NULL || count == 0);
+  validate_with_errno_return(count < UINT32_MAX / 2);
+
+  bzero(filter, sizeof(bitcache_xor_filter_t));
+
+  // the keys must be distinct, or else peeling can never succeed:
+  uint64_t* keys = malloc((count > 0 ? count : 1) * sizeof(uint64_t));
+  if (unlikely(keys == NULL))
+    return -errno; // cannot allocate memory
+  for (size_t j = 0; j < count; j++)
+    keys[j] = bitcache_filter_dword(&ids[j], 0);
+  qsort(keys, count, sizeof(uint64_t), bitcache_xor_filter_key_compare);
+  size_t n = 0;
+  for (size_t j = 0; j < count; j++) {
+    if (n == 0 || keys[j] != keys[n - 1])
+      keys[n++] = keys[j];
+  }
+
+  const uint32_t segment = (uint32_t)((32 + 1.23 * n) / 3) + 1;
+  const size_t slots = (size_t)segment * 3;
+
+  int rc = 0;
+  bitcache_xor_filter_set_t* sets = malloc(slots * sizeof(*sets));
+  bitcache_xor_filter_entry_t* queue = malloc(slots * sizeof(*queue));
+  bitcache_xor_filter_entry_t* stack = malloc((n > 0 ? n : 1) * sizeof(*stack));
+  uint8_t* fingerprints = calloc(1, slots);
+  if (unlikely(sets == NULL || queue == NULL || stack == NULL || fingerprints == NULL)) {
+    rc = -(errno = ENOMEM); // cannot allocate memory
+    goto cleanup;
+  }
+
+  uint64_t seed = UINT64_C(0x9e3779b97f4a7c15);
+  unsigned int attempt = 0;
+  for (; attempt < BITCACHE_XOR_FILTER_MAX_ATTEMPTS; attempt++, seed = bitcache_xor_filter_mix(seed)) {
+    if (bitcache_xor_filter_peel(keys, n, seed, segment, sets, queue, stack))
+      break;
+  }
+  if (unlikely(attempt == BITCACHE_XOR_FILTER_MAX_ATTEMPTS)) {
+    rc = -(errno = EAGAIN); // every seed failed, which should never happen
+    goto cleanup;
+  }
+
+  // assign fingerprints in reverse peeling order, so that each key's slot
+  // is written after the other two slots it depends on are final:
+  for (size_t j = n; j-- > 0; ) {
+    const bitcache_xor_filter_entry_t entry = stack[j];
+    uint8_t fp = bitcache_xor_filter_fingerprint(entry.hash);
+    for (unsigned int i = 0; i < 3; i++)
+      fp ^= fingerprints[bitcache_xor_filter_slot(entry.hash, i, segment)];
+    fingerprints[entry.slot] = fp;
+  }
+
+  filter->size = slots;
+  filter->fingerprints = fingerprints, fingerprints = NULL;
+  filter->seed = seed;
+  filter->count = n;
+
+cleanup:
+  free(fingerprints);
+  free(stack);
+  free(queue);
+  free(sets);
+  free(keys);
+  return rc;
+}
+
+int
+bitcache_xor_filter_reset(bitcache_xor_filter_t* filter) {
+  validate_with_errno_return(filter != NULL);
+
+  if (unlikely(filter->mapping != NULL)) {
+    munmap(filter->mapping, filter->mapping_size);
+    filter->mapping = NULL, filter->mapping_size = 0;
+    filter->fingerprints = NULL;
+    filter->size = 0;
+  }
+
+  if (likely(filter->fingerprints != NULL)) {
+    free(filter->fingerprints), filter->fingerprints = NULL;
+    filter->size = 0;
+  }
+
+  filter->seed = 0, filter->count = 0;
+  filter->checksum = 0;
+
+  return 0;
+}
+
+long PURE
+bitcache_xor_filter_size(const bitcache_xor_filter_t* filter) {
+  validate_with_errno_return(filter != NULL);
+
+  return sizeof(bitcache_xor_filter_t) + filter->size;
+}
+
+bool HOT
+bitcache_xor_filter_lookup(const bitcache_xor_filter_t* filter, const bitcache_id_t* id) {
+  validate_with_false_return(filter != NULL && filter->fingerprints != NULL && id != NULL);
+
+  const uint32_t segment = (uint32_t)(filter->size / 3);
+  const uint64_t hash = bitcache_xor_filter_hash(bitcache_filter_dword(id, 0), filter->seed);
+
+  // false positives are possible, but false negatives are not:
+  return bitcache_xor_filter_fingerprint(hash) ==
+    (filter->fingerprints[bitcache_xor_filter_slot(hash, 0, segment)] ^
+     filter->fingerprints[bitcache_xor_filter_slot(hash, 1, segment)] ^
+     filter->fingerprints[bitcache_xor_filter_slot(hash, 2, segment)]);
+}
+
+int
+bitcache_xor_filter_compare(const bitcache_xor_filter_t* filter1, const bitcache_xor_filter_t* filter2) {
+  validate_with_errno_return(filter1 != NULL && filter1->fingerprints != NULL);
+  validate_with_errno_return(filter2 != NULL && filter2->fingerprints != NULL);
+
+  if (filter1->size != filter2->size || filter1->seed != filter2->seed)
+    return 1;
+
+  return bcmp(filter1->fingerprints, filter2->fingerprints, filter1->size);
+}
+
+long COLD
+bitcache_xor_filter_load(bitcache_xor_filter_t* filter, const int fd) {
+  validate_with_errno_return(filter != NULL && fd >= 0);
+
+  off_t off = lseek(fd, 0, SEEK_CUR);
+  if (unlikely(off == -1)) {
+    return -errno; // pipes, sockets and FIFOs are not supported
+  }
+
+  struct stat sb;
+  if (unlikely(fstat(fd, &sb) == -1)) {
+    return -errno;
+  }
+
+  bitcache_xor_filter_header_t header;
+  if (unlikely(sb.st_size - off < (off_t)sizeof(header) ||
+      pread(fd, &header, sizeof(header), off) != sizeof(header) ||
+      memcmp(header.magic, BITCACHE_XOR_FILTER_MAGIC, sizeof(header.magic)) != 0 ||
+      header.version < 1 || header.version > BITCACHE_XOR_FILTER_VERSION ||
+      header.size == 0 || header.size % 3 != 0 || header.size / 3 > UINT32_MAX ||
+      header.size > (uint64_t)(sb.st_size - off) - sizeof(header))) {
+    return -(errno = EINVAL); // not an xor filter
+  }
+
+  // mmap() requires a page-aligned file offset:
+  const off_t page_off = off & ~((off_t)getpagesize() - 1);
+  const size_t mapping_size = (off - page_off) + sizeof(header) + header.size;
+
+  void* base = mmap(NULL, mapping_size, PROT_READ, MAP_SHARED, fd, page_off);
+  if (unlikely(base == MAP_FAILED)) {
+    return -errno;
+  }
+
+  filter->size = header.size;
+  filter->seed = header.seed;
+  filter->count = header.count;
+  filter->checksum = header.checksum;
+  filter->mapping = base;
+  filter->mapping_size = mapping_size;
+  filter->fingerprints = (uint8_t*)base + (off - page_off) + sizeof(header);
+  return filter->size;
+}
+
+int COLD
+bitcache_xor_filter_verify(const bitcache_xor_filter_t* filter) {
+  validate_with_errno_return(filter != NULL && filter->fingerprints != NULL);
+
+  if (filter->checksum == 0)
+    return 0; // no checksum was recorded
+
+  if (unlikely(bitcache_crc32c(0, filter->fingerprints, filter->size) != filter->checksum))
+    return -(errno = EBADMSG); // checksum mismatch
+
+  return 0;
+}
+
+long COLD
+bitcache_xor_filter_dump(const bitcache_xor_filter_t* filter, const int fd) {
+  validate_with_errno_return(filter != NULL && filter->fingerprints != NULL && fd >= 0);
+
+  bitcache_xor_filter_header_t header;
+  bzero(&header, sizeof(header));
+  memcpy(header.magic, BITCACHE_XOR_FILTER_MAGIC, sizeof(header.magic));
+  header.version  = BITCACHE_XOR_FILTER_VERSION;
+  header.checksum = bitcache_crc32c(0, filter->fingerprints, filter->size);
+  header.seed     = filter->seed;
+  header.size     = filter->size;
+  header.count    = filter->count;
+
+  int rc = bitcache_write(fd, &header, sizeof(header));
+  if (unlikely(rc < 0))
+    return rc;
+
+  rc = bitcache_write(fd, filter->fingerprints, filter->size);
+  if (unlikely(rc < 0))
+    return rc;
+
+  return sizeof(header) + filter->size;
+}
@@ -0,0 +1,110 @@
+/* This is free and unencumbered software released into the public domain. */
+
+#ifndef _BITCACHE_XOR_FILTER_H
+#define _BITCACHE_XOR_FILTER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h> /* for bool */
+#include <stddef.h>  /* for size_t */
+#include <stdint.h>  /* for uint8_t, uint32_t, uint64_t */
+
+/**
+ * Defines the magic bytes at the start of a dumped xor filter header.
+ */
+#define BITCACHE_XOR_FILTER_MAGIC "BCXORFLT"
+
+/**
+ * Defines the current version of the dumped xor filter header format.
+ */
+#define BITCACHE_XOR_FILTER_VERSION 1
+
+/**
+ * Represents a Bitcache xor filter.
+ *
+ * An xor filter is built once from a fixed set of identifiers and cannot
+ * be updated afterwards. It holds about 1.23 8-bit fingerprints per
+ * identifier (9.84 bits) for a false-positive rate of 1/256, and a lookup
+ * reads exactly three of them.
+ */
+typedef struct {
+  size_t size;
+  uint8_t* fingerprints;
+  uint64_t seed;       /* hash seed under which construction succeeded */
+  uint64_t count;      /* number of distinct identifiers */
+  uint32_t checksum;   /* CRC-32C recorded for a loaded filter, or zero */
+  void* mapping;       /* the mmap() region backing a loaded filter, if any */
+  size_t mapping_size;
+} bitcache_xor_filter_t;
+
+/**
+ * Represents the header preceding the fingerprints of a dumped xor filter.
+ * Fields are stored in host byte order.
+ */
+typedef struct {
+  char     magic[8];   /* BITCACHE_XOR_FILTER_MAGIC */
+  uint32_t version;    /* BITCACHE_XOR_FILTER_VERSION */
+  uint32_t checksum;   /* CRC-32C of the fingerprints */
+  uint64_t seed;       /* hash seed */
+  uint64_t size;       /* fingerprint array size (in bytes) */
+  uint64_t count;      /* number of distinct identifiers */
+  uint8_t  reserved[24];
+} bitcache_xor_filter_header_t;
+
+/**
+ * Initializes an xor filter holding a given array of identifiers, which
+ * may contain duplicates.
+ */
+extern int bitcache_xor_filter_init(bitcache_xor_filter_t* filter,
+  const bitcache_id_t* ids,
+  const size_t count);
+
+/**
+ * Resets an xor filter back to an uninitialized state.
+ */
+extern int bitcache_xor_filter_reset(bitcache_xor_filter_t* filter);
+
+/**
+ * Returns the size of an xor filter (in bytes).
+ */
+extern long bitcache_xor_filter_size(const bitcache_xor_filter_t* filter);
+
+/**
+ * Checks whether an xor filter recognizes a given identifier.
+ */
+extern bool bitcache_xor_filter_lookup(const bitcache_xor_filter_t* filter,
+  const bitcache_id_t* id);
+
+/**
+ * Compares two xor filters for equality.
+ */
+extern int bitcache_xor_filter_compare(const bitcache_xor_filter_t* filter1,
+  const bitcache_xor_filter_t* filter2);
+
+/**
+ * Reads in an xor filter from a file descriptor.
+ *
+ * The fingerprints are mapped read-only.
+ */
+extern long bitcache_xor_filter_load(bitcache_xor_filter_t* filter,
+  const int fd);
+
+/**
+ * Verifies the fingerprints of a loaded xor filter against the checksum
+ * recorded in its header, failing with `EBADMSG` on a mismatch.
+ */
+extern int bitcache_xor_filter_verify(const bitcache_xor_filter_t* filter);
+
+/**
+ * Writes out an xor filter to a file descriptor.
+ */
+extern long bitcache_xor_filter_dump(const bitcache_xor_filter_t* filter,
+  const int fd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _BITCACHE_XOR_FILTER_H */